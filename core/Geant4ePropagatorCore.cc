@@ -0,0 +1,283 @@
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagatorCore.h"
+
+//Geant4
+#include "G4ErrorFreeTrajState.hh"
+#include "G4ErrorPlaneSurfaceTarget.hh"
+#include "G4ErrorCylSurfaceTarget.hh"
+#include "G4VUserPhysicsList.hh"
+#include "G4EventManager.hh"
+#include "G4TransportationManager.hh"
+#include "G4FieldManager.hh"
+#include "G4ChordFinder.hh"
+#include "G4MagIntegratorDriver.hh"
+#include "G4MagIntegratorStepper.hh"
+#include "G4EquationOfMotion.hh"
+#include "G4MagneticField.hh"
+#include "G4ErrorMag_UsualEqRhs.hh"
+#include "G4ClassicalRK4.hh"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+
+#include <cmath>
+#include <memory>
+
+namespace {
+  //Chord finder built for a minimum step, with its equation and stepper.
+  //It is installed in the global field manager, so it belongs to the
+  //process: it is only deleted once replaced by the next one, never at
+  //exit, when the field manager may delete its chord finder itself
+  G4ChordFinder* minStepChordFinder = 0;
+  G4MagIntegratorStepper* minStepStepper = 0;
+  G4EquationOfMotion* minStepEquation = 0;
+
+  bool sameValue(double requested, double current) {
+    return requested <= 0 || std::abs(requested - current) <= 1e-9*requested;
+  }
+
+  //Makes field the detector field and the field of the equation of motion
+  //of the chord finder. Before InitGeant4e() there may be no chord finder
+  //yet: Geant4e needs one to build its own from
+  void useField(G4MagneticField* field) {
+    G4FieldManager* fieldMgr = 
+      G4TransportationManager::GetTransportationManager()->GetFieldManager();
+    if (fieldMgr->GetDetectorField() == field)
+      return;
+    fieldMgr->SetDetectorField(field);
+    G4ChordFinder* chordFinder = fieldMgr->GetChordFinder();
+    if (chordFinder)
+      const_cast<G4MagIntegratorStepper*>(chordFinder->GetIntegrationDriver()->GetStepper())
+	->GetEquationOfMotion()->SetFieldObj(field);
+    else if (field)
+      fieldMgr->CreateChordFinder(field);
+  }
+
+  //Deleter of the shared fields: the field manager must not keep a
+  //dangling pointer
+  void releaseField(G4MagneticField* field) {
+    G4FieldManager* fieldMgr = 
+      G4TransportationManager::GetTransportationManager()->GetFieldManager();
+    if (fieldMgr->GetDetectorField() == field)
+      useField(0);
+    delete field;
+  }
+}
+
+Geant4ePropagatorCore::Geant4ePropagatorCore(const std::string& particleName):
+  theParticleName(particleName),
+  theG4eManager(G4ErrorPropagatorManager::GetErrorPropagatorManager()),
+  theSteppingAction(0) {
+}
+
+bool Geant4ePropagatorCore::initialised() const {
+  return theG4eManager->PrintG4ErrorState() != "G4ErrorState_PreInit";
+}
+
+void Geant4ePropagatorCore::setField(G4MagneticField* field) {
+  theField.reset(field, releaseField);
+}
+
+bool Geant4ePropagatorCore::setSteppingParameters(const SteppingParameters& parameters) {
+  theSteppingParameters = parameters;
+  return !initialised() || applySteppingParameters();
+}
+
+/** Geant4 checks the maximum epsilon against the minimum, so the minimum
+ *  goes first when the new maximum is below the current minimum.
+ */
+bool Geant4ePropagatorCore::applySteppingParameters() const {
+  const SteppingParameters& pars = theSteppingParameters;
+  if (!pars.any())
+    return true;
+  if (theField)
+    useField(theField.get());
+
+  G4FieldManager* fieldMgr = 
+    G4TransportationManager::GetTransportationManager()->GetFieldManager();
+  G4ChordFinder* chordFinder = fieldMgr->GetChordFinder();
+  G4MagneticField* field = const_cast<G4MagneticField*>(
+    dynamic_cast<const G4MagneticField*>(fieldMgr->GetDetectorField()));
+  if (pars.minStep > 0 && field &&
+      (!chordFinder || 
+       !sameValue(pars.minStep*mm, chordFinder->GetIntegrationDriver()->GetHmin()))) {
+    G4ErrorMag_UsualEqRhs* equation = new G4ErrorMag_UsualEqRhs(field);
+    G4MagIntegratorStepper* stepper = new G4ClassicalRK4(equation);
+    G4ChordFinder* finder = new G4ChordFinder(field, pars.minStep*mm, stepper);
+    if (chordFinder)
+      finder->SetDeltaChord(chordFinder->GetDeltaChord());
+    fieldMgr->SetChordFinder(finder);
+
+    delete minStepChordFinder;
+    delete minStepStepper;
+    delete minStepEquation;
+    minStepChordFinder = finder;
+    minStepStepper = stepper;
+    minStepEquation = equation;
+    chordFinder = finder;
+  }
+
+  if (pars.deltaChord > 0 && chordFinder)
+    chordFinder->SetDeltaChord(pars.deltaChord*mm);
+  if (pars.deltaOneStep > 0)
+    fieldMgr->SetDeltaOneStep(pars.deltaOneStep*mm);
+  if (pars.deltaIntersection > 0)
+    fieldMgr->SetDeltaIntersection(pars.deltaIntersection*mm);
+  bool minFirst = pars.maximumEpsilonStep > 0 && 
+    pars.maximumEpsilonStep < fieldMgr->GetMinimumEpsilonStep();
+  if (minFirst && pars.minimumEpsilonStep > 0)
+    fieldMgr->SetMinimumEpsilonStep(pars.minimumEpsilonStep);
+  if (pars.maximumEpsilonStep > 0)
+    fieldMgr->SetMaximumEpsilonStep(pars.maximumEpsilonStep);
+  if (!minFirst && pars.minimumEpsilonStep > 0)
+    fieldMgr->SetMinimumEpsilonStep(pars.minimumEpsilonStep);
+
+  SteppingParameters current = currentSteppingParameters();
+  return sameValue(pars.deltaChord, current.deltaChord) &&
+    sameValue(pars.deltaOneStep, current.deltaOneStep) &&
+    sameValue(pars.deltaIntersection, current.deltaIntersection) &&
+    sameValue(pars.minStep, current.minStep) &&
+    sameValue(pars.minimumEpsilonStep, current.minimumEpsilonStep) &&
+    sameValue(pars.maximumEpsilonStep, current.maximumEpsilonStep);
+}
+
+Geant4ePropagatorCore::SteppingParameters
+Geant4ePropagatorCore::currentSteppingParameters() {
+  G4FieldManager* fieldMgr = 
+    G4TransportationManager::GetTransportationManager()->GetFieldManager();
+  SteppingParameters pars;
+  if (G4ChordFinder* chordFinder = fieldMgr->GetChordFinder()) {
+    pars.deltaChord = chordFinder->GetDeltaChord()/mm;
+    pars.minStep = chordFinder->GetIntegrationDriver()->GetHmin()/mm;
+  }
+  pars.deltaOneStep = fieldMgr->GetDeltaOneStep()/mm;
+  pars.deltaIntersection = fieldMgr->GetDeltaIntersection()/mm;
+  pars.minimumEpsilonStep = fieldMgr->GetMinimumEpsilonStep();
+  pars.maximumEpsilonStep = fieldMgr->GetMaximumEpsilonStep();
+  return pars;
+}
+
+/** Geant4e builds its equation of motion from the detector field, so the
+ *  field goes in before InitGeant4e()
+ */
+bool Geant4ePropagatorCore::initialise(G4VUserPhysicsList* physicsList) {
+  return initialiseG4(physicsList);
+}
+
+bool Geant4ePropagatorCore::initialiseG4(G4VUserPhysicsList* physicsList) const {
+  bool done = false;
+  if (!initialised()) {
+    if (theField)
+      useField(theField.get());
+    //Geant4e only builds its default physics list if none was given
+    if (physicsList)
+      theG4eManager->SetUserInitialization(physicsList);
+    theG4eManager->InitGeant4e();
+    done = true;
+  }
+
+  //Geant4e has a single stepping action, shared by all the propagators
+  if (!theSteppingAction) {
+    theSteppingAction = dynamic_cast<Geant4eSteppingAction*>(
+      G4EventManager::GetEventManager()->GetUserSteppingAction());
+    if (!theSteppingAction) {
+      theSteppingAction = new Geant4eSteppingAction;
+      theG4eManager->SetUserAction(theSteppingAction);
+    }
+  }
+  return done;
+}
+
+G4ErrorTarget* Geant4ePropagatorCore::newTarget(const Target& target) {
+  const double* r = target.rotation;
+  if (target.kind == Target::kPlane)
+    return new G4ErrorPlaneSurfaceTarget(
+      HepGeom::Normal3D<double>(target.normal[0], target.normal[1], target.normal[2]),
+      HepGeom::Point3D<double>(target.position[0]*cm, target.position[1]*cm,
+			       target.position[2]*cm));
+  return new G4ErrorCylSurfaceTarget(
+    target.radius*cm,
+    CLHEP::Hep3Vector(target.position[0]*cm, target.position[1]*cm,
+		      target.position[2]*cm),
+    CLHEP::HepRotation(CLHEP::Hep3Vector(r[0], r[3], r[6]),
+		       CLHEP::Hep3Vector(r[1], r[4], r[7]),
+		       CLHEP::Hep3Vector(r[2], r[5], r[8])));
+}
+
+/** The stepping action kills the track when it goes over the budget,
+ *  which ends the propagation.
+ */
+int Geant4ePropagatorCore::propagateG4(G4ErrorFreeTrajState& g4eTrajState,
+				       const G4ErrorTarget& g4eTarget,
+				       G4ErrorMode mode,
+				       const Geant4eSteppingAction::Budget& budget) const {
+  if (!theSteppingAction)
+    initialiseG4(0);
+  if (theField)
+    useField(theField.get());
+  applySteppingParameters();
+  theSteppingAction->setBudget(budget);
+  theSteppingAction->reset();
+
+  int ierr;
+  if(mode == G4ErrorMode_PropBackwards) {
+    //To make geant transport the particle correctly need to give it the opposite momentum
+    //because geant flips the B field bending and adds energy instead of subtracting it
+    //but still wants the momentum "backwards"
+    g4eTrajState.SetMomentum( -g4eTrajState.GetMomentum());
+    ierr = theG4eManager->Propagate( &g4eTrajState, &g4eTarget, mode);
+    g4eTrajState.SetMomentum( -g4eTrajState.GetMomentum());
+  } else {
+    ierr = theG4eManager->Propagate( &g4eTrajState, &g4eTarget, mode);
+  }
+
+  Geant4eSteppingAction::Status status = theSteppingAction->status();
+  if (status != Geant4eSteppingAction::kOk)
+    return ierr != 0 ? ierr : -int(status);
+  return ierr;
+}
+
+/** Geant4e works in mm and MeV with 1/p, the states in cm and GeV with
+ *  q/p, which flips the sign of the correlations of the first parameter
+ *  for negative charges.
+ */
+int Geant4ePropagatorCore::propagate(const State& start, const Target& target,
+				     Direction direction, State& end, double& path,
+				     const Geant4eSteppingAction::Budget& budget) const {
+  G4ErrorTrajErr g4error(5, 1);
+  if (start.hasError)
+    for (unsigned int i = 0, k = 0; i < 5; i++)
+      for (unsigned int j = 0; j <= i; j++, k++)
+	g4error.fast(i+1, j+1) = (j == 0 && i > 0) ? 
+	  start.covariance[k]*start.charge : start.covariance[k];
+
+  G4ErrorFreeTrajState g4eTrajState(theParticleName + (start.charge > 0 ? "+" : "-"),
+				    CLHEP::Hep3Vector(start.position[0]*cm, 
+						      start.position[1]*cm,
+						      start.position[2]*cm),
+				    CLHEP::Hep3Vector(start.momentum[0]*GeV,
+						      start.momentum[1]*GeV,
+						      start.momentum[2]*GeV),
+				    g4error);
+  std::unique_ptr<G4ErrorTarget> g4eTarget(newTarget(target));
+  int ierr = propagateG4(g4eTrajState, *g4eTarget,
+			 direction == kBackwards ? G4ErrorMode_PropBackwards : 
+			 G4ErrorMode_PropForwards, budget);
+  if (ierr != 0)
+    return ierr;
+
+  const CLHEP::Hep3Vector& pos = g4eTrajState.GetPosition();
+  const CLHEP::Hep3Vector& mom = g4eTrajState.GetMomentum();
+  for (unsigned int i = 0; i < 3; i++) {
+    end.position[i] = pos[i]/cm;
+    end.momentum[i] = mom[i]/GeV;
+  }
+  end.charge = start.charge;
+  end.hasError = start.hasError;
+  const G4ErrorTrajErr& error = g4eTrajState.GetError();
+  for (unsigned int i = 0, k = 0; i < 5; i++)
+    for (unsigned int j = 0; j <= i; j++, k++)
+      end.covariance[k] = (j == 0 && i > 0) ? 
+	error.fast(i+1, j+1)*start.charge : error.fast(i+1, j+1);
+  path = theSteppingAction->trackLength()/cm;
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eSteppingAction.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eVolumeProfile.h"
+#include "G4Step.hh"
+#include "G4StepPoint.hh"
+#include "G4Track.hh"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+
+#include <cmath>
+
+void Geant4eSteppingAction::reset() {
+  theTrackLength = 0;
+  theNSteps = 0;
+  theStatus = kOk;
+  theTurnAngle = 0;
+  if (theBudget.maxTime > 0)
+    theStartTime = std::chrono::steady_clock::now();
+  if (theProfile)
+    theProfile->start();
+}
+
+void Geant4eSteppingAction::UserSteppingAction(const G4Step* step) {
+  theTrackLength += step->GetStepLength();
+  ++theNSteps;
+  if (theProfile)
+    theProfile->addStep(step);
+
+  if (theStatus == kOk && theBudget.enabled()) {
+    theStatus = checkBudget(step);
+    if (theStatus != kOk)
+      step->GetTrack()->SetTrackStatus(fStopAndKill);
+  }
+}
+
+Geant4eSteppingAction::Status 
+Geant4eSteppingAction::checkBudget(const G4Step* step) {
+  if (theBudget.maxSteps > 0 && theNSteps > (unsigned int) theBudget.maxSteps)
+    return kMaxSteps;
+  if (theBudget.maxPath > 0 && theTrackLength > theBudget.maxPath*cm)
+    return kMaxPath;
+
+  //Signed sum of the turns of the transverse direction, so that the
+  //multiple scattering does not add up
+  if (theBudget.maxTurns > 0) {
+    double dphi = step->GetPostStepPoint()->GetMomentumDirection().phi() -
+      step->GetPreStepPoint()->GetMomentumDirection().phi();
+    if (dphi > M_PI)
+      dphi -= 2*M_PI;
+    else if (dphi < -M_PI)
+      dphi += 2*M_PI;
+    theTurnAngle += dphi;
+    if (std::abs(theTurnAngle) > 2*M_PI*theBudget.maxTurns)
+      return kLooper;
+  }
+
+  if (theBudget.maxTime > 0 && 
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - 
+				    theStartTime).count() > theBudget.maxTime)
+    return kMaxTime;
+
+  return kOk;
+}
@@ -0,0 +1,131 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eVolumeProfile.h"
+
+//Geant4
+#include "G4Step.hh"
+#include "G4StepPoint.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolume.hh"
+#include "G4Region.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <vector>
+
+namespace {
+  typedef std::pair<std::string, Geant4eVolumeProfile::Entry> NamedEntry;
+
+  bool moreSteps(const NamedEntry& a, const NamedEntry& b) {
+    return a.second.steps > b.second.steps;
+  }
+
+  bool moreTime(const NamedEntry& a, const NamedEntry& b) {
+    return a.second.time > b.second.time;
+  }
+
+  void writeRanking(std::ostream& out, const std::string& title,
+		    std::vector<NamedEntry>& entries, unsigned int nTop,
+		    bool (*order)(const NamedEntry&, const NamedEntry&),
+		    const Geant4eVolumeProfile::Entry& total) {
+    std::sort(entries.begin(), entries.end(), order);
+
+    out << title << "\n"
+	<< std::setw(40) << std::left << "name" << std::right
+	<< std::setw(12) << "steps"
+	<< std::setw(8)  << "%"
+	<< std::setw(12) << "time s"
+	<< std::setw(8)  << "%"
+	<< std::setw(14) << "mean step mm" << "\n";
+    for (unsigned int i = 0; i < entries.size() && i < nTop; i++) {
+      const Geant4eVolumeProfile::Entry& e = entries[i].second;
+      out << std::setw(40) << std::left << entries[i].first << std::right
+	  << std::setw(12) << e.steps
+	  << std::setw(8)  << std::setprecision(3)
+	  << (total.steps > 0 ? 100.*e.steps/total.steps : 0.)
+	  << std::setw(12) << std::setprecision(4) << e.time
+	  << std::setw(8)  << std::setprecision(3)
+	  << (total.time > 0 ? 100.*e.time/total.time : 0.)
+	  << std::setw(14) << std::setprecision(4)
+	  << (e.steps > 0 ? e.length/e.steps : 0.) << "\n";
+    }
+    out << "\n";
+  }
+
+  void add(Geant4eVolumeProfile::Entry& to, const Geant4eVolumeProfile::Entry& e) {
+    to.steps += e.steps;
+    to.length += e.length;
+    to.time += e.time;
+  }
+}
+
+Geant4eVolumeProfile::Geant4eVolumeProfile(const std::string& reportFile,
+					   unsigned int nTop,
+					   const SummaryCallback& summary):
+  theReportFile(reportFile),
+  theNTop(nTop),
+  theSummary(summary),
+  theLastVolume(0),
+  theLastEntry(0),
+  theLastTime(std::chrono::steady_clock::now()) {
+}
+
+Geant4eVolumeProfile::~Geant4eVolumeProfile() {
+  if (theVolumes.empty())
+    return;
+
+  std::ofstream out(theReportFile.c_str());
+  writeReport(out, theNTop);
+  out.close();
+
+  //Short summary for the caller
+  if (!theSummary)
+    return;
+  std::ostringstream summary;
+  summary << "Volume profile written to " << theReportFile << "\n";
+  writeReport(summary, 10);
+  theSummary(summary.str());
+}
+
+void Geant4eVolumeProfile::addStep(const G4Step* step) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  const G4VPhysicalVolume* pv = step->GetPreStepPoint()->GetPhysicalVolume();
+  const G4LogicalVolume* lv = pv ? pv->GetLogicalVolume() : 0;
+  if (lv != theLastVolume || !theLastEntry) {
+    theLastVolume = lv;
+    theLastEntry = &theVolumes[lv];
+  }
+
+  theLastEntry->steps++;
+  theLastEntry->length += step->GetStepLength();
+  theLastEntry->time += std::chrono::duration<double>(now - theLastTime).count();
+  theLastTime = now;
+}
+
+void Geant4eVolumeProfile::writeReport(std::ostream& out,
+				       unsigned int nTop) const {
+  std::vector<NamedEntry> volumes;
+  std::map<std::string, Entry> regions;
+  Entry total;
+  for (VolumeMap::const_iterator it = theVolumes.begin(); it != theVolumes.end(); ++it) {
+    const G4LogicalVolume* lv = it->first;
+    std::string name = lv ? std::string(lv->GetName()) : "(outside world)";
+    std::string region = lv && lv->GetRegion() ?
+      std::string(lv->GetRegion()->GetName()) : "(no region)";
+
+    volumes.push_back(NamedEntry(name, it->second));
+    add(regions[region], it->second);
+    add(total, it->second);
+  }
+
+  std::vector<NamedEntry> regionList(regions.begin(), regions.end());
+
+  out << "Geant4e volume profile: " << total.steps << " steps, "
+      << total.length << " mm, " << total.time << " s in "
+      << theVolumes.size() << " logical volumes\n\n";
+  writeRanking(out, "Regions by time", regionList, nTop, moreTime, total);
+  writeRanking(out, "Logical volumes by steps", volumes, nTop, moreSteps, total);
+  writeRanking(out, "Logical volumes by time", volumes, nTop, moreTime, total);
+}
@@ -3,10 +3,9 @@
 
 //CLHEP
 #include "CLHEP/Geometry/Point3D.h"
-#include "CLHEP/Geometry/Normal3D.h" 
+#include "CLHEP/Geometry/Normal3D.h"
 #include "CLHEP/Vector/ThreeVector.h"
 #include "CLHEP/Vector/Rotation.h"
-#include "CLHEP/Units/GlobalSystemOfUnits.h"
 
 //CMS
 
@@ -14,141 +13,209 @@
 #include "DataFormats/GeometryVector/interface/GlobalVector.h"
 #include "DataFormats/GeometrySurface/interface/TkRotation.h"
 #include "DataFormats/CLHEP/interface/AlgebraicObjects.h"
+#include "TrackingTools/TrajectoryParametrization/interface/GlobalTrajectoryParameters.h"
+#include "TrackingTools/TrajectoryParametrization/interface/CurvilinearTrajectoryError.h"
 
 //Geant4
 #include "G4ErrorFreeTrajState.hh"
 
-/** Utilities to convert among CLHEP and CMS points and vectors
+/** Utilities to convert among CLHEP and CMS points, vectors and
+ *  trajectory states. Everything is inline so that the conversions fold
+ *  into the propagation code.
  */
 
 namespace TrackPropagation {
+
+  /** Geant4 works in mm and MeV, CMS in cm and GeV. These are the values
+   *  of CLHEP::cm and CLHEP::GeV, as compile time constants.
+   */
+  constexpr double cmToG4  = 10.;
+  constexpr double g4ToCm  = 1./cmToG4;
+  constexpr double GeVToG4 = 1000.;
+  constexpr double g4ToGeV = 1./GeVToG4;
+
   /**
-    Convert a CMS GlobalPoint to a CLHEP HepGeom::Point3D<double> 
+    Convert a CMS GlobalPoint to a CLHEP HepGeom::Point3D<double>
     CMS uses cm while Geant4 uses mm. This is taken into account in the
     conversion.
   */
-
-  HepGeom::Point3D<double>  globalPointToHepPoint3D(const GlobalPoint& r) {
-    return HepGeom::Point3D<double> (r.x()*cm, r.y()*cm, r.z()*cm);
+  inline HepGeom::Point3D<double> globalPointToHepPoint3D(const GlobalPoint& r) {
+    return HepGeom::Point3D<double>(r.x()*cmToG4, r.y()*cmToG4, r.z()*cmToG4);
   }
-  
-   
 
-  /** Convert a CLHEP HepGeom::Point3D<double>  to a CMS GlobalPoint 
+  /** Convert a CLHEP HepGeom::Point3D<double>  to a CMS GlobalPoint
       CMS uses cms while Geant4 uses mm. This is taken into account in the
       conversion.
    */
-  GlobalPoint hepPoint3DToGlobalPoint(const HepGeom::Point3D<double> & r) {
-    return GlobalPoint(r.x()/cm, r.y()/cm, r.z()/cm);
+  inline GlobalPoint hepPoint3DToGlobalPoint(const HepGeom::Point3D<double>& r) {
+    return GlobalPoint(r.x()*g4ToCm, r.y()*g4ToCm, r.z()*g4ToCm);
   }
 
-
-  /** Convert a CMS GlobalVector to a CLHEP HepGeom::Normal3D<double> 
-      CMS uses GeV while G4 uses MeV
+  /** Convert a CMS GlobalVector to a CLHEP HepGeom::Normal3D<double>
    */
-  HepGeom::Normal3D<double>  globalVectorToHepNormal3D(const GlobalVector& p) {
-    return HepGeom::Normal3D<double> (p.x(), p.y(), p.z());
+  inline HepGeom::Normal3D<double> globalVectorToHepNormal3D(const GlobalVector& p) {
+    return HepGeom::Normal3D<double>(p.x(), p.y(), p.z());
   }
 
-  /** Convert a CLHEP HepGeom::Normal3D<double>  to a CMS GlobalVector 
-      CMS uses GeV while G4 uses MeV
+  /** Convert a CLHEP HepGeom::Normal3D<double>  to a CMS GlobalVector
    */
-  GlobalVector hepNormal3DToGlobalVector(const HepGeom::Normal3D<double> & p) {
+  inline GlobalVector hepNormal3DToGlobalVector(const HepGeom::Normal3D<double>& p) {
     return GlobalVector(p.x(), p.y(), p.z());
   }
 
-
-
-
-  /** Convert a CMS GlobalVector to a CLHEP CLHEP::Hep3Vector
+  /** Convert a CMS GlobalVector to a CLHEP CLHEP::Hep3Vector. No units
    */
-  CLHEP::Hep3Vector globalVectorToHep3Vector(const GlobalVector& p) {
+  inline CLHEP::Hep3Vector globalVectorToHep3Vector(const GlobalVector& p) {
     return CLHEP::Hep3Vector(p.x(), p.y(), p.z());
   }
 
-  /** Convert a CLHEP CLHEP::Hep3Vector to a CMS GlobalVector 
+  /** Convert a CLHEP CLHEP::Hep3Vector to a CMS GlobalVector. No units
    */
-  GlobalVector hep3VectorToGlobalVector(const CLHEP::Hep3Vector& p) {
+  inline GlobalVector hep3VectorToGlobalVector(const CLHEP::Hep3Vector& p) {
     return GlobalVector(p.x(), p.y(), p.z());
   }
 
+  /** Convert a CMS momentum (GeV) to a Geant4 momentum (MeV)
+   */
+  inline CLHEP::Hep3Vector globalMomentumToHep3Vector(const GlobalVector& p) {
+    return CLHEP::Hep3Vector(p.x()*GeVToG4, p.y()*GeVToG4, p.z()*GeVToG4);
+  }
 
-
+  /** Convert a Geant4 momentum (MeV) to a CMS momentum (GeV)
+   */
+  inline GlobalVector hep3VectorToGlobalMomentum(const CLHEP::Hep3Vector& p) {
+    return GlobalVector(p.x()*g4ToGeV, p.y()*g4ToGeV, p.z()*g4ToGeV);
+  }
 
   /** Convert a CMS GlobalPoint to a CLHEP CLHEP::Hep3Vector
       CMS uses cm while Geant4 uses mm. This is taken into account in the
       conversion.
    */
-  CLHEP::Hep3Vector globalPointToHep3Vector(const GlobalPoint& r) {
-     return CLHEP::Hep3Vector(r.x()*cm, r.y()*cm, r.z()*cm);
+  inline CLHEP::Hep3Vector globalPointToHep3Vector(const GlobalPoint& r) {
+    return CLHEP::Hep3Vector(r.x()*cmToG4, r.y()*cmToG4, r.z()*cmToG4);
   }
 
-  /** Convert a CLHEP CLHEP::Hep3Vector to a CMS GlobalPoint 
+  /** Convert a CLHEP CLHEP::Hep3Vector to a CMS GlobalPoint
       CMS uses cm while Geant4 uses mm. This is taken into account in the
       conversion.
    */
-  GlobalPoint hep3VectorToGlobalPoint(const CLHEP::Hep3Vector& v) {
-    return GlobalPoint(v.x()/cm, v.y()/cm, v.z()/cm);
+  inline GlobalPoint hep3VectorToGlobalPoint(const CLHEP::Hep3Vector& v) {
+    return GlobalPoint(v.x()*g4ToCm, v.y()*g4ToCm, v.z()*g4ToCm);
   }
 
-
-
-
-
-
-
-
-
   /** Convert a CMS TkRotation<float> to a CLHEP CLHEP::HepRotation=G4RotationMatrix
    */
-  CLHEP::HepRotation tkRotationFToHepRotation(const TkRotation<float>& tkr) {
-    return CLHEP::HepRotation(CLHEP::Hep3Vector(tkr.xx(),tkr.yx(), tkr.zx()),
-		       CLHEP::Hep3Vector(tkr.xy(),tkr.yy(), tkr.zy()),
-		       CLHEP::Hep3Vector(tkr.xz(),tkr.yz(), tkr.zz()));
+  inline CLHEP::HepRotation tkRotationFToHepRotation(const TkRotation<float>& tkr) {
+    return CLHEP::HepRotation(CLHEP::Hep3Vector(tkr.xx(), tkr.yx(), tkr.zx()),
+			      CLHEP::Hep3Vector(tkr.xy(), tkr.yy(), tkr.zy()),
+			      CLHEP::Hep3Vector(tkr.xz(), tkr.yz(), tkr.zz()));
   }
 
-  /** Convert a CLHEP CLHEP::Hep3Vector to a CMS GlobalPoint 
+  /** Convert a CLHEP CLHEP::HepRotation to a CMS TkRotation<float>
    */
-  TkRotation<float> hepRotationToTkRotationF(const CLHEP::HepRotation& r) {
+  inline TkRotation<float> hepRotationToTkRotationF(const CLHEP::HepRotation& r) {
     return TkRotation<float>(r.xx(), r.xy(), r.xz(),
 			     r.yx(), r.yy(), r.yz(),
 			     r.zx(), r.zy(), r.zz());
   }
 
   /** Convert a G4 Trajectory Error Matrix to the CMS Algebraic Sym Matrix
-      CMS uses q/p as first parameter, G4 uses 1/p
+      CMS uses q/p as first parameter, G4 uses 1/p. Only the lower triangle
+      is visited.
    */
+  inline void g4ErrorTrajErrToAlgebraicSymMatrix55(const G4ErrorTrajErr& e,
+						   const int q,
+						   AlgebraicSymMatrix55& m55) {
+    for (unsigned int i = 0; i < 5; i++)
+      for (unsigned int j = 0; j <= i; j++)
+	m55(i, j) = e.fast(i+1, j+1);
+    for (unsigned int i = 1; i < 5; i++)
+      m55(i, 0) *= q;
+  }
 
-
-
-  AlgebraicSymMatrix55
-   g4ErrorTrajErrToAlgebraicSymMatrix55(const G4ErrorTrajErr& e, const int q) {
-    //From DataFormats/CLHEP/interface/Migration.h
-    //typedef ROOT::Math::SMatrix<double,5,5,ROOT::Math::MatRepSym<double,5> > AlgebraicSymMatrix55;
+  inline AlgebraicSymMatrix55
+  g4ErrorTrajErrToAlgebraicSymMatrix55(const G4ErrorTrajErr& e, const int q) {
     AlgebraicSymMatrix55 m55;
-    for (unsigned int i = 0; i < 5; i++)
-      for (unsigned int j = 0; j < 5; j++) {
-	m55(i, j) = e(i+1,j+1);
-	if(i==0) m55(i,j) = q*m55(i,j);
-	if(j==0) m55(i,j) = q*m55(i,j);
-      }
+    g4ErrorTrajErrToAlgebraicSymMatrix55(e, q, m55);
     return m55;
   }
 
   /** Convert a CMS Algebraic Sym Matrix (for curv error) to a G4 Trajectory Error Matrix
    */
-  G4ErrorTrajErr
-    algebraicSymMatrix55ToG4ErrorTrajErr(const AlgebraicSymMatrix55& e, const int q) {
-    G4ErrorTrajErr g4err(5,1);
+  inline void algebraicSymMatrix55ToG4ErrorTrajErr(const AlgebraicSymMatrix55& e,
+						   const int q,
+						   G4ErrorTrajErr& g4err) {
     for (unsigned int i = 0; i < 5; i++)
-      for (unsigned int j = 0; j < 5; j++) {
-	g4err(i+1, j+1) = e(i,j);
-	if(i==0) g4err(i+1,j+1) = q*g4err(i+1,j+1);
-	if(j==0) g4err(i+1,j+1) = q*g4err(i+1,j+1);
-      }
+      for (unsigned int j = 0; j <= i; j++)
+	g4err.fast(i+1, j+1) = e(i, j);
+    for (unsigned int i = 1; i < 5; i++)
+      g4err.fast(i+1, 1) *= q;
+  }
+
+  inline G4ErrorTrajErr
+  algebraicSymMatrix55ToG4ErrorTrajErr(const AlgebraicSymMatrix55& e, const int q) {
+    G4ErrorTrajErr g4err(5, 0);
+    algebraicSymMatrix55ToG4ErrorTrajErr(e, q, g4err);
     return g4err;
   }
 
+  /** Same conversions for a lower triangle packed in 15 consecutive values,
+   *  as used by the batch interface, and the packing of the CMS matrix
+   *  itself.
+   */
+  inline void packedToAlgebraicSymMatrix55(const double* packed, 
+					   AlgebraicSymMatrix55& e) {
+    for (unsigned int i = 0, k = 0; i < 5; i++)
+      for (unsigned int j = 0; j <= i; j++, k++)
+	e(i, j) = packed[k];
+  }
+
+  inline void algebraicSymMatrix55ToPacked(const AlgebraicSymMatrix55& e, 
+					   double* packed) {
+    for (unsigned int i = 0, k = 0; i < 5; i++)
+      for (unsigned int j = 0; j <= i; j++, k++)
+	packed[k] = e(i, j);
+  }
+
+  inline void packedToG4ErrorTrajErr(const double* packed, const int q,
+				     G4ErrorTrajErr& g4err) {
+    for (unsigned int i = 0, k = 0; i < 5; i++)
+      for (unsigned int j = 0; j <= i; j++, k++)
+	g4err.fast(i+1, j+1) = (j == 0 && i > 0) ? packed[k]*q : packed[k];
+  }
+
+  inline void g4ErrorTrajErrToPacked(const G4ErrorTrajErr& e, const int q,
+				     double* packed) {
+    for (unsigned int i = 0, k = 0; i < 5; i++)
+      for (unsigned int j = 0; j <= i; j++, k++)
+	packed[k] = (j == 0 && i > 0) ? e.fast(i+1, j+1)*q : e.fast(i+1, j+1);
+  }
+
+  /** Convert a whole CMS state to the Geant4e start state: position (mm),
+   *  momentum (MeV) and, if the state has one, the error matrix. Without
+   *  errors the matrix is left untouched.
+   */
+  inline void freeStateToG4(const GlobalTrajectoryParameters& pars,
+			    const CurvilinearTrajectoryError* err,
+			    CLHEP::Hep3Vector& pos, CLHEP::Hep3Vector& mom,
+			    G4ErrorTrajErr& g4err) {
+    pos = globalPointToHep3Vector(pars.position());
+    mom = globalMomentumToHep3Vector(pars.momentum());
+    if (err)
+      algebraicSymMatrix55ToG4ErrorTrajErr(err->matrix(), pars.charge(), g4err);
+  }
+
+  /** Convert the Geant4e final state back to CMS: position (cm), momentum
+   *  (GeV) and error matrix in one go.
+   */
+  inline void g4ToFreeState(const G4ErrorFreeTrajState& ts, const int q,
+			    GlobalPoint& pos, GlobalVector& mom,
+			    AlgebraicSymMatrix55& m55) {
+    pos = hep3VectorToGlobalPoint(ts.GetPosition());
+    mom = hep3VectorToGlobalMomentum(ts.GetMomentum());
+    g4ErrorTrajErrToAlgebraicSymMatrix55(ts.GetError(), q, m55);
+  }
+
 }
 
 
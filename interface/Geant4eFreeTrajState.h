@@ -0,0 +1,65 @@
+#ifndef TrackPropagation_Geant4eFreeTrajState_h
+#define TrackPropagation_Geant4eFreeTrajState_h
+
+#include "DataFormats/CLHEP/interface/AlgebraicObjects.h"
+
+//Geant4
+#include "G4ErrorFreeTrajState.hh"
+
+class MagneticField;
+class Geant4eMaterialTables;
+
+/** Geant4e free trajectory state with an optional fast transport of the
+ *  error matrix. By default it behaves as G4ErrorFreeTrajState. Once
+ *  setFastErrorTransport() is called, the error is kept as a fixed size
+ *  SMatrix in the CMS curvilinear frame (q/p, cm) and transported at every
+ *  step with the analytical helix jacobian of the step, scaled for the
+ *  energy loss, plus the noise of the multiple scattering (Highland) and
+ *  of the energy loss fluctuations. Nothing is allocated on the
+ *  heap and GetError() is left untouched.
+ *  Only forward propagations are supported.
+ */
+class Geant4eFreeTrajState : public G4ErrorFreeTrajState {
+ public:
+  Geant4eFreeTrajState(const G4String& particleName, const G4Point3D& pos,
+		       const G4Vector3D& mom, const G4ErrorTrajErr& err);
+  virtual ~Geant4eFreeTrajState() {}
+
+  /** Transport cov (CMS curvilinear error) instead of the Geant4e error.
+   *  The field is needed by the jacobian. If material tables are given the
+   *  noise is taken from them for the species they hold.
+   */
+  void setFastErrorTransport(const AlgebraicSymMatrix55& cov, int charge,
+			     const MagneticField* field,
+			     const Geant4eMaterialTables* tables = 0);
+  bool fastErrorTransport() const {return theFastErrorTransport;}
+
+  /** Transported CMS curvilinear error if the fast transport is used
+   */
+  const AlgebraicSymMatrix55& curvilinearError() const {return theError;}
+
+  /** Accumulate the transport jacobian of the propagation in the CMS
+   *  curvilinear frame (q/p), with either transport. The charge converts
+   *  the Geant4e 1/p.
+   */
+  void accumulateJacobian(int charge);
+  bool accumulatesJacobian() const {return theAccumulateJacobian;}
+  const AlgebraicMatrix55& jacobian() const {return theJacobian;}
+
+  /** Called by Geant4e after every step
+   */
+  virtual G4int PropagateError(const G4Track* aTrack);
+
+ private:
+  bool theFastErrorTransport;
+  int theCharge;
+  const MagneticField* theField;
+  const Geant4eMaterialTables* theTables;
+  AlgebraicSymMatrix55 theError;
+
+  bool theAccumulateJacobian;
+  AlgebraicMatrix55 theJacobian;
+};
+
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef TrackPropagation_Geant4eMagneticField_h
+#define TrackPropagation_Geant4eMagneticField_h
+
+#include "G4MagneticField.hh"
+
+#include "FWCore/Utilities/interface/GCC11Compatibility.h"
+
+class MagneticField;
+class MagVolume;
+class VolumeBasedMagneticField;
+
+/** Adapter that presents a CMS MagneticField to the Geant4 steppers used
+ *  by Geant4e. Two caches sit in front of the CMS field:
+ *   * the MagVolume found for the previous point (only for volume based
+ *     fields), which is checked first before doing a full volume search.
+ *   * a cubic cell of configurable size whose corner values are taken from
+ *     a single MagVolume. Points falling in that cell are obtained by
+ *     trilinear interpolation. The cell is only used when all its corners
+ *     are inside the same volume, so no field discontinuity is smeared.
+ *  Geant4e drives a single G4 track at a time from one thread, so the
+ *  caches are kept per adapter instance.
+ *  Counters of field evaluations and cache hits are printed on destruction.
+ */
+class Geant4eMagneticField GCC11_FINAL : public G4MagneticField {
+ public:
+  /** Constructor. Takes as arguments:
+   *  * The CMS magnetic field
+   *  * The side of the interpolation cells in cm. A value <= 0 disables
+   *    the interpolation cache.
+   */
+  explicit Geant4eMagneticField(const MagneticField* field,
+				double cellSize = 0.);
+  virtual ~Geant4eMagneticField();
+
+  /** Called by the Geant4 equation of motion. Point is (x,y,z,t) in
+   *  Geant4 units (mm), the field is returned in Geant4 units.
+   */
+  virtual void GetFieldValue(const double point[4], double* bfield) const;
+
+  const MagneticField* cmsField() const {return theField;}
+
+  /** True if the interpolation cache is used
+   */
+  bool cellCache() const {return theCellSize > 0;}
+
+  /** Statistics of the caches since construction
+   */
+  unsigned long nEvaluations() const {return theNEvaluations;}
+  unsigned long nCellHits() const {return theNCellHits;}
+  unsigned long nVolumeHits() const {return theNVolumeHits;}
+  unsigned long nVolumeSearches() const {return theNVolumeSearches;}
+
+ private:
+  // Field in Tesla at a point in cm, using the volume cache
+  void fieldInTesla(double x, double y, double z, double* b) const;
+
+  // Locate the volume containing a point in cm, using the volume cache
+  const MagVolume* findVolume(double x, double y, double z) const;
+
+  // Try to build the interpolation cell containing a point in cm
+  bool fillCell(double x, double y, double z) const;
+
+  const MagneticField* theField;
+  const VolumeBasedMagneticField* theVolumeField;
+
+  double theCellSize;
+  double theInvCellSize;
+
+  //Volume cache
+  mutable const MagVolume* theLastVolume;
+
+  //Interpolation cell cache: lower corner index and values at the 8 corners
+  mutable bool theCellValid;
+  mutable long theCellIndex[3];
+  mutable double theCellField[8][3];
+
+  //Statistics
+  mutable unsigned long theNEvaluations;
+  mutable unsigned long theNCellHits;
+  mutable unsigned long theNVolumeHits;
+  mutable unsigned long theNVolumeSearches;
+};
+
+
+#endif
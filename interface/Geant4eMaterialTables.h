@@ -0,0 +1,90 @@
+#ifndef TrackPropagation_Geant4eMaterialTables_h
+#define TrackPropagation_Geant4eMaterialTables_h
+
+#include "G4Material.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+class G4ParticleDefinition;
+
+/** Tables of the physics needed by the tabulated physics mode, for every
+ *  material of the geometry and every species, in log spaced bins of
+ *  momentum: the mean energy loss per unit length (from the same
+ *  G4EnergyLossForExtrapolator as Geant4e), the variance of the energy
+ *  loss per unit length (Gaussian, xi*Tmax*(1 - beta^2/2)) and the
+ *  variance of the multiple scattering angle per unit length (Highland
+ *  without its logarithmic term). All in Geant4 units. The lookup clamps
+ *  the momentum to the table range and interpolates linearly without
+ *  branches. The tables are built when the physics tables are, i.e. once
+ *  the geometry and its materials are final.
+ */
+class Geant4eMaterialTables {
+ public:
+  struct Values {
+    Values(): dedx(0), sigma2(0), theta2(0) {}
+    double dedx;      //MeV/mm
+    double sigma2;    //MeV^2/mm
+    double theta2;    //rad^2/mm
+  };
+
+  /** Constructor. Takes the species without the charge ("mu", "pi", ...)
+   *  and the momentum range (MeV) and number of bins of the tables
+   */
+  Geant4eMaterialTables(const std::vector<std::string>& species,
+			double pMin = 100., double pMax = 1e7,
+			unsigned int nBins = 200);
+
+  /** Builds the tables for all the materials, the first time only. Logs
+   *  the largest deviation of the interpolation from the direct
+   *  computation.
+   */
+  void build();
+  bool built() const {return !theValues.empty();}
+
+  /** Index of the species of a particle, -1 if it is not tabulated
+   */
+  int species(const G4ParticleDefinition* particle) const {
+    for (unsigned int i = 0; i < theParticles.size(); i++)
+      if (theParticles[i] == particle)
+	return theParticleSpecies[i];
+    return -1;
+  }
+
+  /** Interpolated values for a momentum p (MeV)
+   */
+  Values values(int species, const G4Material* material, double p) const {
+    size_t index = material->GetIndex();
+    if (index >= theNMaterials)
+      return Values();
+    double x = (std::log(p) - theLogPMin)*theInvStep;
+    x = std::min(std::max(x, 0.), theMaxX);
+    unsigned int i = (unsigned int) x;
+    double f = x - i;
+    const Values* v = &theValues[(species*theNMaterials + index)*theNBins + i];
+    Values result;
+    result.dedx = v[0].dedx + f*(v[1].dedx - v[0].dedx);
+    result.sigma2 = v[0].sigma2 + f*(v[1].sigma2 - v[0].sigma2);
+    result.theta2 = v[0].theta2 + f*(v[1].theta2 - v[0].theta2);
+    return result;
+  }
+
+ private:
+  std::vector<std::string> theSpecies;
+  std::vector<const G4ParticleDefinition*> theParticles;
+  std::vector<int> theParticleSpecies;
+
+  double theLogPMin;
+  double theInvStep;
+  double theMaxX;
+  unsigned int theNBins;
+  size_t theNMaterials;
+
+  //[species][material][bin]
+  std::vector<Values> theValues;
+};
+
+
+#endif
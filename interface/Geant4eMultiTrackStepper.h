@@ -0,0 +1,50 @@
+#ifndef TrackPropagation_Geant4eMultiTrackStepper_h
+#define TrackPropagation_Geant4eMultiTrackStepper_h
+
+#include <vector>
+
+class MagneticField;
+struct Geant4ePropagationBatch;
+
+/** Runge-Kutta transport of several tracks at once through the magnetic
+ *  field alone, for the parts of the detector without material. The
+ *  tracks of a batch are taken kLanes at a time and share the loops of the
+ *  Runge-Kutta stages. The CMS field has no multi-point query, so before
+ *  every stage it is evaluated lane by lane with one call per lane. A lane
+ *  that has reached its target keeps a null step until the other lanes
+ *  are done. There is no energy loss and no noise: the error is
+ *  transported with the analytical helix jacobian of the whole path.
+ */
+class Geant4eMultiTrackStepper {
+ public:
+  static const unsigned int kLanes = 4;
+
+  /** Constructor. Takes the field, the largest step (cm) and the distance
+   *  to the target (cm) at which a track has reached it.
+   */
+  explicit Geant4eMultiTrackStepper(const MagneticField* field,
+				    double maxStep = 10., 
+				    double tolerance = 1e-4);
+
+  /** Transports the requests of batch listed in indices to the cylinder
+   *  of the given radius (cm) around the z axis, in place, along the
+   *  momentum only. Requests that do not reach it forwards within a few
+   *  turns are left unchanged and flagged in reached. path receives the
+   *  path length (cm) of every request.
+   */
+  void propagateToRadius(Geant4ePropagationBatch& batch,
+			 const std::vector<unsigned int>& indices,
+			 double radius, std::vector<double>& path,
+			 std::vector<char>& reached) const;
+
+ private:
+  //Field in Tesla at the positions of the lanes, one query per lane
+  void fieldAt(const double x[3][kLanes], double b[3][kLanes]) const;
+
+  const MagneticField* theField;
+  double theMaxStep;
+  double theTolerance;
+};
+
+
+#endif
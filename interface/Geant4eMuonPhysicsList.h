@@ -0,0 +1,28 @@
+#ifndef TrackPropagation_Geant4eMuonPhysicsList_h
+#define TrackPropagation_Geant4eMuonPhysicsList_h
+
+#include "G4VUserPhysicsList.hh"
+
+/** Physics list for the propagation of muons only. The muons get the
+ *  same processes as in G4ErrorPhysicsList: the transportation, the
+ *  Geant4e energy loss (ionisation, bremsstrahlung and pair production
+ *  through G4EnergyLossForExtrapolator) and the Geant4e step limits, with
+ *  the G4ErrorMessenger that sets them. A muon step therefore costs the
+ *  same. The saving is at initialisation: besides the muons only the
+ *  particles that G4EnergyLossForExtrapolator needs are built, no other
+ *  particle gets processes, and the production cuts are out of reach so
+ *  that no secondary tables are computed.
+ */
+class Geant4eMuonPhysicsList : public G4VUserPhysicsList {
+ public:
+  Geant4eMuonPhysicsList() {}
+  virtual ~Geant4eMuonPhysicsList() {}
+
+ protected:
+  virtual void ConstructParticle();
+  virtual void ConstructProcess();
+  virtual void SetCuts();
+};
+
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TrackPropagation_Geant4ePhysicsTableCache_h
+#define TrackPropagation_Geant4ePhysicsTableCache_h
+
+#include <string>
+
+class G4VUserPhysicsList;
+
+/** On-disk cache of the Geant4 physics tables built by InitGeant4e().
+ *  Tables are kept in a subdirectory of the cache directory named after a
+ *  validation key, a hash of
+ *   * the Geant4 version and the cache format version,
+ *   * the geometry (physical volumes, their placement, logical volumes and
+ *     solids),
+ *   * the materials (density and composition),
+ *   * the physics list type, its default cut and the propagated particle.
+ *  A job finding a complete entry for its key makes the physics list
+ *  retrieve the tables. Otherwise the tables are built as usual and stored
+ *  afterwards. Entries are written to a temporary directory and renamed,
+ *  so concurrent jobs never see a partial entry.
+ */
+class Geant4ePhysicsTableCache {
+ public:
+  Geant4ePhysicsTableCache(const std::string& directory,
+			   const std::string& particleName);
+
+  /** Computes the key from the current Geant4 stores and, if the cache
+   *  holds the tables, sets the physics list to retrieve them. To be
+   *  called before InitGeant4e().
+   */
+  void prepare(G4VUserPhysicsList* physicsList);
+
+  /** Stores the tables just built. Does nothing if they were retrieved.
+   *  To be called after InitGeant4e().
+   */
+  void store(G4VUserPhysicsList* physicsList);
+
+  bool retrieved() const {return theRetrieved;}
+  const std::string& key() const {return theKey;}
+
+ private:
+  std::string computeKey(const G4VUserPhysicsList* physicsList) const;
+
+  std::string theDirectory;
+  std::string theParticleName;
+  std::string theKey;
+  std::string theEntry;
+  bool theRetrieved;
+};
+
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef TrackPropagation_Geant4ePropagationBatch_h
+#define TrackPropagation_Geant4ePropagationBatch_h
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class FreeTrajectoryState;
+class Surface;
+
+/** Structure of arrays holding a batch of propagation requests for
+ *  Geant4ePropagator::propagateBatch(). Units are cm and GeV, covariances
+ *  are the lower triangle of the curvilinear error matrix, 15 values per
+ *  request. Targets must be planes or cylinders and must stay alive during
+ *  the propagation. The optional region key of a request (e.g. the DetId
+ *  of its target) groups the requests in the visiting order: requests
+ *  with the same key are propagated one after the other, and keys are
+ *  visited in increasing order. 0 leaves the order to the target position.
+ *  The key is 64 bits wide so that keys of different kinds (e.g. DetIds
+ *  and target bins, see Geant4ePropagationScheduler) can be kept apart.
+ */
+struct Geant4ePropagationBatch {
+  size_t size() const {return x.size();}
+  void clear();
+  void reserve(size_t n);
+
+  /** Adds a request from a CMS state
+   */
+  void push_back(const FreeTrajectoryState& fts, const Surface* dest,
+		 uint64_t regionKey = 0);
+
+  std::vector<double> x, y, z;
+  std::vector<double> px, py, pz;
+  std::vector<int> charge;
+  std::vector<char> hasError;
+  std::vector<double> covariance;
+  std::vector<const Surface*> target;
+  std::vector<uint64_t> region;
+};
+
+/** Structure of arrays with the results of a batch, in the order of the
+ *  requests. Status is 0 for a successful propagation, the Geant4e error
+ *  code if it failed, or one of the negative codes below: the target is
+ *  neither a plane nor a cylinder, the propagation failed outside
+ *  Geant4e (e.g. through the table), it went over one of the limits of
+ *  the budget of the propagator, or the bounds check of the propagator
+ *  rejected the target.
+ */
+struct Geant4ePropagationBatchResult {
+  enum Status {kOk = 0, kBadTarget = -1, kFailed = -2,
+	       kMaxSteps = -3, kMaxPath = -4, kMaxTime = -5, kLooper = -6,
+	       kUnreachable = -7};
+
+  size_t size() const {return status.size();}
+  void resize(size_t n);
+
+  std::vector<int> status;
+  std::vector<double> x, y, z;
+  std::vector<double> px, py, pz;
+  std::vector<double> covariance;
+  std::vector<double> path;
+};
+
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef TrackPropagation_Geant4ePropagationLog_h
+#define TrackPropagation_Geant4ePropagationLog_h
+
+#include "TrackingTools/TrajectoryState/interface/FreeTrajectoryState.h"
+#include "TrackingTools/TrajectoryState/interface/TrajectoryStateOnSurface.h"
+#include "DataFormats/GeometrySurface/interface/Plane.h"
+#include "DataFormats/GeometrySurface/interface/Cylinder.h"
+#include "DataFormats/TrajectorySeed/interface/PropagationDirection.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+class MagneticField;
+
+/** Binary log of propagation requests and their results, used to capture
+ *  the workload of a production job and replay it later through
+ *  Geant4ePropagator without the original input.
+ *  The file is a Header followed by fixed size Records, one per request
+ *  to Geant4ePropagator: a single track propagation, a mixture (its
+ *  collapsed state) or a request of a batch, with the start state given
+ *  by the caller. Units are cm and GeV and covariances are the lower
+ *  triangle of the curvilinear error matrix.
+ */
+namespace Geant4ePropagationLog {
+
+  static const unsigned int kVersion = 1;
+
+  enum SurfaceType {kPlane = 0, kCylinder = 1};
+
+  struct Header {
+    char magic[8];
+    unsigned int version;
+    unsigned int recordSize;
+    char particle[16];
+  };
+
+  struct Record {
+    //Request
+    int surfaceType;      //SurfaceType
+    int direction;        //PropagationDirection
+    int charge;
+    int hasError;
+    double position[3];
+    double momentum[3];
+    double covariance[15];
+    double surfacePosition[3];
+    double surfaceRotation[9];  //xx, xy, xz, yx, ...
+    double radius;              //cylinders only
+
+    //Result
+    int valid;
+    int ierr;
+    double outPosition[3];
+    double outMomentum[3];
+    double outCovariance[15];
+    double path;
+  };
+
+  /** Conversions between records and CMS objects
+   */
+  void fillRequest(Record& r, const FreeTrajectoryState& fts,
+		   const Plane& plane, PropagationDirection dir);
+  void fillRequest(Record& r, const FreeTrajectoryState& fts,
+		   const Cylinder& cyl, PropagationDirection dir);
+  //Returns false if dest is neither a plane nor a cylinder
+  bool fillRequest(Record& r, const FreeTrajectoryState& fts,
+		   const Surface& dest, PropagationDirection dir);
+  void fillResult(Record& r, const TrajectoryStateOnSurface& tsos,
+		  int ierr, double path);
+
+  FreeTrajectoryState startState(const Record& r, const MagneticField* field);
+  Plane::PlanePointer plane(const Record& r);
+  Cylinder::CylinderPointer cylinder(const Record& r);
+
+  /** Appends records to a log file. Shared by the clones of a
+   *  propagator, so writes are serialised.
+   */
+  class Writer {
+  public:
+    /** Writer of fileName for the job. Propagators capturing to the same
+     *  file share the writer. A file reopened later in the job, e.g. by
+     *  the propagator of a new IOV, is appended to and keeps its single
+     *  header. Throws if the file is being written for another particle.
+     */
+    static boost::shared_ptr<Writer> open(const std::string& fileName,
+					  const std::string& particle);
+
+    /** Constructor. Starts a new file, or appends records to the file
+     *  written earlier if append.
+     */
+    Writer(const std::string& fileName, const std::string& particle,
+	   bool append = false);
+    ~Writer();
+
+    void write(const Record& r);
+    unsigned long nRecords() const {return theNRecords;}
+
+  private:
+    std::mutex theMutex;
+    FILE* theFile;
+    std::string theFileName;
+    std::string theParticle;
+    unsigned long theNRecords;
+  };
+
+  /** Reads the records of a log file in order. Throws if the file is
+   *  missing or has another version.
+   */
+  class Reader {
+  public:
+    explicit Reader(const std::string& fileName);
+    ~Reader();
+
+    const Header& header() const {return theHeader;}
+    bool next(Record& r);
+
+  private:
+    FILE* theFile;
+    Header theHeader;
+  };
+}
+
+
+#endif
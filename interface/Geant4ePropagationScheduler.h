@@ -0,0 +1,71 @@
+#ifndef TrackPropagation_Geant4ePropagationScheduler_h
+#define TrackPropagation_Geant4ePropagationScheduler_h
+
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationBatch.h"
+#include "TrackingTools/TrajectoryState/interface/TrajectoryStateOnSurface.h"
+
+class Geant4ePropagator;
+
+/** Collects the propagation requests of an event, as they arrive, and
+ *  runs them as one batch of Geant4ePropagator in the order of their
+ *  detector region, so that Geant4 navigates the same volumes and the
+ *  field adapter sees the same cells in consecutive propagations. The
+ *  region of a request is its DetId if one is given, or otherwise the
+ *  (eta, phi, distance) bin of its target. The results are handed back by
+ *  the ticket returned when the request was added.
+ *  The throughput over the job, and the cell cache hits of the field
+ *  adapter if its cache is on, are printed on destruction.
+ */
+class Geant4ePropagationScheduler {
+ public:
+  /** Constructor. Takes the propagator, which must outlive the scheduler,
+   *  and the sizes of the target bins in eta, phi (rad) and distance from
+   *  the origin (cm).
+   */
+  explicit Geant4ePropagationScheduler(const Geant4ePropagator* propagator,
+				       double etaBin = 0.2, double phiBin = 0.1,
+				       double distanceBin = 100.);
+  ~Geant4ePropagationScheduler();
+
+  /** Adds a request to a plane or a cylinder. Returns its ticket
+   */
+  unsigned int add(const FreeTrajectoryState& fts, const Surface* dest,
+		   unsigned int detId = 0);
+
+  /** Propagates the pending requests
+   */
+  void run();
+
+  /** Results of the last run, by ticket
+   */
+  TrajectoryStateOnSurface result(unsigned int ticket) const;
+  int status(unsigned int ticket) const {return theResult.status[ticket];}
+  double path(unsigned int ticket) const {return theResult.path[ticket];}
+
+  /** Forgets the requests and the results, e.g. at the start of an event
+   */
+  void clear();
+  size_t size() const {return theBatch.size();}
+
+ private:
+  //Region key of a target without DetId. DetIds take the lower 32 bits of
+  //the keys, the bins are tagged with the highest bit so that they never
+  //collide with a DetId
+  uint64_t binKey(const Surface* dest) const;
+
+  const Geant4ePropagator* thePropagator;
+  double theEtaBin, thePhiBin, theDistanceBin;
+
+  Geant4ePropagationBatch theBatch;
+  Geant4ePropagationBatchResult theResult;
+
+  //Statistics
+  unsigned long theNRuns;
+  unsigned long theNRequests;
+  double theTime;
+  unsigned long theNEvaluations;
+  unsigned long theNCellHits;
+};
+
+
+#endif
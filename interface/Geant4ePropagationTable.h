@@ -0,0 +1,149 @@
+#ifndef TrackPropagation_Geant4ePropagationTable_h
+#define TrackPropagation_Geant4ePropagationTable_h
+
+#include "DataFormats/GeometryVector/interface/GlobalPoint.h"
+#include "DataFormats/GeometryVector/interface/GlobalVector.h"
+#include "DataFormats/CLHEP/interface/AlgebraicObjects.h"
+
+#include <string>
+#include <cstddef>
+
+class FreeTrajectoryState;
+class Plane;
+class Cylinder;
+
+/** Table of precomputed Geant4e propagations from the vertex region to a
+ *  set of reference surfaces (one per muon station). The table is a
+ *  regular grid in (q/pT, eta, phi, vertex z). For each node and station
+ *  it stores the final position and momentum, the path length and the
+ *  covariance accumulated along the path for a start state with a null
+ *  error (i.e. the process noise).
+ *  Final states are stored in a frame rotated by -phi of the node, so
+ *  that the interpolation in phi only has to follow the small deviations
+ *  from azimuthal symmetry.
+ *  The file is mapped in memory and used in place. Its layout is
+ *    Header | Station[nStations] | Node[nStations*nNodes] | Cell[nStations*nCells]
+ *  Cells hold the accuracy of the interpolation at the cell centre
+ *  measured against a direct propagation when the table was written, or
+ *  a negative value if it was not measured.
+ */
+class Geant4ePropagationTable {
+ public:
+
+  enum Axis {kQOverPt = 0, kEta, kPhi, kVertexZ, kNAxes};
+  enum StationType {kCylinder = 0, kZPlane = 1};
+
+  static const unsigned int kVersion = 2;
+
+  struct Header {
+    char magic[8];
+    unsigned int version;
+    unsigned int nStations;
+    unsigned int nNodes[kNAxes];
+    float lo[kNAxes];
+    float hi[kNAxes];
+    char particle[8];
+    float maxVertexRho;   //cm
+  };
+
+  struct Station {
+    unsigned int type;    //StationType
+    float position;       //radius of the cylinder or z of the plane, cm
+    float tolerance;      //cm
+    unsigned int pad;
+  };
+
+  struct Node {
+    float valid;
+    float path;           //cm
+    float position[3];    //cm, rotated by -phi of the node
+    float momentum[3];    //GeV, rotated by -phi of the node
+    float noise[15];      //lower triangle of the curvilinear covariance
+    float pad;
+  };
+
+  struct Cell {
+    float positionResidual;  //cm, negative if not checked
+    float momentumResidual;  //relative, negative if not checked
+  };
+
+  /** Map the table stored in fileName. Throws if the file is missing or
+   *  it does not look like a table of this version.
+   */
+  explicit Geant4ePropagationTable(const std::string& fileName);
+
+  /** View of a table stored in a buffer owned by the caller
+   */
+  Geant4ePropagationTable(const char* buffer, size_t size);
+
+  /** Prints the fraction of lookups served by the table
+   */
+  ~Geant4ePropagationTable();
+
+  const Header& header() const {return *theHeader;}
+  const Station& station(unsigned int i) const {return theStations[i];}
+
+  /** Index of the station matching a target surface, -1 if none. A
+   *  plane matches a z plane station if it is normal to z at its z, or a
+   *  cylinder station if it is parallel to z at its radius from the beam
+   *  line, all within the station tolerance.
+   */
+  int findStation(const Cylinder& cyl) const;
+  int findStation(const Plane& plane) const;
+
+  /** Interpolate the final state on a station for a start state. The
+   *  nodes start on the beam line: the transverse offset of the vertex is
+   *  transported to the station with the helix jacobian. Returns false if
+   *  the state is outside the table domain, if any of the nodes around it
+   *  could not be propagated or, if maxResidual (cm) is positive, if the
+   *  cell accuracy is worse than it or was not checked. The noise is
+   *  returned in CMS curvilinear convention.
+   */
+  bool interpolate(const FreeTrajectoryState& fts, unsigned int station,
+		   double maxResidual, GlobalPoint& pos, GlobalVector& mom,
+		   AlgebraicSymMatrix55& noise, double& path) const;
+
+  /** Grid helpers, also used to write the table
+   */
+  size_t nNodes() const;
+  size_t nCells() const;
+  double nodeValue(unsigned int axis, unsigned int i) const;
+  size_t nodeIndex(const unsigned int* idx) const;
+  size_t cellIndex(const unsigned int* idx) const;
+
+  static size_t fileSize(const Header& h);
+  static size_t stationOffset() {return sizeof(Header);}
+  static size_t nodeOffset(const Header& h) {
+    return stationOffset() + h.nStations*sizeof(Station);
+  }
+  static size_t cellOffset(const Header& h);
+  static size_t nNodes(const Header& h);
+  static size_t nCells(const Header& h);
+
+  /** Sets the magic string and version of a new header
+   */
+  static void initHeader(Header& h);
+
+  /** Coordinates of a start state in the table axes
+   */
+  static void axisValues(const FreeTrajectoryState& fts, double* values);
+
+ private:
+  void setup(const char* data, size_t size);
+
+  const Header* theHeader;
+  const Station* theStations;
+  const Node* theNodes;
+  const Cell* theCells;
+
+  //Memory mapped region, if owned
+  void* theMapping;
+  size_t theMappingSize;
+
+  //Statistics
+  mutable unsigned long theNLookups;
+  mutable unsigned long theNHits;
+};
+
+
+#endif
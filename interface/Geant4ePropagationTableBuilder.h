@@ -0,0 +1,60 @@
+#ifndef TrackPropagation_Geant4ePropagationTableBuilder_h
+#define TrackPropagation_Geant4ePropagationTableBuilder_h
+
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationTable.h"
+
+#include <vector>
+
+class Geant4ePropagator;
+class MagneticField;
+class TrajectoryStateOnSurface;
+
+/** Fills a Geant4ePropagationTable. The Geant4ePropagator is run from
+ *  every node of the grid to every station, starting on the beam line
+ *  with a null error, so that the covariance on the station is the
+ *  process noise alone. The interpolation of every cell can then be
+ *  checked at the cell centre against a direct propagation; the residuals
+ *  are stored in the table and summarised per (q/pT, eta) bin. Cells not
+ *  checked, or where the check failed, keep a negative residual.
+ */
+class Geant4ePropagationTableBuilder {
+ public:
+  typedef Geant4ePropagationTable Table;
+
+  /** Constructor. Takes the grid and particle of the table (the magic
+   *  string, version and number of stations are set here) and the
+   *  stations.
+   */
+  Geant4ePropagationTableBuilder(const Table::Header& header,
+				 const std::vector<Table::Station>& stations);
+
+  /** Propagates the nodes, and checks the cells if checkCells, with
+   *  propagator. buffer receives the contents of the table file.
+   */
+  void build(const Geant4ePropagator& propagator, const MagneticField* field,
+	     bool checkCells, std::vector<char>& buffer) const;
+
+  const Table::Header& header() const {return theHeader;}
+
+ private:
+  // Free state at the given axis values, with a null error
+  FreeTrajectoryState startState(const double* values,
+				 const MagneticField* field) const;
+
+  // Direct propagation to a station. Returns false if it failed
+  bool propagate(const Geant4ePropagator& propagator,
+		 const FreeTrajectoryState& fts, const Table::Station& st,
+		 TrajectoryStateOnSurface& tsos, double& path) const;
+
+  void fillNodes(const Geant4ePropagator& propagator,
+		 const MagneticField* field, std::vector<char>& buffer) const;
+  void checkAccuracy(const Geant4ePropagator& propagator,
+		     const MagneticField* field,
+		     std::vector<char>& buffer) const;
+
+  Table::Header theHeader;
+  std::vector<Table::Station> theStations;
+};
+
+
+#endif
@@ -7,15 +7,34 @@
 #include "TrackingTools/GeomPropagators/interface/Propagator.h"
 
 // - Geant4e
-#include "G4ErrorPropagatorManager.hh"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagatorCore.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eSteppingAction.h"
+#include "DataFormats/CLHEP/interface/AlgebraicObjects.h"
 
+#include <boost/shared_ptr.hpp>
 
+#include <string>
+#include <vector>
 
-class Geant4eSteppingAction;
+
+class Geant4eMagneticField;
+class Geant4ePropagationTable;
+class Geant4eVolumeProfile;
+class Geant4eMaterialTables;
+struct Geant4ePropagationBatch;
+struct Geant4ePropagationBatchResult;
+class G4ErrorFreeTrajState;
+class G4ErrorTarget;
+namespace Geant4ePropagationLog {
+  struct Record;
+  class Writer;
+}
 
 /** Propagator based on the Geant4e package. Uses the Propagator class
  *  in the TrackingTools/GeomPropagators package to define the interface.
- *  See that class for more details.
+ *  See that class for more details. The calls to Geant4e go through
+ *  Geant4ePropagatorCore; this class adds the CMS states and surfaces,
+ *  the field adapter and the optional features on top.
  */
 
 class Geant4ePropagator GCC11_FINAL : public Propagator {
@@ -52,6 +71,17 @@ class Geant4ePropagator GCC11_FINAL : public Propagator {
   virtual TrajectoryStateOnSurface
     propagate (const TrajectoryStateOnSurface& tsos, const Cylinder& cyl) const; 
 
+  /** Same as above with a budget for this call only, instead of the one
+   *  set with setBudget()
+   */
+  TrajectoryStateOnSurface 
+  propagate (const FreeTrajectoryState& ftsStart, const Plane& pDest,
+	     const Geant4eSteppingAction::Budget& budget) const;
+
+  TrajectoryStateOnSurface 
+  propagate (const FreeTrajectoryState& ftsStart, const Cylinder& cDest,
+	     const Geant4eSteppingAction::Budget& budget) const;
+
   /** The methods propagateWithPath() are identical to the corresponding
    *  methods propagate() in what concerns the resulting 
    *  TrajectoryStateOnSurface, but they provide in addition the
@@ -72,29 +102,356 @@ class Geant4ePropagator GCC11_FINAL : public Propagator {
    propagateWithPath (const TrajectoryStateOnSurface&, const Cylinder&) const; 
 
 
+  /** Propagate a batch of start states given as structure of arrays (see
+   *  Geant4ePropagationBatch) to their targets. The set up is done once
+   *  per batch and the requests are propagated grouped by target; the
+   *  results keep the order of the requests. The budget applies to each
+   *  request as a whole, also when it is propagated in several legs (see
+   *  setBatchRegions()).
+   */
+  void propagateBatch(const Geant4ePropagationBatch& batch,
+		      Geant4ePropagationBatchResult& result) const;
+
+  /** Energy loss of one component of a mixture: its weight, the ratio of
+   *  the final to the start momentum and the variance of q/p (1/GeV2)
+   *  added along the path, i.e. by the energy loss fluctuations (the
+   *  multiple scattering only adds to the angles and positions). The
+   *  ratio is 0 if the component did not reach the target, the variance
+   *  0 if its transport was not kept (backward propagations).
+   */
+  struct MixtureEnergyLoss {
+    double weight;
+    double momentumFraction;
+    double variance;
+  };
+
+  /** Propagate the components of a Gaussian mixture (e.g. the state of a
+   *  Gaussian sum filter, see TrajectoryStateOnSurface::components()) to a
+   *  surface. The weighted mean of the components is propagated once with
+   *  Geant4e, keeping its transport, and every component within the
+   *  mixture spread of the mean follows by linear transport around it.
+   *  The other components are propagated on their own. The result is the
+   *  mixture on the surface, with the weights of the start components.
+   *  If energyLoss is given it receives the energy loss of every
+   *  component, in the order of the start components.
+   */
+  TrajectoryStateOnSurface 
+  propagateMixture(const TrajectoryStateOnSurface& tsos, const Plane& plane,
+		   std::vector<MixtureEnergyLoss>* energyLoss = 0) const;
+
+  TrajectoryStateOnSurface 
+  propagateMixture(const TrajectoryStateOnSurface& tsos, const Cylinder& cyl,
+		   std::vector<MixtureEnergyLoss>* energyLoss = 0) const;
+
+  /** Largest relative difference of the momentum of a component of a
+   *  mixture to the mean for the linear transport
+   */
+  void setMixtureMaxSpread(double spread) {theMixtureMaxSpread = spread;}
+
+  /** Radii (cm) of the cylinders splitting the detector in regions for
+   *  the batches propagated along the momentum. All the requests of a
+   *  batch are first propagated to the first boundary they cross, then
+   *  all to the next one, and so on, so that the tracks in one region are
+   *  propagated together and reuse the same geometry and field data.
+   *  Empty to propagate each request to its target in one go.
+   */
+  void setBatchRegions(const std::vector<double>& radii);
+
+  /** Regions of the batches without material, by index: region 0 is
+   *  inside the first boundary, region k between the boundaries k-1 and
+   *  k. The requests starting in them are transported to the next
+   *  boundary through the field only, several at a time (see
+   *  Geant4eMultiTrackStepper), instead of through Geant4e.
+   */
+  void setFieldOnlyRegions(const std::vector<unsigned int>& regions);
+
   virtual Geant4ePropagator* clone() const {return new Geant4ePropagator(*this);}
 
   virtual const MagneticField* magneticField() const {return theField;}
 
+  /** Adapter of the field for the Geant4 steppers, with the statistics of
+   *  its caches. Null before the first propagation
+   */
+  const Geant4eMagneticField* fieldAdapter() const;
+
+  /** Size in cm of the cells used to interpolate the magnetic field seen
+   *  by the Geant4 stepper. A value <= 0 disables the interpolation.
+   *  Only effective before the first propagation.
+   */
+  void setFieldCellSize(double cellSize) {theFieldCellSize = cellSize;}
+
+  /** Accuracy of the Geant4 propagation in the field (see
+   *  Geant4ePropagatorCore::SteppingParameters)
+   */
+  typedef Geant4ePropagatorCore::SteppingParameters SteppingParameters;
+
+  /** Sets the accuracy of the field propagation. The Geant4 field manager
+   *  is global, so the parameters are applied to it before each
+   *  propagation of this propagator and its clones, and stay until
+   *  another propagator changes them. Returns false, with a warning, if
+   *  Geant4 did not take all of them. This is only known once Geant4e is
+   *  initialised: before, the check is done at the first propagation.
+   */
+  bool setSteppingParameters(const SteppingParameters& parameters);
+  const SteppingParameters& steppingParameters() const {return theCore.steppingParameters();}
+
+  /** Use a table of precomputed propagations (see Geant4ePropagationTable)
+   *  for the targets and start states it covers. With a positive
+   *  maxResidual (cm), cells whose accuracy is worse or was not checked
+   *  are not used. Geant4e is used for any
+   *  propagation outside the table domain.
+   */
+  void setPropagationTable(const std::string& fileName, double maxResidual);
+
+  /** Error code returned by Geant4e in the last propagation (0 if it
+   *  succeeded or if it did not need Geant4e) and number of Geant4 steps
+   *  it took.
+   */
+  int lastG4eError() const {return theLastG4eError;}
+  unsigned int lastStepCount() const;
+
+  /** Transport the errors of forward propagations with fixed size
+   *  matrices at every step (see Geant4eFreeTrajState) instead of the
+   *  Geant4e transport. Backward propagations always use Geant4e.
+   */
+  void setFastErrorTransport(bool fast) {theFastErrorTransport = fast;}
+
+  /** Keep the transport of every forward propagation of a state with
+   *  errors: the jacobian J and the process noise Q such that the final
+   *  error is J C Jt + Q for the start error C. lastTransport() returns
+   *  false if the last propagation did not keep it.
+   */
+  void setStoreTransport(bool store) {theStoreTransport = store;}
+  bool lastTransport(AlgebraicMatrix55& jacobian, 
+		     AlgebraicSymMatrix55& noise) const;
+
+  /** Final error for another start error, from the transport of a
+   *  propagation
+   */
+  static AlgebraicSymMatrix55 
+  transportCovariance(const AlgebraicMatrix55& jacobian,
+		      const AlgebraicSymMatrix55& noise,
+		      const AlgebraicSymMatrix55& start) {
+    return ROOT::Math::Similarity(jacobian, start) + noise;
+  }
+
+  /** Derivatives of the local parameters (q/p, dx/dz, dy/dz, x, y) of a
+   *  state on a plane with respect to the rigid body parameters of the
+   *  plane (shifts along local x, y, z and rotations around them). They
+   *  follow from the final position and direction, with the track taken
+   *  as straight near the plane, and match the Karimaki derivatives for
+   *  the positions.
+   *  With setStoreAlignmentDerivatives(true) they are computed for every
+   *  propagation to a plane and lastAlignmentDerivatives() returns them,
+   *  if the last call was a single track propagation to a plane.
+   */
+  typedef ROOT::Math::SMatrix<double, 5, 6> AlignmentDerivatives;
+  static AlignmentDerivatives 
+  alignmentDerivatives(const TrajectoryStateOnSurface& tsos);
+  void setStoreAlignmentDerivatives(bool store) {theStoreAlignmentDerivatives = store;}
+  bool lastAlignmentDerivatives(AlignmentDerivatives& derivatives) const;
+
+  /** Limits on the steps, path, time and turns of every Geant4e
+   *  propagation (see Geant4eSteppingAction::Budget). A propagation that
+   *  exceeds them returns an invalid state and lastStatus() tells which
+   *  limit was hit. The hits are counted over the job and reported at its
+   *  end.
+   */
+  void setBudget(const Geant4eSteppingAction::Budget& budget) {theBudget = budget;}
+  Geant4eSteppingAction::Status lastStatus() const;
+  unsigned long budgetHits(Geant4eSteppingAction::Status status) const;
+
+  /** Reject propagations to planes that both a helix and a straight line
+   *  from the start state miss by more than margin (cm) outside the
+   *  bounds of the plane, or cannot reach in the propagation direction.
+   *  The straight line keeps the muons that the return field of the yoke
+   *  bends back onto the target. The rejected propagations return an
+   *  invalid state without calling Geant4e, with no steps and status
+   *  kOk, and are counted over the job. The target planes must have
+   *  bounds. A margin <= 0 disables the
+   *  check.
+   */
+  void setBoundsCheckMargin(double margin) {theBoundsCheckMargin = margin;}
+  unsigned long boundsRejections() const;
+
+  /** Write every propagation request and its result to fileName (see
+   *  Geant4ePropagationLog) so that the workload can be replayed later.
+   *  The file is started once per job: later propagators capturing to it
+   *  append. An empty name stops the capture.
+   */
+  void setCaptureFile(const std::string& fileName);
+
+  /** Directory where the Geant4 physics tables are cached between jobs
+   *  (see Geant4ePhysicsTableCache). Empty to always build them. Only
+   *  effective before the first propagation.
+   */
+  void setPhysicsTableCache(const std::string& directory);
+
+  /** Physics of the propagation: "Geant4e" for the Geant4e physics list,
+   *  "Tabulated" for the energy loss, and with the fast error transport
+   *  the noise, interpolated in per material tables (see
+   *  Geant4eMaterialTables), "MuonMinimal" for the Geant4e processes of
+   *  the muons only (see Geant4eMuonPhysicsList), which shortens the
+   *  initialisation and the physics tables but not the steps. Only
+   *  effective before the first propagation.
+   */
+  void setPhysics(const std::string& physics);
+
+  /** Navigate a reduced copy of the Geant4 geometry in which daughter
+   *  volumes smaller than minVolume (cm3) are merged into the material of
+   *  their mother (see Geant4eReducedGeometry). Logical volumes whose name
+   *  starts with one of the keep prefixes are not reduced. A minVolume <= 0
+   *  uses the full geometry. Only effective before the first propagation.
+   */
+  void setReducedGeometry(double minVolume, 
+			  const std::vector<std::string>& keep);
+
+  /** Profile the steps, path length and time spent in every logical
+   *  volume and region (see Geant4eVolumeProfile). The ranked report is
+   *  written to fileName when the propagator and its clones are gone.
+   *  An empty name stops the profiling.
+   */
+  void setProfileReport(const std::string& fileName);
 
 
  protected:
 
+  //Initialises Geant4e, the field adapter and the stepping action if
+  //not done yet
+  void initialise() const;
+
+  //Warns that Geant4 did not take the stepping parameters
+  void warnSteppingParameters() const;
+
+  //Propagation proper. The public methods add the capture, once per
+  //request with the start state of the caller
+  TrajectoryStateOnSurface 
+  doPropagate(const FreeTrajectoryState& ftsStart, const Plane& pDest) const;
+  TrajectoryStateOnSurface 
+  doPropagate(const FreeTrajectoryState& ftsStart, const Cylinder& cDest) const;
+
+  //Batch propagation through the region boundaries, without the capture
+  void propagateBatchRegions(const Geant4ePropagationBatch& batch,
+			     Geant4ePropagationBatchResult& result) const;
+
+  //Batch propagation of every request to its target in one go, with the
+  //budget left to every request if given
+  void propagateBatchDirect(const Geant4ePropagationBatch& batch,
+			    Geant4ePropagationBatchResult& result,
+			    const std::vector<Geant4eSteppingAction::Budget>* budgets = 0) const;
+
+  //Mixture propagation to a plane or a cylinder
+  TrajectoryStateOnSurface 
+  propagateMixtureTo(const TrajectoryStateOnSurface& tsos, const Surface& dest,
+		     std::vector<MixtureEnergyLoss>* energyLoss) const;
+
+  //Propagation to a plane or a cylinder keeping the transport
+  TrajectoryStateOnSurface 
+  propagateWithTransport(const FreeTrajectoryState& ftsStart, 
+			 const Surface& dest) const;
+
+  //True if the bounds check rejects the target
+  bool unreachable(const FreeTrajectoryState& ftsStart, 
+		   const Plane& pDest) const;
+
+  //Calls Geant4e in the given mode within the budget and stores its
+  //return code. Returns non zero if the propagation failed or was stopped
+  int propagateG4(G4ErrorFreeTrajState& g4eTrajState,
+		  const G4ErrorTarget& g4eTarget, G4ErrorMode mode) const;
+
+  //Completes a captured request with its result and writes it
+  void capture(Geant4ePropagationLog::Record& record,
+	       const TrajectoryStateOnSurface& tsos) const;
+
+  //Propagation using the table, ended with a straight line from the
+  //station onto dest. Returns an invalid state if the table does not
+  //cover the start state or dest is further than the station tolerance
+  TrajectoryStateOnSurface 
+  propagateWithTable(const FreeTrajectoryState& ftsStart, 
+		     unsigned int station, const Surface& dest) const;
+
   typedef std::pair<TrajectoryStateOnSurface, double> TsosPP;
 
 
   //Magnetic field
   const MagneticField* theField;
 
+  //Cell size of the adapter feeding theField to the Geant4 steppers. The
+  //adapter itself is owned by the core and shared among clones
+  double theFieldCellSize;
+
   //Name of the particle whose properties will be used in the propagation
   std::string theParticleName; 
 
-  //The Geant4e manager. Does the real propagation
-  G4ErrorPropagatorManager* theG4eManager;
+  //Framework independent core. Does the real propagation
+  mutable Geant4ePropagatorCore theCore;
 
-  //A G4 stepping action to find out the track length
+  //A G4 stepping action to find out the track length. Owned by Geant4e
+  //through the core
   mutable Geant4eSteppingAction* theSteppingAction;
 
+  //Return code of the last call to Geant4e
+  mutable int theLastG4eError;
+
+  //Path (cm) of the last propagation, through Geant4e or the table
+  mutable double theLastPath;
+
+  //Table of precomputed propagations. Shared among clones
+  boost::shared_ptr<const Geant4ePropagationTable> theTable;
+  double theTableMaxResidual;
+
+  //Cache directory of the physics tables, empty if not used
+  std::string thePhysicsTableCache;
+
+  //Region boundaries of the batches, and regions without material
+  std::vector<double> theBatchRegionRadii;
+  std::vector<unsigned int> theFieldOnlyRegions;
+
+  //Physics mode, and its material tables if tabulated. Shared among clones
+  std::string thePhysics;
+  mutable boost::shared_ptr<Geant4eMaterialTables> theMaterialTables;
+
+  //Reduced geometry, used if the minimum volume is > 0
+  double theReducedGeometryMinVolume;
+  std::vector<std::string> theReducedGeometryKeep;
+
+  //Profile of the steps per volume, if profiling. Shared among clones
+  boost::shared_ptr<Geant4eVolumeProfile> theProfile;
+
+  //Error transport with SMatrix instead of Geant4e
+  bool theFastErrorTransport;
+
+  //Transport of the last propagation, if kept for every propagation or
+  //for the current call
+  bool theStoreTransport;
+  mutable bool theCallStoreTransport;
+  mutable bool theTransportValid;
+  mutable AlgebraicMatrix55 theTransportJacobian;
+  mutable AlgebraicSymMatrix55 theTransportNoise;
+
+  //Momentum spread of the mixture components transported linearly
+  double theMixtureMaxSpread;
+
+  //Margin of the bounds check, disabled if <= 0
+  double theBoundsCheckMargin;
+
+  //Alignment derivatives of the last propagation to a plane, if kept
+  bool theStoreAlignmentDerivatives;
+  mutable bool theAlignmentDerivativesValid;
+  mutable AlignmentDerivatives theAlignmentDerivatives;
+
+  //Budget of every propagation, and of the current call if it has its own
+  Geant4eSteppingAction::Budget theBudget;
+  mutable const Geant4eSteppingAction::Budget* theCallBudget;
+
+  //Propagations stopped by the budget or rejected by the bounds check.
+  //Shared among clones
+  struct BudgetCounters;
+  boost::shared_ptr<BudgetCounters> theBudgetCounters;
+
+  //Log of the propagation requests, if capturing. Shared among clones
+  boost::shared_ptr<Geant4ePropagationLog::Writer> theCapture;
+
 };
 
 
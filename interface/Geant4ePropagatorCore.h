@@ -0,0 +1,153 @@
+#ifndef TrackPropagation_Geant4ePropagatorCore_h
+#define TrackPropagation_Geant4ePropagatorCore_h
+
+#include "TrackPropagation/Geant4e/interface/Geant4eSteppingAction.h"
+
+//Geant4
+#include "G4ErrorPropagatorManager.hh"
+
+#include <memory>
+#include <string>
+
+class G4ErrorFreeTrajState;
+class G4MagneticField;
+class G4ErrorTarget;
+class G4VUserPhysicsList;
+
+/** Framework independent core of the Geant4e propagation, for tools that
+ *  embed the propagator without the CMS framework. It drives Geant4e with
+ *  plain states and targets and needs only Geant4 and CLHEP: no message
+ *  logger, event setup, CMS field or Propagator interface.
+ *  The geometry is the world given to G4ErrorPropagatorManager by the
+ *  caller. The field is the one of the Geant4 field manager, unless one
+ *  is given with setField(). Geant4ePropagator is the CMS adapter on top
+ *  of it. It is built with Geant4eSteppingAction and Geant4eVolumeProfile
+ *  in the separate library of core/, which links no framework package.
+ */
+class Geant4ePropagatorCore {
+ public:
+  /** State in cm and GeV. The covariance is the lower triangle of the CMS
+   *  curvilinear error matrix (q/p, lambda, phi, xt, yt), 15 values.
+   */
+  struct State {
+    double position[3];
+    double momentum[3];
+    int charge;
+    bool hasError;
+    double covariance[15];
+  };
+
+  /** Plane through position with the given normal, or cylinder of the
+   *  given radius (cm) around position, oriented by rotation, row by row
+   *  as a CMS TkRotation.
+   */
+  struct Target {
+    enum Kind {kPlane, kCylinder};
+    Kind kind;
+    double position[3];
+    double normal[3];
+    double radius;
+    double rotation[9];
+  };
+
+  enum Direction {kForwards, kBackwards};
+
+  /** Accuracy of the Geant4 propagation in the field, with the names and
+   *  units of the G4ClassicalRK4 settings in geantRefit_cff.py: chord
+   *  distance, accuracy of one step and of the boundary intersections,
+   *  and minimum step of the chord finder in mm, relative accuracy of the
+   *  integration (epsilon) without units. A value <= 0 keeps the value
+   *  of the Geant4 field manager.
+   */
+  struct SteppingParameters {
+    SteppingParameters(): deltaChord(0), deltaOneStep(0), deltaIntersection(0),
+			  minStep(0), minimumEpsilonStep(0), maximumEpsilonStep(0) {}
+    bool any() const {
+      return deltaChord > 0 || deltaOneStep > 0 || deltaIntersection > 0 ||
+	minStep > 0 || minimumEpsilonStep > 0 || maximumEpsilonStep > 0;
+    }
+    double deltaChord;
+    double deltaOneStep;
+    double deltaIntersection;
+    double minStep;
+    double minimumEpsilonStep;
+    double maximumEpsilonStep;
+  };
+
+  /** Constructor. Takes the particle name without the charge, e.g. "mu"
+   */
+  explicit Geant4ePropagatorCore(const std::string& particleName = "mu");
+
+  /** Initialises Geant4e if not done yet, with the given physics list or
+   *  the Geant4e one if null. Returns true if this call initialised it.
+   *  The first propagation does it with the Geant4e physics list if the
+   *  caller did not.
+   */
+  bool initialise(G4VUserPhysicsList* physicsList = 0);
+  bool initialised() const;
+
+  /** Field of the propagations, in Geant4 units. The core takes ownership
+   *  of it and shares it with its copies. Geant4 has a single field
+   *  manager holding a plain pointer, so the field is installed in it
+   *  (and in the Geant4e equation of motion) before each propagation, and
+   *  taken out of it when the last owner deletes it. Null leaves the
+   *  field manager as the caller set it up.
+   */
+  void setField(G4MagneticField* field);
+  G4MagneticField* field() const {return theField.get();}
+
+  /** Stepping parameters of this core and of its copies. The Geant4
+   *  field manager is global, so they are applied to it before each
+   *  propagation, and at once if Geant4e is initialised. Returns false if
+   *  Geant4 did not take all of them, e.g. an epsilon out of its range.
+   */
+  bool setSteppingParameters(const SteppingParameters& parameters);
+  const SteppingParameters& steppingParameters() const {return theSteppingParameters;}
+
+  /** Applies the stepping parameters to the field manager. Changing the
+   *  minimum step needs a new chord finder, which is built like the one
+   *  of Geant4e from the current field and kept for the rest of the
+   *  process. Returns false if the values read back differ.
+   */
+  bool applySteppingParameters() const;
+
+  /** Values in the Geant4 field manager, zero where there is no chord
+   *  finder yet
+   */
+  static SteppingParameters currentSteppingParameters();
+
+  /** Propagates start to target. Returns 0 and fills end and path (cm) on
+   *  success, the Geant4e error code if it failed, or minus the status of
+   *  the stepping action if the budget stopped it.
+   */
+  int propagate(const State& start, const Target& target, Direction direction,
+		State& end, double& path,
+		const Geant4eSteppingAction::Budget& budget = 
+		Geant4eSteppingAction::Budget()) const;
+
+  /** Geant4e level interface used by the adapters: a new target to be
+   *  deleted by the caller, and the propagation of a Geant4e state within
+   *  a budget, with the same return code as above
+   */
+  static G4ErrorTarget* newTarget(const Target& target);
+  int propagateG4(G4ErrorFreeTrajState& g4eTrajState,
+		  const G4ErrorTarget& g4eTarget, G4ErrorMode mode,
+		  const Geant4eSteppingAction::Budget& budget) const;
+
+  /** Stepping action of Geant4e, null before the initialisation
+   */
+  Geant4eSteppingAction* steppingAction() const {return theSteppingAction;}
+  const std::string& particleName() const {return theParticleName;}
+
+ private:
+  bool initialiseG4(G4VUserPhysicsList* physicsList) const;
+
+  std::string theParticleName;
+  G4ErrorPropagatorManager* theG4eManager;
+  mutable Geant4eSteppingAction* theSteppingAction;
+  std::shared_ptr<G4MagneticField> theField;
+  SteppingParameters theSteppingParameters;
+};
+
+
+#endif
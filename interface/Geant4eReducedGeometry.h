@@ -0,0 +1,61 @@
+#ifndef TrackPropagation_Geant4eReducedGeometry_h
+#define TrackPropagation_Geant4eReducedGeometry_h
+
+#include <map>
+#include <string>
+#include <vector>
+
+class G4VPhysicalVolume;
+class G4LogicalVolume;
+class G4VSolid;
+class G4Material;
+class G4Element;
+
+/** Builds a reduced copy of a Geant4 geometry for the Geant4e navigation.
+ *  Daughter volumes smaller than a minimum volume are removed and their
+ *  mass is spread over their mother, whose material is replaced by the
+ *  mass weighted mixture of the mother and the removed subtrees. The total
+ *  mass and composition of every mother are therefore kept, only the
+ *  detail is lost.
+ *  Logical volumes with a sensitive detector or whose name starts with one
+ *  of the given prefixes are kept exact, together with all their
+ *  daughters. Volumes with replicated or parameterised daughters are kept
+ *  as well, since those cannot be placed in another mother.
+ *  Unchanged subtrees are shared with the original geometry, which is left
+ *  untouched.
+ */
+class Geant4eReducedGeometry {
+ public:
+  /** Constructor. Takes as arguments:
+   *  * The volume, in Geant4 units, below which daughters are merged
+   *  * The prefixes of the names of the logical volumes kept exact
+   */
+  Geant4eReducedGeometry(double minVolume,
+			 const std::vector<std::string>& keepPrefixes);
+
+  /** Returns the reduced world. It is the original world if nothing could
+   *  be merged. Prints a summary of the reduction.
+   */
+  G4VPhysicalVolume* build(G4VPhysicalVolume* world);
+
+ private:
+  typedef std::map<const G4Element*, double> ElementMasses;
+
+  G4LogicalVolume* reduce(G4LogicalVolume* lv);
+  bool keep(const G4LogicalVolume* lv) const;
+  double volume(const G4VSolid* solid);
+  void addMaterial(const G4Material* mat, double vol, ElementMasses& masses) const;
+  void addSubtree(const G4LogicalVolume* lv, ElementMasses& masses);
+
+  double theMinVolume;
+  std::vector<std::string> theKeepPrefixes;
+
+  std::map<G4LogicalVolume*, G4LogicalVolume*> theReduced;
+  std::map<const G4VSolid*, double> theVolumes;
+
+  unsigned int theNMerged;
+  unsigned int theNMaterials;
+};
+
+
+#endif
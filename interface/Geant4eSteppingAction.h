@@ -3,17 +3,45 @@
 
 #include "G4UserSteppingAction.hh"
 
-#include "FWCore/Utilities/interface/GCC11Compatibility.h"
+#include <chrono>
+#include <cmath>
 
+class Geant4eVolumeProfile;
 
-/** A G4 User stepping action used to calculate the total track. The method
-    G4UserSteppingAction::UserSteppingAction(const G4Step*) should be 
-    automatically called by G4eManager at each step. 
+
+/** A G4 User stepping action used to calculate the total track length
+    and count the steps. Optionally it feeds every step to a
+    Geant4eVolumeProfile. It also enforces the budget of the propagation:
+    when the steps, the path length, the wall time or the turns of the
+    track exceed their limits the track is killed, which ends the
+    Geant4e propagation, and the reason is kept until the next reset().
+    The method G4UserSteppingAction::UserSteppingAction(const G4Step*)
+    should be automatically called by G4eManager at each step. 
 
  */
-class Geant4eSteppingAction GCC11_FINAL : public G4UserSteppingAction {
+class Geant4eSteppingAction final : public G4UserSteppingAction {
  public:
-  Geant4eSteppingAction():theTrackLength(0) {}
+  /** Reason why the last propagation was stopped by the stepping action
+   */
+  enum Status {kOk = 0, kMaxSteps, kMaxPath, kMaxTime, kLooper, kNStatus};
+
+  /** Limits of one propagation. A value <= 0 disables the limit. The path
+      is in cm, as in CMS. A track is a looper once its transverse
+      direction has turned by more than maxTurns full turns.
+  */
+  struct Budget {
+    Budget(): maxSteps(0), maxPath(0), maxTime(0), maxTurns(0) {}
+    bool enabled() const {
+      return maxSteps > 0 || maxPath > 0 || maxTime > 0 || maxTurns > 0;
+    }
+    int maxSteps;
+    double maxPath;   //cm
+    double maxTime;   //s
+    double maxTurns;
+  };
+
+  Geant4eSteppingAction():theTrackLength(0), theNSteps(0), theProfile(0),
+    theStatus(kOk), theTurnAngle(0) {}
   virtual ~Geant4eSteppingAction() {}
 
   /** Retrieve the length that the track has accumulated since the last call
@@ -21,18 +49,57 @@ class Geant4eSteppingAction GCC11_FINAL : public G4UserSteppingAction {
   */
   double trackLength() const {return theTrackLength;}
 
-  /** Resets to 0 the counter on the track length. Should be called at the 
-      beginning of any extrapolation.
+  /** Retrieve the number of steps done since the last call to reset()
   */
-  void reset() {theTrackLength = 0;}
+  unsigned int nSteps() const {return theNSteps;}
+
+  /** Turns of the transverse direction since the last call to reset().
+      Only counted if the budget limits them
+  */
+  double turns() const {return std::abs(theTurnAngle)/(2*M_PI);}
+
+  /** Resets to 0 the counters on the track length and steps. Should be
+      called at the beginning of any extrapolation.
+  */
+  void reset();
+
+  /** Sets the track length when the propagation was not done by Geant4,
+      e.g. when it was taken from a table. In Geant4 units.
+  */
+  void setTrackLength(double length) {theTrackLength = length;}
 
   /** This method is automatically called by G4eManager at each step. The step
-      length is then added to the stored value of the track length.     
+      length is then added to the stored value of the track length and the
+      step counter is incremented.
    */
   virtual void UserSteppingAction(const G4Step* step);
+
+  /** Profile receiving the steps, not owned. 0 to disable the profiling.
+      The stepping action is shared by all the propagators, which set
+      their profile around each propagation only
+  */
+  void setProfile(Geant4eVolumeProfile* profile) {theProfile = profile;}
+
+  /** Budget applied from the next reset() on
+  */
+  void setBudget(const Budget& budget) {theBudget = budget;}
+  const Budget& budget() const {return theBudget;}
+
+  /** kOk unless the budget stopped the track since the last reset()
+  */
+  Status status() const {return theStatus;}
   
  protected:
+  Status checkBudget(const G4Step* step);
+
   double theTrackLength;
+  unsigned int theNSteps;
+  Geant4eVolumeProfile* theProfile;
+
+  Budget theBudget;
+  Status theStatus;
+  double theTurnAngle;
+  std::chrono::steady_clock::time_point theStartTime;
 };
 
 
@@ -0,0 +1,42 @@
+#ifndef TrackPropagation_Geant4eTabulatedEnergyLoss_h
+#define TrackPropagation_Geant4eTabulatedEnergyLoss_h
+
+#include "G4ErrorEnergyLoss.hh"
+
+class Geant4eMaterialTables;
+
+/** Continuous energy loss of the tabulated physics mode. Replaces
+ *  G4ErrorEnergyLoss: the loss of a step is the mean of the dE/dx of the
+ *  material tables at its start and at its end, and it is added instead of
+ *  subtracted when Geant4e propagates backwards. The step is limited so
+ *  that it does not lose more than a fraction of the kinetic energy: the
+ *  step limit of G4ErrorEnergyLoss, so that the G4ErrorMessenger command
+ *  sets it as in the Geant4e physics. Particles that are not in the
+ *  tables lose no energy.
+ */
+class Geant4eTabulatedEnergyLoss : public G4ErrorEnergyLoss {
+ public:
+  explicit Geant4eTabulatedEnergyLoss(Geant4eMaterialTables* tables,
+				      double maxLossFraction = 0.2);
+  virtual ~Geant4eTabulatedEnergyLoss() {}
+
+  virtual G4bool IsApplicable(const G4ParticleDefinition& particle);
+
+  /** Builds the material tables
+   */
+  virtual void BuildPhysicsTable(const G4ParticleDefinition& particle);
+
+  virtual G4double GetContinuousStepLimit(const G4Track& track,
+					  G4double previousStepSize,
+					  G4double currentMinimumStep,
+					  G4double& currentSafety);
+
+  virtual G4VParticleChange* AlongStepDoIt(const G4Track& track, 
+					   const G4Step& step);
+
+ private:
+  Geant4eMaterialTables* theTables;
+};
+
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef TrackPropagation_Geant4eTabulatedPhysicsList_h
+#define TrackPropagation_Geant4eTabulatedPhysicsList_h
+
+#include "G4ErrorPhysicsList.hh"
+
+class Geant4eMaterialTables;
+
+/** Physics list of the tabulated physics mode: the Geant4e physics list
+ *  with Geant4eTabulatedEnergyLoss instead of G4ErrorEnergyLoss. The step
+ *  limits of Geant4e and their G4ErrorMessenger are kept.
+ */
+class Geant4eTabulatedPhysicsList : public G4ErrorPhysicsList {
+ public:
+  explicit Geant4eTabulatedPhysicsList(Geant4eMaterialTables* tables);
+  virtual ~Geant4eTabulatedPhysicsList() {}
+
+ protected:
+  virtual void ConstructProcess();
+
+ private:
+  Geant4eMaterialTables* theTables;
+};
+
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef TrackPropagation_Geant4eVolumeProfile_h
+#define TrackPropagation_Geant4eVolumeProfile_h
+
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+class G4Step;
+class G4LogicalVolume;
+
+/** Accumulates the number of steps, the path length and the wall time
+ *  spent by Geant4e in every logical volume. It is fed by
+ *  Geant4eSteppingAction; the time of a step is the time elapsed since the
+ *  end of the previous step (or the start of the propagation) and is
+ *  assigned to the volume the step starts in. Consecutive steps mostly
+ *  stay in one volume, so the entry of the last volume is cached.
+ *  On destruction a report ranking the volumes and regions by steps and
+ *  by time is written to a file, and a short summary of the top volumes
+ *  is given to the summary callback, if any.
+ */
+class Geant4eVolumeProfile {
+ public:
+  struct Entry {
+    Entry(): steps(0), length(0), time(0) {}
+    unsigned long steps;
+    double length;   //mm
+    double time;     //s
+  };
+
+  typedef std::function<void (const std::string&)> SummaryCallback;
+
+  /** Constructor. Takes the name of the report file, the number of
+   *  volumes listed in each ranking and the callback receiving the
+   *  summary, e.g. to print it to a logger.
+   */
+  explicit Geant4eVolumeProfile(const std::string& reportFile,
+				unsigned int nTop = 50,
+				const SummaryCallback& summary = SummaryCallback());
+  ~Geant4eVolumeProfile();
+
+  /** Marks the beginning of a propagation
+   */
+  void start() {theLastTime = std::chrono::steady_clock::now();}
+
+  void addStep(const G4Step* step);
+
+  /** Rankings of the nTop first regions and volumes
+   */
+  void writeReport(std::ostream& out, unsigned int nTop) const;
+
+ private:
+  typedef std::unordered_map<const G4LogicalVolume*, Entry> VolumeMap;
+
+  std::string theReportFile;
+  unsigned int theNTop;
+  SummaryCallback theSummary;
+
+  VolumeMap theVolumes;
+  const G4LogicalVolume* theLastVolume;
+  Entry* theLastEntry;
+  std::chrono::steady_clock::time_point theLastTime;
+};
+
+
+#endif
@@ -0,0 +1,123 @@
+#include "FWCore/Framework/interface/Frameworkfwd.h"
+#include "FWCore/Framework/interface/EDAnalyzer.h"
+#include "FWCore/Framework/interface/ESHandle.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/EventSetup.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+//- Magnetic field
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
+
+//- Propagator
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationTableBuilder.h"
+
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+/** Offline tool that fills a Geant4ePropagationTable with a
+ *  Geant4ePropagationTableBuilder. The grid is (q/pT, eta, phi, vertex z)
+ *  and the reference surfaces are cylinders for the barrel stations and
+ *  planes perpendicular to the beam for the endcap ones. The table is
+ *  written to a file.
+ *  Everything is done in the first event, which is only needed to access
+ *  the event setup. An EmptySource with one event is enough.
+ */
+class Geant4ePropagationTableWriter: public edm::EDAnalyzer {
+
+public:
+  explicit Geant4ePropagationTableWriter(const edm::ParameterSet&);
+  virtual ~Geant4ePropagationTableWriter() {}
+
+  virtual void analyze(const edm::Event&, const edm::EventSetup&);
+
+private:
+  typedef Geant4ePropagationTable Table;
+
+  bool theDone;
+  std::string theOutputFile;
+  std::string theParticleName;
+  bool theCheckAccuracy;
+
+  Table::Header theHeader;
+  std::vector<Table::Station> theStations;
+};
+
+
+Geant4ePropagationTableWriter::Geant4ePropagationTableWriter(const edm::ParameterSet& iConfig):
+  theDone(false),
+  theOutputFile(iConfig.getParameter<std::string>("OutputFile")),
+  theParticleName(iConfig.getParameter<std::string>("ParticleName")),
+  theCheckAccuracy(iConfig.getParameter<bool>("CheckAccuracy")) {
+
+  if (theParticleName.size() >= sizeof(theHeader.particle))
+    throw cms::Exception("Geant4e") << "Particle name " << theParticleName
+				    << " is too long for the table";
+
+  Table::initHeader(theHeader);
+  std::strcpy(theHeader.particle, theParticleName.c_str());
+  theHeader.maxVertexRho = iConfig.getParameter<double>("MaxVertexRho");
+
+  const char* axisNames[Table::kNAxes] = {"QOverPt", "Eta", "Phi", "VertexZ"};
+  for (unsigned int a = 0; a < Table::kNAxes; a++) {
+    std::string name = axisNames[a];
+    std::vector<double> range =
+      iConfig.getParameter<std::vector<double> >(name + "Range");
+    int nodes = iConfig.getParameter<int>(name + "Nodes");
+    if (range.size() != 2 || range[1] <= range[0] || nodes < 2)
+      throw cms::Exception("Configuration") << "Bad grid definition for "
+					    << name;
+    theHeader.lo[a] = range[0];
+    theHeader.hi[a] = range[1];
+    theHeader.nNodes[a] = nodes;
+  }
+
+  double tolerance = iConfig.getParameter<double>("SurfaceTolerance");
+  std::vector<double> radii =
+    iConfig.getParameter<std::vector<double> >("CylinderRadii");
+  std::vector<double> zs =
+    iConfig.getParameter<std::vector<double> >("PlaneZ");
+  for (unsigned int i = 0; i < radii.size(); i++) {
+    Table::Station st = {Table::kCylinder, float(radii[i]), float(tolerance), 0};
+    theStations.push_back(st);
+  }
+  for (unsigned int i = 0; i < zs.size(); i++) {
+    Table::Station st = {Table::kZPlane, float(zs[i]), float(tolerance), 0};
+    theStations.push_back(st);
+  }
+}
+
+void Geant4ePropagationTableWriter::analyze(const edm::Event& iEvent,
+					    const edm::EventSetup& iSetup) {
+  if (theDone)
+    return;
+  theDone = true;
+
+  edm::ESHandle<MagneticField> bField;
+  iSetup.get<IdealMagneticFieldRecord>().get(bField);
+
+  Geant4ePropagator propagator(&*bField, theParticleName.c_str(),
+			       alongMomentum);
+
+  std::vector<char> buffer;
+  Geant4ePropagationTableBuilder builder(theHeader, theStations);
+  builder.build(propagator, &*bField, theCheckAccuracy, buffer);
+
+  std::ofstream out(theOutputFile.c_str(), std::ios::binary);
+  out.write(&buffer[0], buffer.size());
+  if (!out)
+    throw cms::Exception("Geant4e") << "Could not write propagation table "
+				    << theOutputFile;
+
+  edm::LogInfo("Geant4e") << "G4e -  Wrote propagation table "
+			  << theOutputFile << " (" << buffer.size()
+			  << " bytes)";
+}
+
+//define this as a plug-in
+#include "FWCore/Framework/interface/MakerMacros.h"
+DEFINE_FWK_MODULE(Geant4ePropagationTableWriter);
@@ -39,7 +39,47 @@ GeantPropagatorESProducer::produce(const TrackingComponentsRecord & iRecord){
   if (pdir == "alongMomentum") dir = alongMomentum;
   if (pdir == "anyDirection") dir = anyDirection;
   
-  _propagator  = boost::shared_ptr<Propagator>(new Geant4ePropagator(&(*magfield),part,dir));
+  Geant4ePropagator* propagator = new Geant4ePropagator(&(*magfield),part,dir);
+  propagator->setFieldCellSize(pset_.getParameter<double>("FieldCellSize"));
+
+  std::string table = pset_.getParameter<std::string>("PropagationTable");
+  if (!table.empty())
+    propagator->setPropagationTable(table, 
+				    pset_.getParameter<double>("PropagationTableMaxResidual"));
+
+  propagator->setReducedGeometry(pset_.getParameter<double>("ReducedGeometryMinVolume"),
+				 pset_.getParameter<std::vector<std::string> >("ReducedGeometryKeep"));
+  propagator->setPhysicsTableCache(pset_.getParameter<std::string>("PhysicsTableCache"));
+  propagator->setPhysics(pset_.getParameter<std::string>("Physics"));
+
+  propagator->setProfileReport(pset_.getParameter<std::string>("ProfileReport"));
+  propagator->setFastErrorTransport(pset_.getParameter<bool>("FastErrorTransport"));
+  propagator->setBatchRegions(pset_.getParameter<std::vector<double> >("BatchRegionRadii"));
+  propagator->setFieldOnlyRegions(pset_.getParameter<std::vector<unsigned int> >("FieldOnlyRegions"));
+  propagator->setMixtureMaxSpread(pset_.getParameter<double>("MixtureMaxSpread"));
+  propagator->setBoundsCheckMargin(pset_.getParameter<double>("BoundsCheckMargin"));
+
+  Geant4ePropagator::SteppingParameters stepping;
+  stepping.deltaChord         = pset_.getParameter<double>("DeltaChord");
+  stepping.deltaOneStep       = pset_.getParameter<double>("DeltaOneStep");
+  stepping.deltaIntersection  = pset_.getParameter<double>("DeltaIntersection");
+  stepping.minStep            = pset_.getParameter<double>("MinStep");
+  stepping.minimumEpsilonStep = pset_.getParameter<double>("MinimumEpsilonStep");
+  stepping.maximumEpsilonStep = pset_.getParameter<double>("MaximumEpsilonStep");
+  propagator->setSteppingParameters(stepping);
+
+  Geant4eSteppingAction::Budget budget;
+  budget.maxSteps = pset_.getParameter<int>("MaxSteps");
+  budget.maxPath  = pset_.getParameter<double>("MaxPath");
+  budget.maxTime  = pset_.getParameter<double>("MaxTime");
+  budget.maxTurns = pset_.getParameter<double>("MaxTurns");
+  propagator->setBudget(budget);
+
+  std::string capture = pset_.getParameter<std::string>("CaptureFile");
+  if (!capture.empty())
+    propagator->setCaptureFile(capture);
+
+  _propagator  = boost::shared_ptr<Propagator>(propagator);
   return _propagator;
 }
 
@@ -0,0 +1,31 @@
+import FWCore.ParameterSet.Config as cms
+
+## Fills a table of Geant4e propagations from the vertex region to the
+## muon stations. Needs the Geant4 geometry (see geantRefit_cff) and a
+## single event from an EmptySource.
+Geant4ePropagationTableWriter = cms.EDAnalyzer("Geant4ePropagationTableWriter",
+                                               OutputFile = cms.string("Geant4ePropagationTable.bin"),
+                                               ParticleName = cms.string("mu"),
+                                               ## Check the interpolation at every cell centre. Unchecked
+                                               ## cells are only used with PropagationTableMaxResidual <= 0
+                                               CheckAccuracy = cms.bool(True),
+                                               ## Grid. Use an even number of q/pT nodes so that
+                                               ## q/pT = 0 is not a node. The default, with the 12
+                                               ## stations, takes about 1.6M node propagations and 150 MB
+                                               QOverPtRange = cms.vdouble(-0.25, 0.25),
+                                               QOverPtNodes = cms.int32(24),
+                                               EtaRange = cms.vdouble(-2.4, 2.4),
+                                               EtaNodes = cms.int32(49),
+                                               PhiRange = cms.vdouble(-3.14159265, 3.14159265),
+                                               PhiNodes = cms.int32(37),
+                                               VertexZRange = cms.vdouble(-15., 15.),
+                                               VertexZNodes = cms.int32(3),
+                                               ## Only start states closer than this to the beam line (cm)
+                                               MaxVertexRho = cms.double(0.5),
+                                               ## Reference surfaces: cylinders around the beam line for
+                                               ## the barrel stations and planes at fixed z for the endcaps
+                                               CylinderRadii = cms.vdouble(431., 512., 620., 711.),
+                                               PlaneZ = cms.vdouble(-1025., -935., -830., -615.,
+                                                                    615., 830., 935., 1025.),
+                                               SurfaceTolerance = cms.double(1.)
+                                               )
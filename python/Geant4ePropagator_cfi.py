@@ -3,5 +3,72 @@ import FWCore.ParameterSet.Config as cms
 Geant4ePropagator = cms.ESProducer("GeantPropagatorESProducer",
                                    ComponentName = cms.string("Geant4ePropagator"),
                                    PropagationDirection=cms.string("alongMomentum"),
-                                   ParticleName=cms.string("mu")
+                                   ParticleName=cms.string("mu"),
+                                   ## Side (cm) of the cells used to interpolate the field seen
+                                   ## by the Geant4 stepper. <= 0 evaluates the exact field
+                                   FieldCellSize=cms.double(0.),
+                                   ## Table of precomputed propagations written by
+                                   ## Geant4ePropagationTableWriter. Empty to always use Geant4e
+                                   PropagationTable=cms.string(""),
+                                   ## Cells with a residual above this value (cm), or not checked,
+                                   ## fall back to Geant4e. <= 0 uses every cell
+                                   PropagationTableMaxResidual=cms.double(0.1),
+                                   ## Log every propagation request to this file to replay it
+                                   ## later with Geant4ePropagationReplay. Empty to disable
+                                   CaptureFile=cms.string(""),
+                                   ## Directory caching the Geant4 physics tables between jobs.
+                                   ## Empty to build them in every job
+                                   PhysicsTableCache=cms.string(""),
+                                   ## Physics of the propagation: "Geant4e", "Tabulated" to
+                                   ## interpolate the energy loss and the noise in tables built
+                                   ## per material at the start of the job, or "MuonMinimal" to
+                                   ## give the Geant4e processes to the muons only. MuonMinimal
+                                   ## saves initialisation time and table size, not time per step
+                                   Physics=cms.string("Geant4e"),
+                                   ## Daughter volumes below this size (cm3) are merged into the
+                                   ## material of their mother for the propagation. <= 0 uses
+                                   ## the full geometry
+                                   ReducedGeometryMinVolume=cms.double(0.),
+                                   ## Prefixes of the logical volumes kept exact in the reduced
+                                   ## geometry (volumes with sensitive detectors are always kept)
+                                   ReducedGeometryKeep=cms.vstring("MB", "ME", "RPC"),
+                                   ## File receiving the steps, path and time spent per logical
+                                   ## volume and region at the end of the job. Empty to disable
+                                   ProfileReport=cms.string(""),
+                                   ## Transport the errors of forward propagations with fixed size
+                                   ## matrices instead of the Geant4e transport
+                                   FastErrorTransport=cms.bool(False),
+                                   ## Radii (cm) of the region boundaries where the tracks of a
+                                   ## batch wait for each other. Empty to propagate them one by one
+                                   BatchRegionRadii=cms.vdouble(),
+                                   ## Indices of the batch regions without material (0 is inside the
+                                   ## first boundary). Their legs are transported through the field
+                                   ## only, several tracks at a time, instead of through Geant4e
+                                   FieldOnlyRegions=cms.vuint32(),
+                                   ## Components of a mixture whose momentum differs by less than
+                                   ## this fraction from the mean follow the propagation of the
+                                   ## mean by linear transport
+                                   MixtureMaxSpread=cms.double(0.1),
+                                   ## Propagations to planes that both a helix and a straight line from
+                                   ## the start state miss by more than this margin (cm) outside their
+                                   ## bounds are rejected without calling Geant4e. <= 0 disables the check
+                                   BoundsCheckMargin=cms.double(0.),
+                                   ## Accuracy of the propagation in the field, as the G4ClassicalRK4
+                                   ## settings of geantRefit_cff.py (mm, epsilons without units).
+                                   ## <= 0 keeps the Geant4e value. Geant4eSteppingTuner in test/
+                                   ## finds the fastest values within a residual budget
+                                   DeltaChord=cms.double(0.),
+                                   DeltaOneStep=cms.double(0.),
+                                   DeltaIntersection=cms.double(0.),
+                                   MinStep=cms.double(0.),
+                                   MinimumEpsilonStep=cms.double(0.),
+                                   MaximumEpsilonStep=cms.double(0.),
+                                   ## Budget of every propagation: maximum number of steps, path
+                                   ## (cm), wall time (s) and turns of the track in the transverse
+                                   ## plane. Propagations over the budget return an invalid state.
+                                   ## <= 0 disables each limit
+                                   MaxSteps=cms.int32(0),
+                                   MaxPath=cms.double(0.),
+                                   MaxTime=cms.double(0.),
+                                   MaxTurns=cms.double(0.)
                                    )
@@ -4,6 +4,9 @@ import FWCore.ParameterSet.Config as cms
 from TrackPropagation.Geant4e.Geant4ePropagator_cfi import *
 
 ## Set up geometry
+## Note that the propagator installs its own adapter of the CMS magnetic
+## field in the global field manager (see FieldCellSize in the propagator),
+## which replaces the CMSIMField below for the Geant4e propagation
 geopro = cms.EDProducer("GeometryProducer",
      UseMagneticField = cms.bool(True),
      UseSensitiveDetectors = cms.bool(False),
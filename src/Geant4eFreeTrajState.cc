@@ -0,0 +1,146 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eFreeTrajState.h"
+#include "TrackPropagation/Geant4e/interface/ConvertFromToCLHEP.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMaterialTables.h"
+
+//CMSSW
+#include "TrackingTools/AnalyticalJacobians/interface/AnalyticalCurvilinearJacobian.h"
+
+//Geant4
+#include "G4Track.hh"
+#include "G4Step.hh"
+#include "G4StepPoint.hh"
+#include "G4Material.hh"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+#include "CLHEP/Units/PhysicalConstants.h"
+
+#include <algorithm>
+#include <cmath>
+
+Geant4eFreeTrajState::Geant4eFreeTrajState(const G4String& particleName,
+					   const G4Point3D& pos,
+					   const G4Vector3D& mom,
+					   const G4ErrorTrajErr& err):
+  G4ErrorFreeTrajState(particleName, pos, mom, err),
+  theFastErrorTransport(false),
+  theCharge(0),
+  theField(0),
+  theTables(0),
+  theAccumulateJacobian(false) {
+}
+
+void Geant4eFreeTrajState::setFastErrorTransport(const AlgebraicSymMatrix55& cov,
+						 int charge,
+						 const MagneticField* field,
+						 const Geant4eMaterialTables* tables) {
+  theFastErrorTransport = true;
+  theError = cov;
+  theCharge = charge;
+  theField = field;
+  theTables = tables;
+}
+
+void Geant4eFreeTrajState::accumulateJacobian(int charge) {
+  theAccumulateJacobian = true;
+  theCharge = charge;
+  theJacobian = AlgebraicMatrixID();
+}
+
+G4int Geant4eFreeTrajState::PropagateError(const G4Track* aTrack) {
+  if (!theFastErrorTransport) {
+    G4int ierr = G4ErrorFreeTrajState::PropagateError(aTrack);
+    if (theAccumulateJacobian) {
+      //Geant4e transfer matrix of the step, from 1/p to q/p
+      const G4ErrorMatrix& transf = GetTransfMat();
+      AlgebraicMatrix55 jac;
+      for (unsigned int i = 0; i < 5; i++)
+	for (unsigned int j = 0; j < 5; j++)
+	  jac(i, j) = transf[i][j];
+      for (unsigned int i = 1; i < 5; i++) {
+	jac(0, i) *= theCharge;
+	jac(i, 0) *= theCharge;
+      }
+      theJacobian = jac*theJacobian;
+    }
+    return ierr;
+  }
+
+  const G4Step* step = aTrack->GetStep();
+  const G4StepPoint* pre = step->GetPreStepPoint();
+  const G4StepPoint* post = step->GetPostStepPoint();
+  double length = step->GetStepLength()*TrackPropagation::g4ToCm;
+  if (length <= 0)
+    return 0;
+
+  GlobalPoint  xPre  = TrackPropagation::hep3VectorToGlobalPoint(pre->GetPosition());
+  GlobalVector pPre  = TrackPropagation::hep3VectorToGlobalMomentum(pre->GetMomentum());
+  GlobalPoint  xPost = TrackPropagation::hep3VectorToGlobalPoint(post->GetPosition());
+  GlobalVector pPost = TrackPropagation::hep3VectorToGlobalMomentum(post->GetMomentum());
+  double pIn = pPre.mag();
+  double p = pPost.mag();
+  if (p <= 0)
+    return 0;
+
+  //Helix of the start of the step. The energy loss only changes q/p:
+  //d(1/p_out)/d(1/p_in) = (p_in/p_out)^2 for a loss independent of p
+  AnalyticalCurvilinearJacobian jacobian(GlobalTrajectoryParameters(xPre, pPre, 
+								    theCharge, theField),
+					 xPost, pPost.unit()*pIn, length);
+  AlgebraicMatrix55 jac = jacobian.jacobian();
+  double lossScale = (pIn/p)*(pIn/p);
+  for (unsigned int j = 0; j < 5; j++)
+    jac(0, j) *= lossScale;
+  theError = ROOT::Math::Similarity(jac, theError);
+  if (theAccumulateJacobian)
+    theJacobian = jac*theJacobian;
+
+  //Noise of the step, with the momentum at its end: variances of the
+  //multiple scattering angle and of the energy loss
+  const G4Material* material = pre->GetMaterial();
+  double t = step->GetStepLength()/material->GetRadlen();
+  double theta2 = 0;
+  double sigmaE2 = 0;
+  double mass = aTrack->GetDefinition()->GetPDGMass()*TrackPropagation::g4ToGeV;
+  double energy = std::sqrt(p*p + mass*mass);
+  int species = theTables ? theTables->species(aTrack->GetDefinition()) : -1;
+  if (species >= 0) {
+    Geant4eMaterialTables::Values v = 
+      theTables->values(species, material, p*TrackPropagation::GeVToG4);
+    double highland = t > 0 ? 1 + 0.038*std::log(t) : 0;
+    theta2 = v.theta2*step->GetStepLength()*highland*highland;
+    sigmaE2 = v.sigma2*step->GetStepLength()
+      *TrackPropagation::g4ToGeV*TrackPropagation::g4ToGeV;
+  } else {
+    double beta = p/energy;
+    if (t > 0) {
+      double theta0 = 0.0136/(beta*p)*std::sqrt(t)*(1 + 0.038*std::log(t));
+      theta2 = theta0*theta0;
+    }
+
+    //Gaussian variance xi*Tmax*(1 - beta^2/2) as in Geant4e
+    double me = CLHEP::electron_mass_c2*TrackPropagation::g4ToGeV;
+    double gamma = energy/mass;
+    double tMax = 2*me*beta*beta*gamma*gamma/
+      (1 + 2*gamma*me/mass + (me/mass)*(me/mass));
+    double xi = 2*M_PI*CLHEP::classic_electr_radius*CLHEP::classic_electr_radius
+      *CLHEP::electron_mass_c2*material->GetElectronDensity()
+      *step->GetStepLength()/(beta*beta)*TrackPropagation::g4ToGeV;
+    sigmaE2 = xi*tMax*(1 - 0.5*beta*beta);
+  }
+
+  //Multiple scattering: angles and their correlations with the positions
+  double cosl = std::max(double(pPost.perp())/p, 1e-6);
+  theError(1, 1) += theta2;
+  theError(2, 2) += theta2/(cosl*cosl);
+  theError(3, 3) += length*length*theta2/3;
+  theError(4, 4) += length*length*theta2/3;
+  theError(2, 3) += length*theta2/(2*cosl);
+  theError(1, 4) += length*theta2/2;
+
+  //Energy loss fluctuations converted to q/p
+  double p3 = p*p*p;
+  theError(0, 0) += energy*energy/(p3*p3)*sigmaE2;
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eMagneticField.h"
+
+//CMSSW
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "MagneticField/VolumeBasedEngine/interface/VolumeBasedMagneticField.h"
+#include "MagneticField/VolumeGeometry/interface/MagVolume.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+
+#include <cmath>
+#include <climits>
+
+Geant4eMagneticField::Geant4eMagneticField(const MagneticField* field,
+					   double cellSize):
+  theField(field),
+  theVolumeField(dynamic_cast<const VolumeBasedMagneticField*>(field)),
+  theCellSize(cellSize),
+  theInvCellSize(cellSize > 0 ? 1./cellSize : 0.),
+  theLastVolume(0),
+  theCellValid(false),
+  theNEvaluations(0),
+  theNCellHits(0),
+  theNVolumeHits(0),
+  theNVolumeSearches(0) {
+
+  theCellIndex[0] = theCellIndex[1] = theCellIndex[2] = LONG_MIN;
+
+  //The interpolation cells rely on the volume boundaries to avoid
+  //smearing discontinuities. Without them evaluate directly.
+  if (!theVolumeField && theCellSize > 0) {
+    LogDebug("Geant4e") << "G4e -  Field is not volume based. "
+			<< "Disabling the interpolation cache";
+    theCellSize = 0;
+    theInvCellSize = 0;
+  }
+}
+
+Geant4eMagneticField::~Geant4eMagneticField() {
+  if (theNEvaluations == 0)
+    return;
+
+  double evals = theNEvaluations;
+  edm::LogInfo log("Geant4e");
+  log << "G4e -  Field adapter statistics: " << theNEvaluations << " evaluations, ";
+  if (cellCache())
+    log << "cell cache hit rate " << theNCellHits/evals << ", ";
+  log << "volume cache hits " << theNVolumeHits
+      << ", volume searches " << theNVolumeSearches;
+}
+
+void Geant4eMagneticField::GetFieldValue(const double point[4],
+					 double* bfield) const {
+  ++theNEvaluations;
+
+  //Geant4 uses mm while CMS uses cm
+  double x = point[0]/cm;
+  double y = point[1]/cm;
+  double z = point[2]/cm;
+
+  double b[3];
+
+  if (theCellSize > 0) {
+    double fx = x*theInvCellSize;
+    double fy = y*theInvCellSize;
+    double fz = z*theInvCellSize;
+    long ix = static_cast<long>(std::floor(fx));
+    long iy = static_cast<long>(std::floor(fy));
+    long iz = static_cast<long>(std::floor(fz));
+
+    if (ix != theCellIndex[0] || iy != theCellIndex[1] || iz != theCellIndex[2]) {
+      theCellIndex[0] = ix;
+      theCellIndex[1] = iy;
+      theCellIndex[2] = iz;
+      theCellValid = fillCell(ix*theCellSize, iy*theCellSize, iz*theCellSize);
+    } else if (theCellValid) {
+      ++theNCellHits;
+    }
+
+    if (theCellValid) {
+      //Trilinear interpolation. Corner c has bits (x,y,z) = (c&1, c&2, c&4)
+      double u = fx - ix;
+      double v = fy - iy;
+      double w = fz - iz;
+      double wx[2] = {1.-u, u};
+      double wy[2] = {1.-v, v};
+      double wz[2] = {1.-w, w};
+      b[0] = b[1] = b[2] = 0;
+      for (unsigned int c = 0; c < 8; c++) {
+	double wc = wx[c&1]*wy[(c>>1)&1]*wz[(c>>2)&1];
+	b[0] += wc*theCellField[c][0];
+	b[1] += wc*theCellField[c][1];
+	b[2] += wc*theCellField[c][2];
+      }
+      bfield[0] = b[0]*tesla;
+      bfield[1] = b[1]*tesla;
+      bfield[2] = b[2]*tesla;
+      return;
+    }
+  }
+
+  fieldInTesla(x, y, z, b);
+  bfield[0] = b[0]*tesla;
+  bfield[1] = b[1]*tesla;
+  bfield[2] = b[2]*tesla;
+}
+
+void Geant4eMagneticField::fieldInTesla(double x, double y, double z,
+					double* b) const {
+  GlobalPoint gp(x, y, z);
+  GlobalVector field;
+
+  const MagVolume* vol = theVolumeField ? findVolume(x, y, z) : 0;
+  if (vol)
+    field = vol->fieldInTesla(gp);
+  else
+    field = theField->inTesla(gp);
+
+  b[0] = field.x();
+  b[1] = field.y();
+  b[2] = field.z();
+}
+
+const MagVolume* Geant4eMagneticField::findVolume(double x, double y,
+						   double z) const {
+  GlobalPoint gp(x, y, z);
+  if (theLastVolume && theLastVolume->inside(gp)) {
+    ++theNVolumeHits;
+    return theLastVolume;
+  }
+
+  ++theNVolumeSearches;
+  const MagVolume* vol = theVolumeField->findVolume(gp);
+  if (vol)
+    theLastVolume = vol;
+  return vol;
+}
+
+bool Geant4eMagneticField::fillCell(double x, double y, double z) const {
+  //All the corners have to be in the volume of the lower corner
+  const MagVolume* vol = findVolume(x, y, z);
+  if (!vol)
+    return false;
+
+  for (unsigned int c = 0; c < 8; c++) {
+    GlobalPoint corner(x + ((c&1) ? theCellSize : 0.),
+		       y + (((c>>1)&1) ? theCellSize : 0.),
+		       z + (((c>>2)&1) ? theCellSize : 0.));
+    if (!vol->inside(corner))
+      return false;
+    GlobalVector field = vol->fieldInTesla(corner);
+    theCellField[c][0] = field.x();
+    theCellField[c][1] = field.y();
+    theCellField[c][2] = field.z();
+  }
+
+  return true;
+}
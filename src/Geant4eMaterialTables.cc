@@ -0,0 +1,119 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eMaterialTables.h"
+
+//CMSSW
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+//Geant4
+#include "G4EnergyLossForExtrapolator.hh"
+#include "G4ParticleTable.hh"
+#include "G4ParticleDefinition.hh"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+#include "CLHEP/Units/PhysicalConstants.h"
+
+namespace {
+  //Direct computation of the values of one bin
+  Geant4eMaterialTables::Values compute(G4EnergyLossForExtrapolator& extrapolator,
+					const G4ParticleDefinition* particle,
+					const G4Material* material, double p) {
+    Geant4eMaterialTables::Values v;
+    double mass = particle->GetPDGMass();
+    double energy = std::sqrt(p*p + mass*mass);
+    double kinEnergy = energy - mass;
+    double beta = p/energy;
+    double gamma = energy/mass;
+
+    //Mean loss over a short step, as Geant4e computes it
+    const double step = 1*mm;
+    v.dedx = (kinEnergy - extrapolator.EnergyAfterStep(kinEnergy, step, material, 
+						       particle))/step;
+
+    double me = CLHEP::electron_mass_c2;
+    double tMax = 2*me*beta*beta*gamma*gamma/
+      (1 + 2*gamma*me/mass + (me/mass)*(me/mass));
+    double xi = 2*M_PI*CLHEP::classic_electr_radius*CLHEP::classic_electr_radius
+      *me*material->GetElectronDensity()/(beta*beta);
+    v.sigma2 = xi*tMax*(1 - 0.5*beta*beta);
+
+    double theta = 13.6*MeV/(beta*p);
+    v.theta2 = theta*theta/material->GetRadlen();
+    return v;
+  }
+}
+
+Geant4eMaterialTables::Geant4eMaterialTables(const std::vector<std::string>& species,
+					     double pMin, double pMax,
+					     unsigned int nBins):
+  theSpecies(species),
+  theLogPMin(std::log(pMin)),
+  theInvStep((nBins - 1)/(std::log(pMax) - std::log(pMin))),
+  theMaxX(nBins - 1.000001),
+  theNBins(nBins),
+  theNMaterials(0) {
+  if (nBins < 2 || pMax <= pMin)
+    throw cms::Exception("Geant4e") << "Bad range of the material tables: " 
+				    << nBins << " bins from " << pMin 
+				    << " to " << pMax << " MeV";
+}
+
+void Geant4eMaterialTables::build() {
+  if (built())
+    return;
+
+  G4ParticleTable* particleTable = G4ParticleTable::GetParticleTable();
+  std::vector<const G4ParticleDefinition*> definitions;
+  for (unsigned int s = 0; s < theSpecies.size(); s++) {
+    const G4ParticleDefinition* minus = particleTable->FindParticle(theSpecies[s] + "-");
+    const G4ParticleDefinition* plus = particleTable->FindParticle(theSpecies[s] + "+");
+    if (!minus && !plus)
+      throw cms::Exception("Geant4e") << "No particle '" << theSpecies[s] 
+				      << "' for the material tables";
+    if (minus) {
+      theParticles.push_back(minus);
+      theParticleSpecies.push_back(s);
+    }
+    if (plus) {
+      theParticles.push_back(plus);
+      theParticleSpecies.push_back(s);
+    }
+    definitions.push_back(minus ? minus : plus);
+  }
+
+  const G4MaterialTable* materials = G4Material::GetMaterialTable();
+  theNMaterials = materials->size();
+  theValues.resize(theSpecies.size()*theNMaterials*theNBins);
+
+  G4EnergyLossForExtrapolator extrapolator(0);
+  double maxDeviation = 0;
+  std::string worst;
+  for (unsigned int s = 0; s < theSpecies.size(); s++) {
+    for (size_t m = 0; m < theNMaterials; m++) {
+      const G4Material* material = (*materials)[m];
+      Values* v = &theValues[(s*theNMaterials + m)*theNBins];
+      for (unsigned int i = 0; i < theNBins; i++)
+	v[i] = compute(extrapolator, definitions[s], material,
+		       std::exp(theLogPMin + i/theInvStep));
+
+      //Accuracy of the interpolation in the middle of the bins
+      for (unsigned int i = 0; i + 1 < theNBins; i++) {
+	double p = std::exp(theLogPMin + (i + 0.5)/theInvStep);
+	Values direct = compute(extrapolator, definitions[s], material, p);
+	if (direct.dedx <= 0)
+	  continue;
+	double deviation = std::abs(values(s, material, p).dedx/direct.dedx - 1);
+	if (deviation > maxDeviation) {
+	  maxDeviation = deviation;
+	  worst = theSpecies[s] + " in " + material->GetName();
+	}
+      }
+    }
+  }
+
+  edm::LogInfo("Geant4e") << "G4e -  Built the material tables of " 
+			  << theSpecies.size() << " species and " 
+			  << theNMaterials << " materials. Largest deviation of "
+			  << "the interpolated dE/dx from Geant4e: " 
+			  << maxDeviation << " (" << worst << ")";
+}
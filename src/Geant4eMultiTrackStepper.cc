@@ -0,0 +1,198 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eMultiTrackStepper.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationBatch.h"
+#include "TrackPropagation/Geant4e/interface/ConvertFromToCLHEP.h"
+
+//CMSSW
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "TrackingTools/AnalyticalJacobians/interface/AnalyticalCurvilinearJacobian.h"
+#include "TrackingTools/TrajectoryParametrization/interface/GlobalTrajectoryParameters.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  //Curvature per unit of q/p (GeV) and field (T), in 1/cm
+  const double kappaUnit = 2.99792458e-3;
+
+  //Stage of the equation of motion: dx/ds = t, dt/ds = kappa t^B
+  void derivatives(const double t[3][Geant4eMultiTrackStepper::kLanes],
+		   const double b[3][Geant4eMultiTrackStepper::kLanes],
+		   const double* kappa,
+		   double dt[3][Geant4eMultiTrackStepper::kLanes]) {
+    for (unsigned int l = 0; l < Geant4eMultiTrackStepper::kLanes; l++) {
+      dt[0][l] = kappa[l]*(t[1][l]*b[2][l] - t[2][l]*b[1][l]);
+      dt[1][l] = kappa[l]*(t[2][l]*b[0][l] - t[0][l]*b[2][l]);
+      dt[2][l] = kappa[l]*(t[0][l]*b[1][l] - t[1][l]*b[0][l]);
+    }
+  }
+
+  //y = y0 + h*dy for the positions or directions of all the lanes
+  void advance(const double y0[3][Geant4eMultiTrackStepper::kLanes],
+	       const double dy[3][Geant4eMultiTrackStepper::kLanes],
+	       const double* h, double y[3][Geant4eMultiTrackStepper::kLanes]) {
+    for (unsigned int c = 0; c < 3; c++)
+      for (unsigned int l = 0; l < Geant4eMultiTrackStepper::kLanes; l++)
+	y[c][l] = y0[c][l] + h[l]*dy[c][l];
+  }
+}
+
+Geant4eMultiTrackStepper::Geant4eMultiTrackStepper(const MagneticField* field,
+						   double maxStep, 
+						   double tolerance):
+  theField(field),
+  theMaxStep(maxStep),
+  theTolerance(tolerance) {
+}
+
+void Geant4eMultiTrackStepper::fieldAt(const double x[3][kLanes], 
+				       double b[3][kLanes]) const {
+  for (unsigned int l = 0; l < kLanes; l++) {
+    GlobalVector field = theField->inTesla(GlobalPoint(x[0][l], x[1][l], x[2][l]));
+    b[0][l] = field.x();
+    b[1][l] = field.y();
+    b[2][l] = field.z();
+  }
+}
+
+/** Classical fourth order Runge-Kutta. The step of a lane is the straight
+ *  line distance to the cylinder when the cylinder is ahead of the lane,
+ *  capped at the largest step, so that the last steps converge on the
+ *  crossing as Newton iterations. Otherwise, as for a lane that moves
+ *  inwards inside the cylinder, the lane takes the largest step forwards.
+ *  A step only goes backwards to correct an overshoot, once the lane has
+ *  crossed the cylinder. A lane without a forward crossing runs out of
+ *  path and is not reached.
+ */
+void Geant4eMultiTrackStepper::propagateToRadius(Geant4ePropagationBatch& batch,
+						 const std::vector<unsigned int>& indices,
+						 double radius, std::vector<double>& path,
+						 std::vector<char>& reached) const {
+  path.assign(indices.size(), 0.);
+  reached.assign(indices.size(), 0);
+  const double maxPath = 4*M_PI*radius + 10*theMaxStep;
+
+  for (unsigned int first = 0; first < indices.size(); first += kLanes) {
+    double x[3][kLanes], t[3][kLanes], kappa[kLanes], p[kLanes];
+    double s[kLanes], h[kLanes], side[kLanes];
+    bool active[kLanes], crossed[kLanes];
+    for (unsigned int l = 0; l < kLanes; l++) {
+      //Lanes past the end of the list repeat the first request, inactive
+      const bool used = first + l < indices.size();
+      const unsigned int i = indices[used ? first + l : first];
+      p[l] = std::sqrt(batch.px[i]*batch.px[i] + batch.py[i]*batch.py[i] + 
+		       batch.pz[i]*batch.pz[i]);
+      x[0][l] = batch.x[i];  x[1][l] = batch.y[i];  x[2][l] = batch.z[i];
+      t[0][l] = batch.px[i]/p[l];  t[1][l] = batch.py[i]/p[l];  t[2][l] = batch.pz[i]/p[l];
+      kappa[l] = kappaUnit*batch.charge[i]/p[l];
+      s[l] = 0;
+      side[l] = 0;
+      active[l] = used;
+      crossed[l] = false;
+    }
+
+    double x2[3][kLanes], t2[3][kLanes], b[3][kLanes];
+    double k1x[3][kLanes], k1t[3][kLanes], k2x[3][kLanes], k2t[3][kLanes];
+    double k3x[3][kLanes], k3t[3][kLanes], k4x[3][kLanes], k4t[3][kLanes];
+    double halfH[kLanes];
+    unsigned int nActive = 0;
+    for (unsigned int l = 0; l < kLanes; l++)
+      nActive += active[l];
+
+    while (nActive > 0) {
+      //Step of every lane, 0 for the lanes that are done
+      for (unsigned int l = 0; l < kLanes; l++) {
+	const double r = std::hypot(x[0][l], x[1][l]);
+	const double tr = r > 0 ? (x[0][l]*t[0][l] + x[1][l]*t[1][l])/r : 
+	  std::hypot(t[0][l], t[1][l]);
+	const double distance = radius - r;
+	if (distance*side[l] < 0)
+	  crossed[l] = true;
+	side[l] = distance;
+	double step = theMaxStep;
+	if (std::abs(distance) < theTolerance) {
+	  step = 0;
+	  if (active[l]) {
+	    reached[first + l] = 1;
+	    active[l] = false;
+	    nActive--;
+	  }
+	} else if (std::abs(tr) > 1e-3 && (crossed[l] || distance/tr > 0)) {
+	  //Newton step, backwards only after the lane has crossed the cylinder
+	  step = std::max(-theMaxStep, std::min(theMaxStep, distance/tr));
+	}
+	if (active[l] && std::abs(s[l]) > maxPath) {
+	  active[l] = false;
+	  nActive--;
+	}
+	h[l] = active[l] ? step : 0;
+	halfH[l] = 0.5*h[l];
+      }
+      if (nActive == 0)
+	break;
+
+      for (unsigned int c = 0; c < 3; c++)
+	for (unsigned int l = 0; l < kLanes; l++)
+	  k1x[c][l] = t[c][l];
+      fieldAt(x, b);
+      derivatives(t, b, kappa, k1t);
+
+      advance(x, k1x, halfH, x2);
+      advance(t, k1t, halfH, t2);
+      for (unsigned int c = 0; c < 3; c++)
+	for (unsigned int l = 0; l < kLanes; l++)
+	  k2x[c][l] = t2[c][l];
+      fieldAt(x2, b);
+      derivatives(t2, b, kappa, k2t);
+
+      advance(x, k2x, halfH, x2);
+      advance(t, k2t, halfH, t2);
+      for (unsigned int c = 0; c < 3; c++)
+	for (unsigned int l = 0; l < kLanes; l++)
+	  k3x[c][l] = t2[c][l];
+      fieldAt(x2, b);
+      derivatives(t2, b, kappa, k3t);
+
+      advance(x, k3x, h, x2);
+      advance(t, k3t, h, t2);
+      for (unsigned int c = 0; c < 3; c++)
+	for (unsigned int l = 0; l < kLanes; l++)
+	  k4x[c][l] = t2[c][l];
+      fieldAt(x2, b);
+      derivatives(t2, b, kappa, k4t);
+
+      for (unsigned int c = 0; c < 3; c++)
+	for (unsigned int l = 0; l < kLanes; l++) {
+	  x[c][l] += h[l]/6*(k1x[c][l] + 2*k2x[c][l] + 2*k3x[c][l] + k4x[c][l]);
+	  t[c][l] += h[l]/6*(k1t[c][l] + 2*k2t[c][l] + 2*k3t[c][l] + k4t[c][l]);
+	}
+      for (unsigned int l = 0; l < kLanes; l++) {
+	const double norm = 1/std::sqrt(t[0][l]*t[0][l] + t[1][l]*t[1][l] + 
+					t[2][l]*t[2][l]);
+	t[0][l] *= norm;  t[1][l] *= norm;  t[2][l] *= norm;
+	s[l] += h[l];
+      }
+    }
+
+    //Results, with the error transported along the path
+    for (unsigned int l = 0; l < kLanes && first + l < indices.size(); l++) {
+      path[first + l] = s[l];
+      if (!reached[first + l])
+	continue;
+      const unsigned int i = indices[first + l];
+      GlobalTrajectoryParameters start(GlobalPoint(batch.x[i], batch.y[i], batch.z[i]),
+				       GlobalVector(batch.px[i], batch.py[i], batch.pz[i]),
+				       batch.charge[i], theField);
+      GlobalPoint posEnd(x[0][l], x[1][l], x[2][l]);
+      GlobalVector momEnd(p[l]*t[0][l], p[l]*t[1][l], p[l]*t[2][l]);
+      if (batch.hasError[i]) {
+	AlgebraicSymMatrix55 cov;
+	TrackPropagation::packedToAlgebraicSymMatrix55(&batch.covariance[15*i], cov);
+	AnalyticalCurvilinearJacobian jacobian(start, posEnd, momEnd, s[l]);
+	cov = ROOT::Math::Similarity(jacobian.jacobian(), cov);
+	TrackPropagation::algebraicSymMatrix55ToPacked(cov, &batch.covariance[15*i]);
+      }
+      batch.x[i] = posEnd.x();   batch.y[i] = posEnd.y();   batch.z[i] = posEnd.z();
+      batch.px[i] = momEnd.x();  batch.py[i] = momEnd.y();  batch.pz[i] = momEnd.z();
+    }
+  }
+}
@@ -0,0 +1,65 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eMuonPhysicsList.h"
+
+//Geant4
+#include "G4ErrorEnergyLoss.hh"
+#include "G4ErrorStepLengthLimitProcess.hh"
+#include "G4ErrorMagFieldLimitProcess.hh"
+#include "G4ErrorMessenger.hh"
+#include "G4ProcessManager.hh"
+#include "G4Gamma.hh"
+#include "G4Electron.hh"
+#include "G4Positron.hh"
+#include "G4MuonPlus.hh"
+#include "G4MuonMinus.hh"
+#include "G4PionPlus.hh"
+#include "G4PionMinus.hh"
+#include "G4KaonPlus.hh"
+#include "G4KaonMinus.hh"
+#include "G4Proton.hh"
+#include "G4AntiProton.hh"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+
+void Geant4eMuonPhysicsList::ConstructParticle() {
+  G4MuonPlus::MuonPlusDefinition();
+  G4MuonMinus::MuonMinusDefinition();
+
+  //Used by G4EnergyLossForExtrapolator
+  G4Gamma::GammaDefinition();
+  G4Electron::ElectronDefinition();
+  G4Positron::PositronDefinition();
+  G4PionPlus::PionPlusDefinition();
+  G4PionMinus::PionMinusDefinition();
+  G4KaonPlus::KaonPlusDefinition();
+  G4KaonMinus::KaonMinusDefinition();
+  G4Proton::ProtonDefinition();
+  G4AntiProton::AntiProtonDefinition();
+}
+
+void Geant4eMuonPhysicsList::ConstructProcess() {
+  AddTransportation();
+
+  G4ErrorEnergyLoss* energyLoss = new G4ErrorEnergyLoss;
+  G4ErrorStepLengthLimitProcess* stepLengthLimit = new G4ErrorStepLengthLimitProcess;
+  G4ErrorMagFieldLimitProcess* magFieldLimit = new G4ErrorMagFieldLimitProcess;
+
+  G4ParticleDefinition* muons[2] = {G4MuonPlus::MuonPlus(), G4MuonMinus::MuonMinus()};
+  for (unsigned int i = 0; i < 2; i++) {
+    G4ProcessManager* manager = muons[i]->GetProcessManager();
+    manager->AddContinuousProcess(energyLoss, 1);
+    manager->AddDiscreteProcess(stepLengthLimit, 2);
+    manager->AddDiscreteProcess(magFieldLimit, 3);
+  }
+
+  //UI commands of the step limits, as in G4ErrorPhysicsList
+  new G4ErrorMessenger(stepLengthLimit, magFieldLimit, energyLoss);
+}
+
+void Geant4eMuonPhysicsList::SetCuts() {
+  const double cut = 1*km;
+  SetCutValue(cut, "gamma");
+  SetCutValue(cut, "e-");
+  SetCutValue(cut, "e+");
+  SetCutValue(cut, "proton");
+}
@@ -0,0 +1,137 @@
+#include "TrackPropagation/Geant4e/interface/Geant4ePhysicsTableCache.h"
+
+//CMSSW
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+//Geant4
+#include "G4VUserPhysicsList.hh"
+#include "G4PhysicalVolumeStore.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolume.hh"
+#include "G4VSolid.hh"
+#include "G4Material.hh"
+#include "G4Element.hh"
+#include "G4Version.hh"
+
+//Boost
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <typeinfo>
+#include <unistd.h>
+
+namespace {
+  //Bump when the layout of the cache entries changes
+  const unsigned int kCacheVersion = 1;
+
+  const char* kCompleteMarker = "complete";
+
+  //FNV-1a, 64 bits
+  unsigned long long hash(const std::string& s) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (std::string::const_iterator c = s.begin(); c != s.end(); ++c) {
+      h ^= static_cast<unsigned char>(*c);
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+}
+
+Geant4ePhysicsTableCache::Geant4ePhysicsTableCache(const std::string& directory,
+						   const std::string& particleName):
+  theDirectory(directory),
+  theParticleName(particleName),
+  theRetrieved(false) {
+}
+
+std::string
+Geant4ePhysicsTableCache::computeKey(const G4VUserPhysicsList* physicsList) const {
+  std::ostringstream os;
+  os << std::setprecision(17);
+
+  //Versions and physics configuration
+  os << kCacheVersion << ' ' << G4VERSION_NUMBER << ' '
+     << typeid(*physicsList).name() << ' '
+     << physicsList->GetDefaultCutValue() << ' '
+     << theParticleName << '\n';
+
+  //Geometry
+  const G4PhysicalVolumeStore* volumes = G4PhysicalVolumeStore::GetInstance();
+  for (G4PhysicalVolumeStore::const_iterator it = volumes->begin();
+       it != volumes->end(); ++it) {
+    const G4VPhysicalVolume* pv = *it;
+    const G4LogicalVolume* lv = pv->GetLogicalVolume();
+    os << pv->GetName() << ' ' << pv->GetCopyNo() << ' '
+       << pv->GetTranslation() << ' ';
+    if (pv->GetRotation())
+      os << *pv->GetRotation() << ' ';
+    os << lv->GetName() << ' ' << lv->GetMaterial()->GetName() << ' ';
+    lv->GetSolid()->StreamInfo(os);
+  }
+
+  //Materials
+  const G4MaterialTable* materials = G4Material::GetMaterialTable();
+  for (G4MaterialTable::const_iterator it = materials->begin();
+       it != materials->end(); ++it) {
+    const G4Material* mat = *it;
+    os << mat->GetName() << ' ' << mat->GetDensity() << ' '
+       << mat->GetState() << ' ' << mat->GetTemperature() << ' '
+       << mat->GetPressure();
+    const G4double* fractions = mat->GetFractionVector();
+    for (size_t i = 0; i < mat->GetNumberOfElements(); i++)
+      os << ' ' << mat->GetElement(i)->GetName() << ' ' << fractions[i];
+    os << '\n';
+  }
+
+  std::ostringstream key;
+  key << "v" << kCacheVersion << "-g4" << G4VERSION_NUMBER << "-"
+      << std::hex << std::setw(16) << std::setfill('0') << hash(os.str());
+  return key.str();
+}
+
+void Geant4ePhysicsTableCache::prepare(G4VUserPhysicsList* physicsList) {
+  theKey = computeKey(physicsList);
+  theEntry = (boost::filesystem::path(theDirectory) / theKey).string();
+
+  theRetrieved =
+    boost::filesystem::exists(boost::filesystem::path(theEntry) / kCompleteMarker);
+  if (theRetrieved) {
+    physicsList->SetPhysicsTableRetrieved(theEntry);
+    LogDebug("Geant4e") << "G4e -  Retrieving physics tables from " << theEntry;
+  } else {
+    LogDebug("Geant4e") << "G4e -  No physics tables in cache for key " << theKey;
+  }
+}
+
+void Geant4ePhysicsTableCache::store(G4VUserPhysicsList* physicsList) {
+  if (theRetrieved || theEntry.empty())
+    return;
+
+  //Write to a private directory and move it in place in one go
+  std::ostringstream tmp;
+  tmp << theEntry << ".tmp." << getpid();
+  boost::filesystem::path tmpPath(tmp.str());
+
+  try {
+    boost::filesystem::create_directories(tmpPath);
+    if (!physicsList->StorePhysicsTable(tmpPath.string())) {
+      edm::LogWarning("Geant4e") << "G4e -  Could not store the physics tables in "
+				 << tmpPath.string();
+      boost::filesystem::remove_all(tmpPath);
+      return;
+    }
+    std::ofstream marker((tmpPath / kCompleteMarker).string().c_str());
+    marker << theKey << std::endl;
+    marker.close();
+
+    boost::filesystem::rename(tmpPath, theEntry);
+    edm::LogInfo("Geant4e") << "G4e -  Stored physics tables in " << theEntry;
+  } catch (const boost::filesystem::filesystem_error& e) {
+    //Most likely another job stored the same entry first
+    LogDebug("Geant4e") << "G4e -  Physics tables not stored: " << e.what();
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(tmpPath, ec);
+  }
+}
@@ -0,0 +1,50 @@
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationBatch.h"
+#include "TrackPropagation/Geant4e/interface/ConvertFromToCLHEP.h"
+
+//CMSSW
+#include "TrackingTools/TrajectoryState/interface/FreeTrajectoryState.h"
+
+void Geant4ePropagationBatch::clear() {
+  x.clear(); y.clear(); z.clear();
+  px.clear(); py.clear(); pz.clear();
+  charge.clear();
+  hasError.clear();
+  covariance.clear();
+  target.clear();
+  region.clear();
+}
+
+void Geant4ePropagationBatch::reserve(size_t n) {
+  x.reserve(n); y.reserve(n); z.reserve(n);
+  px.reserve(n); py.reserve(n); pz.reserve(n);
+  charge.reserve(n);
+  hasError.reserve(n);
+  covariance.reserve(15*n);
+  target.reserve(n);
+  region.reserve(n);
+}
+
+void Geant4ePropagationBatch::push_back(const FreeTrajectoryState& fts,
+					const Surface* dest,
+					uint64_t regionKey) {
+  GlobalPoint pos = fts.position();
+  GlobalVector mom = fts.momentum();
+  x.push_back(pos.x()); y.push_back(pos.y()); z.push_back(pos.z());
+  px.push_back(mom.x()); py.push_back(mom.y()); pz.push_back(mom.z());
+  charge.push_back(fts.charge());
+  hasError.push_back(fts.hasError());
+  covariance.resize(covariance.size() + 15, 0.);
+  if (fts.hasError())
+    TrackPropagation::algebraicSymMatrix55ToPacked(fts.curvilinearError().matrix(),
+						   &covariance[covariance.size() - 15]);
+  target.push_back(dest);
+  region.push_back(regionKey);
+}
+
+void Geant4ePropagationBatchResult::resize(size_t n) {
+  status.assign(n, kOk);
+  x.assign(n, 0.); y.assign(n, 0.); z.assign(n, 0.);
+  px.assign(n, 0.); py.assign(n, 0.); pz.assign(n, 0.);
+  covariance.assign(15*n, 0.);
+  path.assign(n, 0.);
+}
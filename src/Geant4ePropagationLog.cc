@@ -0,0 +1,229 @@
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationLog.h"
+#include "TrackPropagation/Geant4e/interface/ConvertFromToCLHEP.h"
+
+//CMSSW
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+#include <boost/weak_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <set>
+
+namespace {
+  const char kMagic[8] = {'G','4','e','P','L','O','G','\0'};
+
+  //Large buffer: records are written on every propagation
+  const size_t kBufferSize = 1 << 20;
+
+  void fillState(const FreeTrajectoryState& fts, double* pos, double* mom,
+		 double* cov) {
+    GlobalPoint p = fts.position();
+    GlobalVector m = fts.momentum();
+    pos[0] = p.x(); pos[1] = p.y(); pos[2] = p.z();
+    mom[0] = m.x(); mom[1] = m.y(); mom[2] = m.z();
+
+    if (fts.hasError())
+      TrackPropagation::algebraicSymMatrix55ToPacked(fts.curvilinearError().matrix(), cov);
+    else
+      std::fill(cov, cov + 15, 0.);
+  }
+
+  void fillSurface(Geant4ePropagationLog::Record& r, const Surface& s) {
+    r.surfacePosition[0] = s.position().x();
+    r.surfacePosition[1] = s.position().y();
+    r.surfacePosition[2] = s.position().z();
+    const Surface::RotationType& rot = s.rotation();
+    double m[9] = {rot.xx(), rot.xy(), rot.xz(),
+		   rot.yx(), rot.yy(), rot.yz(),
+		   rot.zx(), rot.zy(), rot.zz()};
+    std::memcpy(r.surfaceRotation, m, sizeof(m));
+  }
+
+  Surface::PositionType surfacePosition(const Geant4ePropagationLog::Record& r) {
+    return Surface::PositionType(r.surfacePosition[0], r.surfacePosition[1],
+				 r.surfacePosition[2]);
+  }
+
+  //Writers of the job: the live ones, and the files already started
+  std::mutex writersMutex;
+  std::map<std::string, boost::weak_ptr<Geant4ePropagationLog::Writer> > liveWriters;
+  std::set<std::string> startedFiles;
+
+  Surface::RotationType surfaceRotation(const Geant4ePropagationLog::Record& r) {
+    const double* m = r.surfaceRotation;
+    return Surface::RotationType(m[0], m[1], m[2],
+				 m[3], m[4], m[5],
+				 m[6], m[7], m[8]);
+  }
+}
+
+void Geant4ePropagationLog::fillRequest(Record& r,
+					const FreeTrajectoryState& fts,
+					const Plane& plane,
+					PropagationDirection dir) {
+  std::memset(&r, 0, sizeof(Record));
+  r.surfaceType = kPlane;
+  r.direction = dir;
+  r.charge = fts.charge();
+  r.hasError = fts.hasError();
+  fillState(fts, r.position, r.momentum, r.covariance);
+  fillSurface(r, plane);
+}
+
+void Geant4ePropagationLog::fillRequest(Record& r,
+					const FreeTrajectoryState& fts,
+					const Cylinder& cyl,
+					PropagationDirection dir) {
+  std::memset(&r, 0, sizeof(Record));
+  r.surfaceType = kCylinder;
+  r.direction = dir;
+  r.charge = fts.charge();
+  r.hasError = fts.hasError();
+  fillState(fts, r.position, r.momentum, r.covariance);
+  fillSurface(r, cyl);
+  r.radius = cyl.radius();
+}
+
+bool Geant4ePropagationLog::fillRequest(Record& r,
+					const FreeTrajectoryState& fts,
+					const Surface& dest,
+					PropagationDirection dir) {
+  if (const Plane* plane = dynamic_cast<const Plane*>(&dest))
+    fillRequest(r, fts, *plane, dir);
+  else if (const Cylinder* cyl = dynamic_cast<const Cylinder*>(&dest))
+    fillRequest(r, fts, *cyl, dir);
+  else
+    return false;
+  return true;
+}
+
+void Geant4ePropagationLog::fillResult(Record& r,
+				       const TrajectoryStateOnSurface& tsos,
+				       int ierr, double path) {
+  r.valid = tsos.isValid();
+  r.ierr = ierr;
+  r.path = path;
+  if (tsos.isValid())
+    fillState(*tsos.freeState(), r.outPosition, r.outMomentum,
+	      r.outCovariance);
+}
+
+FreeTrajectoryState
+Geant4ePropagationLog::startState(const Record& r, const MagneticField* field) {
+  GlobalTrajectoryParameters pars(GlobalPoint(r.position[0], r.position[1],
+					      r.position[2]),
+				  GlobalVector(r.momentum[0], r.momentum[1],
+					       r.momentum[2]),
+				  r.charge, field);
+  if (!r.hasError)
+    return FreeTrajectoryState(pars);
+
+  AlgebraicSymMatrix55 cov;
+  TrackPropagation::packedToAlgebraicSymMatrix55(r.covariance, cov);
+  return FreeTrajectoryState(pars, CurvilinearTrajectoryError(cov));
+}
+
+Plane::PlanePointer Geant4ePropagationLog::plane(const Record& r) {
+  return Plane::build(surfacePosition(r), surfaceRotation(r));
+}
+
+Cylinder::CylinderPointer Geant4ePropagationLog::cylinder(const Record& r) {
+  return Cylinder::build(surfacePosition(r), surfaceRotation(r), r.radius);
+}
+
+//
+////////////////////////////////////////////////////////////////////////////
+//
+
+boost::shared_ptr<Geant4ePropagationLog::Writer>
+Geant4ePropagationLog::Writer::open(const std::string& fileName,
+				    const std::string& particle) {
+  std::lock_guard<std::mutex> guard(writersMutex);
+  boost::shared_ptr<Writer> writer = liveWriters[fileName].lock();
+  if (writer) {
+    if (writer->theParticle != particle)
+      throw cms::Exception("Geant4e") << "Propagation log " << fileName
+				      << " is already written for particle "
+				      << writer->theParticle;
+    return writer;
+  }
+
+  bool append = !startedFiles.insert(fileName).second;
+  writer.reset(new Writer(fileName, particle, append));
+  liveWriters[fileName] = writer;
+  return writer;
+}
+
+Geant4ePropagationLog::Writer::Writer(const std::string& fileName,
+				      const std::string& particle,
+				      bool append):
+  theFile(std::fopen(fileName.c_str(), append ? "ab" : "wb")),
+  theFileName(fileName),
+  theParticle(particle),
+  theNRecords(0) {
+
+  if (!theFile)
+    throw cms::Exception("Geant4e") << "Cannot open propagation log "
+				    << fileName;
+  std::setvbuf(theFile, 0, _IOFBF, kBufferSize);
+  if (append)
+    return;
+
+  Header h;
+  std::memset(&h, 0, sizeof(Header));
+  std::memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.version = kVersion;
+  h.recordSize = sizeof(Record);
+  std::strncpy(h.particle, particle.c_str(), sizeof(h.particle) - 1);
+  std::fwrite(&h, sizeof(Header), 1, theFile);
+}
+
+Geant4ePropagationLog::Writer::~Writer() {
+  std::fclose(theFile);
+  edm::LogInfo("Geant4e") << "G4e -  Wrote " << theNRecords
+			  << " propagations to " << theFileName;
+}
+
+void Geant4ePropagationLog::Writer::write(const Record& r) {
+  std::lock_guard<std::mutex> guard(theMutex);
+  std::fwrite(&r, sizeof(Record), 1, theFile);
+  ++theNRecords;
+}
+
+//
+////////////////////////////////////////////////////////////////////////////
+//
+
+Geant4ePropagationLog::Reader::Reader(const std::string& fileName):
+  theFile(std::fopen(fileName.c_str(), "rb")) {
+
+  if (!theFile)
+    throw cms::Exception("Geant4e") << "Cannot open propagation log "
+				    << fileName;
+  std::setvbuf(theFile, 0, _IOFBF, kBufferSize);
+
+  if (std::fread(&theHeader, sizeof(Header), 1, theFile) != 1 ||
+      std::memcmp(theHeader.magic, kMagic, sizeof(kMagic)) != 0) {
+    std::fclose(theFile);
+    throw cms::Exception("Geant4e") << fileName
+				    << " is not a Geant4e propagation log";
+  }
+  if (theHeader.version != kVersion || theHeader.recordSize != sizeof(Record)) {
+    std::fclose(theFile);
+    throw cms::Exception("Geant4e") << "Propagation log " << fileName
+				    << " has version " << theHeader.version
+				    << " while " << kVersion << " is expected";
+  }
+}
+
+Geant4ePropagationLog::Reader::~Reader() {
+  std::fclose(theFile);
+}
+
+bool Geant4ePropagationLog::Reader::next(Record& r) {
+  return std::fread(&r, sizeof(Record), 1, theFile) == 1;
+}
@@ -0,0 +1,111 @@
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationScheduler.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMagneticField.h"
+#include "TrackPropagation/Geant4e/interface/ConvertFromToCLHEP.h"
+
+//CMSSW
+#include "TrackingTools/TrajectoryState/interface/SurfaceSideDefinition.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+Geant4ePropagationScheduler::Geant4ePropagationScheduler(const Geant4ePropagator* propagator,
+							 double etaBin, double phiBin,
+							 double distanceBin):
+  thePropagator(propagator),
+  theEtaBin(etaBin),
+  thePhiBin(phiBin),
+  theDistanceBin(distanceBin),
+  theNRuns(0),
+  theNRequests(0),
+  theTime(0),
+  theNEvaluations(0),
+  theNCellHits(0) {
+}
+
+Geant4ePropagationScheduler::~Geant4ePropagationScheduler() {
+  if (theNRequests == 0)
+    return;
+
+  edm::LogInfo log("Geant4e");
+  log << "G4e -  Scheduler: " << theNRequests << " requests in " 
+      << theNRuns << " runs, " << theNRequests/theTime << " propagations/s";
+  if (theNEvaluations > 0)
+    log << ", field cell cache hit rate " << double(theNCellHits)/theNEvaluations;
+}
+
+uint64_t Geant4ePropagationScheduler::binKey(const Surface* dest) const {
+  GlobalPoint pos = dest->position();
+  const double distance = pos.mag();
+  //Targets around the beam line go to the first eta bin
+  const double eta = distance > 0 ? double(pos.eta()) : 0;
+  const unsigned int nPhi = std::ceil(2*M_PI/thePhiBin);
+  const unsigned int nEta = std::ceil(10./theEtaBin);
+  unsigned int iPhi = std::min<unsigned int>((double(pos.phi()) + M_PI)/thePhiBin, nPhi - 1);
+  unsigned int iEta = std::min<unsigned int>(std::max(eta + 5., 0.)/theEtaBin, nEta - 1);
+  unsigned int iDistance = std::min<unsigned int>(distance/theDistanceBin, 255);
+  return (uint64_t(1) << 63) | ((uint64_t(iDistance)*nEta + iEta)*nPhi + iPhi);
+}
+
+unsigned int Geant4ePropagationScheduler::add(const FreeTrajectoryState& fts,
+					      const Surface* dest,
+					      unsigned int detId) {
+  theBatch.push_back(fts, dest, detId != 0 ? detId : (dest ? binKey(dest) : 0));
+  return theBatch.size() - 1;
+}
+
+void Geant4ePropagationScheduler::run() {
+  if (theBatch.size() == 0)
+    return;
+
+  const Geant4eMagneticField* field = thePropagator->fieldAdapter();
+  unsigned long nEvaluations = field ? field->nEvaluations() : 0;
+  unsigned long nCellHits = field ? field->nCellHits() : 0;
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  thePropagator->propagateBatch(theBatch, theResult);
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+  //The adapter only exists once the propagator has been initialised. The
+  //hit rate is only meaningful with the cell cache on
+  field = thePropagator->fieldAdapter();
+  if (field && field->cellCache()) {
+    theNEvaluations += field->nEvaluations() - nEvaluations;
+    theNCellHits += field->nCellHits() - nCellHits;
+  }
+  theNRuns++;
+  theNRequests += theBatch.size();
+  theTime += std::chrono::duration<double>(t1 - t0).count();
+
+  LogDebug("Geant4e") << "G4e -  Scheduler ran " << theBatch.size() 
+		      << " requests in " 
+		      << std::chrono::duration<double>(t1 - t0).count() << " s";
+}
+
+TrajectoryStateOnSurface 
+Geant4ePropagationScheduler::result(unsigned int ticket) const {
+  if (ticket >= theResult.size() || 
+      theResult.status[ticket] != Geant4ePropagationBatchResult::kOk)
+    return TrajectoryStateOnSurface();
+
+  const unsigned int i = ticket;
+  GlobalTrajectoryParameters pars(GlobalPoint(theResult.x[i], theResult.y[i], theResult.z[i]),
+				  GlobalVector(theResult.px[i], theResult.py[i], theResult.pz[i]),
+				  theBatch.charge[i], thePropagator->magneticField());
+  if (!theBatch.hasError[i])
+    return TrajectoryStateOnSurface(pars, *theBatch.target[i], 
+				    SurfaceSideDefinition::atCenterOfSurface);
+
+  AlgebraicSymMatrix55 cov;
+  TrackPropagation::packedToAlgebraicSymMatrix55(&theResult.covariance[15*i], cov);
+  return TrajectoryStateOnSurface(pars, CurvilinearTrajectoryError(cov), 
+				  *theBatch.target[i],
+				  SurfaceSideDefinition::atCenterOfSurface);
+}
+
+void Geant4ePropagationScheduler::clear() {
+  theBatch.clear();
+  theResult.resize(0);
+}
@@ -0,0 +1,346 @@
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationTable.h"
+#include "TrackPropagation/Geant4e/interface/ConvertFromToCLHEP.h"
+
+//CMSSW
+#include "TrackingTools/TrajectoryState/interface/FreeTrajectoryState.h"
+#include "TrackingTools/AnalyticalJacobians/interface/AnalyticalCurvilinearJacobian.h"
+#include "DataFormats/GeometrySurface/interface/Cylinder.h"
+#include "DataFormats/GeometrySurface/interface/Plane.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+#include <cmath>
+#include <cstring>
+
+//POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+  const char kMagic[8] = {'G','4','e','P','T','A','B','\0'};
+
+  //Surfaces are considered aligned with the z axis above this cosine
+  const double kMinAxisCosine = 0.9999;
+
+  //Shortest straight line step from pos along the unit vector dir onto a
+  //station. Returns false if the line misses it
+  bool stepToStation(const Geant4ePropagationTable::Station& st,
+		     const GlobalPoint& pos, const GlobalVector& dir,
+		     double& step) {
+    if (st.type == Geant4ePropagationTable::kZPlane) {
+      if (dir.z() == 0)
+	return false;
+      step = (st.position - pos.z())/dir.z();
+      return true;
+    }
+    double a = dir.perp2();
+    double b = pos.x()*dir.x() + pos.y()*dir.y();
+    double c = pos.perp2() - double(st.position)*st.position;
+    double disc = b*b - a*c;
+    if (a == 0 || disc < 0)
+      return false;
+    //Smaller root of a s^2 + 2 b s + c, without cancellation
+    double far = -b - (b > 0 ? std::sqrt(disc) : -std::sqrt(disc));
+    step = far != 0 ? c/far : 0;
+    return true;
+  }
+}
+
+Geant4ePropagationTable::Geant4ePropagationTable(const std::string& fileName):
+  theHeader(0), theStations(0), theNodes(0), theCells(0),
+  theMapping(0), theMappingSize(0),
+  theNLookups(0), theNHits(0) {
+
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw cms::Exception("Geant4e") << "Cannot open propagation table "
+				    << fileName;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Header)) {
+    close(fd);
+    throw cms::Exception("Geant4e") << "Propagation table " << fileName
+				    << " is too short";
+  }
+
+  theMappingSize = st.st_size;
+  theMapping = mmap(0, theMappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (theMapping == MAP_FAILED) {
+    theMapping = 0;
+    throw cms::Exception("Geant4e") << "Cannot map propagation table "
+				    << fileName;
+  }
+
+  try {
+    setup(static_cast<const char*>(theMapping), theMappingSize);
+  } catch (...) {
+    munmap(theMapping, theMappingSize);
+    theMapping = 0;
+    throw;
+  }
+}
+
+Geant4ePropagationTable::Geant4ePropagationTable(const char* buffer,
+						 size_t size):
+  theHeader(0), theStations(0), theNodes(0), theCells(0),
+  theMapping(0), theMappingSize(0),
+  theNLookups(0), theNHits(0) {
+  setup(buffer, size);
+}
+
+Geant4ePropagationTable::~Geant4ePropagationTable() {
+  if (theNLookups > 0)
+    edm::LogInfo("Geant4e") << "G4e -  Propagation table served " << theNHits
+			    << " out of " << theNLookups << " lookups";
+  if (theMapping)
+    munmap(theMapping, theMappingSize);
+}
+
+void Geant4ePropagationTable::setup(const char* data, size_t size) {
+  if (size < sizeof(Header))
+    throw cms::Exception("Geant4e") << "Propagation table is too short";
+
+  theHeader = reinterpret_cast<const Header*>(data);
+  if (std::memcmp(theHeader->magic, kMagic, sizeof(kMagic)) != 0)
+    throw cms::Exception("Geant4e") << "Not a Geant4e propagation table";
+  if (theHeader->version != kVersion)
+    throw cms::Exception("Geant4e") << "Propagation table version "
+				    << theHeader->version
+				    << " while " << kVersion << " is expected";
+  for (unsigned int a = 0; a < kNAxes; a++)
+    if (theHeader->nNodes[a] < 2)
+      throw cms::Exception("Geant4e") << "Propagation table needs at least "
+				      << "two nodes per axis";
+  if (size < fileSize(*theHeader))
+    throw cms::Exception("Geant4e") << "Propagation table is truncated";
+
+  theStations = reinterpret_cast<const Station*>(data + stationOffset());
+  theNodes = reinterpret_cast<const Node*>(data + nodeOffset(*theHeader));
+  theCells = reinterpret_cast<const Cell*>(data + cellOffset(*theHeader));
+}
+
+//
+////////////////////////////////////////////////////////////////////////////
+//
+
+void Geant4ePropagationTable::initHeader(Header& h) {
+  std::memset(&h, 0, sizeof(Header));
+  std::memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.version = kVersion;
+}
+
+size_t Geant4ePropagationTable::nNodes(const Header& h) {
+  size_t n = 1;
+  for (unsigned int a = 0; a < kNAxes; a++)
+    n *= h.nNodes[a];
+  return n;
+}
+
+size_t Geant4ePropagationTable::nCells(const Header& h) {
+  size_t n = 1;
+  for (unsigned int a = 0; a < kNAxes; a++)
+    n *= h.nNodes[a] - 1;
+  return n;
+}
+
+size_t Geant4ePropagationTable::cellOffset(const Header& h) {
+  return nodeOffset(h) + h.nStations*nNodes(h)*sizeof(Node);
+}
+
+size_t Geant4ePropagationTable::fileSize(const Header& h) {
+  return cellOffset(h) + h.nStations*nCells(h)*sizeof(Cell);
+}
+
+size_t Geant4ePropagationTable::nNodes() const {return nNodes(*theHeader);}
+
+size_t Geant4ePropagationTable::nCells() const {return nCells(*theHeader);}
+
+double Geant4ePropagationTable::nodeValue(unsigned int axis,
+					  unsigned int i) const {
+  return theHeader->lo[axis] +
+    i*(theHeader->hi[axis] - theHeader->lo[axis])/(theHeader->nNodes[axis] - 1);
+}
+
+size_t Geant4ePropagationTable::nodeIndex(const unsigned int* idx) const {
+  size_t index = 0;
+  for (unsigned int a = 0; a < kNAxes; a++)
+    index = index*theHeader->nNodes[a] + idx[a];
+  return index;
+}
+
+size_t Geant4ePropagationTable::cellIndex(const unsigned int* idx) const {
+  size_t index = 0;
+  for (unsigned int a = 0; a < kNAxes; a++)
+    index = index*(theHeader->nNodes[a] - 1) + idx[a];
+  return index;
+}
+
+void Geant4ePropagationTable::axisValues(const FreeTrajectoryState& fts,
+					 double* values) {
+  GlobalVector mom = fts.momentum();
+  values[kQOverPt] = fts.charge()/mom.perp();
+  values[kEta]     = mom.eta();
+  values[kPhi]     = mom.phi();
+  values[kVertexZ] = fts.position().z();
+}
+
+//
+////////////////////////////////////////////////////////////////////////////
+//
+
+int Geant4ePropagationTable::findStation(const Cylinder& cyl) const {
+  if (std::abs(cyl.rotation().zz()) < kMinAxisCosine)
+    return -1;
+
+  for (unsigned int i = 0; i < theHeader->nStations; i++) {
+    const Station& st = theStations[i];
+    if (st.type != kCylinder)
+      continue;
+    if (cyl.position().perp() < st.tolerance &&
+	std::abs(cyl.radius() - st.position) < st.tolerance)
+      return i;
+  }
+  return -1;
+}
+
+/** Endcap chambers are planes normal to z, rotated about it. Barrel
+ *  chambers are planes parallel to z, tangent to a station cylinder at
+ *  their position: the caller moves the state from the cylinder onto the
+ *  plane, within the station tolerance.
+ */
+int Geant4ePropagationTable::findStation(const Plane& plane) const {
+  GlobalVector normal = plane.normalVector();
+  GlobalPoint pos = plane.position();
+  bool alongZ = std::abs(normal.z()) >= kMinAxisCosine;
+  bool parallelToZ = normal.perp() >= kMinAxisCosine;
+  if (!alongZ && !parallelToZ)
+    return -1;
+
+  //Distance of a barrel plane to the beam line
+  double rho = parallelToZ ? 
+    std::abs(pos.x()*normal.x() + pos.y()*normal.y())/normal.perp() : 0;
+  for (unsigned int i = 0; i < theHeader->nStations; i++) {
+    const Station& st = theStations[i];
+    if (alongZ && st.type == kZPlane &&
+	std::abs(pos.z() - st.position) < st.tolerance)
+      return i;
+    if (parallelToZ && st.type == kCylinder &&
+	std::abs(rho - st.position) < st.tolerance)
+      return i;
+  }
+  return -1;
+}
+
+bool Geant4ePropagationTable::interpolate(const FreeTrajectoryState& fts,
+					  unsigned int station,
+					  double maxResidual,
+					  GlobalPoint& pos, GlobalVector& mom,
+					  AlgebraicSymMatrix55& noise,
+					  double& path) const {
+  ++theNLookups;
+  if (fts.position().perp() > theHeader->maxVertexRho)
+    return false;
+
+  //Locate the cell and the position inside it
+  double values[kNAxes];
+  axisValues(fts, values);
+
+  unsigned int cell[kNAxes];
+  double frac[kNAxes];
+  for (unsigned int a = 0; a < kNAxes; a++) {
+    unsigned int n = theHeader->nNodes[a];
+    double t = (values[a] - theHeader->lo[a])/
+      (theHeader->hi[a] - theHeader->lo[a])*(n - 1);
+    if (!(t >= 0 && t <= n - 1))
+      return false;
+    unsigned int i = static_cast<unsigned int>(t);
+    if (i > n - 2)
+      i = n - 2;
+    cell[a] = i;
+    frac[a] = t - i;
+  }
+
+  if (maxResidual > 0) {
+    float residual = theCells[station*nCells() + cellIndex(cell)].positionResidual;
+    if (residual < 0 || residual > maxResidual)
+      return false;
+  }
+
+  //Multilinear interpolation over the 16 corners
+  double p[3] = {0, 0, 0};
+  double m[3] = {0, 0, 0};
+  double q[15];
+  for (unsigned int k = 0; k < 15; k++)
+    q[k] = 0;
+  path = 0;
+
+  const Node* nodes = theNodes + station*nNodes();
+  for (unsigned int c = 0; c < (1u << kNAxes); c++) {
+    unsigned int idx[kNAxes];
+    double w = 1;
+    for (unsigned int a = 0; a < kNAxes; a++) {
+      unsigned int bit = (c >> a) & 1;
+      idx[a] = cell[a] + bit;
+      w *= bit ? frac[a] : 1. - frac[a];
+    }
+
+    const Node& node = nodes[nodeIndex(idx)];
+    if (!node.valid)
+      return false;
+
+    path += w*node.path;
+    for (unsigned int k = 0; k < 3; k++) {
+      p[k] += w*node.position[k];
+      m[k] += w*node.momentum[k];
+    }
+    for (unsigned int k = 0; k < 15; k++)
+      q[k] += w*node.noise[k];
+  }
+
+  //Rotate back to the azimuth of the start state
+  double cphi = std::cos(values[kPhi]);
+  double sphi = std::sin(values[kPhi]);
+  pos = GlobalPoint(cphi*p[0] - sphi*p[1], sphi*p[0] + cphi*p[1], p[2]);
+  mom = GlobalVector(cphi*m[0] - sphi*m[1], sphi*m[0] + cphi*m[1], m[2]);
+
+  //The nodes start on the beam line. The transverse offset of the vertex
+  //is transported with the helix jacobian of the interpolated path, and
+  //the shifted state is moved back onto the station
+  GlobalVector offset(fts.position().x(), fts.position().y(), 0);
+  if (offset.mag2() > 0) {
+    GlobalVector dirStart = fts.momentum().unit();
+    GlobalVector uStart(-sphi, cphi, 0);
+    AlgebraicVector5 start;
+    start[3] = offset.dot(uStart);
+    start[4] = offset.dot(dirStart.cross(uStart));
+    GlobalTrajectoryParameters reference(GlobalPoint(0, 0, fts.position().z()),
+					 fts.momentum(), fts.charge(),
+					 &fts.parameters().magneticField());
+    AnalyticalCurvilinearJacobian jacobian(reference, pos, mom, path);
+    AlgebraicVector5 end = jacobian.jacobian()*start;
+
+    double phiEnd = mom.phi();
+    GlobalVector uEnd(-std::sin(phiEnd), std::cos(phiEnd), 0);
+    GlobalVector vEnd = mom.unit().cross(uEnd);
+    GlobalPoint shifted = pos + end[3]*uEnd + end[4]*vEnd;
+    double lambda = M_PI/2 - mom.theta() + end[1];
+    phiEnd += end[2];
+    GlobalVector dir(std::cos(lambda)*std::cos(phiEnd), 
+		     std::cos(lambda)*std::sin(phiEnd), std::sin(lambda));
+    double step;
+    if (!stepToStation(theStations[station], shifted, dir, step))
+      return false;
+    pos = shifted + step*dir;
+    mom = mom.mag()*dir;
+    //Moving the start along the track shortens the path
+    path += step - offset.dot(dirStart);
+  }
+
+  TrackPropagation::packedToAlgebraicSymMatrix55(q, noise);
+
+  ++theNHits;
+  return true;
+}
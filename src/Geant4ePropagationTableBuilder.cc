@@ -0,0 +1,228 @@
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationTableBuilder.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
+
+//CMSSW
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "TrackingTools/TrajectoryState/interface/FreeTrajectoryState.h"
+#include "TrackingTools/TrajectoryState/interface/TrajectoryStateOnSurface.h"
+#include "DataFormats/GeometrySurface/interface/Cylinder.h"
+#include "DataFormats/GeometrySurface/interface/Plane.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+
+#include <cstring>
+#include <cmath>
+
+Geant4ePropagationTableBuilder::Geant4ePropagationTableBuilder(const Table::Header& header,
+							       const std::vector<Table::Station>& stations):
+  theHeader(header),
+  theStations(stations) {
+  Table::Header fresh;
+  Table::initHeader(fresh);
+  std::memcpy(theHeader.magic, fresh.magic, sizeof(fresh.magic));
+  theHeader.version = fresh.version;
+  theHeader.nStations = theStations.size();
+}
+
+void Geant4ePropagationTableBuilder::build(const Geant4ePropagator& propagator,
+					   const MagneticField* field,
+					   bool checkCells,
+					   std::vector<char>& buffer) const {
+  buffer.assign(Table::fileSize(theHeader), 0);
+  std::memcpy(&buffer[0], &theHeader, sizeof(theHeader));
+  if (!theStations.empty())
+    std::memcpy(&buffer[Table::stationOffset()], &theStations[0],
+		theStations.size()*sizeof(Table::Station));
+
+  //No cell is usable with a residual cut until checked
+  Table::Cell* cells =
+    reinterpret_cast<Table::Cell*>(&buffer[Table::cellOffset(theHeader)]);
+  for (size_t c = 0, n = theStations.size()*Table::nCells(theHeader); c < n; c++) {
+    cells[c].positionResidual = -1;
+    cells[c].momentumResidual = -1;
+  }
+
+  fillNodes(propagator, field, buffer);
+  if (checkCells)
+    checkAccuracy(propagator, field, buffer);
+}
+
+FreeTrajectoryState
+Geant4ePropagationTableBuilder::startState(const double* values,
+					   const MagneticField* field) const {
+  double qOverPt = values[Table::kQOverPt];
+  double pt = 1./std::abs(qOverPt);
+  double theta = 2.*std::atan(std::exp(-values[Table::kEta]));
+  GlobalVector mom(pt*std::cos(values[Table::kPhi]),
+		   pt*std::sin(values[Table::kPhi]),
+		   pt/std::tan(theta));
+  GlobalPoint pos(0., 0., values[Table::kVertexZ]);
+  int charge = qOverPt > 0 ? 1 : -1;
+  //Without an error Geant4e would start from the unit matrix and the
+  //nodes would hold its transport on top of the noise
+  return FreeTrajectoryState(GlobalTrajectoryParameters(pos, mom, charge, field),
+			     CurvilinearTrajectoryError(AlgebraicSymMatrix55()));
+}
+
+bool Geant4ePropagationTableBuilder::propagate(const Geant4ePropagator& propagator,
+					       const FreeTrajectoryState& fts,
+					       const Table::Station& st,
+					       TrajectoryStateOnSurface& tsos,
+					       double& path) const {
+  Surface::RotationType rot;
+  std::pair<TrajectoryStateOnSurface, double> res;
+  if (st.type == Table::kCylinder) {
+    Cylinder::CylinderPointer cyl =
+      Cylinder::build(Surface::PositionType(0, 0, 0), rot, st.position);
+    res = propagator.propagateWithPath(fts, *cyl);
+  } else {
+    Plane::PlanePointer plane =
+      Plane::build(Surface::PositionType(0, 0, st.position), rot);
+    res = propagator.propagateWithPath(fts, *plane);
+  }
+
+  tsos = res.first;
+  //The path from the stepping action is in Geant4 units
+  path = res.second/cm;
+  return tsos.isValid();
+}
+
+void Geant4ePropagationTableBuilder::fillNodes(const Geant4ePropagator& propagator,
+					       const MagneticField* field,
+					       std::vector<char>& buffer) const {
+  Table table(&buffer[0], buffer.size());
+  Table::Node* nodes =
+    reinterpret_cast<Table::Node*>(&buffer[Table::nodeOffset(theHeader)]);
+  size_t nNodes = table.nNodes();
+
+  unsigned long nValid = 0;
+  for (size_t n = 0; n < nNodes; n++) {
+    //Unfold the node index, axis 0 varies slowest
+    unsigned int idx[Table::kNAxes];
+    size_t rest = n;
+    for (int a = Table::kNAxes - 1; a >= 0; a--) {
+      idx[a] = rest % theHeader.nNodes[a];
+      rest /= theHeader.nNodes[a];
+    }
+
+    double values[Table::kNAxes];
+    for (unsigned int a = 0; a < Table::kNAxes; a++)
+      values[a] = table.nodeValue(a, idx[a]);
+    if (values[Table::kQOverPt] == 0)
+      continue;
+
+    FreeTrajectoryState fts = startState(values, field);
+    double cphi = std::cos(values[Table::kPhi]);
+    double sphi = std::sin(values[Table::kPhi]);
+
+    for (unsigned int s = 0; s < theStations.size(); s++) {
+      TrajectoryStateOnSurface tsos;
+      double path;
+      if (!propagate(propagator, fts, theStations[s], tsos, path))
+	continue;
+
+      Table::Node& node = nodes[s*nNodes + n];
+      GlobalPoint pos = tsos.globalPosition();
+      GlobalVector mom = tsos.globalMomentum();
+      node.valid = 1;
+      node.path = path;
+      //Store in the frame rotated by -phi of the node
+      node.position[0] =  cphi*pos.x() + sphi*pos.y();
+      node.position[1] = -sphi*pos.x() + cphi*pos.y();
+      node.position[2] = pos.z();
+      node.momentum[0] =  cphi*mom.x() + sphi*mom.y();
+      node.momentum[1] = -sphi*mom.x() + cphi*mom.y();
+      node.momentum[2] = mom.z();
+
+      const AlgebraicSymMatrix55& cov = tsos.curvilinearError().matrix();
+      unsigned int k = 0;
+      for (unsigned int i = 0; i < 5; i++)
+	for (unsigned int j = 0; j <= i; j++)
+	  node.noise[k++] = cov(i, j);
+      ++nValid;
+    }
+  }
+
+  edm::LogInfo("Geant4e") << "G4e -  Propagated " << nValid << " out of "
+			  << nNodes*theStations.size() << " table nodes";
+}
+
+void Geant4ePropagationTableBuilder::checkAccuracy(const Geant4ePropagator& propagator,
+						   const MagneticField* field,
+						   std::vector<char>& buffer) const {
+  Table table(&buffer[0], buffer.size());
+  Table::Cell* cells =
+    reinterpret_cast<Table::Cell*>(&buffer[Table::cellOffset(theHeader)]);
+  size_t nCells = table.nCells();
+
+  //Summary per station and (q/pT, eta) bin
+  unsigned int nQ = theHeader.nNodes[Table::kQOverPt] - 1;
+  unsigned int nEta = theHeader.nNodes[Table::kEta] - 1;
+  std::vector<double> sumRes(theStations.size()*nQ*nEta, 0.);
+  std::vector<double> maxRes(theStations.size()*nQ*nEta, 0.);
+  std::vector<unsigned int> nRes(theStations.size()*nQ*nEta, 0);
+
+  for (size_t c = 0; c < nCells; c++) {
+    unsigned int idx[Table::kNAxes];
+    size_t rest = c;
+    for (int a = Table::kNAxes - 1; a >= 0; a--) {
+      idx[a] = rest % (theHeader.nNodes[a] - 1);
+      rest /= theHeader.nNodes[a] - 1;
+    }
+
+    double values[Table::kNAxes];
+    for (unsigned int a = 0; a < Table::kNAxes; a++)
+      values[a] = 0.5*(table.nodeValue(a, idx[a]) + table.nodeValue(a, idx[a] + 1));
+    if (values[Table::kQOverPt] == 0)
+      continue;
+
+    FreeTrajectoryState fts = startState(values, field);
+
+    for (unsigned int s = 0; s < theStations.size(); s++) {
+      Table::Cell& cell = cells[s*nCells + c];
+      GlobalPoint pos;
+      GlobalVector mom;
+      AlgebraicSymMatrix55 noise;
+      double pathTable;
+      if (!table.interpolate(fts, s, 0., pos, mom, noise, pathTable))
+	continue;
+
+      TrajectoryStateOnSurface tsos;
+      double path;
+      if (!propagate(propagator, fts, theStations[s], tsos, path))
+	continue;
+
+      cell.positionResidual = (tsos.globalPosition() - pos).mag();
+      cell.momentumResidual =
+	(tsos.globalMomentum() - mom).mag()/tsos.globalMomentum().mag();
+
+      unsigned int bin = (s*nQ + idx[Table::kQOverPt])*nEta + idx[Table::kEta];
+      sumRes[bin] += cell.positionResidual;
+      if (cell.positionResidual > maxRes[bin])
+	maxRes[bin] = cell.positionResidual;
+      nRes[bin]++;
+    }
+  }
+
+  edm::LogVerbatim("Geant4e") << "G4e -  Table accuracy at the cell centres "
+			      << "(position residual in cm)";
+  for (unsigned int s = 0; s < theStations.size(); s++)
+    for (unsigned int iq = 0; iq < nQ; iq++)
+      for (unsigned int ie = 0; ie < nEta; ie++) {
+	unsigned int bin = (s*nQ + iq)*nEta + ie;
+	if (nRes[bin] == 0)
+	  continue;
+	edm::LogVerbatim("Geant4e") << "  station " << s
+				    << (theStations[s].type == Table::kCylinder ? " R=" : " Z=")
+				    << theStations[s].position
+				    << "  q/pT [" << table.nodeValue(Table::kQOverPt, iq)
+				    << ", " << table.nodeValue(Table::kQOverPt, iq + 1)
+				    << "]  eta [" << table.nodeValue(Table::kEta, ie)
+				    << ", " << table.nodeValue(Table::kEta, ie + 1)
+				    << "]  mean " << sumRes[bin]/nRes[bin]
+				    << "  max " << maxRes[bin]
+				    << "  (" << nRes[bin] << " cells)";
+      }
+}
@@ -3,15 +3,34 @@
 #include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
 #include "TrackPropagation/Geant4e/interface/ConvertFromToCLHEP.h"
 #include "TrackPropagation/Geant4e/interface/Geant4eSteppingAction.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMagneticField.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationTable.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationLog.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePhysicsTableCache.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eReducedGeometry.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eVolumeProfile.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationBatch.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMultiTrackStepper.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eFreeTrajState.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMaterialTables.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eTabulatedPhysicsList.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMuonPhysicsList.h"
 
 //CMSSW
 #include "MagneticField/Engine/interface/MagneticField.h"
 #include "DataFormats/TrajectorySeed/interface/PropagationDirection.h"
 #include "TrackingTools/TrajectoryState/interface/TrajectoryStateOnSurface.h"
 #include "TrackingTools/TrajectoryState/interface/SurfaceSideDefinition.h"
+#include "TrackingTools/AnalyticalJacobians/interface/AnalyticalCurvilinearJacobian.h"
+#include "TrackingTools/GeomPropagators/interface/StraightLinePlaneCrossing.h"
+#include "TrackingTools/GeomPropagators/interface/HelixArbitraryPlaneCrossing.h"
+#include "TrackingTools/GeomPropagators/interface/StraightLineCylinderCrossing.h"
+#include "TrackingTools/GsfTools/interface/MultiTrajectoryStateAssembler.h"
 #include "DataFormats/GeometrySurface/interface/Cylinder.h"
 #include "DataFormats/GeometrySurface/interface/Plane.h"
+#include "DataFormats/GeometrySurface/interface/Bounds.h"
 #include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/Utilities/interface/Exception.h"
 
 //Geant4
 #include "G4ErrorFreeTrajState.hh"
@@ -20,11 +39,284 @@
 #include "G4ErrorPropagatorData.hh"
 #include "G4EventManager.hh"
 #include "G4SteppingControl.hh"
+#include "G4TransportationManager.hh"
+#include "G4ErrorPhysicsList.hh"
+#include "G4Navigator.hh"
+#include "G4VPhysicalVolume.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
 
 //CLHEP
 #include "CLHEP/Units/GlobalSystemOfUnits.h"
 
 
+namespace {
+  //Volume profile summary to the log
+  void profileSummary(const std::string& summary) {
+    edm::LogInfo("Geant4e") << "G4e -  " << summary;
+  }
+
+  //Core target for a plane or a cylinder. False for other surfaces
+  bool coreTarget(const Surface* dest, Geant4ePropagatorCore::Target& target) {
+    GlobalPoint pos = dest ? dest->position() : GlobalPoint();
+    target.position[0] = pos.x(); 
+    target.position[1] = pos.y(); 
+    target.position[2] = pos.z();
+    if (const Plane* plane = dynamic_cast<const Plane*>(dest)) {
+      GlobalVector normal = plane->toGlobal(LocalVector(0,0,1.)).unit();
+      target.kind = Geant4ePropagatorCore::Target::kPlane;
+      target.normal[0] = normal.x(); 
+      target.normal[1] = normal.y(); 
+      target.normal[2] = normal.z();
+      return true;
+    }
+    if (const Cylinder* cylinder = dynamic_cast<const Cylinder*>(dest)) {
+      const Surface::RotationType& r = cylinder->rotation();
+      const double rotation[9] = {r.xx(), r.xy(), r.xz(), 
+				  r.yx(), r.yy(), r.yz(), 
+				  r.zx(), r.zy(), r.zz()};
+      target.kind = Geant4ePropagatorCore::Target::kCylinder;
+      target.radius = cylinder->radius();
+      std::copy(rotation, rotation + 9, target.rotation);
+      return true;
+    }
+    return false;
+  }
+
+  //Geant4e target for a plane or a cylinder, null for other surfaces
+  G4ErrorTarget* newTarget(const Surface* dest) {
+    Geant4ePropagatorCore::Target target;
+    return coreTarget(dest, target) ? Geant4ePropagatorCore::newTarget(target) : 0;
+  }
+
+  //Same choice of the Geant4e mode as the single track methods when the
+  //propagation direction is anyDirection
+  G4ErrorMode anyDirectionMode(const Surface* dest, 
+			       const GlobalPoint& pos, const GlobalVector& mom) {
+    if (const Plane* plane = dynamic_cast<const Plane*>(dest))
+      return plane->localZ(pos)*plane->localZ(mom) < 0 ? 
+	G4ErrorMode_PropForwards : G4ErrorMode_PropBackwards;
+    return dest->side(dest->toLocal(pos), 0) == SurfaceOrientation::positiveSide ?
+      G4ErrorMode_PropBackwards : G4ErrorMode_PropForwards;
+  }
+
+  const char* const statusNames[Geant4eSteppingAction::kNStatus] = 
+    {"propagations", "max steps", "max path", "max time", "loopers"};
+
+  //Status of a failed request of a batch
+  int batchStatus(Geant4eSteppingAction::Status status, int ierr) {
+    switch (status) {
+    case Geant4eSteppingAction::kMaxSteps: return Geant4ePropagationBatchResult::kMaxSteps;
+    case Geant4eSteppingAction::kMaxPath:  return Geant4ePropagationBatchResult::kMaxPath;
+    case Geant4eSteppingAction::kMaxTime:  return Geant4ePropagationBatchResult::kMaxTime;
+    case Geant4eSteppingAction::kLooper:   return Geant4ePropagationBatchResult::kLooper;
+    default: return ierr;
+    }
+  }
+
+  //CMS state of the request i of a batch
+  FreeTrajectoryState batchState(const Geant4ePropagationBatch& batch, 
+				 unsigned int i, const MagneticField* field) {
+    GlobalTrajectoryParameters pars(GlobalPoint(batch.x[i], batch.y[i], batch.z[i]),
+				    GlobalVector(batch.px[i], batch.py[i], batch.pz[i]),
+				    batch.charge[i], field);
+    if (!batch.hasError[i])
+      return FreeTrajectoryState(pars);
+    AlgebraicSymMatrix55 cov;
+    TrackPropagation::packedToAlgebraicSymMatrix55(&batch.covariance[15*i], cov);
+    return FreeTrajectoryState(pars, CurvilinearTrajectoryError(cov));
+  }
+
+  //Stores a state in the arrays of a batch or of its results
+  template <class SoA>
+  void setBatchState(SoA& soa, unsigned int i, const TrajectoryStateOnSurface& tsos) {
+    GlobalPoint pos = tsos.globalPosition();
+    GlobalVector mom = tsos.globalMomentum();
+    soa.x[i] = pos.x();   soa.y[i] = pos.y();   soa.z[i] = pos.z();
+    soa.px[i] = mom.x();  soa.py[i] = mom.y();  soa.pz[i] = mom.z();
+    if (tsos.hasError())
+      TrackPropagation::algebraicSymMatrix55ToPacked(tsos.curvilinearError().matrix(),
+						     &soa.covariance[15*i]);
+    else
+      std::fill(&soa.covariance[15*i], &soa.covariance[15*i] + 15, 0.);
+  }
+
+  //CMS state of the result i of a batch, on the target of the request
+  TrajectoryStateOnSurface resultState(const Geant4ePropagationBatchResult& result,
+				       unsigned int i,
+				       const Geant4ePropagationBatch& batch,
+				       const MagneticField* field) {
+    GlobalTrajectoryParameters pars(GlobalPoint(result.x[i], result.y[i], result.z[i]),
+				    GlobalVector(result.px[i], result.py[i], result.pz[i]),
+				    batch.charge[i], field);
+    if (!batch.hasError[i])
+      return TrajectoryStateOnSurface(pars, *batch.target[i], 
+				      SurfaceSideDefinition::atCenterOfSurface);
+    AlgebraicSymMatrix55 cov;
+    TrackPropagation::packedToAlgebraicSymMatrix55(&result.covariance[15*i], cov);
+    return TrajectoryStateOnSurface(pars, CurvilinearTrajectoryError(cov), 
+				    *batch.target[i], 
+				    SurfaceSideDefinition::atCenterOfSurface);
+  }
+
+  //Takes one leg of a request off the budget left to it. Returns the limit
+  //the leg used up, if any, since a limit at 0 would be disabled
+  Geant4eSteppingAction::Status spend(Geant4eSteppingAction::Budget& budget, 
+				      unsigned int steps, double path, 
+				      double time, double turns) {
+    if (budget.maxSteps > 0 && (budget.maxSteps -= int(steps)) <= 0)
+      return Geant4eSteppingAction::kMaxSteps;
+    if (budget.maxPath > 0 && (budget.maxPath -= path) <= 0)
+      return Geant4eSteppingAction::kMaxPath;
+    if (budget.maxTime > 0 && (budget.maxTime -= time) <= 0)
+      return Geant4eSteppingAction::kMaxTime;
+    if (budget.maxTurns > 0 && (budget.maxTurns -= turns) <= 0)
+      return Geant4eSteppingAction::kLooper;
+    return Geant4eSteppingAction::kOk;
+  }
+
+  //Curvilinear parameters (q/p, lambda, phi, xt, yt) of a state relative
+  //to a reference state, in the curvilinear frame of the reference
+  AlgebraicVector5 curvilinearOffset(const GlobalTrajectoryParameters& pars,
+				     const GlobalTrajectoryParameters& ref) {
+    GlobalVector mom = pars.momentum(), refMom = ref.momentum();
+    double refPhi = refMom.phi(), refLambda = M_PI/2 - refMom.theta();
+    double dphi = mom.phi() - refPhi;
+    if (dphi > M_PI) dphi -= 2*M_PI;
+    if (dphi < -M_PI) dphi += 2*M_PI;
+    GlobalVector u(-std::sin(refPhi), std::cos(refPhi), 0);
+    GlobalVector v(-std::sin(refLambda)*std::cos(refPhi), 
+		   -std::sin(refLambda)*std::sin(refPhi), std::cos(refLambda));
+    GlobalVector dx = pars.position() - ref.position();
+    AlgebraicVector5 offset;
+    offset[0] = pars.signedInverseMomentum() - ref.signedInverseMomentum();
+    offset[1] = (M_PI/2 - mom.theta()) - refLambda;
+    offset[2] = dphi;
+    offset[3] = dx.dot(u);
+    offset[4] = dx.dot(v);
+    return offset;
+  }
+
+  //Inverse of curvilinearOffset()
+  GlobalTrajectoryParameters 
+  curvilinearShifted(const GlobalTrajectoryParameters& ref,
+		     const AlgebraicVector5& offset, const MagneticField* field) {
+    GlobalVector refMom = ref.momentum();
+    double refPhi = refMom.phi(), refLambda = M_PI/2 - refMom.theta();
+    GlobalVector u(-std::sin(refPhi), std::cos(refPhi), 0);
+    GlobalVector v(-std::sin(refLambda)*std::cos(refPhi), 
+		   -std::sin(refLambda)*std::sin(refPhi), std::cos(refLambda));
+    double qOverP = ref.signedInverseMomentum() + offset[0];
+    double lambda = refLambda + offset[1], phi = refPhi + offset[2];
+    GlobalVector dir(std::cos(lambda)*std::cos(phi), std::cos(lambda)*std::sin(phi),
+		     std::sin(lambda));
+    return GlobalTrajectoryParameters(ref.position() + offset[3]*u + offset[4]*v,
+				      dir/std::abs(qOverP), 
+				      qOverP > 0 ? 1 : -1, field);
+  }
+
+  //Signed straight line path from pos along mom to a plane or a cylinder
+  std::pair<bool, double> straightPath(const GlobalPoint& pos, 
+				       const GlobalVector& mom,
+				       const Surface& dest) {
+    std::pair<bool, double> path(false, 0);
+    if (const Plane* plane = dynamic_cast<const Plane*>(&dest)) {
+      StraightLinePlaneCrossing crossing(pos.basicVector(), mom.basicVector(),
+					 anyDirection);
+      path = crossing.pathLength(*plane);
+    } else if (const Cylinder* cylinder = dynamic_cast<const Cylinder*>(&dest)) {
+      StraightLineCylinderCrossing crossing(cylinder->toLocal(pos), 
+					    cylinder->toLocal(mom.unit()),
+					    anyDirection);
+      path = crossing.pathLength(*cylinder);
+    }
+    return path;
+  }
+
+  //Moves a state along a straight line onto a plane or a cylinder. The
+  //errors are curvilinear, so they do not change
+  GlobalPoint ontoSurface(const GlobalPoint& pos, const GlobalVector& mom,
+			  const Surface& dest) {
+    std::pair<bool, double> path = straightPath(pos, mom, dest);
+    return path.first ? pos + path.second*mom.unit() : pos;
+  }
+
+  //Visiting order of a batch: requests of the same region, to the same
+  //target, and then to neighbouring targets, are propagated one after the
+  //other so that Geant4 navigates through the same volumes
+  struct BatchOrder {
+    uint64_t region;
+    const Surface* target;
+    float targetPhi, targetZ, startPhi;
+    bool operator<(const BatchOrder& o) const {
+      if (region != o.region) return region < o.region;
+      if (targetPhi != o.targetPhi) return targetPhi < o.targetPhi;
+      if (targetZ != o.targetZ) return targetZ < o.targetZ;
+      if (target != o.target) return target < o.target;
+      return startPhi < o.startPhi;
+    }
+  };
+
+  //Gives the profile to the shared stepping action for one propagation
+  class ProfileScope {
+  public:
+    ProfileScope(Geant4eSteppingAction* action, Geant4eVolumeProfile* profile):
+      theAction(action) {theAction->setProfile(profile);}
+    ~ProfileScope() {theAction->setProfile(0);}
+  private:
+    Geant4eSteppingAction* theAction;
+  };
+
+  //Sets a per call member of the propagator for one call, and restores it
+  //also if the propagation throws
+  template <class T>
+  class CallSetting {
+  public:
+    CallSetting(T& member, const T& value): theMember(member), theOld(member) {
+      theMember = value;
+    }
+    ~CallSetting() {theMember = theOld;}
+  private:
+    T& theMember;
+    T theOld;
+  };
+}
+
+
+/** Job statistics of the budget and of the bounds check. Index kOk counts
+ *  all the Geant4e calls
+ */
+struct Geant4ePropagator::BudgetCounters {
+  BudgetCounters(): rejected(0) {
+    for (unsigned int i = 0; i < Geant4eSteppingAction::kNStatus; i++)
+      counts[i] = 0;
+  }
+  ~BudgetCounters() {
+    if (rejected > 0)
+      edm::LogInfo("Geant4e") << "G4e -  " << rejected 
+			      << " propagations to unreachable targets rejected "
+			      << "by the bounds check";
+
+    unsigned long stopped = 0;
+    for (unsigned int i = 1; i < Geant4eSteppingAction::kNStatus; i++)
+      stopped += counts[i];
+    if (stopped == 0)
+      return;
+
+    edm::LogInfo log("Geant4e");
+    log << "G4e -  " << stopped << " of " << counts[0] 
+	<< " propagations stopped by the budget:";
+    for (unsigned int i = 1; i < Geant4eSteppingAction::kNStatus; i++)
+      log << " " << statusNames[i] << " " << counts[i];
+  }
+  unsigned long counts[Geant4eSteppingAction::kNStatus];
+  unsigned long rejected;
+};
+
+
 /** Constructor. 
  */
 Geant4ePropagator::Geant4ePropagator(const MagneticField* field,
@@ -32,9 +324,25 @@ Geant4ePropagator::Geant4ePropagator(const MagneticField* field,
 				     PropagationDirection dir):
   Propagator(dir),
   theField(field),
+  theFieldCellSize(0),
   theParticleName(particleName),
-  theG4eManager(G4ErrorPropagatorManager::GetErrorPropagatorManager()),
-  theSteppingAction(0) {
+  theCore(particleName),
+  theSteppingAction(0),
+  theLastG4eError(0),
+  theLastPath(0),
+  theTableMaxResidual(0),
+  thePhysics("Geant4e"),
+  theReducedGeometryMinVolume(0),
+  theFastErrorTransport(false),
+  theStoreTransport(false),
+  theCallStoreTransport(false),
+  theTransportValid(false),
+  theMixtureMaxSpread(0.1),
+  theBoundsCheckMargin(0),
+  theStoreAlignmentDerivatives(false),
+  theAlignmentDerivativesValid(false),
+  theCallBudget(0),
+  theBudgetCounters(new BudgetCounters) {
 
   G4ErrorPropagatorData::SetVerbose(0);
 }
@@ -44,6 +352,326 @@ Geant4ePropagator::Geant4ePropagator(const MagneticField* field,
 Geant4ePropagator::~Geant4ePropagator() {
 }
 
+void Geant4ePropagator::setPropagationTable(const std::string& fileName,
+					    double maxResidual) {
+  theTable.reset(new Geant4ePropagationTable(fileName));
+  theTableMaxResidual = maxResidual;
+
+  if (theParticleName != theTable->header().particle)
+    edm::LogWarning("Geant4e") << "G4e -  Propagation table " << fileName 
+			       << " was built for particle '" 
+			       << theTable->header().particle 
+			       << "' but the propagator uses '" 
+			       << theParticleName 
+			       << "'. The table will not be used.";
+}
+
+void Geant4ePropagator::setCaptureFile(const std::string& fileName) {
+  if (fileName.empty())
+    theCapture.reset();
+  else
+    theCapture = Geant4ePropagationLog::Writer::open(fileName, theParticleName);
+}
+
+void Geant4ePropagator::setPhysicsTableCache(const std::string& directory) {
+  thePhysicsTableCache = directory;
+}
+
+void Geant4ePropagator::setPhysics(const std::string& physics) {
+  if (physics != "Geant4e" && physics != "Tabulated" && physics != "MuonMinimal")
+    throw cms::Exception("Geant4e") << "Unknown physics '" << physics 
+				    << "'. Use Geant4e, Tabulated or MuonMinimal";
+  if (physics == "MuonMinimal" && theParticleName != "mu")
+    throw cms::Exception("Geant4e") << "The MuonMinimal physics cannot propagate '"
+				    << theParticleName << "'";
+  thePhysics = physics;
+}
+
+void Geant4ePropagator::setBatchRegions(const std::vector<double>& radii) {
+  theBatchRegionRadii = radii;
+  std::sort(theBatchRegionRadii.begin(), theBatchRegionRadii.end());
+}
+
+void Geant4ePropagator::setFieldOnlyRegions(const std::vector<unsigned int>& regions) {
+  theFieldOnlyRegions = regions;
+}
+
+const Geant4eMagneticField* Geant4ePropagator::fieldAdapter() const {
+  return static_cast<const Geant4eMagneticField*>(theCore.field());
+}
+
+/** If Geant4e is not running yet, the parameters are checked at the
+ *  first propagation. Otherwise the field adapter of this propagator is
+ *  created first, the minimum step needs it.
+ */
+bool Geant4ePropagator::setSteppingParameters(const SteppingParameters& parameters) {
+  if (!theCore.initialised()) {
+    theCore.setSteppingParameters(parameters);
+    return true;
+  }
+  initialise();
+  if (theCore.setSteppingParameters(parameters))
+    return true;
+  warnSteppingParameters();
+  return false;
+}
+
+void Geant4ePropagator::warnSteppingParameters() const {
+  const SteppingParameters& pars = theCore.steppingParameters();
+  SteppingParameters current = Geant4ePropagatorCore::currentSteppingParameters();
+  edm::LogWarning("Geant4e") << "G4e -  Geant4 did not take all the stepping parameters. "
+			     << "Requested (0 to keep) / in use: DeltaChord " 
+			     << pars.deltaChord << "/" << current.deltaChord 
+			     << " mm, DeltaOneStep " << pars.deltaOneStep << "/" 
+			     << current.deltaOneStep << " mm, DeltaIntersection " 
+			     << pars.deltaIntersection << "/" << current.deltaIntersection
+			     << " mm, MinStep " << pars.minStep << "/" << current.minStep
+			     << " mm, MinimumEpsilonStep " << pars.minimumEpsilonStep 
+			     << "/" << current.minimumEpsilonStep 
+			     << ", MaximumEpsilonStep " << pars.maximumEpsilonStep 
+			     << "/" << current.maximumEpsilonStep;
+}
+
+void Geant4ePropagator::setReducedGeometry(double minVolume,
+					   const std::vector<std::string>& keep) {
+  theReducedGeometryMinVolume = minVolume;
+  theReducedGeometryKeep = keep;
+}
+
+void Geant4ePropagator::setProfileReport(const std::string& fileName) {
+  if (fileName.empty())
+    theProfile.reset();
+  else
+    theProfile.reset(new Geant4eVolumeProfile(fileName, 50, profileSummary));
+}
+
+void Geant4ePropagator::capture(Geant4ePropagationLog::Record& record,
+				const TrajectoryStateOnSurface& tsos) const {
+  Geant4ePropagationLog::fillResult(record, tsos, theLastG4eError, theLastPath);
+  theCapture->write(record);
+}
+
+unsigned int Geant4ePropagator::lastStepCount() const {
+  return theSteppingAction ? theSteppingAction->nSteps() : 0;
+}
+
+Geant4eSteppingAction::Status Geant4ePropagator::lastStatus() const {
+  return theSteppingAction ? theSteppingAction->status() : Geant4eSteppingAction::kOk;
+}
+
+bool Geant4ePropagator::lastTransport(AlgebraicMatrix55& jacobian,
+				      AlgebraicSymMatrix55& noise) const {
+  if (!theTransportValid)
+    return false;
+  jacobian = theTransportJacobian;
+  noise = theTransportNoise;
+  return true;
+}
+
+bool Geant4ePropagator::lastAlignmentDerivatives(AlignmentDerivatives& derivatives) const {
+  if (!theAlignmentDerivativesValid)
+    return false;
+  derivatives = theAlignmentDerivatives;
+  return true;
+}
+
+/** The plane moves by the local shift s and the small rotation w = (a, b, c)
+ *  around its local axes. A point x of the old local frame has the new
+ *  local coordinates x - s - w^(x - s). The track crosses the new plane at
+ *  t = dz + a y - b x along the direction (x', y', 1), so that
+ *    x -> x - dx + x' t + c y,   y -> y - dy + y' t - c x,
+ *  and the direction (x', y', 1) - w^(x', y', 1) gives the new slopes.
+ */
+Geant4ePropagator::AlignmentDerivatives
+Geant4ePropagator::alignmentDerivatives(const TrajectoryStateOnSurface& tsos) {
+  AlgebraicVector5 local = tsos.localParameters().vector();
+  double dxdz = local[1], dydz = local[2];
+  double x = local[3], y = local[4];
+
+  AlignmentDerivatives d;
+  //dx/dz
+  d(1, 3) = dxdz*dydz;
+  d(1, 4) = -(1 + dxdz*dxdz);
+  d(1, 5) = dydz;
+  //dy/dz
+  d(2, 3) = 1 + dydz*dydz;
+  d(2, 4) = -dxdz*dydz;
+  d(2, 5) = -dxdz;
+  //x
+  d(3, 0) = -1;
+  d(3, 2) = dxdz;
+  d(3, 3) = y*dxdz;
+  d(3, 4) = -x*dxdz;
+  d(3, 5) = y;
+  //y
+  d(4, 1) = -1;
+  d(4, 2) = dydz;
+  d(4, 3) = y*dydz;
+  d(4, 4) = -x*dydz;
+  d(4, 5) = -x;
+  return d;
+}
+
+unsigned long 
+Geant4ePropagator::budgetHits(Geant4eSteppingAction::Status status) const {
+  return theBudgetCounters->counts[status];
+}
+
+unsigned long Geant4ePropagator::boundsRejections() const {
+  return theBudgetCounters->rejected;
+}
+
+/** The helix at the start field is only a rough estimate of the path
+ *  through the return field of the yoke, where low momentum muons bend
+ *  back: a target is rejected only if both the helix and the straight
+ *  line miss it, i.e. do not reach it in the propagation direction or
+ *  cross it farther than the margin out of its bounds.
+ */
+bool Geant4ePropagator::unreachable(const FreeTrajectoryState& ftsStart,
+				    const Plane& pDest) const {
+  if (theBoundsCheckMargin <= 0)
+    return false;
+
+  HelixPlaneCrossing::PositionType x(ftsStart.position());
+  HelixPlaneCrossing::DirectionType p(ftsStart.momentum());
+  const double margin2 = theBoundsCheckMargin*theBoundsCheckMargin;
+  const LocalError margin(margin2, 0, margin2);
+
+  HelixArbitraryPlaneCrossing helix(x, p, ftsStart.transverseCurvature(), 
+				    propagationDirection());
+  std::pair<bool, double> path = helix.pathLength(pDest);
+  bool rejected = !path.first || 
+    !pDest.bounds().inside(pDest.toLocal(GlobalPoint(helix.position(path.second))), 
+			   margin);
+  if (rejected) {
+    StraightLinePlaneCrossing line(x, p, propagationDirection());
+    std::pair<bool, double> linePath = line.pathLength(pDest);
+    rejected = !linePath.first ||
+      !pDest.bounds().inside(pDest.toLocal(GlobalPoint(line.position(linePath.second))), 
+			     margin);
+  }
+
+  if (rejected) {
+    theBudgetCounters->rejected++;
+    //No steps for lastStepCount() and lastStatus() of this propagation
+    if (theSteppingAction)
+      theSteppingAction->reset();
+    LogDebug("Geant4e") << "G4e -  Target out of reach of the start state at " 
+			<< ftsStart.position() << " cm";
+  }
+  return rejected;
+}
+
+/** Initialise Geant4e the first time it is needed. The CMS field goes
+ *  to the core through the field adapter, which the core installs in the
+ *  Geant4 field manager before InitGeant4e() and before each propagation.
+ */
+void Geant4ePropagator::initialise() const {
+
+  if (theField && !theCore.field()) {
+    theCore.setField(new Geant4eMagneticField(theField, theFieldCellSize));
+    LogDebug("Geant4e") << "G4e -  Created field adapter. Cell size: " 
+			<< theFieldCellSize << " cm";
+  }
+
+  if (!theCore.initialised()) {
+    //The reduced geometry is built from the full one before Geant4e takes
+    //the world, and before the physics tables see its new materials
+    if (theReducedGeometryMinVolume > 0) {
+      G4VPhysicalVolume* world = G4TransportationManager::GetTransportationManager()
+	->GetNavigatorForTracking()->GetWorldVolume();
+      Geant4eReducedGeometry reduced(theReducedGeometryMinVolume*cm3, 
+				     theReducedGeometryKeep);
+      G4ErrorPropagatorManager::GetErrorPropagatorManager()
+	->SetUserInitialization(reduced.build(world));
+    }
+
+    //The core lets Geant4e build its default physics list if none is
+    //given, so provide it here when the tables have to go through the cache
+    G4VUserPhysicsList* physicsList = 0;
+    if (thePhysics == "Tabulated") {
+      theMaterialTables.reset(new Geant4eMaterialTables(
+	std::vector<std::string>(1, theParticleName)));
+      physicsList = new Geant4eTabulatedPhysicsList(theMaterialTables.get());
+    } else if (thePhysics == "MuonMinimal") {
+      physicsList = new Geant4eMuonPhysicsList;
+    } else if (!thePhysicsTableCache.empty()) {
+      physicsList = new G4ErrorPhysicsList;
+    }
+
+    std::unique_ptr<Geant4ePhysicsTableCache> cache;
+    if (!thePhysicsTableCache.empty()) {
+      cache.reset(new Geant4ePhysicsTableCache(thePhysicsTableCache, 
+					       theParticleName));
+      cache->prepare(physicsList);
+    }
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    theCore.initialise(physicsList);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    if (cache)
+      cache->store(physicsList);
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    edm::LogInfo log("Geant4e");
+    log << "G4e -  InitGeant4e took " 
+	<< std::chrono::duration<double>(t1 - t0).count() << " s";
+    if (cache && cache->retrieved())
+      log << " with the physics tables from the cache (key " 
+	  << cache->key() << ")";
+    else if (cache)
+      log << ", storing the physics tables in the cache took " 
+	  << std::chrono::duration<double>(t2 - t1).count() << " s (key "
+	  << cache->key() << ")";
+  }
+
+  //InitGeant4e builds its own chord finder, so this comes after it. Once
+  //per propagator, since Geant4e may have been initialised by another one
+  if (!theSteppingAction) {
+    theCore.initialise();
+    theSteppingAction = theCore.steppingAction();
+
+    if (!theCore.applySteppingParameters())
+      warnSteppingParameters();
+    else if (theCore.steppingParameters().any()) {
+      SteppingParameters current = Geant4ePropagatorCore::currentSteppingParameters();
+      LogDebug("Geant4e") << "G4e -  Stepping parameters: DeltaChord " 
+			  << current.deltaChord << " mm, DeltaOneStep " 
+			  << current.deltaOneStep << " mm, DeltaIntersection " 
+			  << current.deltaIntersection << " mm, MinStep " 
+			  << current.minStep << " mm, epsilon " 
+			  << current.minimumEpsilonStep << " to " 
+			  << current.maximumEpsilonStep;
+    }
+  }
+}
+
+/** Calls Geant4e through the core and keeps its return code. The
+ *  stepping action is shared by all the propagators, so it only sees the
+ *  profile of this one during the call.
+ */
+int Geant4ePropagator::propagateG4(G4ErrorFreeTrajState& g4eTrajState,
+				   const G4ErrorTarget& g4eTarget,
+				   G4ErrorMode mode) const {
+  ProfileScope profileScope(theSteppingAction, theProfile.get());
+  int ierr = theCore.propagateG4(g4eTrajState, g4eTarget, mode,
+				 theCallBudget ? *theCallBudget : theBudget);
+  theLastG4eError = ierr < 0 ? 0 : ierr;
+  //The stepping action works in Geant4 units
+  theLastPath = theSteppingAction->trackLength()/cm;
+
+  Geant4eSteppingAction::Status status = theSteppingAction->status();
+  theBudgetCounters->counts[Geant4eSteppingAction::kOk]++;
+  if (status != Geant4eSteppingAction::kOk) {
+    theBudgetCounters->counts[status]++;
+    LogDebug("Geant4e") << "G4e -  Propagation stopped by the budget (" 
+			<< statusNames[status] << ") after " 
+			<< theSteppingAction->nSteps() << " steps, " 
+			<< theSteppingAction->trackLength()/cm << " cm";
+  }
+  return ierr;
+}
+
 //
 ////////////////////////////////////////////////////////////////////////////
 //
@@ -55,15 +683,47 @@ Geant4ePropagator::~Geant4ePropagator() {
 TrajectoryStateOnSurface 
 Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart, 
 			      const Plane& pDest) const {
+  theAlignmentDerivativesValid = false;
+  Geant4ePropagationLog::Record record;
+  if (theCapture)
+    Geant4ePropagationLog::fillRequest(record, ftsStart, pDest, 
+				       propagationDirection());
 
-  if(theG4eManager->PrintG4ErrorState() == "G4ErrorState_PreInit")
-    theG4eManager->InitGeant4e();
+  TrajectoryStateOnSurface tsos = doPropagate(ftsStart, pDest);
 
-  if (!theSteppingAction) {
-    theSteppingAction = new Geant4eSteppingAction;
-    theG4eManager->SetUserAction(theSteppingAction);
+  if (theCapture)
+    capture(record, tsos);
+
+  theAlignmentDerivativesValid = theStoreAlignmentDerivatives && tsos.isValid();
+  if (theAlignmentDerivativesValid)
+    theAlignmentDerivatives = alignmentDerivatives(tsos);
+  return tsos;
+}
+
+TrajectoryStateOnSurface 
+Geant4ePropagator::doPropagate (const FreeTrajectoryState& ftsStart, 
+				const Plane& pDest) const {
+
+  theTransportValid = false;
+  theLastPath = 0;
+
+  if (unreachable(ftsStart, pDest)) {
+    theLastG4eError = 0;
+    return TrajectoryStateOnSurface();
+  }
+
+  if (theTable) {
+    int station = theTable->findStation(pDest);
+    if (station >= 0) {
+      TrajectoryStateOnSurface tsos = 
+	propagateWithTable(ftsStart, station, pDest);
+      if (tsos.isValid())
+	return tsos;
+    }
   }
 
+  initialise();
+
   ///////////////////////////////
   // Construct the target surface
   //
@@ -98,10 +758,9 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   //DEBUG
 
   //* Set the target surface
-  G4ErrorSurfaceTarget* g4eTarget = new G4ErrorPlaneSurfaceTarget(surfNorm,
-								  surfPos);
+  G4ErrorPlaneSurfaceTarget g4eTarget(surfNorm, surfPos);
 
-  //g4eTarget->Dump("G4e - ");
+  //g4eTarget.Dump("G4e - ");
   //
   ///////////////////////////////
 
@@ -111,13 +770,18 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
 
   // * Get the starting point and direction and convert them to CLHEP::Hep3Vector 
   //   for G4. CMS uses cm and GeV while Geant4 uses mm and MeV
-  GlobalPoint  cmsInitPos = ftsStart.position();
-  GlobalVector cmsInitMom = ftsStart.momentum();
-
-  CLHEP::Hep3Vector g4InitPos = 
-    TrackPropagation::globalPointToHep3Vector(cmsInitPos);
-  CLHEP::Hep3Vector g4InitMom = 
-    TrackPropagation::globalVectorToHep3Vector(cmsInitMom*GeV);
+  //   The error matrix is converted in the same pass. Without errors
+  //   Geant4e starts from the unit matrix
+  const GlobalTrajectoryParameters& cmsInitPars = ftsStart.parameters();
+  GlobalPoint  cmsInitPos = cmsInitPars.position();
+  GlobalVector cmsInitMom = cmsInitPars.momentum();
+
+  CLHEP::Hep3Vector g4InitPos;
+  CLHEP::Hep3Vector g4InitMom;
+  G4ErrorTrajErr g4error(5, 1);
+  TrackPropagation::freeStateToG4(cmsInitPars,
+				  ftsStart.hasError() ? &ftsStart.curvilinearError() : 0,
+				  g4InitPos, g4InitMom, g4error);
 
   //DEBUG
   LogDebug("Geant4e") << "G4e -  Initial CMS point position:" << cmsInitPos 
@@ -159,16 +823,10 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   ///////////////////////////////
   //Set the error and trajectories, and finally propagate
   //
-  G4ErrorTrajErr g4error( 5, 1 );
-  if(ftsStart.hasError()) {
-    const CurvilinearTrajectoryError initErr = ftsStart.curvilinearError();
-    g4error = TrackPropagation::algebraicSymMatrix55ToG4ErrorTrajErr( initErr , charge); //The error matrix
-  }
   LogDebug("Geant4e") << "G4e -  Error matrix: " << g4error;
 
-  G4ErrorFreeTrajState* g4eTrajState = 
-    new G4ErrorFreeTrajState(particleName, g4InitPos, g4InitMom, g4error);
-  LogDebug("Geant4e") << "G4e -  Traj. State: " << (*g4eTrajState);
+  Geant4eFreeTrajState g4eTrajState(particleName, g4InitPos, g4InitMom, g4error);
+  LogDebug("Geant4e") << "G4e -  Traj. State: " << g4eTrajState;
 
   //Set the mode of propagation according to the propagation direction
   G4ErrorMode mode = G4ErrorMode_PropForwards;
@@ -179,14 +837,11 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   } else if(propagationDirection() == alongMomentum) {
     LogDebug("Geant4e") << "G4e -  Propagator mode is \'forwards\'";
   } else {   //Mode must be anyDirection then - need to figure out for Geant which it is
-    std::cout << "Determining actual direction";
     if(pDest.localZ(cmsInitPos)*pDest.localZ(cmsInitMom) < 0) {
-      LogDebug("Geant4e") << "G4e -  Propagator mode is \'forwards\'";
-      std::cout << ", got forwards" << std::endl;
+      LogDebug("Geant4e") << "G4e -  Propagator mode is \'forwards\' (any direction)";
     } else {
       mode = G4ErrorMode_PropBackwards;
-      LogDebug("Geant4e") << "G4e -  Propagator mode is \'backwards\'";
-      std::cout << ", got backwards" << std::endl;
+      LogDebug("Geant4e") << "G4e -  Propagator mode is \'backwards\' (any direction)";
     }
   }
 
@@ -196,17 +851,15 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   //////////////////////////////
   // Propagate
 
-  int ierr;
-  if(mode == G4ErrorMode_PropBackwards) {
-    //To make geant transport the particle correctly need to give it the opposite momentum
-    //because geant flips the B field bending and adds energy instead of subtracting it
-    //but still wants the momentum "backwards"
-    g4eTrajState->SetMomentum( -g4eTrajState->GetMomentum());
-    ierr = theG4eManager->Propagate( g4eTrajState, g4eTarget, mode);
-    g4eTrajState->SetMomentum( -g4eTrajState->GetMomentum());
-  } else {
-    ierr = theG4eManager->Propagate( g4eTrajState, g4eTarget, mode);
-  }
+  if (theFastErrorTransport && ftsStart.hasError() && 
+      mode == G4ErrorMode_PropForwards)
+    g4eTrajState.setFastErrorTransport(ftsStart.curvilinearError().matrix(),
+				       charge, theField, theMaterialTables.get());
+  if ((theStoreTransport || theCallStoreTransport) && ftsStart.hasError() && 
+      mode == G4ErrorMode_PropForwards)
+    g4eTrajState.accumulateJacobian(charge);
+
+  int ierr = propagateG4(g4eTrajState, g4eTarget, mode);
   LogDebug("Geant4e") << "G4e -  Return error from propagation: " << ierr;
 
   if(ierr!=0) {
@@ -222,11 +875,20 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   // and points, and build global trajectory parameters.
   // CMS uses cm and GeV while Geant4 uses mm and MeV
   //
-  HepGeom::Point3D<double>  posEnd = g4eTrajState->GetPosition();
-  HepGeom::Vector3D<double>  momEnd = g4eTrajState->GetMomentum();
-
-  GlobalPoint  posEndGV = TrackPropagation::hepPoint3DToGlobalPoint(posEnd);
-  GlobalVector momEndGV = TrackPropagation::hep3VectorToGlobalVector(momEnd)/GeV;
+  //The error covariance matrix from Geant4e comes in curvilinear
+  //coordinates, so it is converted in the same pass
+  GlobalPoint  posEndGV;
+  GlobalVector momEndGV;
+  AlgebraicSymMatrix55 covEnd;
+  TrackPropagation::g4ToFreeState(g4eTrajState, charge, posEndGV, momEndGV, covEnd);
+  if (g4eTrajState.fastErrorTransport())
+    covEnd = g4eTrajState.curvilinearError();
+  if (g4eTrajState.accumulatesJacobian()) {
+    theTransportJacobian = g4eTrajState.jacobian();
+    theTransportNoise = covEnd - ROOT::Math::Similarity(theTransportJacobian, 
+							ftsStart.curvilinearError().matrix());
+    theTransportValid = true;
+  }
 
   //DEBUG
   LogDebug("Geant4e") << "G4e -  Final CMS point position:" << posEndGV 
@@ -235,12 +897,12 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
 		      << posEndGV.perp() << " cm, " 
 		      << posEndGV.eta() << ", " 
 		      << posEndGV.phi().degrees() << " deg)\n"
-		      << "G4e -  Final G4  point position: " << posEnd 
-		      << " mm,\tRo =" << posEnd.perp()  << " mm";
+		      << "G4e -  Final G4  point position: " 
+		      << g4eTrajState.GetPosition() << " mm";
   LogDebug("Geant4e") << "G4e -  Final CMS momentum      :" << momEndGV
 		      << "GeV\n"
-		      << "G4e -  Final G4  momentum      : " << momEnd 
-		      << " MeV";
+		      << "G4e -  Final G4  momentum      : " 
+		      << g4eTrajState.GetMomentum() << " MeV";
   LogDebug("Geant4e") << "G4e -  Distance from final point to plane: " 
 		      << pDest.localZ(posEndGV) << " cm";
   //DEBUG
@@ -248,12 +910,9 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   GlobalTrajectoryParameters tParsDest(posEndGV, momEndGV, charge, theField);
 
 
-  // Get the error covariance matrix from Geant4e. It comes in curvilinear
-  // coordinates so use the appropiate CMS class  
-  G4ErrorTrajErr g4errorEnd = g4eTrajState->GetError();
-  CurvilinearTrajectoryError 
-    curvError(TrackPropagation::g4ErrorTrajErrToAlgebraicSymMatrix55(g4errorEnd, charge));
-  LogDebug("Geant4e") << "G4e -  Error matrix after propagation: " << g4errorEnd;
+  CurvilinearTrajectoryError curvError(covEnd);
+  LogDebug("Geant4e") << "G4e -  Error matrix after propagation: " 
+		      << g4eTrajState.GetError();
 
   ////////////////////////////////////////////////////////////////////////
   // We set the SurfaceSide to atCenterOfSurface.                       //
@@ -270,8 +929,14 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
 //Don't need extra info about starting surface; use regular propagation method
 TrajectoryStateOnSurface
 Geant4ePropagator::propagate (const TrajectoryStateOnSurface& tsos, const Plane& plane) const {
-  const FreeTrajectoryState ftsStart = *tsos.freeState();
-  return propagate(ftsStart,plane);
+  return propagate(*tsos.freeState(),plane);
+}
+
+TrajectoryStateOnSurface
+Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart, const Plane& pDest,
+			      const Geant4eSteppingAction::Budget& budget) const {
+  CallSetting<const Geant4eSteppingAction::Budget*> callBudget(theCallBudget, &budget);
+  return propagate(ftsStart, pDest);
 }
 
 
@@ -281,14 +946,38 @@ Geant4ePropagator::propagate (const TrajectoryStateOnSurface& tsos, const Plane&
 TrajectoryStateOnSurface 
 Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart, 
 			      const Cylinder& cDest) const {
+  theAlignmentDerivativesValid = false;
+  if (!theCapture)
+    return doPropagate(ftsStart, cDest);
+
+  Geant4ePropagationLog::Record record;
+  Geant4ePropagationLog::fillRequest(record, ftsStart, cDest, 
+				     propagationDirection());
+  TrajectoryStateOnSurface tsos = doPropagate(ftsStart, cDest);
+  capture(record, tsos);
+  return tsos;
+}
 
-  if(theG4eManager->PrintG4ErrorState() == "G4ErrorState_PreInit")
-    theG4eManager->InitGeant4e();
-  if (!theSteppingAction) {
-    theSteppingAction = new Geant4eSteppingAction;
-    theG4eManager->SetUserAction(theSteppingAction);
+TrajectoryStateOnSurface 
+Geant4ePropagator::doPropagate (const FreeTrajectoryState& ftsStart, 
+				const Cylinder& cDest) const {
+
+  theTransportValid = false;
+  theLastPath = 0;
+  theAlignmentDerivativesValid = false;
+
+  if (theTable) {
+    int station = theTable->findStation(cDest);
+    if (station >= 0) {
+      TrajectoryStateOnSurface tsos = 
+	propagateWithTable(ftsStart, station, cDest);
+      if (tsos.isValid())
+	return tsos;
+    }
   }
 
+  initialise();
+
   //Get Cylinder parameters.
   //CMS uses cm and GeV while Geant4 uses mm and MeV.
   // - Radius
@@ -307,8 +996,7 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
 
 
   //Set the target surface
-  G4ErrorSurfaceTarget* g4eTarget = new G4ErrorCylSurfaceTarget(radCyl,	posCyl,
-								rotCyl);
+  G4ErrorCylSurfaceTarget g4eTarget(radCyl, posCyl, rotCyl);
 
   //DEBUG
   LogDebug("Geant4e") << "G4e -  Destination CMS cylinder position:" << cDest.position() << "cm\n"
@@ -321,13 +1009,18 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
 
   //Get the starting point and direction and convert them to CLHEP::Hep3Vector for G4
   //CMS uses cm and GeV while Geant4 uses mm and MeV
-  GlobalPoint  cmsInitPos = ftsStart.position();
-  GlobalVector cmsInitMom = ftsStart.momentum();
-
-  CLHEP::Hep3Vector g4InitMom = 
-    TrackPropagation::globalVectorToHep3Vector(cmsInitMom*GeV);
-  CLHEP::Hep3Vector g4InitPos = 
-    TrackPropagation::globalPointToHep3Vector(cmsInitPos);
+  //The error matrix is converted in the same pass. Without errors
+  //Geant4e starts from the unit matrix
+  const GlobalTrajectoryParameters& cmsInitPars = ftsStart.parameters();
+  GlobalPoint  cmsInitPos = cmsInitPars.position();
+  GlobalVector cmsInitMom = cmsInitPars.momentum();
+
+  CLHEP::Hep3Vector g4InitPos;
+  CLHEP::Hep3Vector g4InitMom;
+  G4ErrorTrajErr g4error(5, 1);
+  TrackPropagation::freeStateToG4(cmsInitPars,
+				  ftsStart.hasError() ? &ftsStart.curvilinearError() : 0,
+				  g4InitPos, g4InitMom, g4error);
 
   //DEBUG
   LogDebug("Geant4e") << "G4e -  Initial CMS point position:" << cmsInitPos 
@@ -353,16 +1046,10 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   LogDebug("Geant4e") << "G4e -  Particle name: " << particleName;
 
   //Set the error and trajectories, and finally propagate
-  G4ErrorTrajErr g4error( 5, 1 );
-  if(ftsStart.hasError()) {
-    const CurvilinearTrajectoryError initErr = ftsStart.curvilinearError();
-    g4error = TrackPropagation::algebraicSymMatrix55ToG4ErrorTrajErr( initErr , charge); //The error matrix
-  }
   LogDebug("Geant4e") << "G4e -  Error matrix: " << g4error;
 
-  G4ErrorFreeTrajState* g4eTrajState = 
-    new G4ErrorFreeTrajState(particleName, g4InitPos, g4InitMom, g4error);
-  LogDebug("Geant4e") << "G4e -  Traj. State: " << (*g4eTrajState);
+  Geant4eFreeTrajState g4eTrajState(particleName, g4InitPos, g4InitMom, g4error);
+  LogDebug("Geant4e") << "G4e -  Traj. State: " << g4eTrajState;
 
   //Set the mode of propagation according to the propagation direction
   G4ErrorMode mode = G4ErrorMode_PropForwards;
@@ -390,17 +1077,15 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   //////////////////////////////
   // Propagate
 
-  int ierr;
-  if(mode == G4ErrorMode_PropBackwards) {
-    //To make geant transport the particle correctly need to give it the opposite momentum
-    //because geant flips the B field bending and adds energy instead of subtracting it
-    //but still wants the momentum "backwards"
-    g4eTrajState->SetMomentum( -g4eTrajState->GetMomentum());
-    ierr = theG4eManager->Propagate( g4eTrajState, g4eTarget, mode);
-    g4eTrajState->SetMomentum( -g4eTrajState->GetMomentum());
-  } else {
-    ierr = theG4eManager->Propagate( g4eTrajState, g4eTarget, mode);
-  }
+  if (theFastErrorTransport && ftsStart.hasError() && 
+      mode == G4ErrorMode_PropForwards)
+    g4eTrajState.setFastErrorTransport(ftsStart.curvilinearError().matrix(),
+				       charge, theField, theMaterialTables.get());
+  if ((theStoreTransport || theCallStoreTransport) && ftsStart.hasError() && 
+      mode == G4ErrorMode_PropForwards)
+    g4eTrajState.accumulateJacobian(charge);
+
+  int ierr = propagateG4(g4eTrajState, g4eTarget, mode);
   LogDebug("Geant4e") << "G4e -  Return error from propagation: " << ierr;
 
   if(ierr!=0) {
@@ -411,11 +1096,20 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
   // Retrieve the state in the end from Geant4e, converte them to CMS vectors
   // and points, and build global trajectory parameters
   // CMS uses cm and GeV while Geant4 uses mm and MeV
-  HepGeom::Point3D<double>  posEnd = g4eTrajState->GetPosition();
-  HepGeom::Vector3D<double>  momEnd = g4eTrajState->GetMomentum();
-
-  GlobalPoint  posEndGV = TrackPropagation::hepPoint3DToGlobalPoint(posEnd);
-  GlobalVector momEndGV = TrackPropagation::hep3VectorToGlobalVector(momEnd)/GeV;
+  //The error covariance matrix from Geant4e comes in curvilinear
+  //coordinates, so it is converted in the same pass
+  GlobalPoint  posEndGV;
+  GlobalVector momEndGV;
+  AlgebraicSymMatrix55 covEnd;
+  TrackPropagation::g4ToFreeState(g4eTrajState, charge, posEndGV, momEndGV, covEnd);
+  if (g4eTrajState.fastErrorTransport())
+    covEnd = g4eTrajState.curvilinearError();
+  if (g4eTrajState.accumulatesJacobian()) {
+    theTransportJacobian = g4eTrajState.jacobian();
+    theTransportNoise = covEnd - ROOT::Math::Similarity(theTransportJacobian, 
+							ftsStart.curvilinearError().matrix());
+    theTransportValid = true;
+  }
 
 
   //DEBUG
@@ -425,22 +1119,19 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
 		      << posEndGV.perp() << " cm, " 
 		      << posEndGV.eta() << ", " 
 		      << posEndGV.phi().degrees() << " deg)\n"
-		      << "G4e -  Final G4  point position: " << posEnd 
-		      << " mm,\tRo =" << posEnd.perp()  << " mm";
+		      << "G4e -  Final G4  point position: " 
+		      << g4eTrajState.GetPosition() << " mm";
   LogDebug("Geant4e") << "G4e -  Final CMS momentum      :" << momEndGV
 		      << "GeV\n"
-		      << "G4e -  Final G4  momentum      : " << momEnd 
-		      << " MeV";
+		      << "G4e -  Final G4  momentum      : " 
+		      << g4eTrajState.GetMomentum() << " MeV";
 
   GlobalTrajectoryParameters tParsDest(posEndGV, momEndGV, charge, theField);
 
 
-  // Get the error covariance matrix from Geant4e. It comes in curvilinear
-  // coordinates so use the appropiate CMS class  
-  G4ErrorTrajErr g4errorEnd = g4eTrajState->GetError();
-  CurvilinearTrajectoryError 
-    curvError(TrackPropagation::g4ErrorTrajErrToAlgebraicSymMatrix55(g4errorEnd, charge));
-  LogDebug("Geant4e") << "G4e -  Error matrix after propagation: " << g4errorEnd;
+  CurvilinearTrajectoryError curvError(covEnd);
+  LogDebug("Geant4e") << "G4e -  Error matrix after propagation: " 
+		      << g4eTrajState.GetError();
 
   ////////////////////////////////////////////////////////////////////////
   // We set the SurfaceSide to atCenterOfSurface.                       //
@@ -456,11 +1147,516 @@ Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart,
 //Don't need extra info about starting surface; use regular propagation method
 TrajectoryStateOnSurface
 Geant4ePropagator::propagate (const TrajectoryStateOnSurface& tsos, const Cylinder& cyl) const {
-  const FreeTrajectoryState ftsStart = *tsos.freeState();
-  return propagate(ftsStart,cyl);
+  return propagate(*tsos.freeState(),cyl);
+}
+
+TrajectoryStateOnSurface
+Geant4ePropagator::propagate (const FreeTrajectoryState& ftsStart, const Cylinder& cDest,
+			      const Geant4eSteppingAction::Budget& budget) const {
+  CallSetting<const Geant4eSteppingAction::Budget*> callBudget(theCallBudget, &budget);
+  return propagate(ftsStart, cDest);
+}
+
+
+TrajectoryStateOnSurface
+Geant4ePropagator::propagateMixture(const TrajectoryStateOnSurface& tsos, 
+				    const Plane& plane,
+				    std::vector<MixtureEnergyLoss>* energyLoss) const {
+  theAlignmentDerivativesValid = false;
+  return propagateMixtureTo(tsos, plane, energyLoss);
+}
+
+TrajectoryStateOnSurface
+Geant4ePropagator::propagateMixture(const TrajectoryStateOnSurface& tsos, 
+				    const Cylinder& cyl,
+				    std::vector<MixtureEnergyLoss>* energyLoss) const {
+  theAlignmentDerivativesValid = false;
+  return propagateMixtureTo(tsos, cyl, energyLoss);
+}
+
+TrajectoryStateOnSurface
+Geant4ePropagator::propagateWithTransport(const FreeTrajectoryState& ftsStart,
+					  const Surface& dest) const {
+  CallSetting<bool> storeTransport(theCallStoreTransport, true);
+  const Plane* plane = dynamic_cast<const Plane*>(&dest);
+  return plane ? doPropagate(ftsStart, *plane) :
+    doPropagate(ftsStart, static_cast<const Cylinder&>(dest));
+}
+
+/** Mixture propagation. The mean starts without errors, so that the error
+ *  at its end is the noise of the path. A component at the curvilinear
+ *  offset d from the mean ends at the offset J d from the end of the mean,
+ *  with the error J C Jt plus the noise, and is moved along a straight
+ *  line onto the target. The mixture is captured as its collapsed state,
+ *  with the path of the mean.
+ */
+TrajectoryStateOnSurface
+Geant4ePropagator::propagateMixtureTo(const TrajectoryStateOnSurface& tsos,
+				      const Surface& dest,
+				      std::vector<MixtureEnergyLoss>* energyLoss) const {
+  if (energyLoss)
+    energyLoss->clear();
+  if (!tsos.isValid())
+    return TrajectoryStateOnSurface();
+
+  Geant4ePropagationLog::Record record;
+  const bool captured = theCapture &&
+    Geant4ePropagationLog::fillRequest(record, *tsos.freeState(), dest, 
+				       propagationDirection());
+
+  std::vector<TrajectoryStateOnSurface> components = tsos.components();
+
+  //Weighted mean of the components
+  double weightSum = 0;
+  GlobalVector posSum, momSum;
+  for (unsigned int k = 0; k < components.size(); k++) {
+    const double weight = components[k].weight();
+    weightSum += weight;
+    posSum += weight*(components[k].globalPosition() - GlobalPoint(0, 0, 0));
+    momSum += weight*components[k].globalMomentum();
+  }
+  if (weightSum <= 0)
+    return TrajectoryStateOnSurface();
+  GlobalTrajectoryParameters meanStart(GlobalPoint(0, 0, 0) + posSum/weightSum,
+				       momSum/weightSum, 
+				       components.front().charge(), theField);
+
+  TrajectoryStateOnSurface meanEnd = 
+    propagateWithTransport(FreeTrajectoryState(meanStart, 
+					       CurvilinearTrajectoryError(AlgebraicSymMatrix55())),
+			   dest);
+  const double meanPath = theLastPath;
+  const bool linear = meanEnd.isValid() && theTransportValid;
+  const AlgebraicMatrix55 jacobian = theTransportJacobian;
+  const AlgebraicSymMatrix55 noise = theTransportNoise;
+  const double meanP = meanStart.momentum().mag();
+
+  MultiTrajectoryStateAssembler assembler;
+  unsigned int nLinear = 0;
+  for (unsigned int k = 0; k < components.size(); k++) {
+    const TrajectoryStateOnSurface& component = components[k];
+    const double weight = component.weight();
+    const double pStart = component.globalMomentum().mag();
+
+    TrajectoryStateOnSurface end;
+    double variance = 0;
+    if (linear && component.hasError() &&
+	std::abs(pStart/meanP - 1) <= theMixtureMaxSpread) {
+      GlobalTrajectoryParameters pars = 
+	curvilinearShifted(meanEnd.globalParameters(), 
+			   jacobian*curvilinearOffset(component.globalParameters(), meanStart),
+			   theField);
+      pars = GlobalTrajectoryParameters(ontoSurface(pars.position(), pars.momentum(), dest),
+					pars.momentum(), pars.charge(), theField);
+      AlgebraicSymMatrix55 cov = 
+	transportCovariance(jacobian, noise, component.curvilinearError().matrix());
+      end = TrajectoryStateOnSurface(pars, CurvilinearTrajectoryError(cov), dest,
+				     SurfaceSideDefinition::atCenterOfSurface, weight);
+      variance = noise(0, 0);
+      nLinear++;
+    } else {
+      TrajectoryStateOnSurface single = 
+	propagateWithTransport(*component.freeState(), dest);
+      if (single.isValid()) {
+	end = TrajectoryStateOnSurface(single.globalParameters(), 
+				       single.curvilinearError(), dest,
+				       SurfaceSideDefinition::atCenterOfSurface, weight);
+	if (theTransportValid)
+	  variance = theTransportNoise(0, 0);
+      }
+    }
+
+    if (end.isValid())
+      assembler.addState(end);
+    else
+      assembler.addInvalidState(weight);
+
+    if (energyLoss) {
+      MixtureEnergyLoss loss;
+      loss.weight = weight;
+      loss.momentumFraction = end.isValid() ? end.globalMomentum().mag()/pStart : 0;
+      loss.variance = variance;
+      energyLoss->push_back(loss);
+    }
+  }
+
+  LogDebug("Geant4e") << "G4e -  Mixture of " << components.size() 
+		      << " components propagated, " << nLinear 
+		      << " of them around the mean";
+  TrajectoryStateOnSurface combined = assembler.combinedState();
+  theLastPath = meanPath;
+  if (captured)
+    capture(record, combined);
+  return combined;
+}
+
+
+/** Batch propagation. Every request is captured once, from the start
+ *  state of the caller to its result, whatever legs it took.
+ */
+void
+Geant4ePropagator::propagateBatch(const Geant4ePropagationBatch& batch,
+				  Geant4ePropagationBatchResult& result) const {
+  theAlignmentDerivativesValid = false;
+  if (!theCapture) {
+    propagateBatchRegions(batch, result);
+    return;
+  }
+
+  const size_t n = batch.size();
+  std::vector<Geant4ePropagationLog::Record> records(n);
+  std::vector<char> captured(n, 0);
+  for (unsigned int i = 0; i < n; i++)
+    captured[i] = batch.target[i] &&
+      Geant4ePropagationLog::fillRequest(records[i], batchState(batch, i, theField),
+					 *batch.target[i], propagationDirection());
+
+  propagateBatchRegions(batch, result);
+
+  for (unsigned int i = 0; i < n; i++) {
+    if (!captured[i])
+      continue;
+    const int status = result.status[i];
+    Geant4ePropagationLog::fillResult(records[i], 
+				      status == Geant4ePropagationBatchResult::kOk ?
+				      resultState(result, i, batch, theField) : 
+				      TrajectoryStateOnSurface(),
+				      status > 0 ? status : 0, result.path[i]);
+    theCapture->write(records[i]);
+  }
+}
+
+/** Batch propagation, through the region boundaries if there are any.
+ *  Geant4e cannot suspend a propagation, so the tracks are interleaved at
+ *  the boundaries: every request is a sequence of legs and each leg is
+ *  done for all the requests before the next one starts.
+ */
+void
+Geant4ePropagator::propagateBatchRegions(const Geant4ePropagationBatch& batch,
+					 Geant4ePropagationBatchResult& result) const {
+  if (theBatchRegionRadii.empty() || propagationDirection() != alongMomentum) {
+    propagateBatchDirect(batch, result);
+    return;
+  }
+
+  initialise();
+
+  //Requests stop at every region boundary between their start and their
+  //target. A request that does not reach a boundary (e.g. it leaves
+  //through an endcap) takes no more legs and goes on to its target from
+  //where it was. Each leg is taken off the budget left to its request
+  const size_t n = batch.size();
+  Geant4ePropagationBatch current(batch);
+  const bool budgeted = theBudget.enabled();
+  std::vector<Geant4eSteppingAction::Budget> budgets(budgeted ? n : 0, theBudget);
+  std::vector<double> legPath(n, 0.);
+  std::vector<int> legStatus(n, Geant4ePropagationBatchResult::kOk);
+  std::vector<char> missedBoundary(n, 0);
+  std::vector<float> targetRadius(n, 0.);
+  for (unsigned int i = 0; i < n; i++) {
+    const Cylinder* cylinder = dynamic_cast<const Cylinder*>(batch.target[i]);
+    if (cylinder)
+      targetRadius[i] = cylinder->radius();
+    else if (batch.target[i])
+      targetRadius[i] = batch.target[i]->position().perp();
+  }
+
+  unsigned int nLegs = 0, nFieldOnlyLegs = 0;
+  for (unsigned int r = 0; r < theBatchRegionRadii.size(); r++) {
+    const double radius = theBatchRegionRadii[r];
+    Cylinder::CylinderPointer boundary = 
+      Cylinder::build(Surface::PositionType(0, 0, 0), Surface::RotationType(), 
+		      radius);
+
+    std::vector<std::pair<float, unsigned int> > leg;
+    for (unsigned int i = 0; i < n; i++)
+      if (legStatus[i] == Geant4ePropagationBatchResult::kOk &&
+	  !missedBoundary[i] && targetRadius[i] > radius && 
+	  std::hypot(current.x[i], current.y[i]) < radius)
+	leg.push_back(std::make_pair(std::atan2(current.py[i], current.px[i]), i));
+    std::sort(leg.begin(), leg.end());
+
+    //Requests starting inside a region without material are transported
+    //through the field only, several at a time. Those that do not get to
+    //the boundary go through Geant4e
+    if (theField && std::find(theFieldOnlyRegions.begin(), theFieldOnlyRegions.end(), 
+			      r) != theFieldOnlyRegions.end()) {
+      const double inner = r > 0 ? theBatchRegionRadii[r - 1] : 0;
+      std::vector<unsigned int> fieldOnly;
+      std::vector<std::pair<float, unsigned int> > g4eLeg;
+      for (unsigned int k = 0; k < leg.size(); k++) {
+	const unsigned int i = leg[k].second;
+	if (std::hypot(current.x[i], current.y[i]) >= inner - 0.01)
+	  fieldOnly.push_back(i);
+	else
+	  g4eLeg.push_back(leg[k]);
+      }
+      std::vector<double> path;
+      std::vector<char> reached;
+      Geant4eMultiTrackStepper stepper(theField);
+      stepper.propagateToRadius(current, fieldOnly, radius, path, reached);
+      for (unsigned int k = 0; k < fieldOnly.size(); k++) {
+	if (reached[k]) {
+	  legPath[fieldOnly[k]] += path[k];
+	  if (budgeted) {
+	    Geant4eSteppingAction::Status status = 
+	      spend(budgets[fieldOnly[k]], 0, path[k], 0, 0);
+	    if (status != Geant4eSteppingAction::kOk)
+	      legStatus[fieldOnly[k]] = batchStatus(status, 0);
+	  }
+	  nLegs++;
+	  nFieldOnlyLegs++;
+	} else {
+	  g4eLeg.push_back(std::make_pair(std::atan2(current.py[fieldOnly[k]], 
+						     current.px[fieldOnly[k]]), 
+					  fieldOnly[k]));
+	}
+      }
+      leg.swap(g4eLeg);
+    }
+
+    for (unsigned int k = 0; k < leg.size(); k++) {
+      const unsigned int i = leg[k].second;
+      CallSetting<const Geant4eSteppingAction::Budget*> 
+	callBudget(theCallBudget, budgeted ? &budgets[i] : theCallBudget);
+      std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      TrajectoryStateOnSurface tsos = 
+	doPropagate(batchState(current, i, theField), *boundary);
+      if (tsos.isValid()) {
+	setBatchState(current, i, tsos);
+	legPath[i] += theLastPath;
+	nLegs++;
+      } else if (theSteppingAction->status() != Geant4eSteppingAction::kOk) {
+	legStatus[i] = batchStatus(theSteppingAction->status(), 0);
+	continue;
+      } else {
+	missedBoundary[i] = 1;
+      }
+      if (budgeted) {
+	Geant4eSteppingAction::Status status = 
+	  spend(budgets[i], theSteppingAction->nSteps(), 
+		theSteppingAction->trackLength()/cm,
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(),
+		theSteppingAction->turns());
+	if (status != Geant4eSteppingAction::kOk)
+	  legStatus[i] = batchStatus(status, 0);
+      }
+    }
+  }
+
+  propagateBatchDirect(current, result, budgeted ? &budgets : 0);
+  for (unsigned int i = 0; i < n; i++) {
+    if (legStatus[i] != Geant4ePropagationBatchResult::kOk)
+      result.status[i] = legStatus[i];
+    else
+      result.path[i] += legPath[i];
+  }
+
+  LogDebug("Geant4e") << "G4e -  Batch of " << n << " states propagated in " 
+		      << nLegs << " legs through " << theBatchRegionRadii.size() 
+		      << " region boundaries, " << nFieldOnlyLegs 
+		      << " of them through the field only";
+}
+
+/** Batch propagation. Geant4e is initialised, the particle names and the
+ *  mode are set once for the whole batch, and a target is built once per
+ *  distinct surface. The start states go straight from the arrays to
+ *  Geant4 and back without building CMS states, unless the table is
+ *  used; those requests go through the single track propagation.
+ */
+void
+Geant4ePropagator::propagateBatchDirect(const Geant4ePropagationBatch& batch,
+					Geant4ePropagationBatchResult& result,
+					const std::vector<Geant4eSteppingAction::Budget>* budgets) const {
+  const size_t n = batch.size();
+  result.resize(n);
+  if (n == 0)
+    return;
+
+  initialise();
+
+  const G4String particleNames[2] = {theParticleName + "-", 
+				     theParticleName + "+"};
+  G4ErrorMode batchMode = propagationDirection() == oppositeToMomentum ?
+    G4ErrorMode_PropBackwards : G4ErrorMode_PropForwards;
+
+  std::vector<BatchOrder> order(n);
+  std::vector<unsigned int> index(n);
+  for (unsigned int i = 0; i < n; i++) {
+    const Surface* dest = batch.target[i];
+    order[i].region = batch.region.size() == n ? batch.region[i] : 0;
+    order[i].target = dest;
+    order[i].targetPhi = dest ? float(dest->position().phi()) : 0;
+    order[i].targetZ = dest ? dest->position().z() : 0;
+    order[i].startPhi = std::atan2(batch.py[i], batch.px[i]);
+    index[i] = i;
+  }
+  std::sort(index.begin(), index.end(), 
+	    [&order](unsigned int a, unsigned int b) {return order[a] < order[b];});
+
+  const Surface* lastTarget = 0;
+  std::unique_ptr<G4ErrorTarget> g4eTarget;
+  for (unsigned int k = 0; k < n; k++) {
+    const unsigned int i = index[k];
+    const Surface* dest = batch.target[i];
+    CallSetting<const Geant4eSteppingAction::Budget*> 
+      callBudget(theCallBudget, budgets ? &(*budgets)[i] : theCallBudget);
+    if (dest != lastTarget || !g4eTarget) {
+      g4eTarget.reset(newTarget(dest));
+      lastTarget = dest;
+    }
+    if (!g4eTarget) {
+      result.status[i] = Geant4ePropagationBatchResult::kBadTarget;
+      continue;
+    }
+
+    if (theBoundsCheckMargin > 0) {
+      const Plane* plane = dynamic_cast<const Plane*>(dest);
+      if (plane && unreachable(batchState(batch, i, theField), *plane)) {
+	result.status[i] = Geant4ePropagationBatchResult::kUnreachable;
+	continue;
+      }
+    }
+
+    const int charge = batch.charge[i];
+    GlobalPoint cmsPos(batch.x[i], batch.y[i], batch.z[i]);
+    GlobalVector cmsMom(batch.px[i], batch.py[i], batch.pz[i]);
+
+    if (theTable) {
+      FreeTrajectoryState fts = batchState(batch, i, theField);
+      const Plane* plane = dynamic_cast<const Plane*>(dest);
+      TrajectoryStateOnSurface tsos = plane ? doPropagate(fts, *plane) :
+	doPropagate(fts, *static_cast<const Cylinder*>(dest));
+      if (!tsos.isValid()) {
+	result.status[i] = batchStatus(theSteppingAction->status(), 
+				       theLastG4eError != 0 ? theLastG4eError :
+				       Geant4ePropagationBatchResult::kFailed);
+	continue;
+      }
+      setBatchState(result, i, tsos);
+      result.path[i] = theLastPath;
+      continue;
+    }
+
+    CLHEP::Hep3Vector g4Pos(batch.x[i]*TrackPropagation::cmToG4,
+			    batch.y[i]*TrackPropagation::cmToG4,
+			    batch.z[i]*TrackPropagation::cmToG4);
+    CLHEP::Hep3Vector g4Mom(batch.px[i]*TrackPropagation::GeVToG4,
+			    batch.py[i]*TrackPropagation::GeVToG4,
+			    batch.pz[i]*TrackPropagation::GeVToG4);
+    G4ErrorTrajErr g4error(5, 1);
+    if (batch.hasError[i])
+      TrackPropagation::packedToG4ErrorTrajErr(&batch.covariance[15*i], charge, 
+					       g4error);
+    Geant4eFreeTrajState g4eTrajState(particleNames[charge > 0], 
+				      g4Pos, g4Mom, g4error);
+
+    G4ErrorMode mode = propagationDirection() == anyDirection ?
+      anyDirectionMode(dest, cmsPos, cmsMom) : batchMode;
+    if (theFastErrorTransport && batch.hasError[i] && 
+	mode == G4ErrorMode_PropForwards) {
+      AlgebraicSymMatrix55 cov;
+      TrackPropagation::packedToAlgebraicSymMatrix55(&batch.covariance[15*i], cov);
+      g4eTrajState.setFastErrorTransport(cov, charge, theField, 
+					 theMaterialTables.get());
+    }
+
+    int ierr = propagateG4(g4eTrajState, *g4eTarget, mode);
+    if (ierr != 0) {
+      result.status[i] = batchStatus(theSteppingAction->status(), ierr);
+      continue;
+    }
+
+    const CLHEP::Hep3Vector& posEnd = g4eTrajState.GetPosition();
+    const CLHEP::Hep3Vector& momEnd = g4eTrajState.GetMomentum();
+    result.x[i] = posEnd.x()*TrackPropagation::g4ToCm;
+    result.y[i] = posEnd.y()*TrackPropagation::g4ToCm;
+    result.z[i] = posEnd.z()*TrackPropagation::g4ToCm;
+    result.px[i] = momEnd.x()*TrackPropagation::g4ToGeV;
+    result.py[i] = momEnd.y()*TrackPropagation::g4ToGeV;
+    result.pz[i] = momEnd.z()*TrackPropagation::g4ToGeV;
+    if (g4eTrajState.fastErrorTransport())
+      TrackPropagation::algebraicSymMatrix55ToPacked(g4eTrajState.curvilinearError(),
+						     &result.covariance[15*i]);
+    else
+      TrackPropagation::g4ErrorTrajErrToPacked(g4eTrajState.GetError(), charge,
+					       &result.covariance[15*i]);
+    result.path[i] = theLastPath;
+  }
+
+  //The requests through the single track methods leave their derivatives
+  theTransportValid = false;
+  theAlignmentDerivativesValid = false;
+  LogDebug("Geant4e") << "G4e -  Propagated a batch of " << n << " states";
 }
 
 
+/** Propagation from the table of precomputed propagations. The noise
+ *  accumulated along the path comes from the table, while the start
+ *  covariance is transported with the analytical helix jacobian over the
+ *  whole path, including the straight line onto dest.
+ */
+TrajectoryStateOnSurface
+Geant4ePropagator::propagateWithTable(const FreeTrajectoryState& ftsStart,
+				      unsigned int station,
+				      const Surface& dest) const {
+
+  //The table only holds forward propagations of theParticleName
+  if (propagationDirection() != alongMomentum ||
+      theParticleName != theTable->header().particle)
+    return TrajectoryStateOnSurface();
+
+  GlobalPoint posEnd;
+  GlobalVector momEnd;
+  AlgebraicSymMatrix55 cov;
+  double path;
+  if (!theTable->interpolate(ftsStart, station, theTableMaxResidual,
+			     posEnd, momEnd, cov, path)) {
+    LogDebug("Geant4e") << "G4e -  Start state outside the table domain";
+    return TrajectoryStateOnSurface();
+  }
+
+  //The table ends on the nominal station, up to its tolerance away from
+  //dest. The rest is a straight line, or Geant4e if it is longer
+  std::pair<bool, double> step = straightPath(posEnd, momEnd, dest);
+  if (!step.first || 
+      std::abs(step.second) > theTable->station(station).tolerance) {
+    LogDebug("Geant4e") << "G4e -  Table state too far from the destination";
+    return TrajectoryStateOnSurface();
+  }
+  posEnd += step.second*momEnd.unit();
+  path += step.second;
+
+  if (ftsStart.hasError()) {
+    AnalyticalCurvilinearJacobian jacobian(ftsStart.parameters(),
+					   posEnd, momEnd, path);
+    if (theStoreTransport || theCallStoreTransport) {
+      theTransportJacobian = jacobian.jacobian();
+      theTransportNoise = cov;
+      theTransportValid = true;
+    }
+    cov += ROOT::Math::Similarity(jacobian.jacobian(),
+				  ftsStart.curvilinearError().matrix());
+  }
+
+  LogDebug("Geant4e") << "G4e -  Final state from table: " << posEnd 
+		      << " cm, " << momEnd << " GeV";
+
+  //Keep propagateWithPath() consistent. The stepping action works in
+  //Geant4 units
+  if (theSteppingAction) {
+    theSteppingAction->reset();
+    theSteppingAction->setTrackLength(path*cm);
+  }
+  theLastG4eError = 0;
+  theLastPath = path;
+
+  GlobalTrajectoryParameters tParsDest(posEnd, momEnd, ftsStart.charge(), 
+				       theField);
+  return TrajectoryStateOnSurface(tParsDest, CurvilinearTrajectoryError(cov),
+				  dest, SurfaceSideDefinition::atCenterOfSurface);
+}
+
 //
 ////////////////////////////////////////////////////////////////////////////
 //
@@ -475,6 +1671,7 @@ std::pair< TrajectoryStateOnSurface, double>
 Geant4ePropagator::propagateWithPath (const FreeTrajectoryState& ftsStart, 
 				      const Plane& pDest) const {
 
+  initialise();
   theSteppingAction->reset();
 
   //Finally build the pair<...> that needs to be returned where the second
@@ -486,6 +1683,7 @@ Geant4ePropagator::propagateWithPath (const FreeTrajectoryState& ftsStart,
 std::pair< TrajectoryStateOnSurface, double> 
 Geant4ePropagator::propagateWithPath (const FreeTrajectoryState& ftsStart,
 				      const Cylinder& cDest) const {
+  initialise();
   theSteppingAction->reset();
 
   //Finally build the pair<...> that needs to be returned where the second
@@ -498,6 +1696,7 @@ std::pair< TrajectoryStateOnSurface, double>
 Geant4ePropagator::propagateWithPath (const TrajectoryStateOnSurface& tsosStart, 
 				      const Plane& pDest) const {
 
+  initialise();
   theSteppingAction->reset();
 
   //Finally build the pair<...> that needs to be returned where the second
@@ -509,6 +1708,7 @@ Geant4ePropagator::propagateWithPath (const TrajectoryStateOnSurface& tsosStart,
 std::pair< TrajectoryStateOnSurface, double> 
 Geant4ePropagator::propagateWithPath (const TrajectoryStateOnSurface& tsosStart,
 				      const Cylinder& cDest) const {
+  initialise();
   theSteppingAction->reset();
 
   //Finally build the pair<...> that needs to be returned where the second
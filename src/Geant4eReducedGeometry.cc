@@ -0,0 +1,181 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eReducedGeometry.h"
+
+//CMSSW
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+//Geant4
+#include "G4VPhysicalVolume.hh"
+#include "G4PVPlacement.hh"
+#include "G4LogicalVolume.hh"
+#include "G4PhysicalVolumeStore.hh"
+#include "G4VSolid.hh"
+#include "G4Material.hh"
+#include "G4Element.hh"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+#include "CLHEP/Units/GlobalPhysicalConstants.h"
+
+#include <algorithm>
+#include <sstream>
+
+Geant4eReducedGeometry::Geant4eReducedGeometry(double minVolume,
+					       const std::vector<std::string>& keepPrefixes):
+  theMinVolume(minVolume),
+  theKeepPrefixes(keepPrefixes),
+  theNMerged(0),
+  theNMaterials(0) {
+}
+
+G4VPhysicalVolume* Geant4eReducedGeometry::build(G4VPhysicalVolume* world) {
+  size_t nVolumesIn = G4PhysicalVolumeStore::GetInstance()->size();
+
+  G4LogicalVolume* lv = reduce(world->GetLogicalVolume());
+  G4VPhysicalVolume* reduced = world;
+  if (lv != world->GetLogicalVolume())
+    reduced = new G4PVPlacement(0, G4ThreeVector(), lv, world->GetName(),
+				0, false, 0);
+
+  edm::LogInfo("Geant4e") << "G4e -  Reduced geometry: " << theNMerged
+			  << " daughter volumes below " << theMinVolume/cm3
+			  << " cm3 merged into " << theNMaterials
+			  << " mixtures, "
+			  << G4PhysicalVolumeStore::GetInstance()->size() - nVolumesIn
+			  << " placements added next to the " << nVolumesIn
+			  << " of the full geometry";
+  return reduced;
+}
+
+bool Geant4eReducedGeometry::keep(const G4LogicalVolume* lv) const {
+  if (lv->GetSensitiveDetector())
+    return true;
+  const std::string& name = lv->GetName();
+  for (unsigned int i = 0; i < theKeepPrefixes.size(); i++)
+    if (name.compare(0, theKeepPrefixes[i].size(), theKeepPrefixes[i]) == 0)
+      return true;
+  return false;
+}
+
+double Geant4eReducedGeometry::volume(const G4VSolid* solid) {
+  //GetCubicVolume() may be a Monte Carlo estimate, so compute it once
+  std::map<const G4VSolid*, double>::const_iterator it = theVolumes.find(solid);
+  if (it != theVolumes.end())
+    return it->second;
+  double v = const_cast<G4VSolid*>(solid)->GetCubicVolume();
+  theVolumes[solid] = v;
+  return v;
+}
+
+void Geant4eReducedGeometry::addMaterial(const G4Material* mat, double vol,
+					 ElementMasses& masses) const {
+  if (vol <= 0)
+    return;
+  const G4double* fractions = mat->GetFractionVector();
+  for (size_t i = 0; i < mat->GetNumberOfElements(); i++)
+    masses[mat->GetElement(i)] += fractions[i]*mat->GetDensity()*vol;
+}
+
+void Geant4eReducedGeometry::addSubtree(const G4LogicalVolume* lv,
+					ElementMasses& masses) {
+  double own = volume(lv->GetSolid());
+  for (int i = 0; i < lv->GetNoDaughters(); i++) {
+    const G4VPhysicalVolume* pv = lv->GetDaughter(i);
+    //Parameterised copies are approximated by the solid of the logical volume
+    int copies = pv->IsReplicated() ? pv->GetMultiplicity() : 1;
+    const G4LogicalVolume* dlv = pv->GetLogicalVolume();
+    own -= copies*volume(dlv->GetSolid());
+
+    ElementMasses daughter;
+    addSubtree(dlv, daughter);
+    for (ElementMasses::const_iterator it = daughter.begin(); it != daughter.end(); ++it)
+      masses[it->first] += copies*it->second;
+  }
+  addMaterial(lv->GetMaterial(), own, masses);
+}
+
+G4LogicalVolume* Geant4eReducedGeometry::reduce(G4LogicalVolume* lv) {
+  if (keep(lv))
+    return lv;
+
+  std::map<G4LogicalVolume*, G4LogicalVolume*>::const_iterator memo =
+    theReduced.find(lv);
+  if (memo != theReduced.end())
+    return memo->second;
+
+  for (int i = 0; i < lv->GetNoDaughters(); i++) {
+    if (lv->GetDaughter(i)->IsReplicated()) {
+      theReduced[lv] = lv;
+      return lv;
+    }
+  }
+
+  //Split the daughters into the ones placed in the reduced mother and the
+  //ones merged into its material
+  ElementMasses merged;
+  std::vector<G4VPhysicalVolume*> placed;
+  std::vector<G4LogicalVolume*> placedVolumes;
+  double motherVolume = volume(lv->GetSolid());
+  double daughtersVolume = 0;
+  double placedVolume = 0;
+  unsigned int nMerged = 0;
+  bool changed = false;
+  for (int i = 0; i < lv->GetNoDaughters(); i++) {
+    G4VPhysicalVolume* pv = lv->GetDaughter(i);
+    G4LogicalVolume* dlv = pv->GetLogicalVolume();
+    double vd = volume(dlv->GetSolid());
+    daughtersVolume += vd;
+    if (keep(dlv) || vd >= theMinVolume) {
+      G4LogicalVolume* rdlv = reduce(dlv);
+      changed |= rdlv != dlv;
+      placed.push_back(pv);
+      placedVolumes.push_back(rdlv);
+      placedVolume += vd;
+    } else {
+      addSubtree(dlv, merged);
+      ++nMerged;
+      changed = true;
+    }
+  }
+
+  if (!changed) {
+    theReduced[lv] = lv;
+    return lv;
+  }
+
+  G4Material* material = lv->GetMaterial();
+  theNMerged += nMerged;
+
+  addMaterial(lv->GetMaterial(), motherVolume - daughtersVolume, merged);
+  double mass = 0;
+  for (ElementMasses::const_iterator it = merged.begin(); it != merged.end(); ++it)
+    mass += it->second;
+
+  if (nMerged > 0 && mass > 0) {
+    double density = std::max(mass/(motherVolume - placedVolume),
+			      universe_mean_density);
+
+    std::ostringstream name;
+    name << lv->GetName() << "_reduced" << theNMaterials++;
+    material = new G4Material(name.str(), density, merged.size());
+    for (ElementMasses::const_iterator it = merged.begin(); it != merged.end(); ++it)
+      material->AddElement(const_cast<G4Element*>(it->first), it->second/mass);
+
+    LogDebug("Geant4e") << "G4e -  " << lv->GetName() << ": "
+			<< lv->GetMaterial()->GetName() << " at "
+			<< lv->GetMaterial()->GetDensity()/(g/cm3)
+			<< " g/cm3 replaced by " << material->GetName()
+			<< " at " << density/(g/cm3) << " g/cm3";
+  }
+
+  G4LogicalVolume* reduced = new G4LogicalVolume(lv->GetSolid(), material,
+						 lv->GetName() + "_reduced");
+  for (unsigned int i = 0; i < placed.size(); i++) {
+    G4VPhysicalVolume* pv = placed[i];
+    new G4PVPlacement(pv->GetRotation(), pv->GetTranslation(),
+		      placedVolumes[i], pv->GetName(), reduced,
+		      false, pv->GetCopyNo());
+  }
+
+  theReduced[lv] = reduced;
+  return reduced;
+}
@@ -0,0 +1,71 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eTabulatedEnergyLoss.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMaterialTables.h"
+
+//Geant4
+#include "G4ErrorPropagatorData.hh"
+#include "G4ParticleDefinition.hh"
+#include "G4Track.hh"
+#include "G4Step.hh"
+#include "G4StepPoint.hh"
+
+#include <cfloat>
+#include <cmath>
+
+Geant4eTabulatedEnergyLoss::Geant4eTabulatedEnergyLoss(Geant4eMaterialTables* tables,
+						       double maxLossFraction):
+  G4ErrorEnergyLoss("Geant4eTabulatedEnergyLoss"),
+  theTables(tables) {
+  SetStepLimit(maxLossFraction);
+}
+
+G4bool Geant4eTabulatedEnergyLoss::IsApplicable(const G4ParticleDefinition& particle) {
+  return particle.GetPDGCharge() != 0;
+}
+
+void Geant4eTabulatedEnergyLoss::BuildPhysicsTable(const G4ParticleDefinition&) {
+  theTables->build();
+}
+
+G4double 
+Geant4eTabulatedEnergyLoss::GetContinuousStepLimit(const G4Track& track,
+						   G4double, G4double,
+						   G4double&) {
+  int species = theTables->species(track.GetDefinition());
+  if (species < 0)
+    return DBL_MAX;
+  double dedx = theTables->values(species, track.GetMaterial(),
+				  track.GetMomentum().mag()).dedx;
+  return dedx > 0 ? GetStepLimit()*track.GetKineticEnergy()/dedx : DBL_MAX;
+}
+
+G4VParticleChange* 
+Geant4eTabulatedEnergyLoss::AlongStepDoIt(const G4Track& track, 
+					  const G4Step& step) {
+  aParticleChange.Initialize(track);
+
+  int species = theTables->species(track.GetDefinition());
+  double length = step.GetStepLength();
+  if (species < 0 || length <= 0)
+    return &aParticleChange;
+
+  const G4Material* material = step.GetPreStepPoint()->GetMaterial();
+  double mass = track.GetDefinition()->GetPDGMass();
+  double kinEnergy = step.GetPreStepPoint()->GetKineticEnergy();
+  double p = step.GetPreStepPoint()->GetMomentum().mag();
+  double sign = G4ErrorPropagatorData::GetErrorPropagatorData()->GetMode() == 
+    G4ErrorMode_PropBackwards ? -1. : 1.;
+
+  //Trapezoid between the start and a first estimate of the end
+  double dedxStart = theTables->values(species, material, p).dedx;
+  double kinEnd = kinEnergy - sign*dedxStart*length;
+  if (kinEnd <= 0) {
+    aParticleChange.ProposeEnergy(0.);
+    return &aParticleChange;
+  }
+  double pEnd = std::sqrt(kinEnd*(kinEnd + 2*mass));
+  double dedxEnd = theTables->values(species, material, pEnd).dedx;
+  kinEnd = kinEnergy - sign*0.5*(dedxStart + dedxEnd)*length;
+
+  aParticleChange.ProposeEnergy(kinEnd > 0 ? kinEnd : 0.);
+  return &aParticleChange;
+}
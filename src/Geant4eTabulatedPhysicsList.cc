@@ -0,0 +1,35 @@
+#include "TrackPropagation/Geant4e/interface/Geant4eTabulatedPhysicsList.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eTabulatedEnergyLoss.h"
+
+//Geant4
+#include "G4ErrorStepLengthLimitProcess.hh"
+#include "G4ErrorMagFieldLimitProcess.hh"
+#include "G4ErrorMessenger.hh"
+#include "G4ParticleDefinition.hh"
+#include "G4ProcessManager.hh"
+
+Geant4eTabulatedPhysicsList::Geant4eTabulatedPhysicsList(Geant4eMaterialTables* tables):
+  theTables(tables) {
+}
+
+void Geant4eTabulatedPhysicsList::ConstructProcess() {
+  AddTransportation();
+
+  Geant4eTabulatedEnergyLoss* energyLoss = new Geant4eTabulatedEnergyLoss(theTables);
+  G4ErrorStepLengthLimitProcess* stepLengthLimit = new G4ErrorStepLengthLimitProcess;
+  G4ErrorMagFieldLimitProcess* magFieldLimit = new G4ErrorMagFieldLimitProcess;
+
+  theParticleIterator->reset();
+  while ((*theParticleIterator)()) {
+    G4ParticleDefinition* particle = theParticleIterator->value();
+    if (particle->GetPDGCharge() == 0)
+      continue;
+    G4ProcessManager* manager = particle->GetProcessManager();
+    manager->AddContinuousProcess(energyLoss, 1);
+    manager->AddDiscreteProcess(stepLengthLimit, 2);
+    manager->AddDiscreteProcess(magFieldLimit, 3);
+  }
+
+  //UI commands of the step limits, as in G4ErrorPhysicsList
+  new G4ErrorMessenger(stepLengthLimit, magFieldLimit, energyLoss);
+}
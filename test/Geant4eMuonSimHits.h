@@ -0,0 +1,102 @@
+#ifndef TrackPropagation_Geant4e_Geant4eMuonSimHits_h
+#define TrackPropagation_Geant4e_Geant4eMuonSimHits_h
+
+//- Geometry
+#include "Geometry/DTGeometry/interface/DTGeometry.h"
+#include "Geometry/CSCGeometry/interface/CSCGeometry.h"
+#include "Geometry/RPCGeometry/interface/RPCGeometry.h"
+#include "DataFormats/MuonDetId/interface/DTWireId.h"
+#include "DataFormats/MuonDetId/interface/RPCDetId.h"
+#include "DataFormats/MuonDetId/interface/CSCDetId.h"
+#include "FWCore/Framework/interface/ESHandle.h"
+
+//- SimHits
+#include "SimDataFormats/TrackingHit/interface/PSimHit.h"
+#include "SimDataFormats/TrackingHit/interface/PSimHitContainer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+/** Muon sim hit helpers shared by the analyzers of this directory: the
+ *  index of the hits of an event by track and time of flight, and the
+ *  layer and station of a hit.
+ */
+namespace Geant4eMuonSimHits {
+
+  enum ChamberType {DT = 0, CSC, RPC, NChamberTypes};
+
+  inline const char* chamberName(unsigned int type) {
+    static const char* names[NChamberTypes] = {"DT", "CSC", "RPC"};
+    return names[type];
+  }
+
+  //Sim hits of one event for one chamber type, ordered by track and
+  //time of flight, so that the hits of a track are found with a binary
+  //search and come in the order they were crossed
+  typedef std::vector<const PSimHit*> HitIndex;
+
+  inline bool hitLess(const PSimHit* a, const PSimHit* b) {
+    if (a->trackId() != b->trackId())
+      return a->trackId() < b->trackId();
+    return a->timeOfFlight() < b->timeOfFlight();
+  }
+
+  inline bool hitTrackLess(const PSimHit* a, unsigned int trkId) {
+    return a->trackId() < trkId;
+  }
+
+  inline bool trackHitLess(unsigned int trkId, const PSimHit* a) {
+    return trkId < a->trackId();
+  }
+
+  //Index of the muon hits of simHits
+  inline void buildIndex(const edm::PSimHitContainer& simHits, HitIndex& index) {
+    index.clear();
+    index.reserve(simHits.size());
+    for (edm::PSimHitContainer::const_iterator it = simHits.begin();
+	 it != simHits.end(); ++it)
+      if (std::abs(it->particleType()) == 13)
+	index.push_back(&*it);
+    std::sort(index.begin(), index.end(), hitLess);
+  }
+
+  //Hits of track trkId in the index, in time order
+  inline std::pair<HitIndex::const_iterator, HitIndex::const_iterator>
+  trackHits(const HitIndex& index, unsigned int trkId) {
+    HitIndex::const_iterator first =
+      std::lower_bound(index.begin(), index.end(), trkId, hitTrackLess);
+    return std::make_pair(first,
+			  std::upper_bound(first, index.end(), trkId, trackHitLess));
+  }
+
+  struct Geometries {
+    edm::ESHandle<DTGeometry> dt;
+    edm::ESHandle<CSCGeometry> csc;
+    edm::ESHandle<RPCGeometry> rpc;
+  };
+
+  //Layer of a hit, null if not found, and its station
+  inline const GeomDet* layerForHit(const PSimHit& hit, ChamberType type,
+				    const Geometries& geom, int& station) {
+    const GeomDet* layer = 0;
+    if (type == DT) {
+      DTWireId wId(hit.detUnitId());
+      station = wId.station();
+      layer = geom.dt->layer(wId.layerId());
+    } else if (type == CSC) {
+      CSCDetId cscId(hit.detUnitId());
+      station = cscId.station();
+      layer = geom.csc->idToDet(cscId);
+    } else if (type == RPC) {
+      RPCDetId rpcId(hit.detUnitId());
+      station = rpcId.station();
+      layer = geom.rpc->idToDet(rpcId);
+    }
+    return layer;
+  }
+}
+
+
+#endif
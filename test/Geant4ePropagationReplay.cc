@@ -0,0 +1,149 @@
+#include "FWCore/Framework/interface/Frameworkfwd.h"
+#include "FWCore/Framework/interface/one/EDAnalyzer.h"
+#include "FWCore/Framework/interface/ESHandle.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/EventSetup.h"
+#include "FWCore/Framework/interface/MakerMacros.h" //For define_fwk_module
+
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
+
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+
+/** Replays a log written by Geant4ePropagator::setCaptureFile() through a
+ *  new propagator and reports the throughput and the differences with the
+ *  recorded results. It only needs the geometry and the field, so it runs
+ *  with an EmptySource and the replay is done in the first event.
+ *  If OutputFile is set the replayed results are logged again, so that
+ *  two configurations can be compared offline.
+ */
+class Geant4ePropagationReplay: public edm::one::EDAnalyzer<> {
+
+public:
+  explicit Geant4ePropagationReplay(const edm::ParameterSet&);
+  virtual ~Geant4ePropagationReplay() {}
+
+  virtual void analyze(const edm::Event&, const edm::EventSetup&);
+
+private:
+  std::string theLogFileName;
+  std::string theOutputFileName;
+  long theMaxRecords;
+  double theFieldCellSize;
+  bool theDone;
+};
+
+
+Geant4ePropagationReplay::Geant4ePropagationReplay(const edm::ParameterSet& iConfig):
+  theLogFileName(iConfig.getParameter<std::string>("LogFile")),
+  theOutputFileName(iConfig.getParameter<std::string>("OutputFile")),
+  theMaxRecords(iConfig.getParameter<int>("MaxRecords")),
+  theFieldCellSize(iConfig.getParameter<double>("FieldCellSize")),
+  theDone(false) {
+}
+
+void Geant4ePropagationReplay::analyze(const edm::Event&,
+				       const edm::EventSetup& iSetup) {
+  if (theDone)
+    return;
+  theDone = true;
+
+  edm::ESHandle<MagneticField> bField;
+  iSetup.get<IdealMagneticFieldRecord>().get(bField);
+
+  Geant4ePropagationLog::Reader reader(theLogFileName);
+
+  Geant4ePropagator propagator(&*bField, reader.header().particle);
+  propagator.setFieldCellSize(theFieldCellSize);
+  if (!theOutputFileName.empty())
+    propagator.setCaptureFile(theOutputFileName);
+
+  unsigned long nRecords = 0;
+  unsigned long nValidMismatch = 0;
+  unsigned long nCompared = 0;
+  double time = 0;       //s, excluding the first call
+  double sumDPos = 0, maxDPos = 0;  //cm
+  double sumDMom = 0, maxDMom = 0;  //relative
+  double sumDErr = 0, maxDErr = 0;  //relative, on the diagonal
+
+  Geant4ePropagationLog::Record r;
+  while ((theMaxRecords < 0 || (long) nRecords < theMaxRecords) &&
+	 reader.next(r)) {
+
+    propagator.setPropagationDirection(PropagationDirection(r.direction));
+    FreeTrajectoryState fts = Geant4ePropagationLog::startState(r, &*bField);
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    TrajectoryStateOnSurface tsos;
+    if (r.surfaceType == Geant4ePropagationLog::kPlane)
+      tsos = propagator.propagate(fts, *Geant4ePropagationLog::plane(r));
+    else
+      tsos = propagator.propagate(fts, *Geant4ePropagationLog::cylinder(r));
+    double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    //The first call initialises Geant4
+    if (nRecords > 0)
+      time += dt;
+    nRecords++;
+
+    if (tsos.isValid() != bool(r.valid)) {
+      nValidMismatch++;
+      continue;
+    }
+    if (!tsos.isValid())
+      continue;
+
+    nCompared++;
+    GlobalPoint pos = tsos.globalPosition();
+    GlobalVector mom = tsos.globalMomentum();
+    GlobalPoint recPos(r.outPosition[0], r.outPosition[1], r.outPosition[2]);
+    GlobalVector recMom(r.outMomentum[0], r.outMomentum[1], r.outMomentum[2]);
+
+    double dPos = (pos - recPos).mag();
+    double dMom = (mom - recMom).mag()/recMom.mag();
+    sumDPos += dPos;
+    sumDMom += dMom;
+    maxDPos = std::max(maxDPos, dPos);
+    maxDMom = std::max(maxDMom, dMom);
+
+    if (tsos.hasError()) {
+      const AlgebraicSymMatrix55& cov = tsos.curvilinearError().matrix();
+      double dErr = 0;
+      for (unsigned int i = 0, k = 0; i < 5; k += i + 2, i++) {
+	double rec = r.outCovariance[k];
+	if (rec > 0)
+	  dErr = std::max(dErr, std::abs(cov(i, i) - rec)/rec);
+      }
+      sumDErr += dErr;
+      maxDErr = std::max(maxDErr, dErr);
+    }
+  }
+
+  double n = nCompared > 0 ? nCompared : 1;
+  edm::LogVerbatim("Geant4e") << "G4e -- Replayed " << nRecords
+			      << " propagations from " << theLogFileName << "\n"
+			      << "G4e --   throughput: "
+			      << (time > 0 ? (nRecords - 1)/time : 0.)
+			      << " propagations/s ("
+			      << (nRecords > 1 ? 1.e6*time/(nRecords - 1) : 0.)
+			      << " us each)\n"
+			      << "G4e --   validity mismatches: " << nValidMismatch << "\n"
+			      << "G4e --   position diff (cm): mean " << sumDPos/n
+			      << ", max " << maxDPos << "\n"
+			      << "G4e --   momentum diff (rel): mean " << sumDMom/n
+			      << ", max " << maxDMom << "\n"
+			      << "G4e --   error diag diff (rel): mean " << sumDErr/n
+			      << ", max " << maxDErr;
+}
+
+//define this as a plug-in
+DEFINE_FWK_MODULE(Geant4ePropagationReplay);
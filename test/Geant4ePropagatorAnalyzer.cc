@@ -1,5 +1,5 @@
 #include "FWCore/Framework/interface/Frameworkfwd.h"
-#include "FWCore/Framework/interface/EDAnalyzer.h"
+#include "FWCore/Framework/interface/global/EDAnalyzer.h"
 #include "FWCore/Framework/interface/ESHandle.h"
 #include "FWCore/Framework/interface/Event.h"
 #include "FWCore/Framework/interface/MakerMacros.h" //For define_fwk_module
@@ -8,26 +8,13 @@
 #include "FWCore/MessageLogger/interface/MessageLogger.h"
 #include "FWCore/Utilities/interface/InputTag.h"
 
-//- Timing
-#include "Utilities/Timing/interface/TimingReport.h"
-
-//- Geometry
-#include "DetectorDescription/Core/interface/DDCompactView.h"
-#include "Geometry/Records/interface/IdealGeometryRecord.h"
-#include "SimG4Core/Geometry/interface/DDDWorld.h"
-#include "Geometry/DTGeometry/interface/DTGeometry.h"
-#include "Geometry/CSCGeometry/interface/CSCGeometry.h"
-#include "Geometry/RPCGeometry/interface/RPCGeometry.h"
+//- Geometry and muon sim hits
+#include "TrackPropagation/Geant4e/test/Geant4eMuonSimHits.h"
 #include "Geometry/Records/interface/MuonGeometryRecord.h"
-#include "DataFormats/MuonDetId/interface/DTWireId.h"
-#include "DataFormats/MuonDetId/interface/RPCDetId.h"
-#include "DataFormats/MuonDetId/interface/CSCDetId.h"
 
 //- Magnetic field
 #include "MagneticField/Engine/interface/MagneticField.h"
 #include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
-#include "SimG4Core/MagneticField/interface/Field.h"
-#include "SimG4Core/MagneticField/interface/FieldBuilder.h"
 
 //- Propagator
 #include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
@@ -36,68 +23,163 @@
 #include "TrackingTools/TrajectoryState/interface/TrajectoryStateOnSurface.h"
 
 
-//- SimHits, Tracks and Vertices
-#include "SimDataFormats/TrackingHit/interface/PSimHit.h"
-#include "SimDataFormats/TrackingHit/interface/PSimHitContainer.h"
+//- Tracks and Vertices
 #include "SimDataFormats/Track/interface/SimTrack.h"
 #include "SimDataFormats/Track/interface/SimTrackContainer.h"
 #include "SimDataFormats/Vertex/interface/SimVertex.h"
 #include "SimDataFormats/Vertex/interface/SimVertexContainer.h"
 
-//- Geant4
-#include "G4TransportationManager.hh"
-
 //- ROOT
 #include "TFile.h"
 #include "TH1.h"
 #include "TH2.h"
+#include "TString.h"
+#include "TTree.h"
 
-using namespace std;
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
 
-enum testMuChamberType {DT, RPC, CSC};
+using namespace std;
 
-class Geant4ePropagatorAnalyzer: public edm::EDAnalyzer {
+typedef Geant4eMuonSimHits::ChamberType testMuChamberType;
+using Geant4eMuonSimHits::DT;
+using Geant4eMuonSimHits::CSC;
+using Geant4eMuonSimHits::RPC;
+using Geant4eMuonSimHits::NChamberTypes;
+using Geant4eMuonSimHits::chamberName;
+using Geant4eMuonSimHits::HitIndex;
+using Geant4eMuonSimHits::Geometries;
+
+namespace {
+  template <class V> void fillVector(float* out, const V& v) {
+    out[0] = v.x();
+    out[1] = v.y();
+    out[2] = v.z();
+  }
 
-public:
-  explicit Geant4ePropagatorAnalyzer(const edm::ParameterSet&);
-  virtual ~Geant4ePropagatorAnalyzer() {}
+  //Histogram fills a stream collects before handing them over
+  const unsigned int kFillChunkSize = 10000;
 
-  virtual void analyze(const edm::Event&, const edm::EventSetup&);
-  virtual void endJob();
-  virtual void beginJob();
-  void iterateOverHits(edm::Handle<edm::PSimHitContainer> simHits,
-		       testMuChamberType muonChamberType,
-		       unsigned int trkIndex,
-		       const FreeTrajectoryState& ftsTrack);
+  void fillCovariance(float* out, const FreeTrajectoryState& fts) {
+    if (!fts.hasError()) {
+      std::fill(out, out + 15, 0.f);
+      return;
+    }
+    const AlgebraicSymMatrix55& cov = fts.curvilinearError().matrix();
+    unsigned int k = 0;
+    for (unsigned int i = 0; i < 5; i++)
+      for (unsigned int j = 0; j <= i; j++)
+	out[k++] = cov(i, j);
+  }
+}
 
+/** One row of the propagation tree: start state, target, result,
+ *  return code, number of steps and time of one propagation, and the sim
+ *  hit it is compared to. Covariances are the lower triangle of the
+ *  curvilinear error matrix.
+ */
+struct Geant4ePropagationRow {
+  unsigned int run;
+  unsigned int event;
+  unsigned int detId;
+  int chamberType;
+  int station;
+
+  int charge;
+  float inPos[3];
+  float inMom[3];
+  float inCov[15];
+
+  int valid;
+  int ierr;
+  unsigned int nSteps;
+  float time;  //s
+  float outPos[3];
+  float outMom[3];
+  float outCov[15];
+
+  float hitPos[3];
+  float hitMom[3];
+};
 
-protected:
+/** Writes Geant4ePropagationRow's to a TTree with one branch per column.
+ *  Streams collect rows and hand them over in chunks, so the lock is
+ *  taken once per chunk.
+ */
+class Geant4ePropagationTreeWriter {
+ public:
+  explicit Geant4ePropagationTreeWriter(const std::string& fileName);
+  ~Geant4ePropagationTreeWriter();
+
+  void fill(const std::vector<Geant4ePropagationRow>& rows);
+
+ private:
+  std::mutex theMutex;
+  TFile* theFile;
+  TTree* theTree;
+  Geant4ePropagationRow theRow;
+};
 
-  int theRun;
-  int theEvent;
+/** What one stream collects: bookkeeping, rows of the propagation tree
+ *  and histogram fills. ROOT objects are not thread safe, so the
+ *  histograms are only booked in beginJob and the streams hand their
+ *  fills over to them in chunks, under a lock.
+ */
+struct Geant4ePropagatorAnalyzerFills {
+  struct Entry {
+    TH1* histo;
+    bool twoD;
+    float x, y;
+  };
+
+  Geant4ePropagatorAnalyzerFills():
+    nPropagations(0),
+    nFailures(0),
+    nSteps(0),
+    propagationTime(0) {}
+
+  void fill(TH1F* h, double x) {
+    Entry e = {h, false, float(x), 0.f};
+    entries.push_back(e);
+  }
+  void fill(TH2F* h, double x, double y) {
+    Entry e = {h, true, float(x), float(y)};
+    entries.push_back(e);
+  }
 
-  Propagator* thePropagator;
-  //std::auto_ptr<sim::FieldBuilder> theFieldBuilder;
+  unsigned long nPropagations;
+  unsigned long nFailures;
+  unsigned long nSteps;
+  double propagationTime; //s
 
-  //Geometry
-  edm::ESHandle<DTGeometry> theDTGeomESH; //DTs
-  edm::ESHandle<RPCGeometry> theRPCGeomESH; //RPC
-  edm::ESHandle<CSCGeometry> theCSCGeomESH; //CSC
+  std::vector<Entry> entries;
 
-  //Station that we want to study. -1 for all
-  int fStudyStation;
+  //Rows waiting to be written to the propagation tree
+  std::vector<Geant4ePropagationRow> rows;
+};
 
-  // Single muons Beam direction (phi) and interval to plot simhits
-  float fBeamCenter;
-  float fBeamInterval;
+/** Histograms and bookkeeping of the job. They are detached from any
+ *  ROOT directory and written at the end of the job.
+ */
+class Geant4ePropagatorAnalyzerHistos {
+ public:
+  Geant4ePropagatorAnalyzerHistos(float beamCenter, float beamInterval);
+  ~Geant4ePropagatorAnalyzerHistos();
 
-  // Histograms and ROOT stuff  
-  TFile* theRootFile;
+  //Applies the fills of a stream and clears them
+  void apply(Geant4ePropagatorAnalyzerFills& fills);
+  //Adds the bookkeeping of a stream
+  void addCounts(const Geant4ePropagatorAnalyzerFills& fills);
+  void write() const;
 
   TH1F* fDistanceSHLayer;
 
   TH1F*  fDistance;
   TH1F*  fDistanceSt[4];
+  TH1F*  fDistanceType[NChamberTypes];
 
   TH1F*  fHitR;
   TH1F*  fHitRho;
@@ -106,7 +188,6 @@ protected:
   TH1F*  fHitPhi1L;
   TH2F*  fHitRVsPhi;
 
-
   TH1F*  fLayerR;
   TH1F*  fLayerRho;
   TH1F*  fLayerEta;
@@ -123,7 +204,7 @@ protected:
   TH1F*  fDeltaEta;
   TH1F*  fDeltaPhi;
 
-  //Studies on Phi distribution
+  //Studies on Phi distribution (DT)
   TH1F* fStationPosPhi;
   TH1F* fSectorPosPhi;
   TH1F* fSLayerPosPhi;
@@ -134,239 +215,368 @@ protected:
   TH1F* fSLayerNegPhi;
   TH1F* fLayerNegPhi;
 
-  edm::InputTag G4VtxSrc_;
-  edm::InputTag G4TrkSrc_;
+  //Bookkeeping
+  unsigned long nPropagations;
+  unsigned long nFailures;
+  unsigned long nSteps;
+  double propagationTime; //s
+
+ private:
+  template <class H> H* book(H* h) {
+    h->SetDirectory(0);
+    theHistos.push_back(h);
+    return h;
+  }
+
+  std::vector<TH1*> theHistos;
 };
 
 
-Geant4ePropagatorAnalyzer::Geant4ePropagatorAnalyzer(const edm::ParameterSet& iConfig):
-  theRun(-1),
-  theEvent(-1),
-  thePropagator(0),
-  G4VtxSrc_(iConfig.getParameter<edm::InputTag>("G4VtxSrc")),
-  G4TrkSrc_(iConfig.getParameter<edm::InputTag>("G4TrkSrc")) {
+class Geant4ePropagatorAnalyzer:
+  public edm::global::EDAnalyzer<edm::StreamCache<Geant4ePropagatorAnalyzerFills> > {
 
-  //debug_ = iConfig.getParameter<bool>("debug");
-  fStudyStation = iConfig.getParameter<int>("StudyStation");
+public:
+  explicit Geant4ePropagatorAnalyzer(const edm::ParameterSet&);
+  virtual ~Geant4ePropagatorAnalyzer() {}
 
-  fBeamCenter   = iConfig.getParameter<double>("BeamCenter");
-  fBeamInterval = iConfig.getParameter<double>("BeamInterval");
+  virtual void beginJob();
+  virtual std::unique_ptr<Geant4ePropagatorAnalyzerFills> beginStream(edm::StreamID) const;
+  virtual void analyze(edm::StreamID, const edm::Event&, const edm::EventSetup&) const;
+  virtual void endStream(edm::StreamID) const;
+  virtual void endJob();
 
+private:
 
-  ///////////////////////////////////////////////////////////////////////////////////
-  // Histograms
-  //
+  void iterateOverHits(const HitIndex& index,
+		       testMuChamberType muonChamberType,
+		       unsigned int trkIndex,
+		       const FreeTrajectoryState& ftsTrack,
+		       const Geometries& geom,
+		       const edm::EventID& eventId,
+		       Geant4ePropagatorAnalyzerFills& fills) const;
 
-  // Output ROOT file
-  theRootFile = 
-    new TFile(iConfig.getParameter<std::string>("RootFile").c_str(), "recreate");
+  //Station that we want to study. -1 for all
+  int fStudyStation;
 
-  // Distance between Sim Hit and associated Layer   
-  fDistanceSHLayer = new TH1F("fDistanceSHLayer", 
-			      "Distance(sim hit - layer)", 
-			      200, -1, 1);
+  // Single muons Beam direction (phi) and interval to plot simhits
+  float fBeamCenter;
+  float fBeamInterval;
+
+  // Propagate from hit to hit instead of from the vertex to every hit
+  bool fChainPropagation;
+
+  std::string theRootFileName;
+
+  // Reduced geometry for the propagation. Disabled if the volume is <= 0
+  double theReducedGeometryMinVolume;
+  std::vector<std::string> theReducedGeometryKeep;
+
+  // Per propagation output. Rows are handed to the writer in chunks
+  std::unique_ptr<Geant4ePropagationTreeWriter> theTreeWriter;
+  unsigned int theTreeChunkSize;
+
+  edm::EDGetTokenT<edm::SimVertexContainer> G4VtxToken_;
+  edm::EDGetTokenT<edm::SimTrackContainer> G4TrkToken_;
+  edm::EDGetTokenT<edm::PSimHitContainer> simHitTokens_[NChamberTypes];
+
+  // Geant4e runs a single process-wide G4 propagation manager, so all the
+  // propagations are serialised. Hit indexing, geometry lookups and
+  // histogramming run concurrently in the streams.
+  mutable std::mutex thePropagatorMutex;
+  mutable std::unique_ptr<Geant4ePropagator> thePropagator;
+
+  // Job totals, booked in beginJob and filled from the streams in chunks
+  mutable std::mutex theTotalsMutex;
+  std::unique_ptr<Geant4ePropagatorAnalyzerHistos> theTotals;
+};
+
+
+//
+////////////////////////////////////////////////////////////////////////////
+//
+
+Geant4ePropagatorAnalyzerHistos::Geant4ePropagatorAnalyzerHistos(float fBeamCenter,
+								 float fBeamInterval):
+  nPropagations(0),
+  nFailures(0),
+  nSteps(0),
+  propagationTime(0) {
+
+  // Distance between Sim Hit and associated Layer
+  fDistanceSHLayer = book(new TH1F("fDistanceSHLayer",
+				   "Distance(sim hit - layer)",
+				   200, -1, 1));
 
   // Distance between simhit and extrapolation
-  fDistance = new TH1F("fDistance", 
-		       "Distance(sim hit - extrap)", 
-		       150, 0, 300);
-  // Distance between simhit and extrapolation
-  fDistanceSt[0] = new TH1F("fDistance_St1", 
-			    "Distance(sim hit - extrap) for station 1", 
-			    150, 0, 300);
-  fDistanceSt[1] = new TH1F("fDistance_St2", 
-			    "Distance(sim hit - extrap) for station 2", 
-			    150, 0, 300);
-  fDistanceSt[2] = new TH1F("fDistance_St3", 
-			    "Distance(sim hit - extrap) for station 3", 
-			    150, 0, 300);
-  fDistanceSt[3] = new TH1F("fDistance_St4", 
-			    "Distance(sim hit - extrap) for station 4", 
-			    150, 0, 300);
+  fDistance = book(new TH1F("fDistance",
+			    "Distance(sim hit - extrap)",
+			    150, 0, 300));
+  for (unsigned int i = 0; i < 4; i++) {
+    fDistanceSt[i] = book(new TH1F(Form("fDistance_St%d", i+1),
+				   Form("Distance(sim hit - extrap) for station %d", i+1),
+				   150, 0, 300));
+  }
+  for (unsigned int i = 0; i < NChamberTypes; i++) {
+    fDistanceType[i] = book(new TH1F(Form("fDistance_%s", chamberName(i)),
+				     Form("Distance(sim hit - extrap) for %s", chamberName(i)),
+				     150, 0, 300));
+  }
 
   // Simulated hits
-  fHitR     = new TH1F("fHitR",     "R^{sim hit}",       300, 400, 1000);
-  fHitRho   = new TH1F("fHitRho",   "#rho^{sim hit}",    300, 400, 1000);
-  fHitEta   = new TH1F("fHitEta",   "#eta^{sim hit}",    100, -0.1, 0.1);
-  fHitPhi   = new TH1F("fHitPhi",   "#varphi^{sim hit}", 
-		       160, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval);
-  fHitPhi1L = new TH1F("fHitPhi1L", "#varphi^{sim hit} for 1st layer", 
-		       160, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval);
-  
-  fHitRVsPhi = new TH2F("fHitRVsPhi", "R vs. #varphi for sim hits",
-			60, 400, 1000, 
-			80, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval);
-  
+  fHitR     = book(new TH1F("fHitR",     "R^{sim hit}",       300, 400, 1000));
+  fHitRho   = book(new TH1F("fHitRho",   "#rho^{sim hit}",    300, 400, 1000));
+  fHitEta   = book(new TH1F("fHitEta",   "#eta^{sim hit}",    100, -0.1, 0.1));
+  fHitPhi   = book(new TH1F("fHitPhi",   "#varphi^{sim hit}",
+			    160, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval));
+  fHitPhi1L = book(new TH1F("fHitPhi1L", "#varphi^{sim hit} for 1st layer",
+			    160, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval));
+
+  fHitRVsPhi = book(new TH2F("fHitRVsPhi", "R vs. #varphi for sim hits",
+			     60, 400, 1000,
+			     80, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval));
+
   // Position of layers
-  fLayerR    = new TH1F("fLayerR", "R^{layer}", 300, 400, 1000);
-  fLayerRho  = new TH1F("fLayerRho", "#rho^{layer}", 300, 400, 1000);
-  fLayerEta  = new TH1F("fLayerEta", "#eta^{layer}", 100, -0.1, 0.1);
-  fLayerPhi  = new TH1F("fLayerPhi", "#varphi^{layer}", 
-			160, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval);
-  fLayerRVsPhi = new TH2F("fLayerRVsPhi", "R vs. #varphi for layers",
-			60, 400, 1000, 
-			80, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval);
-  
+  fLayerR    = book(new TH1F("fLayerR", "R^{layer}", 300, 400, 1000));
+  fLayerRho  = book(new TH1F("fLayerRho", "#rho^{layer}", 300, 400, 1000));
+  fLayerEta  = book(new TH1F("fLayerEta", "#eta^{layer}", 100, -0.1, 0.1));
+  fLayerPhi  = book(new TH1F("fLayerPhi", "#varphi^{layer}",
+			     160, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval));
+  fLayerRVsPhi = book(new TH2F("fLayerRVsPhi", "R vs. #varphi for layers",
+			       60, 400, 1000,
+			       80, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval));
+
   // Extrapolated hits
-  fExtrapR    = new TH1F("fExtrapR",   "R^{extrap. hit}", 300, 400, 1000);
-  fExtrapRho  = new TH1F("fExtrapRho", "#rho^{extrap. hit}", 300, 400, 1000);
-  fExtrapEta  = new TH1F("fExtrapEta", "#eta^{extrap. hit}", 100, -0.1, 0.1);
-  fExtrapPhi  = new TH1F("fExtrapPhi", "#varphi^{extrap. hit}", 
-			 160, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval);
-  
-  fExtrapRVsPhi = new TH2F("fExtrapRVsPhi", "R vs. #varphi for extrap. hits",
-			   60, 400, 1000, 
-			   80, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval);
+  fExtrapR    = book(new TH1F("fExtrapR",   "R^{extrap. hit}", 300, 400, 1000));
+  fExtrapRho  = book(new TH1F("fExtrapRho", "#rho^{extrap. hit}", 300, 400, 1000));
+  fExtrapEta  = book(new TH1F("fExtrapEta", "#eta^{extrap. hit}", 100, -0.1, 0.1));
+  fExtrapPhi  = book(new TH1F("fExtrapPhi", "#varphi^{extrap. hit}",
+			      160, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval));
+
+  fExtrapRVsPhi = book(new TH2F("fExtrapRVsPhi", "R vs. #varphi for extrap. hits",
+				60, 400, 1000,
+				80, fBeamCenter-fBeamInterval, fBeamCenter+fBeamInterval));
 
   // Distances
-  fDeltaRo  = new TH1F("fDeltaRo", "#Delta(#rho^{sim}, #rho^{extrap})",
-		       100, 0, 200);
-  fDeltaEta = new TH1F("fDeltaEta", "#Delta(#eta^{sim}, #eta^{extrap})", 
-		       100, -1, 1);
-  fDeltaPhi = new TH1F("fDeltaPhi", "#Delta(#varphi^{sim}, #varphi^{extrap})", 
-		       120, -30, 30);
+  fDeltaRo  = book(new TH1F("fDeltaRo", "#Delta(#rho^{sim}, #rho^{extrap})",
+			    100, 0, 200));
+  fDeltaEta = book(new TH1F("fDeltaEta", "#Delta(#eta^{sim}, #eta^{extrap})",
+			    100, -1, 1));
+  fDeltaPhi = book(new TH1F("fDeltaPhi", "#Delta(#varphi^{sim}, #varphi^{extrap})",
+			    120, -30, 30));
 
   // Studies on Phi
-  fStationPosPhi = new TH1F("fStationPosPhi", 
-			    "Station with positive #varphi", 
-			    6, -0.5, 5.5);
-  fSectorPosPhi  = new TH1F("fSectorPosPhi",  
-			    "Sector with positive #varphi", 
-			    6, -0.5, 5.5);
-  fSLayerPosPhi  = new TH1F("fSLayerPosPhi",  
-			    "Superlayer with positive #varphi", 
-			    6, -0.5, 5.5);
-  fLayerPosPhi   = new TH1F("fLayerPosPhi",   
-			    "Layer with positive #varphi", 
-			    6, -0.5, 5.5);
-  fStationNegPhi = new TH1F("fStationNegPhi", 
-			    "Station with negative #varphi", 
-			    6, -0.5, 5.5);
-  fSectorNegPhi  = new TH1F("fSectorNegPhi",  
-			    "Sector with negative #varphi", 
-			    6, -0.5, 5.5);
-  fSLayerNegPhi  = new TH1F("fSLayerNegPhi",  
-			    "Superlayer with negative #varphi", 
-			    6, -0.5, 5.5);
-  fLayerNegPhi   = new TH1F("fLayerNegPhi",   
-			    "Layer with negative #varphi", 
-			    6, -0.5, 5.5);
-
-  //
-  ///////////////////////////////////////////////////////////////////////////////////
+  fStationPosPhi = book(new TH1F("fStationPosPhi",
+				 "Station with positive #varphi",
+				 6, -0.5, 5.5));
+  fSectorPosPhi  = book(new TH1F("fSectorPosPhi",
+				 "Sector with positive #varphi",
+				 6, -0.5, 5.5));
+  fSLayerPosPhi  = book(new TH1F("fSLayerPosPhi",
+				 "Superlayer with positive #varphi",
+				 6, -0.5, 5.5));
+  fLayerPosPhi   = book(new TH1F("fLayerPosPhi",
+				 "Layer with positive #varphi",
+				 6, -0.5, 5.5));
+  fStationNegPhi = book(new TH1F("fStationNegPhi",
+				 "Station with negative #varphi",
+				 6, -0.5, 5.5));
+  fSectorNegPhi  = book(new TH1F("fSectorNegPhi",
+				 "Sector with negative #varphi",
+				 6, -0.5, 5.5));
+  fSLayerNegPhi  = book(new TH1F("fSLayerNegPhi",
+				 "Superlayer with negative #varphi",
+				 6, -0.5, 5.5));
+  fLayerNegPhi   = book(new TH1F("fLayerNegPhi",
+				 "Layer with negative #varphi",
+				 6, -0.5, 5.5));
 }
 
-void Geant4ePropagatorAnalyzer::beginJob() {
-  LogDebug("Geant4e") << "Nothing done in beginJob...";
+Geant4ePropagatorAnalyzerHistos::~Geant4ePropagatorAnalyzerHistos() {
+  for (unsigned int i = 0; i < theHistos.size(); i++)
+    delete theHistos[i];
 }
 
-void Geant4ePropagatorAnalyzer::endJob() {
-  fDistanceSHLayer->Write();
-  fDistance->Write();
-  for (unsigned int i = 0; i < 4; i++)
-    fDistanceSt[i]->Write();
-
-  fHitR->Write();
-  fHitRho->Write();
-  fHitEta->Write();
-  fHitPhi->Write();
-  fHitPhi1L->Write();
-  fHitRVsPhi->Write();
-
-  fLayerR->Write();
-  fLayerRho->Write();
-  fLayerEta->Write();
-  fLayerPhi->Write();
-  fLayerRVsPhi->Write();
-
-  fExtrapR->Write();
-  fExtrapRho->Write();
-  fExtrapEta->Write();
-  fExtrapPhi->Write();
-  fExtrapRVsPhi->Write();
-
-  fDeltaRo->Write();
-  fDeltaEta->Write();
-  fDeltaPhi->Write();
-
-  //Phi studies
-  fStationPosPhi->Write();
-  fSectorPosPhi->Write();
-  fSLayerPosPhi->Write();
-  fLayerPosPhi->Write();
-  fStationNegPhi->Write();
-  fSectorNegPhi->Write();
-  fSLayerNegPhi->Write();
-  fLayerNegPhi->Write();
-
-
-  theRootFile->Close();
-  TimingReport::current()->dump(std::cout);
+void Geant4ePropagatorAnalyzerHistos::apply(Geant4ePropagatorAnalyzerFills& fills) {
+  for (unsigned int i = 0; i < fills.entries.size(); i++) {
+    const Geant4ePropagatorAnalyzerFills::Entry& e = fills.entries[i];
+    if (e.twoD)
+      static_cast<TH2*>(e.histo)->Fill(e.x, e.y);
+    else
+      e.histo->Fill(e.x);
+  }
+  fills.entries.clear();
 }
 
-void Geant4ePropagatorAnalyzer::analyze(const edm::Event& iEvent, 
-					const edm::EventSetup& iSetup) {
+void Geant4ePropagatorAnalyzerHistos::addCounts(const Geant4ePropagatorAnalyzerFills& fills) {
+  nPropagations += fills.nPropagations;
+  nFailures += fills.nFailures;
+  nSteps += fills.nSteps;
+  propagationTime += fills.propagationTime;
+}
 
-  using namespace edm;
+void Geant4ePropagatorAnalyzerHistos::write() const {
+  for (unsigned int i = 0; i < theHistos.size(); i++)
+    theHistos[i]->Write();
+}
 
-  LogDebug("Geant4e") << "Starting analyze...";
+//
+////////////////////////////////////////////////////////////////////////////
+//
+
+Geant4ePropagationTreeWriter::Geant4ePropagationTreeWriter(const std::string& fileName):
+  theFile(new TFile(fileName.c_str(), "recreate")),
+  theTree(new TTree("propagations", "Geant4e propagations")) {
+
+  theTree->SetDirectory(theFile);
+  //Baskets are flushed every ~16 MB
+  theTree->SetAutoFlush(-16000000);
+
+  Geant4ePropagationRow& r = theRow;
+  theTree->Branch("run",         &r.run,         "run/i");
+  theTree->Branch("event",       &r.event,       "event/i");
+  theTree->Branch("detId",       &r.detId,       "detId/i");
+  theTree->Branch("chamberType", &r.chamberType, "chamberType/I");
+  theTree->Branch("station",     &r.station,     "station/I");
+  theTree->Branch("charge",      &r.charge,      "charge/I");
+  theTree->Branch("inPos",       r.inPos,        "inPos[3]/F");
+  theTree->Branch("inMom",       r.inMom,        "inMom[3]/F");
+  theTree->Branch("inCov",       r.inCov,        "inCov[15]/F");
+  theTree->Branch("valid",       &r.valid,       "valid/I");
+  theTree->Branch("ierr",        &r.ierr,        "ierr/I");
+  theTree->Branch("nSteps",      &r.nSteps,      "nSteps/i");
+  theTree->Branch("time",        &r.time,        "time/F");
+  theTree->Branch("outPos",      r.outPos,       "outPos[3]/F");
+  theTree->Branch("outMom",      r.outMom,       "outMom[3]/F");
+  theTree->Branch("outCov",      r.outCov,       "outCov[15]/F");
+  theTree->Branch("hitPos",      r.hitPos,       "hitPos[3]/F");
+  theTree->Branch("hitMom",      r.hitMom,       "hitMom[3]/F");
+}
 
-  ///////////////////////////////////////
-  //Construct Magnetic Field
-  ESHandle<MagneticField> bField;
-  iSetup.get<IdealMagneticFieldRecord>().get(bField);
-  if (bField.isValid())
-    LogDebug("Geant4e") << "G4e -- Magnetic field is valid. Value in (0,0,0): "
-			<< bField->inTesla(GlobalPoint(0,0,0)).mag() 
-			<< " Tesla";
-  else
-     LogError("Geant4e") << "G4e -- NO valid Magnetic field";
- 
-  
+Geant4ePropagationTreeWriter::~Geant4ePropagationTreeWriter() {
+  theFile->cd();
+  theTree->Write();
+  theFile->Close();
+  delete theFile;
+}
 
-  ///////////////////////////////////////
-  //Build geometry
+void Geant4ePropagationTreeWriter::fill(const std::vector<Geant4ePropagationRow>& rows) {
+  std::lock_guard<std::mutex> guard(theMutex);
+  for (unsigned int i = 0; i < rows.size(); i++) {
+    theRow = rows[i];
+    theTree->Fill();
+  }
+}
 
-  //- DT...
-  iSetup.get<MuonGeometryRecord>().get(theDTGeomESH);
-  LogDebug("Geant4e") << "Got DTGeometry";
+//
+////////////////////////////////////////////////////////////////////////////
+//
 
-  //- CSC...
-  iSetup.get<MuonGeometryRecord>().get(theCSCGeomESH);
-  LogDebug("Geant4e") << "Got CSCGeometry";
+Geant4ePropagatorAnalyzer::Geant4ePropagatorAnalyzer(const edm::ParameterSet& iConfig):
+  fStudyStation(iConfig.getParameter<int>("StudyStation")),
+  fBeamCenter(iConfig.getParameter<double>("BeamCenter")),
+  fBeamInterval(iConfig.getParameter<double>("BeamInterval")),
+  fChainPropagation(iConfig.getParameter<bool>("ChainPropagation")),
+  theRootFileName(iConfig.getParameter<std::string>("RootFile")),
+  theReducedGeometryMinVolume(iConfig.getParameter<double>("ReducedGeometryMinVolume")),
+  theReducedGeometryKeep(iConfig.getParameter<std::vector<std::string> >("ReducedGeometryKeep")),
+  theTreeChunkSize(iConfig.getParameter<unsigned int>("TreeChunkSize")),
+  G4VtxToken_(consumes<edm::SimVertexContainer>(iConfig.getParameter<edm::InputTag>("G4VtxSrc"))),
+  G4TrkToken_(consumes<edm::SimTrackContainer>(iConfig.getParameter<edm::InputTag>("G4TrkSrc"))) {
+
+  simHitTokens_[DT]  = consumes<edm::PSimHitContainer>(iConfig.getParameter<edm::InputTag>("DTHitSrc"));
+  simHitTokens_[CSC] = consumes<edm::PSimHitContainer>(iConfig.getParameter<edm::InputTag>("CSCHitSrc"));
+  simHitTokens_[RPC] = consumes<edm::PSimHitContainer>(iConfig.getParameter<edm::InputTag>("RPCHitSrc"));
+
+  std::string treeFile = iConfig.getParameter<std::string>("TreeFile");
+  if (!treeFile.empty())
+    theTreeWriter.reset(new Geant4ePropagationTreeWriter(treeFile));
+}
 
-  //- RPC...
-  iSetup.get<MuonGeometryRecord>().get(theRPCGeomESH);
-  LogDebug("Geant4e") << "Got RPCGeometry";
+void Geant4ePropagatorAnalyzer::beginJob() {
+  theTotals.reset(new Geant4ePropagatorAnalyzerHistos(fBeamCenter, fBeamInterval));
+}
 
+std::unique_ptr<Geant4ePropagatorAnalyzerFills>
+Geant4ePropagatorAnalyzer::beginStream(edm::StreamID) const {
+  return std::unique_ptr<Geant4ePropagatorAnalyzerFills>(new Geant4ePropagatorAnalyzerFills);
+}
 
-  ///////////////////////////////////////
-  //Run/Event information
-  theRun = (int)iEvent.id().run();
-  theEvent = (int)iEvent.id().event();
-  LogDebug("Geant4e") << "G4e -- Begin for run/event ==" << theRun 
-		      << "/" << theEvent 
-		      << " ---------------------------------";
+void Geant4ePropagatorAnalyzer::endStream(edm::StreamID id) const {
+  Geant4ePropagatorAnalyzerFills& fills = *streamCache(id);
+  if (theTreeWriter) {
+    theTreeWriter->fill(fills.rows);
+    fills.rows.clear();
+  }
 
+  std::lock_guard<std::mutex> guard(theTotalsMutex);
+  theTotals->apply(fills);
+  theTotals->addCounts(fills);
+}
 
-  ///////////////////////////////////////
-  //Initialise the propagator
-  if (! thePropagator) 
-    thePropagator = new Geant4ePropagator(&*bField);
+void Geant4ePropagatorAnalyzer::endJob() {
+  //Closes the tree file
+  theTreeWriter.reset();
+
+  TFile rootFile(theRootFileName.c_str(), "recreate");
+  theTotals->write();
+  rootFile.Close();
+
+  edm::LogInfo("Geant4e") << "G4e -- " << theTotals->nPropagations
+			  << " propagations (" << theTotals->nFailures
+			  << " failed) in " << theTotals->propagationTime
+			  << " s, "
+			  << (theTotals->nPropagations > 0 ?
+			      1.e3*theTotals->propagationTime/theTotals->nPropagations : 0.)
+			  << " ms and "
+			  << (theTotals->nPropagations > 0 ?
+			      double(theTotals->nSteps)/theTotals->nPropagations : 0.)
+			  << " steps per propagation";
+}
 
-  if (thePropagator)
-    LogDebug("Geant4e") << "Propagator built!";
-  else
-    LogError("Geant4e") << "Could not build propagator!";
+void Geant4ePropagatorAnalyzer::analyze(edm::StreamID id,
+					const edm::Event& iEvent,
+					const edm::EventSetup& iSetup) const {
 
+  using namespace edm;
 
+  Geant4ePropagatorAnalyzerFills& fills = *streamCache(id);
 
+  LogDebug("Geant4e") << "G4e -- Begin for run/event ==" << iEvent.id().run()
+		      << "/" << iEvent.id().event()
+		      << " ---------------------------------";
 
+  ///////////////////////////////////////
+  //Construct Magnetic Field
+  ESHandle<MagneticField> bField;
+  iSetup.get<IdealMagneticFieldRecord>().get(bField);
+  if (!bField.isValid()) {
+    LogError("Geant4e") << "G4e -- NO valid Magnetic field";
+    return;
+  }
 
   ///////////////////////////////////////
-  //Get the sim tracks & vertices 
+  //Build geometry
+  Geometries geom;
+  iSetup.get<MuonGeometryRecord>().get(geom.dt);
+  iSetup.get<MuonGeometryRecord>().get(geom.csc);
+  iSetup.get<MuonGeometryRecord>().get(geom.rpc);
+
+  ///////////////////////////////////////
+  //Initialise the propagator
+  {
+    std::lock_guard<std::mutex> guard(thePropagatorMutex);
+    if (!thePropagator) {
+      thePropagator.reset(new Geant4ePropagator(&*bField));
+      thePropagator->setReducedGeometry(theReducedGeometryMinVolume,
+					theReducedGeometryKeep);
+      LogDebug("Geant4e") << "Propagator built!";
+    }
+  }
+
+  ///////////////////////////////////////
+  //Get the sim tracks & vertices
   Handle<SimTrackContainer> simTracks;
-  iEvent.getByLabel<SimTrackContainer>(G4TrkSrc_, simTracks);
+  iEvent.getByToken(G4TrkToken_, simTracks);
   if (! simTracks.isValid() ){
     LogWarning("Geant4e") << "No tracks found" << std::endl;
     return;
@@ -374,101 +584,54 @@ void Geant4ePropagatorAnalyzer::analyze(const edm::Event& iEvent,
   LogDebug("Geant4e") << "G4e -- Got simTracks of size " << simTracks->size();
 
   Handle<SimVertexContainer> simVertices;
-  iEvent.getByLabel<SimVertexContainer>(G4VtxSrc_, simVertices);
+  iEvent.getByToken(G4VtxToken_, simVertices);
   if (! simVertices.isValid() ){
-    LogWarning("Geant4e") << "No tracks found" << std::endl;
+    LogWarning("Geant4e") << "No vertices found" << std::endl;
     return;
   }
   LogDebug("Geant4e") << "Got simVertices of size " << simVertices->size();
 
-
   ///////////////////////////////////////
-  //Get the sim hits for the different muon parts
-  Handle<PSimHitContainer> simHitsDT;
-  iEvent.getByLabel("g4SimHits", "MuonDTHits", simHitsDT);
-  if (! simHitsDT.isValid() ){
-    LogWarning("Geant4e") << "No hits found" << std::endl;
-    return;
-  }
-  LogDebug("Geant4e") << "Got MuonDTHits of size " << simHitsDT->size();
-
-  Handle<PSimHitContainer> simHitsCSC;
-  iEvent.getByLabel("g4SimHits", "MuonCSCHits", simHitsCSC);
-  if (! simHitsCSC.isValid() ){
-    LogWarning("Geant4e") << "No hits found" << std::endl;
-    return;
-  }
-  LogDebug("Geant4e") << "Got MuonCSCHits of size " << simHitsCSC->size();
-
-
-  Handle<PSimHitContainer> simHitsRPC;
-  iEvent.getByLabel("g4SimHits", "MuonRPCHits", simHitsRPC);
-  if (! simHitsRPC.isValid() ){
-    LogWarning("Geant4e") << "No hits found" << std::endl;
-    return;
+  //Get the sim hits for the different muon parts and index them by track
+  HitIndex hitIndex[NChamberTypes];
+  for (unsigned int type = 0; type < NChamberTypes; type++) {
+    Handle<PSimHitContainer> simHits;
+    iEvent.getByToken(simHitTokens_[type], simHits);
+    if (! simHits.isValid() ){
+      LogWarning("Geant4e") << "No " << chamberName(type) << " hits found";
+      continue;
+    }
+    LogDebug("Geant4e") << "Got " << chamberName(type) << " hits of size "
+			<< simHits->size();
+    Geant4eMuonSimHits::buildIndex(*simHits, hitIndex[type]);
   }
-  LogDebug("Geant4e") << "Got MuonRPCHits of size " << simHitsRPC->size();
-
-
 
   ///////////////////////////////////////
   // Iterate over sim tracks to build the FreeTrajectoryState for
   // for the initial position.
-  //DEBUG
-  unsigned int counter = 0;
-  //DEBUG
-  for(SimTrackContainer::const_iterator simTracksIt = simTracks->begin(); 
-      simTracksIt != simTracks->end(); 
+  for(SimTrackContainer::const_iterator simTracksIt = simTracks->begin();
+      simTracksIt != simTracks->end();
       simTracksIt++){
 
-    //DEBUG
-    counter++;
-    LogDebug("Geant4e") << "G4e -- Iterating over " << counter 
-			<< "rd track. Number: " 
-			<< simTracksIt->genpartIndex() 
-			<< "------------------";
-    //DEBUG
-
-    int simTrackPDG = simTracksIt->type();
-    if (abs(simTrackPDG) != 13 ) {
-      continue;
-    }
-    LogDebug("Geant4e") << "G4e -- Track PDG " << simTrackPDG;
-
-    //- Timing
-    TimeMe tProp("Geant4ePropagatorAnalyzer::analyze::propagate");
-   
     //- Check if the track corresponds to a muon
     int trkPDG = simTracksIt->type();
     if (abs(trkPDG) != 13 ) {
       LogDebug("Geant4e") << "Track is not a muon: " << trkPDG;
       continue;
     }
-    else
-      LogDebug("Geant4e") << "Found a muon track " << trkPDG;
-      
-    
+
     //- Get momentum, but only use tracks with P > 2 GeV
-    GlobalVector p3T = 
-      TrackPropagation::hep3VectorToGlobalVector(CLHEP::Hep3Vector(simTracksIt->momentum().x(),
-                                                            simTracksIt->momentum().y(),
-                                                            simTracksIt->momentum().z()));
+    GlobalVector p3T(simTracksIt->momentum().x(),
+		     simTracksIt->momentum().y(),
+		     simTracksIt->momentum().z());
     if (p3T.perp() < 2.) {
       LogDebug("Geant4e") << "Track PT is too low: " << p3T.perp();
       continue;
     }
-    else {
-      LogDebug("Geant4e") << "*** Phi (rad): " << p3T.phi() << " - Phi(deg)" 
-			  << p3T.phi().degrees();
-      LogDebug("Geant4e") << "Track PT is enough.";
-      LogDebug("Geant4e") << "Track P.: " << p3T
-			  << "\nTrack P.: PT=" << p3T.perp()
-			  << "\tEta=" << p3T.eta()
-			  << "\tPhi=" << p3T.phi().degrees()
-			  << "--> Rad: Phi=" << p3T.phi();
-
-    }
-      
+    LogDebug("Geant4e") << "Track P.: " << p3T
+			<< "\nTrack P.: PT=" << p3T.perp()
+			<< "\tEta=" << p3T.eta()
+			<< "\tPhi=" << p3T.phi().degrees();
 
     //- Vertex fixes the starting point
     int vtxInd = simTracksIt->vertIndex();
@@ -480,254 +643,202 @@ void Geant4ePropagatorAnalyzer::analyze(const edm::Event& iEvent,
       r3T = TrackPropagation::hep3VectorToGlobalPoint(CLHEP::Hep3Vector((*simVertices)[vtxInd].position().x(),
                                                                  (*simVertices)[vtxInd].position().y(),
                                                                  (*simVertices)[vtxInd].position().z()));
+    LogDebug("Geant4e") << "Init point: " << r3T;
 
-    LogDebug("Geant4e") << "Init point: " << r3T
-			<< "\nInit point Ro=" << r3T.perp()
-			<< "\tEta=" << r3T.eta()
-			<< "\tPhi=" << r3T.phi().degrees() ;
-    
     //- Charge
     int charge = trkPDG > 0 ? -1 : 1;
-    LogDebug("Geant4e") << "Track charge = " << charge;
 
-    //- Initial covariance matrix is unity 10-6
+    //- Initial covariance matrix is unity
     CurvilinearTrajectoryError covT;
-    //covT *= 1E-6;
 
     //- Build FreeTrajectoryState
     GlobalTrajectoryParameters trackPars(r3T, p3T, charge, &*bField);
     FreeTrajectoryState ftsTrack(trackPars, covT);
 
+    //- Sim hits are associated through the G4 track id
+    unsigned int trkInd = simTracksIt->trackId();
 
-    //- Get index of generated particle. Used further down
-    unsigned int trkInd = simTracksIt->genpartIndex();
-
-    ////////////////////////////////////////////////
-    //- Iterate over Sim Hits in DT and check propagation
-    iterateOverHits(simHitsDT, DT, trkInd, ftsTrack);
-    ////////////////////////////////////////////////
-    //- Iterate over Sim Hits in RPC and check propagation
-    //iterateOverHits(simHitsRPC, RPC, trkInd, ftsTrack);
-    ////////////////////////////////////////////////
-    //- Iterate over Sim Hits in CSC and check propagation
-    //iterateOverHits(simHitsCSC, CSC, trkInd, ftsTrack);
-
+    for (unsigned int type = 0; type < NChamberTypes; type++)
+      iterateOverHits(hitIndex[type], testMuChamberType(type), trkInd,
+		      ftsTrack, geom, iEvent.id(), fills);
 
+    if (theTreeWriter && fills.rows.size() >= theTreeChunkSize) {
+      theTreeWriter->fill(fills.rows);
+      fills.rows.clear();
+    }
+    if (fills.entries.size() >= kFillChunkSize) {
+      std::lock_guard<std::mutex> guard(theTotalsMutex);
+      theTotals->apply(fills);
+    }
 
   } // <-- for over sim tracks
 }
 
 
 void
-Geant4ePropagatorAnalyzer::iterateOverHits(edm::Handle<edm::PSimHitContainer> simHits, 
+Geant4ePropagatorAnalyzer::iterateOverHits(const HitIndex& index,
 					   testMuChamberType muonChamberType,
 					   unsigned int trkIndex,
-					   const FreeTrajectoryState& ftsTrack) {
+					   const FreeTrajectoryState& ftsTrack,
+					   const Geometries& geom,
+					   const edm::EventID& eventId,
+					   Geant4ePropagatorAnalyzerFills& fills) const {
 
   using namespace edm;
 
-  if (muonChamberType == DT)
-    LogDebug("Geant4e") << "G4e -- Iterating over DT hits...";
-  else if (muonChamberType == RPC)
-    LogDebug("Geant4e") << "G4e -- Iterating over RPC hits...";
-  else if (muonChamberType == CSC)
-    LogDebug("Geant4e") << "G4e -- Iterating over CSC hits...";
-  
-  for (PSimHitContainer::const_iterator simHitIt = simHits->begin(); 
-       simHitIt != simHits->end(); 
-       simHitIt++){
-
-    ///////////////
-    // Skip if this hit does not belong to the track
-    if (simHitIt->trackId() != trkIndex ) {
-      LogDebug("Geant4e") << "Hit (in tr " << simHitIt->trackId()
-			  << ") does not belong to track "<< trkIndex;
+  std::pair<HitIndex::const_iterator, HitIndex::const_iterator> hits =
+    Geant4eMuonSimHits::trackHits(index, trkIndex);
+  HitIndex::const_iterator first = hits.first, last = hits.second;
+
+  LogDebug("Geant4e") << "G4e -- " << (last - first) << " "
+		      << chamberName(muonChamberType)
+		      << " hits for track " << trkIndex;
+
+  //State the next propagation starts from
+  FreeTrajectoryState ftsStart = ftsTrack;
+
+  for (HitIndex::const_iterator hitIt = first; hitIt != last; ++hitIt) {
+    const PSimHit& simHit = **hitIt;
+
+    //////////////////////////////////////////////////////////
+    // Get the surface. This is different for DT, RPC, CSC
+    int station = 0;
+    const GeomDet* layer =
+      Geant4eMuonSimHits::layerForHit(simHit, muonChamberType, geom, station);
+    if (layer == 0) {
+      LogDebug("Geant4e") << "Failed to get detector unit";
       continue;
     }
-    
-    LogDebug("Geant4e") << "G4e -- Hit belongs to track " << trkIndex;
-    
-    //////////////
-    // Skip if it is not a muon (this is checked before also)
-    int trkPDG = simHitIt->particleType();
-    if (abs(trkPDG) != 13) {
-      LogDebug("Geant4e") << "Associated track is not a muon: " << trkPDG;
+    if (fStudyStation != -1 && fStudyStation != station)
       continue;
-    }
-    LogDebug("Geant4e") << "G4e -- Found a hit corresponding to a muon " << trkPDG;
-    
-    //////////////////////////////////////////////////////////
-    // Build the surface. This is different for DT, RPC, CSC
-    //const GeomDetUnit* layer = 0;
-    const GeomDet* layer = 0;
-    // * DT
-    DTWireId* wIdDT = 0; //For DT holds the information about the chamber
-    if (muonChamberType == DT) {
-      wIdDT = new DTWireId(simHitIt->detUnitId());
-      int station =  wIdDT->station();
-      LogDebug("Geant4e") << "G4e -- DT Chamber. Station: " << station
-			  << ". DetId: " << wIdDT->layerId();
-
-      
-      if (fStudyStation != -1 && fStudyStation != station) 
-	continue;
-
-      layer = theDTGeomESH->layer(*wIdDT);
-      if (layer == 0){
-	LogDebug("Geant4e") << "Failed to get detector unit";
-	continue;
-      }
-    }
-    // * RPC
-    else if (muonChamberType == RPC) {
-      RPCDetId rpcId(simHitIt->detUnitId());
-      layer = theRPCGeomESH->idToDet(rpcId);
-      if (layer == 0){
-	LogDebug("Geant4e") << "Failed to get detector unit";
-	continue;
-      }
-    }
 
-    // * CSC
-    else if (muonChamberType ==CSC) {
-      CSCDetId cscId(simHitIt->detUnitId());
-      layer = theCSCGeomESH->idToDet(cscId);
-      if (layer == 0){
-	LogDebug("Geant4e") << "Failed to get detector unit";
-	continue;
-      }
-
-    }
+    const Plane& surf = layer->surface();
 
-    const Surface& surf = layer->surface();
-    if (layer->geographicalId()!=DTLayerId(simHitIt->detUnitId()))
-      LogError("Geant4e") << "ERROR: wrong DetId";
-
-    
-    //==>DEBUG
-    //const BoundPlane& bp = layer->surface();
-    //const Bounds& bounds = bp.bounds();
-    //LogDebug("Geant4e") << "Surface: length = " << bounds.length() 
-    //		  << ", thickness = " << bounds.thickness() 
-    //		<< ", width = " << bounds.width();
-    //<==DEBUG
-    
     ////////////
-    // Discard hits with very low momentum ???
-    GlobalVector p3Hit = surf.toGlobal(simHitIt->momentumAtEntry());
-    if (p3Hit.perp() < 0.5 ) 
+    // Discard hits with very low momentum
+    GlobalVector p3Hit = surf.toGlobal(simHit.momentumAtEntry());
+    if (p3Hit.perp() < 0.5 )
       continue;
-    GlobalPoint posHit = surf.toGlobal(simHitIt->localPosition());
-    Point3DBase< float, GlobalTag > surfpos = surf.position();
-    LogDebug("Geant4e") << "G4e -- Layer position: " << surfpos << " cm"
-			<< "\nG4e --                   Ro=" << surfpos.perp()
-			<< "\tEta=" << surfpos.eta()
-			<< "\tPhi=" << surfpos.phi().degrees() <<"deg";
-    LogDebug("Geant4e") << "G4e -- Sim Hit position: " << posHit << " cm"
-			<< "\nG4e --                   Ro=" << posHit.perp()
-			<< "\tEta=" << posHit.eta()
-			<< "\tPhi=" << posHit.phi().degrees() << "deg"
-			<< "\t localpos=" << simHitIt->localPosition();
-
-
-    const Plane* bp = dynamic_cast<const Plane*>(&surf);
-    if (bp != 0) {
-      Float_t distance = bp->localZ(posHit);
-      LogDebug("Geant4e") << "\nG4e -- Distance from plane to sim hit: " 
-			  << distance << "cm";
-      fDistanceSHLayer->Fill(distance);
+    GlobalPoint posHit = surf.toGlobal(simHit.localPosition());
+    GlobalPoint surfpos = surf.position();
+
+    fills.fill(theTotals->fDistanceSHLayer, surf.localZ(posHit));
+
+    /////////////////////////////////////////
+    // Propagate
+    TrajectoryStateOnSurface tSOSDest;
+    double time;
+    int ierr;
+    unsigned int nSteps;
+    {
+      std::lock_guard<std::mutex> guard(thePropagatorMutex);
+      std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      tSOSDest = thePropagator->propagate(ftsStart, surf);
+      time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      ierr = thePropagator->lastG4eError();
+      nSteps = thePropagator->lastStepCount();
     }
-    else {
-      LogWarning("Geant4e") << "G4e -- Layer is not a Plane!!!";
-      fDistanceSHLayer->Fill(-1);
+    fills.propagationTime += time;
+    fills.nPropagations++;
+    fills.nSteps += nSteps;
+
+    if (theTreeWriter) {
+      fills.rows.push_back(Geant4ePropagationRow());
+      Geant4ePropagationRow& row = fills.rows.back();
+      row.run = eventId.run();
+      row.event = eventId.event();
+      row.detId = simHit.detUnitId();
+      row.chamberType = muonChamberType;
+      row.station = station;
+      row.charge = ftsStart.charge();
+      fillVector(row.inPos, ftsStart.position());
+      fillVector(row.inMom, ftsStart.momentum());
+      fillCovariance(row.inCov, ftsStart);
+      row.valid = tSOSDest.isValid();
+      row.ierr = ierr;
+      row.nSteps = nSteps;
+      row.time = time;
+      if (tSOSDest.isValid()) {
+	fillVector(row.outPos, tSOSDest.globalPosition());
+	fillVector(row.outMom, tSOSDest.globalMomentum());
+	fillCovariance(row.outCov, *tSOSDest.freeState());
+      } else {
+	std::fill(row.outPos, row.outPos + 3, 0.f);
+	std::fill(row.outMom, row.outMom + 3, 0.f);
+	std::fill(row.outCov, row.outCov + 15, 0.f);
+      }
+      fillVector(row.hitPos, posHit);
+      fillVector(row.hitMom, p3Hit);
     }
 
+    if (!tSOSDest.isValid()) {
+      LogDebug("Geant4e") << "G4e -- Propagation failed";
+      fills.nFailures++;
+      continue;
+    }
+    if (fChainPropagation)
+      ftsStart = *tSOSDest.freeState();
 
-    LogDebug("Geant4e") << "Sim Hit Momentum PT=" << p3Hit.perp()
-			<< "\tEta=" << p3Hit.eta()
-			<< "\tPhi=" << p3Hit.phi().degrees() << "deg";
-    
-   
-    /////////////////////////////////////////
-    // Propagate: Need to explicetely
-    TrajectoryStateOnSurface tSOSDest = 
-      thePropagator->propagate(ftsTrack, surf);
-    
     /////////////////////
     // Get hit position and extrapolation position to compare
-    GlobalPoint posExtrap = tSOSDest.freeState()->position();
-    //     GlobalPoint posExtrap(posExtrap_prov.theta(), 
-    // 			  posExtrap_prov.phi()*12,
-    // 			  posExtrap_prov.mag());
-    
+    GlobalPoint posExtrap = tSOSDest.globalPosition();
     GlobalVector posDistance = posExtrap - posHit;
     float distance = posDistance.mag();
     float simhitphi = posHit.phi().degrees();
     float layerphi  = surfpos.phi().degrees();
     float extrapphi = posExtrap.phi().degrees();
-    LogDebug("Geant4e") << "G4e -- Difference between hit and final position: " 
+    LogDebug("Geant4e") << "G4e -- Difference between hit and final position: "
 			<< distance << " cm\n"
-			<< "G4e -- Transversal difference between hit and final position: "
-			<< posDistance.perp() << " cm.";
-    LogDebug("Geant4e") << "G4e -- Extrapolated position:" << posExtrap 
+			<< "G4e -- Extrapolated position:" << posExtrap
 			<< " cm\n"
-			<< "G4e --       (Rho, eta, phi): (" << posExtrap.perp()
-			<< " cm, " << posExtrap.eta() << ", " << extrapphi
-			<< " deg)";
-    LogDebug("Geant4e") << "G4e --          Hit position: " << posHit 
-			<< " cm\n"
-                        << "G4e --       (Rho, eta, phi): (" << posHit.perp()
-                        << " cm, " << posHit.eta() << ", " << simhitphi
-                        << " deg)";
- 
-    
-    fDistance->Fill(distance);
-    fDistanceSt[wIdDT->station()-1]->Fill(distance);
-      
-
-    fHitR->Fill(posHit.mag());
-    fHitRho->Fill(posHit.perp());
-    fHitEta->Fill(posHit.eta());
-    fHitPhi->Fill(simhitphi);
+			<< "G4e --          Hit position: " << posHit
+			<< " cm";
+
+    fills.fill(theTotals->fDistance, distance);
+    if (station >= 1 && station <= 4)
+      fills.fill(theTotals->fDistanceSt[station-1], distance);
+    fills.fill(theTotals->fDistanceType[muonChamberType], distance);
+
+    fills.fill(theTotals->fHitR, posHit.mag());
+    fills.fill(theTotals->fHitRho, posHit.perp());
+    fills.fill(theTotals->fHitEta, posHit.eta());
+    fills.fill(theTotals->fHitPhi, simhitphi);
     if (posHit.perp() < 500)
-      fHitPhi1L->Fill(simhitphi);
-    fHitRVsPhi->Fill(posHit.mag(), simhitphi);
-
-    fLayerR->Fill(surfpos.mag());
-    fLayerRho->Fill(surfpos.perp());
-    fLayerEta->Fill(surfpos.eta());
-    fLayerPhi->Fill(layerphi);
-    fLayerRVsPhi->Fill(surfpos.mag(), layerphi);
+      fills.fill(theTotals->fHitPhi1L, simhitphi);
+    fills.fill(theTotals->fHitRVsPhi, posHit.mag(), simhitphi);
 
-    fExtrapR->Fill(posExtrap.mag());
-    fExtrapRho->Fill(posExtrap.perp());
-    fExtrapEta->Fill(posExtrap.eta());
-    fExtrapPhi->Fill(extrapphi);
-    fExtrapRVsPhi->Fill(posExtrap.mag(), extrapphi);
+    fills.fill(theTotals->fLayerR, surfpos.mag());
+    fills.fill(theTotals->fLayerRho, surfpos.perp());
+    fills.fill(theTotals->fLayerEta, surfpos.eta());
+    fills.fill(theTotals->fLayerPhi, layerphi);
+    fills.fill(theTotals->fLayerRVsPhi, surfpos.mag(), layerphi);
 
-    fDeltaRo->Fill(posExtrap.perp() - posHit.perp());
-    fDeltaEta->Fill(posExtrap.eta() - posHit.eta());
-    fDeltaPhi->Fill(extrapphi - simhitphi);
+    fills.fill(theTotals->fExtrapR, posExtrap.mag());
+    fills.fill(theTotals->fExtrapRho, posExtrap.perp());
+    fills.fill(theTotals->fExtrapEta, posExtrap.eta());
+    fills.fill(theTotals->fExtrapPhi, extrapphi);
+    fills.fill(theTotals->fExtrapRVsPhi, posExtrap.mag(), extrapphi);
 
+    fills.fill(theTotals->fDeltaRo, posExtrap.perp() - posHit.perp());
+    fills.fill(theTotals->fDeltaEta, posExtrap.eta() - posHit.eta());
+    fills.fill(theTotals->fDeltaPhi, extrapphi - simhitphi);
 
-    if (wIdDT) {
+    if (muonChamberType == DT) {
+      DTWireId wIdDT(simHit.detUnitId());
       if (simhitphi > 0) {
-	fStationPosPhi->Fill(wIdDT->station());
-	fSectorPosPhi->Fill(wIdDT->sector());
-	fSLayerPosPhi->Fill(wIdDT->superlayer());
-	fLayerPosPhi->Fill(wIdDT->layer());
+	fills.fill(theTotals->fStationPosPhi, wIdDT.station());
+	fills.fill(theTotals->fSectorPosPhi, wIdDT.sector());
+	fills.fill(theTotals->fSLayerPosPhi, wIdDT.superlayer());
+	fills.fill(theTotals->fLayerPosPhi, wIdDT.layer());
       }
       else {
-	fStationNegPhi->Fill(wIdDT->station());
-	fSectorNegPhi->Fill(wIdDT->sector());
-	fSLayerNegPhi->Fill(wIdDT->superlayer());
-	fLayerNegPhi->Fill(wIdDT->layer());
+	fills.fill(theTotals->fStationNegPhi, wIdDT.station());
+	fills.fill(theTotals->fSectorNegPhi, wIdDT.sector());
+	fills.fill(theTotals->fSLayerNegPhi, wIdDT.superlayer());
+	fills.fill(theTotals->fLayerNegPhi, wIdDT.layer());
       }
-      //Some cleaning...
-      delete wIdDT;
     }
 
-
   } //<== For over simhits
 
 }
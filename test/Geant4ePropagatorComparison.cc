@@ -0,0 +1,424 @@
+#include "FWCore/Framework/interface/Frameworkfwd.h"
+#include "FWCore/Framework/interface/one/EDAnalyzer.h"
+#include "FWCore/Framework/interface/ESHandle.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/EventSetup.h"
+#include "FWCore/Framework/interface/MakerMacros.h" //For define_fwk_module
+
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/Utilities/interface/InputTag.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+//- Geometry and muon sim hits
+#include "TrackPropagation/Geant4e/test/Geant4eMuonSimHits.h"
+#include "Geometry/Records/interface/MuonGeometryRecord.h"
+
+//- Magnetic field
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
+
+//- Propagators
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
+#include "TrackPropagation/Geant4e/interface/ConvertFromToCLHEP.h"
+#include "TrackingTools/GeomPropagators/interface/Propagator.h"
+#include "TrackingTools/Records/interface/TrackingComponentsRecord.h"
+#include "TrackingTools/TrajectoryState/interface/FreeTrajectoryState.h"
+#include "TrackingTools/TrajectoryState/interface/TrajectoryStateOnSurface.h"
+
+//- Tracks and Vertices
+#include "SimDataFormats/Track/interface/SimTrack.h"
+#include "SimDataFormats/Track/interface/SimTrackContainer.h"
+#include "SimDataFormats/Vertex/interface/SimVertex.h"
+#include "SimDataFormats/Vertex/interface/SimVertexContainer.h"
+
+//- CLHEP
+#include "CLHEP/Random/JamesRandom.h"
+#include "CLHEP/Random/RandGauss.h"
+
+//- ROOT
+#include "TFile.h"
+#include "TH1.h"
+#include "TString.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <vector>
+
+/** Sends the same start states and target surfaces through Geant4e and a
+ *  set of analytic propagators taken from the TrackingComponentsRecord,
+ *  and compares them on the muon sim hits. Every muon sim track is
+ *  propagated from its vertex to each of its DT, CSC and RPC hits.
+ *
+ *  For every propagator and detector region (chamber type and station) it
+ *  books the time per call, the local residuals to the sim hit and the
+ *  pulls of those residuals with the propagated errors. The start state
+ *  is the sim track smeared with diagonal curvilinear errors given by
+ *  StartErrors (random seed Seed), which are also its errors, so the
+ *  pulls test how well each propagator transports them and accounts for
+ *  the material.
+ *  A summary table is printed at the end of the job.
+ */
+class Geant4ePropagatorComparison: public edm::one::EDAnalyzer<> {
+
+public:
+  explicit Geant4ePropagatorComparison(const edm::ParameterSet&);
+  virtual ~Geant4ePropagatorComparison();
+
+  virtual void analyze(const edm::Event&, const edm::EventSetup&);
+  virtual void endJob();
+
+private:
+
+  static const unsigned int NStations = 4;
+  static const unsigned int NRegions = Geant4eMuonSimHits::NChamberTypes*NStations;
+
+  /** Histograms and totals of one propagator in one region
+   */
+  struct RegionStats {
+    TH1F* time;        //us
+    TH1F* residualX;   //cm
+    TH1F* residualY;   //cm
+    TH1F* pullX;
+    TH1F* pullY;
+
+    unsigned long nCalls;
+    unsigned long nFailures;
+    unsigned long nTimed;
+    double sumTime;    //s
+    double sumResidual2;
+    unsigned long nPulls;
+    double sumPull;
+    double sumPull2;
+  };
+
+  struct PropagatorEntry {
+    std::string name;
+    const Propagator* propagator;
+    bool timed;        //The first call includes the lazy setup
+    RegionStats regions[NRegions];
+  };
+
+  void book(PropagatorEntry& entry);
+
+  void compare(const FreeTrajectoryState& fts, const PSimHit& simHit,
+	       const Plane& surf, unsigned int region);
+
+  static std::string regionName(unsigned int region);
+
+  //Start parameters moved by a random curvilinear offset drawn from the
+  //start errors
+  GlobalTrajectoryParameters smeared(const GlobalTrajectoryParameters& pars);
+
+  std::vector<std::string> thePropagatorNames;
+  std::vector<double> theStartErrors;
+  CLHEP::HepJamesRandom theRandom;
+  double theMinPt;
+  std::string theRootFileName;
+
+  edm::EDGetTokenT<edm::SimVertexContainer> G4VtxToken_;
+  edm::EDGetTokenT<edm::SimTrackContainer> G4TrkToken_;
+  edm::EDGetTokenT<edm::PSimHitContainer> simHitTokens_[Geant4eMuonSimHits::NChamberTypes];
+
+  std::unique_ptr<Geant4ePropagator> theGeant4ePropagator;
+
+  //Geant4e first, then the analytic propagators in configuration order
+  std::vector<PropagatorEntry> theEntries;
+};
+
+using namespace Geant4eMuonSimHits;
+
+//
+////////////////////////////////////////////////////////////////////////////
+//
+
+Geant4ePropagatorComparison::Geant4ePropagatorComparison(const edm::ParameterSet& iConfig):
+  thePropagatorNames(iConfig.getParameter<std::vector<std::string> >("Propagators")),
+  theStartErrors(iConfig.getParameter<std::vector<double> >("StartErrors")),
+  theRandom(iConfig.getParameter<unsigned int>("Seed")),
+  theMinPt(iConfig.getParameter<double>("MinPt")),
+  theRootFileName(iConfig.getParameter<std::string>("RootFile")),
+  G4VtxToken_(consumes<edm::SimVertexContainer>(iConfig.getParameter<edm::InputTag>("G4VtxSrc"))),
+  G4TrkToken_(consumes<edm::SimTrackContainer>(iConfig.getParameter<edm::InputTag>("G4TrkSrc"))) {
+
+  simHitTokens_[DT]  = consumes<edm::PSimHitContainer>(iConfig.getParameter<edm::InputTag>("DTHitSrc"));
+  simHitTokens_[CSC] = consumes<edm::PSimHitContainer>(iConfig.getParameter<edm::InputTag>("CSCHitSrc"));
+  simHitTokens_[RPC] = consumes<edm::PSimHitContainer>(iConfig.getParameter<edm::InputTag>("RPCHitSrc"));
+
+  if (theStartErrors.size() != 5)
+    throw cms::Exception("Configuration") << "StartErrors needs 5 values "
+					  << "(q/p, lambda, phi, xT, yT), got "
+					  << theStartErrors.size();
+
+  theEntries.resize(thePropagatorNames.size() + 1);
+  theEntries[0].name = "Geant4e";
+  for (unsigned int i = 0; i < thePropagatorNames.size(); i++)
+    theEntries[i+1].name = thePropagatorNames[i];
+  for (unsigned int i = 0; i < theEntries.size(); i++) {
+    theEntries[i].propagator = 0;
+    theEntries[i].timed = false;
+    book(theEntries[i]);
+  }
+}
+
+Geant4ePropagatorComparison::~Geant4ePropagatorComparison() {
+  for (unsigned int i = 0; i < theEntries.size(); i++) {
+    for (unsigned int r = 0; r < NRegions; r++) {
+      RegionStats& s = theEntries[i].regions[r];
+      delete s.time;
+      delete s.residualX;
+      delete s.residualY;
+      delete s.pullX;
+      delete s.pullY;
+    }
+  }
+}
+
+std::string Geant4ePropagatorComparison::regionName(unsigned int region) {
+  return Form("%s%d", chamberName(region/NStations), region%NStations + 1);
+}
+
+GlobalTrajectoryParameters
+Geant4ePropagatorComparison::smeared(const GlobalTrajectoryParameters& pars) {
+  double offset[5];
+  for (unsigned int i = 0; i < 5; i++)
+    offset[i] = CLHEP::RandGauss::shoot(&theRandom, 0., theStartErrors[i]);
+
+  GlobalVector dir = pars.momentum().unit();
+  double phi = dir.phi() + offset[2];
+  double lambda = M_PI/2 - dir.theta() + offset[1];
+  GlobalVector u(-std::sin(dir.phi()), std::cos(dir.phi()), 0);
+  GlobalVector v = dir.cross(u);
+  double qOverP = pars.signedInverseMomentum() + offset[0];
+  if (qOverP*pars.charge() <= 0)
+    qOverP = pars.signedInverseMomentum();
+  GlobalVector mom(std::cos(lambda)*std::cos(phi), std::cos(lambda)*std::sin(phi),
+		   std::sin(lambda));
+  return GlobalTrajectoryParameters(pars.position() + offset[3]*u + offset[4]*v,
+				    mom/std::abs(qOverP), pars.charge(),
+				    &pars.magneticField());
+}
+
+void Geant4ePropagatorComparison::book(PropagatorEntry& entry) {
+  for (unsigned int r = 0; r < NRegions; r++) {
+    RegionStats& s = entry.regions[r];
+    std::string prefix = entry.name + "_" + regionName(r);
+    const char* p = prefix.c_str();
+
+    s.time      = new TH1F(Form("%s_time", p),
+			   Form("Time per call (#mus) %s", p), 200, 0, 20000);
+    s.residualX = new TH1F(Form("%s_resX", p),
+			   Form("Local x residual (cm) %s", p), 200, -20, 20);
+    s.residualY = new TH1F(Form("%s_resY", p),
+			   Form("Local y residual (cm) %s", p), 200, -20, 20);
+    s.pullX     = new TH1F(Form("%s_pullX", p),
+			   Form("Local x pull %s", p), 100, -10, 10);
+    s.pullY     = new TH1F(Form("%s_pullY", p),
+			   Form("Local y pull %s", p), 100, -10, 10);
+    s.time->SetDirectory(0);
+    s.residualX->SetDirectory(0);
+    s.residualY->SetDirectory(0);
+    s.pullX->SetDirectory(0);
+    s.pullY->SetDirectory(0);
+
+    s.nCalls = s.nFailures = s.nTimed = s.nPulls = 0;
+    s.sumTime = s.sumResidual2 = s.sumPull = s.sumPull2 = 0;
+  }
+}
+
+void Geant4ePropagatorComparison::analyze(const edm::Event& iEvent,
+					  const edm::EventSetup& iSetup) {
+
+  using namespace edm;
+
+  ESHandle<MagneticField> bField;
+  iSetup.get<IdealMagneticFieldRecord>().get(bField);
+
+  Geometries geom;
+  iSetup.get<MuonGeometryRecord>().get(geom.dt);
+  iSetup.get<MuonGeometryRecord>().get(geom.csc);
+  iSetup.get<MuonGeometryRecord>().get(geom.rpc);
+
+  //Propagators
+  if (!theGeant4ePropagator)
+    theGeant4ePropagator.reset(new Geant4ePropagator(&*bField));
+  theEntries[0].propagator = theGeant4ePropagator.get();
+  for (unsigned int i = 0; i < thePropagatorNames.size(); i++) {
+    ESHandle<Propagator> prop;
+    iSetup.get<TrackingComponentsRecord>().get(thePropagatorNames[i], prop);
+    theEntries[i+1].propagator = &*prop;
+  }
+
+  Handle<SimTrackContainer> simTracks;
+  iEvent.getByToken(G4TrkToken_, simTracks);
+  Handle<SimVertexContainer> simVertices;
+  iEvent.getByToken(G4VtxToken_, simVertices);
+  if (!simTracks.isValid() || !simVertices.isValid()) {
+    LogWarning("Geant4e") << "No sim tracks or vertices found";
+    return;
+  }
+
+  //Muon sim hits ordered by track and time of flight
+  HitIndex hitIndex[NChamberTypes];
+  for (unsigned int type = 0; type < NChamberTypes; type++) {
+    Handle<PSimHitContainer> simHits;
+    iEvent.getByToken(simHitTokens_[type], simHits);
+    if (!simHits.isValid()) {
+      LogWarning("Geant4e") << "No " << chamberName(type) << " hits found";
+      continue;
+    }
+    buildIndex(*simHits, hitIndex[type]);
+  }
+
+  //Diagonal start errors
+  AlgebraicSymMatrix55 startCov;
+  for (unsigned int i = 0; i < 5; i++)
+    startCov(i, i) = theStartErrors[i]*theStartErrors[i];
+  CurvilinearTrajectoryError startError(startCov);
+
+  for (SimTrackContainer::const_iterator simTracksIt = simTracks->begin();
+       simTracksIt != simTracks->end();
+       ++simTracksIt) {
+
+    int trkPDG = simTracksIt->type();
+    if (std::abs(trkPDG) != 13)
+      continue;
+
+    GlobalVector p3T(simTracksIt->momentum().x(),
+		     simTracksIt->momentum().y(),
+		     simTracksIt->momentum().z());
+    if (p3T.perp() < theMinPt)
+      continue;
+
+    GlobalPoint r3T(0., 0., 0.);
+    int vtxInd = simTracksIt->vertIndex();
+    if (vtxInd >= 0)
+      r3T = TrackPropagation::hep3VectorToGlobalPoint(CLHEP::Hep3Vector((*simVertices)[vtxInd].position().x(),
+									(*simVertices)[vtxInd].position().y(),
+									(*simVertices)[vtxInd].position().z()));
+
+    int charge = trkPDG > 0 ? -1 : 1;
+    GlobalTrajectoryParameters trackPars(r3T, p3T, charge, &*bField);
+    FreeTrajectoryState ftsTrack(smeared(trackPars), startError);
+
+    unsigned int trkInd = simTracksIt->trackId();
+
+    for (unsigned int type = 0; type < NChamberTypes; type++) {
+      std::pair<HitIndex::const_iterator, HitIndex::const_iterator> hits =
+	trackHits(hitIndex[type], trkInd);
+
+      for (HitIndex::const_iterator hitIt = hits.first; hitIt != hits.second; ++hitIt) {
+	const PSimHit& simHit = **hitIt;
+
+	int station = 0;
+	const GeomDet* layer = layerForHit(simHit, ChamberType(type), geom, station);
+	if (layer == 0 || station < 1 || station > (int) NStations)
+	  continue;
+
+	compare(ftsTrack, simHit, layer->surface(), type*NStations + station - 1);
+      }
+    }
+  }
+}
+
+void Geant4ePropagatorComparison::compare(const FreeTrajectoryState& fts,
+					  const PSimHit& simHit,
+					  const Plane& surf,
+					  unsigned int region) {
+  //Sim hits are in the frame of the layer, which is the target surface
+  LocalPoint posHit = simHit.localPosition();
+
+  for (unsigned int i = 0; i < theEntries.size(); i++) {
+    PropagatorEntry& entry = theEntries[i];
+    RegionStats& s = entry.regions[region];
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    TrajectoryStateOnSurface tsos = entry.propagator->propagate(fts, surf);
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    s.nCalls++;
+    if (entry.timed) {
+      s.time->Fill(1.e6*time);
+      s.sumTime += time;
+      s.nTimed++;
+    }
+    entry.timed = true;
+
+    if (!tsos.isValid()) {
+      s.nFailures++;
+      continue;
+    }
+
+    LocalPoint pos = tsos.localPosition();
+    double dx = pos.x() - posHit.x();
+    double dy = pos.y() - posHit.y();
+    s.residualX->Fill(dx);
+    s.residualY->Fill(dy);
+    s.sumResidual2 += dx*dx + dy*dy;
+
+    if (tsos.hasError()) {
+      LocalError err = tsos.localError().positionError();
+      if (err.xx() > 0 && err.yy() > 0) {
+	double px = dx/std::sqrt(err.xx());
+	double py = dy/std::sqrt(err.yy());
+	s.pullX->Fill(px);
+	s.pullY->Fill(py);
+	s.nPulls += 2;
+	s.sumPull += px + py;
+	s.sumPull2 += px*px + py*py;
+      }
+    }
+  }
+}
+
+void Geant4ePropagatorComparison::endJob() {
+  TFile rootFile(theRootFileName.c_str(), "recreate");
+  for (unsigned int i = 0; i < theEntries.size(); i++) {
+    rootFile.mkdir(theEntries[i].name.c_str())->cd();
+    for (unsigned int r = 0; r < NRegions; r++) {
+      const RegionStats& s = theEntries[i].regions[r];
+      s.time->Write();
+      s.residualX->Write();
+      s.residualY->Write();
+      s.pullX->Write();
+      s.pullY->Write();
+    }
+  }
+  rootFile.Close();
+
+  edm::LogVerbatim out("Geant4e");
+  out << "G4e -- Propagator comparison\n"
+      << std::setw(24) << std::left << "propagator" << std::right
+      << std::setw(7)  << "region"
+      << std::setw(9)  << "calls"
+      << std::setw(8)  << "failed"
+      << std::setw(12) << "us/call"
+      << std::setw(12) << "rms res cm"
+      << std::setw(11) << "pull mean"
+      << std::setw(10) << "pull rms" << "\n";
+  for (unsigned int r = 0; r < NRegions; r++) {
+    for (unsigned int i = 0; i < theEntries.size(); i++) {
+      const RegionStats& s = theEntries[i].regions[r];
+      if (s.nCalls == 0)
+	continue;
+      unsigned long nGood = s.nCalls - s.nFailures;
+      double pullMean = s.nPulls > 0 ? s.sumPull/s.nPulls : 0.;
+      out << std::setw(24) << std::left << theEntries[i].name << std::right
+	  << std::setw(7)  << regionName(r)
+	  << std::setw(9)  << s.nCalls
+	  << std::setw(8)  << s.nFailures
+	  << std::setw(12) << (s.nTimed > 0 ? 1.e6*s.sumTime/s.nTimed : 0.)
+	  << std::setw(12) << (nGood > 0 ? std::sqrt(s.sumResidual2/(2*nGood)) : 0.)
+	  << std::setw(11) << pullMean
+	  << std::setw(10) << (s.nPulls > 0 ?
+			       std::sqrt(std::max(0., s.sumPull2/s.nPulls - pullMean*pullMean)) : 0.)
+	  << "\n";
+    }
+  }
+}
+
+//define this as a plug-in
+DEFINE_FWK_MODULE(Geant4ePropagatorComparison);
@@ -0,0 +1,375 @@
+#include "FWCore/Framework/interface/Frameworkfwd.h"
+#include "FWCore/Framework/interface/one/EDAnalyzer.h"
+#include "FWCore/Framework/interface/ESHandle.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/EventSetup.h"
+#include "FWCore/Framework/interface/MakerMacros.h" //For define_fwk_module
+
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
+
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+/** Looks for the fastest stepping parameters of Geant4ePropagator (see
+ *  Geant4ePropagator::setSteppingParameters()) whose results stay within
+ *  a residual and pull budget. The sample is a log written with the
+ *  CaptureFile parameter of the propagator or, if LogFile is empty, muons
+ *  generated at the origin and propagated to a cylinder. The sample is
+ *  first propagated with the Reference parameters, which should be tight
+ *  enough to be the truth. Then, starting from the Start parameters, each
+ *  parameter in turn is multiplied by the Scales and the fastest value
+ *  that keeps every propagation within MaxResidual (cm) and MaxPull (in
+ *  units of the reference errors) is kept, for a number of Passes over
+ *  the parameters. Values that Geant4 does not take (e.g. an epsilon out
+ *  of its range) are skipped. Like Geant4ePropagationReplay it only needs
+ *  the geometry and the field, and runs in the first event.
+ */
+class Geant4eSteppingTuner: public edm::one::EDAnalyzer<> {
+
+public:
+  explicit Geant4eSteppingTuner(const edm::ParameterSet&);
+  virtual ~Geant4eSteppingTuner() {}
+
+  virtual void analyze(const edm::Event&, const edm::EventSetup&);
+
+private:
+  typedef Geant4ePropagator::SteppingParameters Parameters;
+
+  //One propagation of the sample
+  struct Request {
+    FreeTrajectoryState start;
+    Plane::PlanePointer plane;
+    Cylinder::CylinderPointer cylinder;
+    int direction;
+  };
+
+  //Time per propagation (us) and worst differences to the reference.
+  //Not applied if Geant4 did not take the parameters
+  struct Score {
+    Score(): applied(true), time(0), maxResidual(0), maxPull(0), mismatches(0) {}
+    bool applied;
+    double time;
+    double maxResidual;
+    double maxPull;
+    unsigned long mismatches;
+  };
+
+  void readSample(const MagneticField* field, std::string& particle);
+  void generateSample(const MagneticField* field);
+
+  //Propagates the sample with the parameters. Fills results if given,
+  //otherwise compares with the reference results
+  Score run(Geant4ePropagator& propagator, const Parameters& pars,
+	    std::vector<TrajectoryStateOnSurface>* results) const;
+  bool accepted(const Score& score) const;
+
+  static Parameters parameters(const edm::ParameterSet& pset);
+  static double& parameter(Parameters& pars, unsigned int i);
+  static const char* parameterName(unsigned int i);
+
+  std::string theLogFileName;
+  long theMaxRecords;
+  double theFieldCellSize;
+  int theGenerateTracks;
+  double theGenerateRadius;
+  double theGenerateMinPt, theGenerateMaxPt, theGenerateMaxEta;
+  Parameters theReference;
+  Parameters theStart;
+  std::vector<double> theScales;
+  unsigned int thePasses;
+  unsigned int theRepetitions;
+  double theMaxResidual;
+  double theMaxPull;
+
+  std::vector<Request> theSample;
+  std::vector<TrajectoryStateOnSurface> theReferenceResults;
+  bool theDone;
+};
+
+
+Geant4eSteppingTuner::Geant4eSteppingTuner(const edm::ParameterSet& iConfig):
+  theLogFileName(iConfig.getParameter<std::string>("LogFile")),
+  theMaxRecords(iConfig.getParameter<int>("MaxRecords")),
+  theFieldCellSize(iConfig.getParameter<double>("FieldCellSize")),
+  theGenerateTracks(iConfig.getParameter<int>("GenerateTracks")),
+  theGenerateRadius(iConfig.getParameter<double>("GenerateRadius")),
+  theGenerateMinPt(iConfig.getParameter<double>("GenerateMinPt")),
+  theGenerateMaxPt(iConfig.getParameter<double>("GenerateMaxPt")),
+  theGenerateMaxEta(iConfig.getParameter<double>("GenerateMaxEta")),
+  theReference(parameters(iConfig.getParameter<edm::ParameterSet>("Reference"))),
+  theStart(parameters(iConfig.getParameter<edm::ParameterSet>("Start"))),
+  theScales(iConfig.getParameter<std::vector<double> >("Scales")),
+  thePasses(iConfig.getParameter<unsigned int>("Passes")),
+  theRepetitions(std::max(1u, iConfig.getParameter<unsigned int>("Repetitions"))),
+  theMaxResidual(iConfig.getParameter<double>("MaxResidual")),
+  theMaxPull(iConfig.getParameter<double>("MaxPull")),
+  theDone(false) {
+}
+
+Geant4eSteppingTuner::Parameters
+Geant4eSteppingTuner::parameters(const edm::ParameterSet& pset) {
+  Parameters pars;
+  for (unsigned int i = 0; i < 6; i++)
+    parameter(pars, i) = pset.getParameter<double>(parameterName(i));
+  return pars;
+}
+
+double& Geant4eSteppingTuner::parameter(Parameters& pars, unsigned int i) {
+  switch (i) {
+  case 0:  return pars.deltaChord;
+  case 1:  return pars.deltaOneStep;
+  case 2:  return pars.deltaIntersection;
+  case 3:  return pars.minStep;
+  case 4:  return pars.minimumEpsilonStep;
+  default: return pars.maximumEpsilonStep;
+  }
+}
+
+const char* Geant4eSteppingTuner::parameterName(unsigned int i) {
+  static const char* names[6] = {"DeltaChord", "DeltaOneStep", "DeltaIntersection",
+				 "MinStep", "MinimumEpsilonStep", "MaximumEpsilonStep"};
+  return names[i];
+}
+
+void Geant4eSteppingTuner::readSample(const MagneticField* field,
+				      std::string& particle) {
+  Geant4ePropagationLog::Reader reader(theLogFileName);
+  particle = reader.header().particle;
+
+  Geant4ePropagationLog::Record r;
+  while ((theMaxRecords < 0 || (long) theSample.size() < theMaxRecords) &&
+	 reader.next(r)) {
+    Request req;
+    req.start = Geant4ePropagationLog::startState(r, field);
+    if (r.surfaceType == Geant4ePropagationLog::kPlane)
+      req.plane = Geant4ePropagationLog::plane(r);
+    else
+      req.cylinder = Geant4ePropagationLog::cylinder(r);
+    req.direction = r.direction;
+    theSample.push_back(req);
+  }
+}
+
+/** Muons of both charges from the origin, flat in pt, eta and phi, with
+ *  small errors, propagated along the momentum to one cylinder.
+ */
+void Geant4eSteppingTuner::generateSample(const MagneticField* field) {
+  std::mt19937 random(12345);
+  std::uniform_real_distribution<double> ptDist(theGenerateMinPt, theGenerateMaxPt);
+  std::uniform_real_distribution<double> etaDist(-theGenerateMaxEta, theGenerateMaxEta);
+  std::uniform_real_distribution<double> phiDist(-M_PI, M_PI);
+  Cylinder::CylinderPointer cyl = Cylinder::build(Surface::PositionType(0, 0, 0),
+						  Surface::RotationType(),
+						  theGenerateRadius);
+  AlgebraicSymMatrix55 cov;
+  cov(0, 0) = 1e-6;
+  cov(1, 1) = cov(2, 2) = 1e-6;
+  cov(3, 3) = cov(4, 4) = 1e-4;
+
+  for (int i = 0; i < theGenerateTracks; i++) {
+    double pt = ptDist(random);
+    double eta = etaDist(random);
+    double phi = phiDist(random);
+    GlobalVector mom(pt*std::cos(phi), pt*std::sin(phi), pt*std::sinh(eta));
+    Request req;
+    req.start = FreeTrajectoryState(GlobalTrajectoryParameters(GlobalPoint(0, 0, 0), mom,
+							       i%2 ? 1 : -1, field),
+				    CurvilinearTrajectoryError(cov));
+    req.cylinder = cyl;
+    req.direction = alongMomentum;
+    theSample.push_back(req);
+  }
+}
+
+/** The pulls are those of q/p and of the local position, with the errors
+ *  of the reference state. The time is the best of the repetitions, to
+ *  keep the noise of the machine out of the comparison.
+ */
+Geant4eSteppingTuner::Score
+Geant4eSteppingTuner::run(Geant4ePropagator& propagator, const Parameters& pars,
+			  std::vector<TrajectoryStateOnSurface>* results) const {
+  Score score;
+  score.applied = propagator.setSteppingParameters(pars);
+  if (!score.applied)
+    return score;
+
+  double best = -1;
+  for (unsigned int rep = 0; rep < theRepetitions; rep++) {
+    double time = 0;
+    for (unsigned int i = 0; i < theSample.size(); i++) {
+      const Request& req = theSample[i];
+      propagator.setPropagationDirection(PropagationDirection(req.direction));
+
+      std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      TrajectoryStateOnSurface tsos;
+      if (req.plane.get())
+	tsos = propagator.propagate(req.start, *req.plane);
+      else
+	tsos = propagator.propagate(req.start, *req.cylinder);
+      time += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+      if (rep > 0)
+	continue;
+      if (results) {
+	results->push_back(tsos);
+	continue;
+      }
+
+      const TrajectoryStateOnSurface& ref = theReferenceResults[i];
+      if (tsos.isValid() != ref.isValid()) {
+	score.mismatches++;
+	continue;
+      }
+      if (!tsos.isValid())
+	continue;
+
+      score.maxResidual = std::max(score.maxResidual,
+				   (tsos.globalPosition() - ref.globalPosition()).mag());
+      if (ref.hasError()) {
+	LocalPoint local = ref.surface().toLocal(tsos.globalPosition());
+	LocalPoint refLocal = ref.localPosition();
+	const AlgebraicSymMatrix55& cov = ref.localError().matrix();
+	double dQoverP = tsos.localParameters().vector()[0] -
+	  ref.localParameters().vector()[0];
+	if (cov(0, 0) > 0)
+	  score.maxPull = std::max(score.maxPull, std::abs(dQoverP)/std::sqrt(cov(0, 0)));
+	if (cov(3, 3) > 0)
+	  score.maxPull = std::max(score.maxPull,
+				   std::abs(local.x() - refLocal.x())/std::sqrt(cov(3, 3)));
+	if (cov(4, 4) > 0)
+	  score.maxPull = std::max(score.maxPull,
+				   std::abs(local.y() - refLocal.y())/std::sqrt(cov(4, 4)));
+      }
+    }
+    if (best < 0 || time < best)
+      best = time;
+  }
+
+  score.time = theSample.empty() ? 0. : 1.e6*best/theSample.size();
+  return score;
+}
+
+bool Geant4eSteppingTuner::accepted(const Score& score) const {
+  return score.applied && score.mismatches == 0 && score.maxResidual <= theMaxResidual &&
+    score.maxPull <= theMaxPull;
+}
+
+void Geant4eSteppingTuner::analyze(const edm::Event&,
+				   const edm::EventSetup& iSetup) {
+  if (theDone)
+    return;
+  theDone = true;
+
+  edm::ESHandle<MagneticField> bField;
+  iSetup.get<IdealMagneticFieldRecord>().get(bField);
+
+  std::string particle = "mu";
+  if (theLogFileName.empty())
+    generateSample(&*bField);
+  else
+    readSample(&*bField, particle);
+  if (theSample.empty()) {
+    edm::LogWarning("Geant4e") << "G4e -- Empty sample, nothing to tune";
+    return;
+  }
+
+  Geant4ePropagator propagator(&*bField, particle.c_str());
+  propagator.setFieldCellSize(theFieldCellSize);
+
+  //The first call initialises Geant4, keep it out of the timing
+  if (theSample[0].plane.get())
+    propagator.propagate(theSample[0].start, *theSample[0].plane);
+  else
+    propagator.propagate(theSample[0].start, *theSample[0].cylinder);
+
+  Score reference = run(propagator, theReference, &theReferenceResults);
+  if (!reference.applied) {
+    edm::LogWarning("Geant4e") << "G4e -- Geant4 did not take the reference "
+			       << "parameters, nothing to tune against";
+    return;
+  }
+
+  edm::LogVerbatim log("Geant4e");
+  log << "G4e -- Tuning the stepping parameters on " << theSample.size()
+      << " propagations (" << (theLogFileName.empty() ? "generated" : theLogFileName)
+      << ")\n"
+      << "G4e --   reference: " << reference.time << " us per propagation\n";
+
+  Parameters best = theStart;
+  Score bestScore = run(propagator, best, 0);
+  if (!bestScore.applied)
+    log << "G4e --   start: not taken by Geant4\n";
+  else
+    log << "G4e --   start: " << bestScore.time << " us, residual "
+	<< bestScore.maxResidual << " cm, pull " << bestScore.maxPull
+	<< ", mismatches " << bestScore.mismatches << "\n";
+  if (!accepted(bestScore))
+    log << "G4e --   the start parameters are out of the budget, "
+	<< "only faster values within it are kept\n";
+
+  for (unsigned int pass = 0; pass < thePasses; pass++) {
+    bool changed = false;
+    for (unsigned int i = 0; i < 6; i++) {
+      const double start = parameter(theStart, i);
+      if (start <= 0)
+	continue;
+      for (unsigned int j = 0; j < theScales.size(); j++) {
+	Parameters candidate = best;
+	parameter(candidate, i) = start*theScales[j];
+	if (parameter(candidate, i) == parameter(best, i))
+	  continue;
+	//Geant4 wants the minimum epsilon below the maximum
+	if (candidate.minimumEpsilonStep > 0 && candidate.maximumEpsilonStep > 0 &&
+	    candidate.minimumEpsilonStep > candidate.maximumEpsilonStep)
+	  continue;
+
+	Score score = run(propagator, candidate, 0);
+	if (!score.applied) {
+	  log << "G4e --   pass " << pass << " " << parameterName(i) << " "
+	      << parameter(candidate, i) << ": not taken by Geant4\n";
+	  continue;
+	}
+	log << "G4e --   pass " << pass << " " << parameterName(i) << " "
+	    << parameter(candidate, i) << ": " << score.time << " us, residual "
+	    << score.maxResidual << " cm, pull " << score.maxPull
+	    << ", mismatches " << score.mismatches
+	    << (accepted(score) ? "" : " (out of budget)") << "\n";
+	if (accepted(score) && (!accepted(bestScore) || score.time < bestScore.time)) {
+	  best = candidate;
+	  bestScore = score;
+	  changed = true;
+	}
+      }
+    }
+    if (!changed)
+      break;
+  }
+
+  if (!accepted(bestScore)) {
+    log << "G4e --   no configuration within a residual of " << theMaxResidual
+	<< " cm and a pull of " << theMaxPull;
+    return;
+  }
+
+  log << "G4e --   fastest configuration within a residual of " << theMaxResidual
+      << " cm and a pull of " << theMaxPull << ": " << bestScore.time
+      << " us per propagation (" << reference.time/bestScore.time
+      << " times the reference), residual " << bestScore.maxResidual
+      << " cm, pull " << bestScore.maxPull << "\n"
+      << "G4e --   Geant4ePropagator parameters:\n";
+  for (unsigned int i = 0; i < 6; i++)
+    log << "G4e --     " << parameterName(i) << "=cms.double("
+	<< parameter(best, i) << "),\n";
+}
+
+//define this as a plug-in
+DEFINE_FWK_MODULE(Geant4eSteppingTuner);
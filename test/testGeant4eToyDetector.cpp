@@ -0,0 +1,953 @@
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagator.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagatorCore.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationBatch.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationScheduler.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMultiTrackStepper.h"
+#include "TrackPropagation/Geant4e/interface/Geant4eMagneticField.h"
+#include "TrackPropagation/Geant4e/interface/Geant4ePropagationTableBuilder.h"
+
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "TrackingTools/GeomPropagators/interface/AnalyticalPropagator.h"
+#include "TrackingTools/TrajectoryState/interface/TrajectoryStateOnSurface.h"
+#include "TrackingTools/TrajectoryState/interface/FreeTrajectoryState.h"
+#include "TrackingTools/GsfTools/interface/MultiTrajectoryStateAssembler.h"
+#include "DataFormats/GeometrySurface/interface/Plane.h"
+#include "DataFormats/GeometrySurface/interface/Cylinder.h"
+#include "DataFormats/GeometrySurface/interface/RectangularPlaneBounds.h"
+
+//Geant4
+#include "G4ErrorPropagatorManager.hh"
+#include "G4NistManager.hh"
+#include "G4Box.hh"
+#include "G4Tubs.hh"
+#include "G4LogicalVolume.hh"
+#include "G4PVPlacement.hh"
+#include "G4ThreeVector.hh"
+
+//CLHEP
+#include "CLHEP/Units/GlobalSystemOfUnits.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//POSIX
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** Standalone test and benchmark of Geant4ePropagator on a toy detector
+ *  built in code: a 3.8 T solenoid with a brass calorimeter inside the
+ *  coil and three iron yoke layers carrying the return field, with
+ *  cylindrical and planar targets between them. It needs neither the CMS
+ *  geometry nor field maps nor input files, and runs in a few seconds.
+ *  The checks are deterministic; the exit code is the number of failed
+ *  checks. Each test builds its own propagator and leaves the global
+ *  Geant4 state (field and stepping parameters) as it found it, so the
+ *  tests do not depend on their order. Optional arguments set the number
+ *  of tracks of the benchmark (default 1000) and the physics of the
+ *  propagator (Geant4e, Tabulated or MuonMinimal), so that the modes can
+ *  be compared. The Tabulated and Geant4e physics are also compared on a
+ *  sample propagated in child processes.
+ */
+
+namespace {
+
+  //Dimensions of the toy detector (cm)
+  const double coilRadius = 295;
+  const double halfLength = 650;
+  const double hcalRadii[2] = {180, 290};
+  const double yokeRadii[3][2] = {{400, 430}, {500, 530}, {600, 630}};
+
+  /** Field of the toy detector: uniform inside the coil and opposite,
+   *  smaller, in the iron of the yoke.
+   */
+  class ToySolenoidField : public MagneticField {
+  public:
+    virtual GlobalVector inTesla(const GlobalPoint& gp) const {
+      if (std::abs(gp.z()) > halfLength)
+	return GlobalVector(0, 0, 0);
+      double r = gp.perp();
+      if (r < coilRadius)
+	return GlobalVector(0, 0, 3.8);
+      for (unsigned int i = 0; i < 3; i++)
+	if (r > yokeRadii[i][0] && r < yokeRadii[i][1])
+	  return GlobalVector(0, 0, -1.8);
+      return GlobalVector(0, 0, 0);
+    }
+  };
+
+  G4VPhysicalVolume* buildToyDetector() {
+    G4NistManager* nist = G4NistManager::Instance();
+    G4LogicalVolume* world =
+      new G4LogicalVolume(new G4Box("World", 10*m, 10*m, 15*m),
+			  nist->FindOrBuildMaterial("G4_AIR"), "World");
+
+    G4LogicalVolume* hcal =
+      new G4LogicalVolume(new G4Tubs("HCAL", hcalRadii[0]*cm, hcalRadii[1]*cm,
+				     halfLength*cm, 0, 2*M_PI),
+			  nist->FindOrBuildMaterial("G4_BRASS"), "HCAL");
+    new G4PVPlacement(0, G4ThreeVector(), hcal, "HCAL", world, false, 0);
+
+    for (unsigned int i = 0; i < 3; i++) {
+      G4LogicalVolume* yoke =
+	new G4LogicalVolume(new G4Tubs("Yoke", yokeRadii[i][0]*cm,
+				       yokeRadii[i][1]*cm, halfLength*cm,
+				       0, 2*M_PI),
+			    nist->FindOrBuildMaterial("G4_Fe"), "Yoke");
+      new G4PVPlacement(0, G4ThreeVector(), yoke, "Yoke", world, false, i);
+    }
+
+    return new G4PVPlacement(0, G4ThreeVector(), world, "World", 0, false, 0);
+  }
+
+  Cylinder::CylinderPointer cylinder(double radius) {
+    return Cylinder::build(Surface::PositionType(0, 0, 0),
+			   Surface::RotationType(), radius);
+  }
+
+  //Plane normal to the x axis at x
+  Plane::PlanePointer planeAtX(double x) {
+    return Plane::build(Surface::PositionType(x, 0, 0),
+			Surface::RotationType(0, 1, 0, 0, 0, 1, 1, 0, 0));
+  }
+
+  FreeTrajectoryState startState(const MagneticField* field, double pt,
+				 double eta, double phi, int charge) {
+    GlobalVector mom(pt*std::cos(phi), pt*std::sin(phi), pt*std::sinh(eta));
+    AlgebraicSymMatrix55 cov;
+    cov(0, 0) = 1e-6;
+    cov(1, 1) = cov(2, 2) = 1e-6;
+    cov(3, 3) = cov(4, 4) = 1e-4;
+    return FreeTrajectoryState(GlobalTrajectoryParameters(GlobalPoint(0, 0, 0),
+							  mom, charge, field),
+			       CurvilinearTrajectoryError(cov));
+  }
+
+  //Plane moved by the local shift (dx, dy, dz) and the small rotations
+  //(a, b, c) around its local axes
+  Plane::PlanePointer movedPlane(const Plane& plane, const double* p) {
+    LocalVector w(p[3], p[4], p[5]);
+    GlobalVector x = plane.toGlobal(LocalVector(1, 0, 0) + w.cross(LocalVector(1, 0, 0)));
+    GlobalVector y = plane.toGlobal(LocalVector(0, 1, 0) + w.cross(LocalVector(0, 1, 0)));
+    GlobalVector z = plane.toGlobal(LocalVector(0, 0, 1) + w.cross(LocalVector(0, 0, 1)));
+    return Plane::build(plane.toGlobal(LocalPoint(p[0], p[1], p[2])),
+			Surface::RotationType(x.x(), x.y(), x.z(),
+					      y.x(), y.y(), y.z(),
+					      z.x(), z.y(), z.z()));
+  }
+
+  int nFailed = 0;
+  unsigned int nBenchmark = 1000;
+  std::string physics;
+  std::ostringstream benchmark;
+
+  void check(bool ok, const char* name, double value) {
+    std::cout << (ok ? "PASS " : "FAIL ") << name << ": " << value << std::endl;
+    if (!ok)
+      nFailed++;
+  }
+
+  double seconds(std::chrono::steady_clock::time_point t0,
+		 std::chrono::steady_clock::time_point t1) {
+    return std::chrono::duration<double>(t1 - t0).count();
+  }
+
+  /** Setup of one test: the toy field, a propagator of its own and the
+   *  targets. The propagator takes its field out of the Geant4 field
+   *  manager when it is destroyed.
+   */
+  struct Toy {
+    Toy(): propagator(&field, "mu", alongMomentum), helix(&field, alongMomentum),
+	   tracker(cylinder(150)), coil(cylinder(350)), station1(cylinder(450)),
+	   station4(cylinder(650)), plane1(planeAtX(450)) {
+      if (!physics.empty())
+	propagator.setPhysics(physics);
+    }
+
+    //Benchmark sample: muons of both charges in the barrel, half of them to
+    //the first station and half to the last
+    std::vector<FreeTrajectoryState> tracks() const {
+      std::mt19937 random(12345);
+      std::uniform_real_distribution<double> ptDist(5, 100);
+      std::uniform_real_distribution<double> etaDist(-0.8, 0.8);
+      std::uniform_real_distribution<double> phiDist(-M_PI, M_PI);
+      std::vector<FreeTrajectoryState> result;
+      for (unsigned int i = 0; i < nBenchmark; i++)
+	result.push_back(startState(&field, ptDist(random), etaDist(random),
+				    phiDist(random), i%2 ? 1 : -1));
+      return result;
+    }
+    const Cylinder& target(unsigned int i) const {return i%3 ? *station4 : *station1;}
+
+    Geant4ePropagationBatch batch(const std::vector<FreeTrajectoryState>& tracks) const {
+      Geant4ePropagationBatch result;
+      result.reserve(tracks.size());
+      for (unsigned int i = 0; i < tracks.size(); i++)
+	result.push_back(tracks[i], &target(i));
+      return result;
+    }
+
+    std::vector<TrajectoryStateOnSurface> 
+    single(const std::vector<FreeTrajectoryState>& tracks, unsigned int n) {
+      std::vector<TrajectoryStateOnSurface> result;
+      for (unsigned int i = 0; i < std::min<size_t>(n, tracks.size()); i++)
+	result.push_back(propagator.propagate(tracks[i], target(i)));
+      return result;
+    }
+
+    ToySolenoidField field;
+    Geant4ePropagator propagator;
+    AnalyticalPropagator helix;
+    Cylinder::CylinderPointer tracker, coil, station1, station4;
+    Plane::PlanePointer plane1;
+  };
+
+  //Largest distance between the results of a batch and single propagations
+  //(1e9 if one of them failed and not the other)
+  double batchDifference(const Geant4ePropagationBatchResult& result,
+			 const std::vector<TrajectoryStateOnSurface>& single) {
+    double maxDiff = 0;
+    for (unsigned int i = 0; i < single.size(); i++) {
+      bool ok = result.status[i] == Geant4ePropagationBatchResult::kOk;
+      if (ok != single[i].isValid())
+	return 1e9;
+      if (!ok)
+	continue;
+      GlobalPoint pos(result.x[i], result.y[i], result.z[i]);
+      maxDiff = std::max(maxDiff, double((pos - single[i].globalPosition()).mag()));
+    }
+    return maxDiff;
+  }
+
+  FreeTrajectoryState mu20(const MagneticField* field) {
+    return startState(field, 20, 0.3, 0.2, -1);
+  }
+
+
+  //End state of a sample propagation: validity, position (cm) and error
+  //of q/p (1/GeV)
+  const unsigned int kSampleValues = 5;
+  const unsigned int kSampleSize = 50;
+
+  /** Propagates the first tracks of the benchmark sample with the given
+   *  physics in a child process, since the physics of Geant4e is fixed
+   *  once it is initialised, and returns their end states.
+   */
+  bool propagateSample(const std::string& samplePhysics, std::vector<double>& values) {
+    int fd[2];
+    if (pipe(fd) != 0)
+      return false;
+    std::cout << std::flush;
+    pid_t pid = fork();
+    if (pid < 0) {
+      close(fd[0]);
+      close(fd[1]);
+      return false;
+    }
+
+    if (pid == 0) {
+      close(fd[0]);
+      physics = samplePhysics;
+      nBenchmark = std::max(nBenchmark, kSampleSize);
+      Toy toy;
+      std::vector<FreeTrajectoryState> tracks = toy.tracks();
+      std::vector<double> out(kSampleValues*kSampleSize, 0.);
+      for (unsigned int i = 0; i < kSampleSize; i++) {
+	TrajectoryStateOnSurface tsos = toy.propagator.propagate(tracks[i], toy.target(i));
+	if (!tsos.isValid())
+	  continue;
+	double* v = &out[kSampleValues*i];
+	v[0] = 1;
+	v[1] = tsos.globalPosition().x();
+	v[2] = tsos.globalPosition().y();
+	v[3] = tsos.globalPosition().z();
+	v[4] = std::sqrt(tsos.curvilinearError().matrix()(0, 0));
+      }
+      size_t size = out.size()*sizeof(double);
+      bool ok = write(fd[1], &out[0], size) == ssize_t(size);
+      close(fd[1]);
+      _exit(ok ? 0 : 1);
+    }
+
+    close(fd[1]);
+    values.assign(kSampleValues*kSampleSize, 0.);
+    char* buffer = reinterpret_cast<char*>(&values[0]);
+    size_t size = values.size()*sizeof(double), done = 0;
+    ssize_t n;
+    while (done < size && (n = read(fd[0], buffer + done, size - done)) > 0)
+      done += n;
+    close(fd[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return done == size && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+
+  //The tabulated physics gives the Geant4e end states through the yoke
+  //within 0.5 cm and the Geant4e error of q/p within 10%. Run first: the
+  //samples are propagated in child processes that must not inherit an
+  //initialised Geant4e
+  void testTabulatedPhysics() {
+    std::vector<double> geant4e, tabulated;
+    bool done = propagateSample("Geant4e", geant4e) && 
+      propagateSample("Tabulated", tabulated);
+    double maxPosDiff = done ? 0 : 1e9, maxErrDiff = done ? 0 : 1e9;
+    for (unsigned int i = 0; done && i < kSampleSize; i++) {
+      const double* a = &geant4e[kSampleValues*i];
+      const double* b = &tabulated[kSampleValues*i];
+      if (a[0] != b[0]) {
+	maxPosDiff = maxErrDiff = 1e9;
+	break;
+      }
+      if (!a[0])
+	continue;
+      maxPosDiff = std::max(maxPosDiff, std::sqrt((a[1] - b[1])*(a[1] - b[1]) + 
+						  (a[2] - b[2])*(a[2] - b[2]) + 
+						  (a[3] - b[3])*(a[3] - b[3])));
+      maxErrDiff = std::max(maxErrDiff, std::abs(b[4]/a[4] - 1));
+    }
+    check(maxPosDiff < 0.5, "tabulated physics against Geant4e, cm", maxPosDiff);
+    check(maxErrDiff < 0.1, "tabulated physics against Geant4e, relative q/p error", 
+	  maxErrDiff);
+  }
+
+  //Inside the tracker there is only air and a uniform field: Geant4e
+  //follows the helix
+  void testHelixInTracker() {
+    Toy toy;
+    TrajectoryStateOnSurface g4Tracker = toy.propagator.propagate(mu20(&toy.field), *toy.tracker);
+    TrajectoryStateOnSurface hxTracker = toy.helix.propagate(mu20(&toy.field), *toy.tracker);
+    check(g4Tracker.isValid() && hxTracker.isValid() &&
+	  (g4Tracker.globalPosition() - hxTracker.globalPosition()).mag() < 0.01,
+	  "helix in the tracker, cm",
+	  (g4Tracker.globalPosition() - hxTracker.globalPosition()).mag());
+  }
+
+  //Opposite charges bend symmetrically, also through the calorimeter
+  void testChargeSymmetry() {
+    Toy toy;
+    TrajectoryStateOnSurface muMinus =
+      toy.propagator.propagate(startState(&toy.field, 10, 0, 0, -1), *toy.coil);
+    TrajectoryStateOnSurface muPlus =
+      toy.propagator.propagate(startState(&toy.field, 10, 0, 0, 1), *toy.coil);
+    double dPhi = muMinus.globalPosition().phi() + muPlus.globalPosition().phi();
+    check(muMinus.isValid() && muPlus.isValid() && std::abs(dPhi) < 1e-4 &&
+	  std::abs(muMinus.globalPosition().phi()) > 0.01,
+	  "charge symmetry, rad", dPhi);
+  }
+
+  //Energy loss in the first yoke layer (30 cm of iron), growth of the
+  //errors through the iron, and back: the backward propagation recovers
+  //the start state, adding back the energy lost
+  void testThroughTheYoke() {
+    Toy toy;
+    TrajectoryStateOnSurface atCoil =
+      toy.propagator.propagate(startState(&toy.field, 10, 0, 0, -1), *toy.coil);
+    TrajectoryStateOnSurface atStation1 = atCoil.isValid() ?
+      toy.propagator.propagate(*atCoil.freeState(), *toy.station1) : 
+      TrajectoryStateOnSurface();
+    double loss = atCoil.globalMomentum().mag() -
+      (atStation1.isValid() ? atStation1.globalMomentum().mag() : 0);
+    check(atStation1.isValid() && loss > 0.2 && loss < 0.7,
+	  "energy loss in 30 cm of iron, GeV", loss);
+
+    TrajectoryStateOnSurface atStation4 = atStation1.isValid() ?
+      toy.propagator.propagate(*atStation1.freeState(), *toy.station4) :
+      TrajectoryStateOnSurface();
+    double errRatio = atStation4.isValid() ?
+      atStation4.curvilinearError().matrix()(1, 1)/
+      atStation1.curvilinearError().matrix()(1, 1) : 0;
+    check(errRatio > 1, "growth of the angular error in the yoke", errRatio);
+
+    toy.propagator.setPropagationDirection(oppositeToMomentum);
+    TrajectoryStateOnSurface back = atStation4.isValid() ?
+      toy.propagator.propagate(*atStation4.freeState(), *toy.coil) :
+      TrajectoryStateOnSurface();
+    double dPos = back.isValid() ?
+      (back.globalPosition() - atCoil.globalPosition()).mag() : 1e9;
+    double dMom = back.isValid() ?
+      std::abs(back.globalMomentum().mag()/atCoil.globalMomentum().mag() - 1) : 1e9;
+    check(dPos < 0.05, "round trip position, cm", dPos);
+    check(dMom < 2e-3, "round trip momentum, relative", dMom);
+  }
+
+  void testPlaneTarget() {
+    Toy toy;
+    TrajectoryStateOnSurface onPlane =
+      toy.propagator.propagate(startState(&toy.field, 50, 0, 0, 1), *toy.plane1);
+    double dPlane = onPlane.isValid() ?
+      std::abs(toy.plane1->localZ(onPlane.globalPosition())) : 1e9;
+    check(dPlane < 1e-3, "distance to the target plane, cm", dPlane);
+  }
+
+  //A propagation over the step limit is stopped
+  void testBudget() {
+    Toy toy;
+    Geant4eSteppingAction::Budget budget;
+    budget.maxSteps = 3;
+    TrajectoryStateOnSurface stopped =
+      toy.propagator.propagate(mu20(&toy.field), *toy.station4, budget);
+    check(!stopped.isValid() &&
+	  toy.propagator.lastStatus() == Geant4eSteppingAction::kMaxSteps &&
+	  toy.propagator.budgetHits(Geant4eSteppingAction::kMaxSteps) == 1,
+	  "propagation stopped at max steps", toy.propagator.lastStepCount());
+
+    //The budget of a batch request covers all its legs, each of them
+    //shorter than the limit
+    Toy legs;
+    Geant4eSteppingAction::Budget pathBudget;
+    pathBudget.maxPath = 500;
+    legs.propagator.setBudget(pathBudget);
+    legs.propagator.setBatchRegions(std::vector<double>{175., 350., 465., 565.});
+    Geant4ePropagationBatch batch;
+    batch.push_back(mu20(&legs.field), legs.station4.get());
+    Geant4ePropagationBatchResult result;
+    legs.propagator.propagateBatch(batch, result);
+    check(result.status[0] == Geant4ePropagationBatchResult::kMaxPath,
+	  "batch request over its path budget in several legs", result.status[0]);
+  }
+
+  //The batch gives the same results as the single track method
+  void testBatch() {
+    Toy toy;
+    std::vector<FreeTrajectoryState> tracks = toy.tracks();
+    Geant4ePropagationBatch batch = toy.batch(tracks);
+    Geant4ePropagationBatchResult result;
+
+    //The first call initialises Geant4e, keep it out of the timing
+    toy.propagator.propagate(tracks[0], toy.target(0));
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    std::vector<TrajectoryStateOnSurface> single;
+    unsigned long nSteps = 0;
+    for (unsigned int i = 0; i < tracks.size(); i++) {
+      single.push_back(toy.propagator.propagate(tracks[i], toy.target(i)));
+      nSteps += toy.propagator.lastStepCount();
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    toy.propagator.propagateBatch(batch, result);
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    double maxDiff = batchDifference(result, single);
+    check(maxDiff < 1e-4, "batch against single tracks, cm", maxDiff);
+
+    benchmark << "  single: " << tracks.size()/seconds(t0, t1) << " propagations/s, "
+	      << double(nSteps)/tracks.size() << " steps per propagation, "
+	      << 1e6*seconds(t0, t1)/std::max(nSteps, 1UL) << " us per step\n"
+	      << "  batch : " << tracks.size()/seconds(t1, t2) << " propagations/s\n";
+  }
+
+  //The fast error transport agrees with Geant4e from the tracker to the
+  //last station
+  void testFastErrorTransport() {
+    Toy toy;
+    std::vector<FreeTrajectoryState> tracks = toy.tracks();
+    std::vector<TrajectoryStateOnSurface> atTracker;
+    for (unsigned int i = 0; i < tracks.size(); i++)
+      atTracker.push_back(toy.propagator.propagate(tracks[i], *toy.tracker));
+
+    std::vector<TrajectoryStateOnSurface> g4eErrors, fastErrors;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < atTracker.size(); i++)
+      g4eErrors.push_back(atTracker[i].isValid() ? 
+			  toy.propagator.propagate(*atTracker[i].freeState(), *toy.station4) :
+			  TrajectoryStateOnSurface());
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    toy.propagator.setFastErrorTransport(true);
+    for (unsigned int i = 0; i < atTracker.size(); i++)
+      fastErrors.push_back(atTracker[i].isValid() ? 
+			   toy.propagator.propagate(*atTracker[i].freeState(), *toy.station4) :
+			   TrajectoryStateOnSurface());
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    double maxErrDiff = 0;
+    for (unsigned int i = 0; i < g4eErrors.size(); i++) {
+      if (!g4eErrors[i].isValid() || !fastErrors[i].isValid())
+	continue;
+      const AlgebraicSymMatrix55& a = g4eErrors[i].curvilinearError().matrix();
+      const AlgebraicSymMatrix55& b = fastErrors[i].curvilinearError().matrix();
+      for (unsigned int j = 0; j < 5; j++)
+	maxErrDiff = std::max(maxErrDiff, std::abs(std::sqrt(b(j, j)/a(j, j)) - 1));
+    }
+    check(maxErrDiff < 0.2, "fast error transport against Geant4e, relative sigma",
+	  maxErrDiff);
+
+    benchmark << "  tracker to muon station 4, Geant4e errors: " 
+	      << tracks.size()/seconds(t0, t1) << " propagations/s, fast errors: "
+	      << tracks.size()/seconds(t1, t2) << " propagations/s\n";
+  }
+
+  //The transport of a propagation gives the final error of any other start
+  //error
+  void testTransport() {
+    Toy toy;
+    toy.propagator.setStoreTransport(true);
+    FreeTrajectoryState narrow = startState(&toy.field, 15, 0.5, 1., 1);
+    AlgebraicSymMatrix55 wideError = 4.*narrow.curvilinearError().matrix();
+    wideError(0, 1) = wideError(1, 0) = 1e-7;
+    FreeTrajectoryState wide(narrow.parameters(), CurvilinearTrajectoryError(wideError));
+    AlgebraicMatrix55 jacobian;
+    AlgebraicSymMatrix55 noise;
+    TrajectoryStateOnSurface narrowEnd = toy.propagator.propagate(narrow, *toy.station4);
+    bool transport = toy.propagator.lastTransport(jacobian, noise);
+    TrajectoryStateOnSurface wideEnd = toy.propagator.propagate(wide, *toy.station4);
+    double maxTransportDiff = 1e9;
+    if (transport && wideEnd.isValid()) {
+      AlgebraicSymMatrix55 transported = 
+	Geant4ePropagator::transportCovariance(jacobian, noise, wideError);
+      const AlgebraicSymMatrix55& propagated = wideEnd.curvilinearError().matrix();
+      maxTransportDiff = 0;
+      for (unsigned int j = 0; j < 5; j++)
+	maxTransportDiff = std::max(maxTransportDiff, 
+				    std::abs(transported(j, j)/propagated(j, j) - 1));
+    }
+    check(narrowEnd.isValid() && maxTransportDiff < 1e-3, 
+	  "transport of another start error, relative", maxTransportDiff);
+  }
+
+  //A small table around one start state gives the error and the position
+  //of a direct propagation, on and off the beam line, and on a chamber
+  //plane next to the station
+  void testPropagationTable() {
+    Toy toy;
+    FreeTrajectoryState start = startState(&toy.field, 20, 0, 0, 1);
+    FreeTrajectoryState offAxis(GlobalTrajectoryParameters(GlobalPoint(0.3, -0.2, 0),
+							   start.momentum(), 1, &toy.field),
+				start.curvilinearError());
+    Plane::PlanePointer chamber = planeAtX(toy.station1->radius() + 0.3);
+    TrajectoryStateOnSurface direct = toy.propagator.propagate(start, *toy.station1);
+    TrajectoryStateOnSurface directOffAxis = toy.propagator.propagate(offAxis, *toy.station1);
+    TrajectoryStateOnSurface directChamber = toy.propagator.propagate(start, *chamber);
+
+    Geant4ePropagationTable::Header header;
+    Geant4ePropagationTable::initHeader(header);
+    std::strcpy(header.particle, "mu");
+    header.maxVertexRho = 0.5;
+    const float lo[Geant4ePropagationTable::kNAxes] = {0.04, -0.1, -0.1, -1};
+    const float hi[Geant4ePropagationTable::kNAxes] = {0.06, 0.1, 0.1, 1};
+    for (unsigned int a = 0; a < Geant4ePropagationTable::kNAxes; a++) {
+      header.nNodes[a] = 3;
+      header.lo[a] = lo[a];
+      header.hi[a] = hi[a];
+    }
+    Geant4ePropagationTable::Station station = 
+      {Geant4ePropagationTable::kCylinder, float(toy.station1->radius()), 1, 0};
+    std::vector<char> buffer;
+    Geant4ePropagationTableBuilder(header, std::vector<Geant4ePropagationTable::Station>(1, station))
+      .build(toy.propagator, &toy.field, false, buffer);
+    const char* fileName = "testGeant4eToyDetector.table";
+    std::ofstream(fileName, std::ios::binary).write(&buffer[0], buffer.size());
+    toy.propagator.setPropagationTable(fileName, 0.1);
+    toy.propagator.propagate(start, *toy.station1);
+    bool unchecked = toy.propagator.lastStepCount() > 0;
+    check(unchecked, "unchecked cells refused by the residual cut", unchecked);
+    toy.propagator.setPropagationTable(fileName, 0);
+    std::remove(fileName);
+
+    TrajectoryStateOnSurface table = toy.propagator.propagate(start, *toy.station1);
+    bool fromTable = toy.propagator.lastStepCount() == 0;
+    TrajectoryStateOnSurface tableOffAxis = toy.propagator.propagate(offAxis, *toy.station1);
+    fromTable = fromTable && toy.propagator.lastStepCount() == 0;
+    TrajectoryStateOnSurface tableChamber = toy.propagator.propagate(start, *chamber);
+    fromTable = fromTable && toy.propagator.lastStepCount() == 0;
+    check(fromTable, "table lookups without Geant4 steps", fromTable);
+    double maxErrDiff = 1e9;
+    if (direct.isValid() && table.isValid()) {
+      const AlgebraicSymMatrix55& a = direct.curvilinearError().matrix();
+      const AlgebraicSymMatrix55& b = table.curvilinearError().matrix();
+      maxErrDiff = 0;
+      for (unsigned int j = 0; j < 5; j++)
+	maxErrDiff = std::max(maxErrDiff, std::abs(std::sqrt(b(j, j)/a(j, j)) - 1));
+    }
+    check(maxErrDiff < 0.05, "table error against Geant4e, relative sigma", maxErrDiff);
+    double offAxisDiff = 1e9;
+    if (directOffAxis.isValid() && tableOffAxis.isValid())
+      offAxisDiff = (tableOffAxis.globalPosition() - 
+		     directOffAxis.globalPosition()).mag();
+    check(offAxisDiff < 0.05, "table off the beam line against Geant4e, cm", offAxisDiff);
+    double chamberDiff = 1e9;
+    if (directChamber.isValid() && tableChamber.isValid())
+      chamberDiff = (tableChamber.globalPosition() - 
+		     directChamber.globalPosition()).mag();
+    check(chamberDiff < 0.05, "table onto a chamber plane against Geant4e, cm", chamberDiff);
+  }
+
+  //Alignment derivatives against moving the target plane
+  void testAlignmentDerivatives() {
+    Toy toy;
+    toy.propagator.setStoreAlignmentDerivatives(true);
+    FreeTrajectoryState toPlane = startState(&toy.field, 30, 0.2, 0.1, -1);
+    TrajectoryStateOnSurface onPlane1 = toy.propagator.propagate(toPlane, *toy.plane1);
+    Geant4ePropagator::AlignmentDerivatives derivatives;
+    bool hasDerivatives = toy.propagator.lastAlignmentDerivatives(derivatives);
+    toy.propagator.setStoreAlignmentDerivatives(false);
+    double maxDerivativeDiff = 1e9;
+    if (hasDerivatives) {
+      const double steps[6] = {1e-2, 1e-2, 1e-2, 1e-5, 1e-5, 1e-5};
+      maxDerivativeDiff = 0;
+      //The moved plane may be slightly behind the state
+      toy.propagator.setPropagationDirection(anyDirection);
+      for (unsigned int j = 0; j < 6; j++) {
+	double p[6] = {0, 0, 0, 0, 0, 0};
+	p[j] = steps[j];
+	TrajectoryStateOnSurface moved = 
+	  toy.propagator.propagate(*onPlane1.freeState(), *movedPlane(*toy.plane1, p));
+	if (!moved.isValid()) {
+	  maxDerivativeDiff = 1e9;
+	  break;
+	}
+	AlgebraicVector5 delta = moved.localParameters().vector() - 
+	  onPlane1.localParameters().vector();
+	for (unsigned int i = 1; i < 5; i++)
+	  maxDerivativeDiff = std::max(maxDerivativeDiff, 
+				       std::abs(delta[i]/steps[j] - derivatives(i, j))/
+				       std::max(1., std::abs(derivatives(i, j))));
+      }
+    }
+    check(maxDerivativeDiff < 0.05, "alignment derivatives against moved planes",
+	  maxDerivativeDiff);
+  }
+
+  //Interleaving the batch at the region boundaries gives the same results
+  void testInterleavedBatch() {
+    Toy toy;
+    std::vector<FreeTrajectoryState> tracks = toy.tracks();
+    Geant4ePropagationBatch batch = toy.batch(tracks);
+    std::vector<TrajectoryStateOnSurface> single = toy.single(tracks, tracks.size());
+
+    toy.propagator.setBatchRegions(std::vector<double>{175., 350., 465., 565.});
+    Geant4ePropagationBatchResult interleaved;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    toy.propagator.propagateBatch(batch, interleaved);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    double maxLegDiff = batchDifference(interleaved, single);
+    check(maxLegDiff < 0.01, "batch interleaved at the region boundaries, cm", maxLegDiff);
+
+    benchmark << "  batch interleaved at 4 region boundaries: " 
+	      << tracks.size()/seconds(t0, t1) << " propagations/s\n";
+  }
+
+  //The components of a mixture transported around the mean end where their
+  //own propagations end
+  void testMixture() {
+    Toy toy;
+    TrajectoryStateOnSurface g4Tracker = toy.propagator.propagate(mu20(&toy.field), *toy.tracker);
+    const double fractions[5] = {0.95, 0.98, 1., 1.02, 1.05};
+    const double weights[5] = {0.1, 0.2, 0.4, 0.2, 0.1};
+    MultiTrajectoryStateAssembler startMixture;
+    for (unsigned int k = 0; k < 5 && g4Tracker.isValid(); k++)
+      startMixture.addState(TrajectoryStateOnSurface(
+	GlobalTrajectoryParameters(g4Tracker.globalPosition(), 
+				   fractions[k]*g4Tracker.globalMomentum(),
+				   g4Tracker.charge(), &toy.field),
+	g4Tracker.curvilinearError(), *toy.tracker, 
+	SurfaceSideDefinition::atCenterOfSurface, weights[k]));
+    TrajectoryStateOnSurface mixture = startMixture.combinedState();
+    std::vector<TrajectoryStateOnSurface> mixtureComponents = 
+      mixture.isValid() ? mixture.components() : std::vector<TrajectoryStateOnSurface>();
+
+    std::vector<Geant4ePropagator::MixtureEnergyLoss> energyLoss;
+    const unsigned int nMixtures = std::max(nBenchmark/10, 1U);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    TrajectoryStateOnSurface mixtureEnd;
+    for (unsigned int i = 0; i < nMixtures && mixture.isValid(); i++)
+      mixtureEnd = toy.propagator.propagateMixture(mixture, *toy.station4, &energyLoss);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    std::vector<TrajectoryStateOnSurface> componentEnds;
+    for (unsigned int i = 0; i < nMixtures; i++) {
+      componentEnds.clear();
+      for (unsigned int k = 0; k < mixtureComponents.size(); k++)
+	componentEnds.push_back(toy.propagator.propagate(*mixtureComponents[k].freeState(), 
+							 *toy.station4));
+    }
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    double maxMixtureDiff = 1e9;
+    std::vector<TrajectoryStateOnSurface> endComponents = 
+      mixtureEnd.isValid() ? mixtureEnd.components() : std::vector<TrajectoryStateOnSurface>();
+    if (!endComponents.empty() && endComponents.size() == componentEnds.size() && 
+	energyLoss.size() == 5) {
+      maxMixtureDiff = 0;
+      for (unsigned int k = 0; k < endComponents.size(); k++) {
+	if (!componentEnds[k].isValid() || energyLoss[k].momentumFraction <= 0 ||
+	    energyLoss[k].momentumFraction >= 1) {
+	  maxMixtureDiff = 1e9;
+	  break;
+	}
+	maxMixtureDiff = std::max(maxMixtureDiff, 
+				  double((endComponents[k].globalPosition() - 
+					  componentEnds[k].globalPosition()).mag()));
+      }
+    }
+    check(maxMixtureDiff < 0.5, "mixture components against their own propagation, cm",
+	  maxMixtureDiff);
+
+    benchmark << "  mixtures of 5 components to muon station 4: " 
+	      << nMixtures/seconds(t0, t1) << " mixtures/s, component by component: "
+	      << nMixtures/seconds(t1, t2) << " mixtures/s\n";
+  }
+
+  //The scheduler hands back the results of the requests in their order of
+  //arrival
+  void testScheduler() {
+    Toy toy;
+    std::vector<FreeTrajectoryState> tracks = toy.tracks();
+    std::vector<TrajectoryStateOnSurface> single = toy.single(tracks, tracks.size());
+
+    Geant4ePropagationScheduler scheduler(&toy.propagator);
+    std::vector<unsigned int> tickets;
+    for (unsigned int i = 0; i < tracks.size(); i++)
+      tickets.push_back(scheduler.add(tracks[i], &toy.target(i)));
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    scheduler.run();
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    double maxScheduledDiff = 0;
+    unsigned int nScheduledMismatch = 0;
+    for (unsigned int i = 0; i < tracks.size(); i++) {
+      TrajectoryStateOnSurface scheduled = scheduler.result(tickets[i]);
+      if (scheduled.isValid() != single[i].isValid()) {
+	nScheduledMismatch++;
+	continue;
+      }
+      if (scheduled.isValid())
+	maxScheduledDiff = std::max(maxScheduledDiff, 
+				    double((scheduled.globalPosition() - 
+					    single[i].globalPosition()).mag()));
+    }
+    check(nScheduledMismatch == 0 && maxScheduledDiff < 1e-4, 
+	  "scheduled requests against single tracks, cm", maxScheduledDiff);
+
+    benchmark << "  scheduled by region: " << tracks.size()/seconds(t0, t1) 
+	      << " propagations/s\n";
+  }
+
+  //The bounds check rejects a chamber missed by metres and one behind the
+  //track, and lets through the one it hits and the one that the helix of
+  //the start field misses but the real track, bent back outside the
+  //coil, gets to within the margin
+  void testBoundsCheck() {
+    Toy toy;
+    Plane::PlanePointer chamber = 
+      Plane::build(toy.plane1->position(), toy.plane1->rotation(), 
+		   new RectangularPlaneBounds(100, 100, 10));
+    toy.propagator.setBoundsCheckMargin(20);
+    TrajectoryStateOnSurface hit = 
+      toy.propagator.propagate(startState(&toy.field, 50, 0, 0, 1), *chamber);
+    TrajectoryStateOnSurface missed = 
+      toy.propagator.propagate(startState(&toy.field, 50, 0, 1.2, 1), *chamber);
+    unsigned int missedSteps = toy.propagator.lastStepCount();
+    TrajectoryStateOnSurface behind = 
+      toy.propagator.propagate(startState(&toy.field, 50, 0, M_PI, 1), *chamber);
+    TrajectoryStateOnSurface lowPt = 
+      toy.propagator.propagate(startState(&toy.field, 9, 0, 0, 1), *chamber);
+    check(hit.isValid() && !missed.isValid() && !behind.isValid() && lowPt.isValid() &&
+	  toy.propagator.boundsRejections() == 2, 
+	  "targets rejected by the bounds check", toy.propagator.boundsRejections());
+    check(missedSteps == 0, "no steps left from before a rejection", missedSteps);
+  }
+
+  //The multi-track stepper follows the helix in the tracker, and the batch
+  //legs through the field only end where Geant4e ends them
+  void testMultiTrackStepper() {
+    Toy toy;
+    std::vector<FreeTrajectoryState> tracks = toy.tracks();
+    Geant4ePropagationBatch batch = toy.batch(tracks);
+
+    Geant4ePropagationBatch toTracker(batch);
+    std::vector<unsigned int> all(tracks.size());
+    for (unsigned int i = 0; i < tracks.size(); i++)
+      all[i] = i;
+    std::vector<double> stepperPath;
+    std::vector<char> stepperReached;
+    Geant4eMultiTrackStepper stepper(&toy.field);
+    stepper.propagateToRadius(toTracker, all, toy.tracker->radius(), stepperPath, 
+			      stepperReached);
+    double maxStepperDiff = 0;
+    for (unsigned int i = 0; i < tracks.size(); i++) {
+      TrajectoryStateOnSurface hx = toy.helix.propagate(tracks[i], *toy.tracker);
+      if (!stepperReached[i] || !hx.isValid()) {
+	maxStepperDiff = 1e9;
+	break;
+      }
+      maxStepperDiff = std::max(maxStepperDiff, 
+				double((GlobalPoint(toTracker.x[i], toTracker.y[i], 
+						    toTracker.z[i]) -
+					hx.globalPosition()).mag()));
+    }
+    check(maxStepperDiff < 1e-3, "multi-track stepper against the helix, cm", 
+	  maxStepperDiff);
+
+    //A lane that starts inwards crosses the cylinder on the far side, one
+    //that starts outside and outwards does not cross it forwards
+    Geant4ePropagationBatch lanes;
+    FreeTrajectoryState inwards(GlobalTrajectoryParameters(GlobalPoint(100, 0, 0),
+							   GlobalVector(-20, 5, 10), 
+							   1, &toy.field));
+    FreeTrajectoryState outwards(GlobalTrajectoryParameters(GlobalPoint(200, 0, 0),
+							    GlobalVector(20, 5, 10), 
+							    1, &toy.field));
+    lanes.push_back(inwards, toy.tracker.get());
+    lanes.push_back(outwards, toy.tracker.get());
+    stepper.propagateToRadius(lanes, std::vector<unsigned int>{0, 1}, 
+			      toy.tracker->radius(), stepperPath, stepperReached);
+    TrajectoryStateOnSurface hxInwards = toy.helix.propagate(inwards, *toy.tracker);
+    double inwardsDiff = 1e9;
+    if (stepperReached[0] && stepperPath[0] > 0 && hxInwards.isValid())
+      inwardsDiff = (GlobalPoint(lanes.x[0], lanes.y[0], lanes.z[0]) - 
+		     hxInwards.globalPosition()).mag();
+    check(inwardsDiff < 1e-3, "multi-track stepper, inwards lane against the helix, cm",
+	  inwardsDiff);
+    check(!stepperReached[1] && lanes.x[1] == 200, 
+	  "multi-track stepper, outwards lane outside not reached", stepperReached[1]);
+
+    toy.propagator.setBatchRegions(std::vector<double>{175., 350., 465., 565.});
+    Geant4ePropagationBatchResult interleaved;
+    toy.propagator.propagateBatch(batch, interleaved);
+    toy.propagator.setFieldOnlyRegions(std::vector<unsigned int>(1, 0));
+    Geant4ePropagationBatchResult fieldOnly;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    toy.propagator.propagateBatch(batch, fieldOnly);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    double maxFieldOnlyDiff = 0;
+    for (unsigned int i = 0; i < tracks.size(); i++) {
+      if ((fieldOnly.status[i] == 0) != (interleaved.status[i] == 0)) {
+	maxFieldOnlyDiff = 1e9;
+	break;
+      }
+      if (fieldOnly.status[i] == 0)
+	maxFieldOnlyDiff = std::max(maxFieldOnlyDiff, 
+				    std::hypot(std::hypot(fieldOnly.x[i] - interleaved.x[i],
+							  fieldOnly.y[i] - interleaved.y[i]),
+					       fieldOnly.z[i] - interleaved.z[i]));
+    }
+    check(maxFieldOnlyDiff < 0.05, "batch with the tracker through the field only, cm",
+	  maxFieldOnlyDiff);
+
+    benchmark << "  batch interleaved, tracker through the field only: " 
+	      << tracks.size()/seconds(t0, t1) << " propagations/s\n";
+  }
+
+  //The framework independent core, with its own field adapter, gives the
+  //result of the propagator
+  void testCore() {
+    Toy toy;
+    FreeTrajectoryState start = mu20(&toy.field);
+    TrajectoryStateOnSurface adapted = toy.propagator.propagate(start, *toy.station4);
+
+    Geant4ePropagatorCore core("mu");
+    core.setField(new Geant4eMagneticField(&toy.field, 0));
+    core.initialise();
+    Geant4ePropagatorCore::State coreStart, coreEnd;
+    coreStart.position[0] = start.position().x();
+    coreStart.position[1] = start.position().y();
+    coreStart.position[2] = start.position().z();
+    coreStart.momentum[0] = start.momentum().x();
+    coreStart.momentum[1] = start.momentum().y();
+    coreStart.momentum[2] = start.momentum().z();
+    coreStart.charge = start.charge();
+    coreStart.hasError = false;
+    Geant4ePropagatorCore::Target coreTarget;
+    coreTarget.kind = Geant4ePropagatorCore::Target::kCylinder;
+    std::fill(coreTarget.position, coreTarget.position + 3, 0.);
+    coreTarget.radius = toy.station4->radius();
+    const double identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    std::copy(identity, identity + 9, coreTarget.rotation);
+    double corePath = 0;
+    int coreStatus = core.propagate(coreStart, coreTarget, 
+				    Geant4ePropagatorCore::kForwards, coreEnd, corePath);
+    double coreDiff = 1e9;
+    if (coreStatus == 0 && adapted.isValid())
+      coreDiff = (GlobalPoint(coreEnd.position[0], coreEnd.position[1], 
+			      coreEnd.position[2]) -
+		  adapted.globalPosition()).mag();
+    check(coreDiff < 1e-4, "core against propagator, cm", coreDiff);
+  }
+
+  //Looser stepping parameters, with a new chord finder for the minimum
+  //step, stay close to the Geant4e ones. The parameters of the global
+  //field manager are restored afterwards
+  void testSteppingParameters() {
+    Toy toy;
+    std::vector<FreeTrajectoryState> tracks = toy.tracks();
+    std::vector<TrajectoryStateOnSurface> single = toy.single(tracks, 50);
+    Geant4ePropagator::SteppingParameters saved = 
+      Geant4ePropagatorCore::currentSteppingParameters();
+
+    Geant4ePropagator::SteppingParameters loose;
+    loose.deltaChord = 0.01;
+    loose.deltaOneStep = 0.01;
+    loose.deltaIntersection = 0.001;
+    loose.minStep = 0.5;
+    loose.minimumEpsilonStep = 1e-4;
+    loose.maximumEpsilonStep = 0.01;
+    bool applied = toy.propagator.setSteppingParameters(loose);
+    std::vector<TrajectoryStateOnSurface> looseResults = toy.single(tracks, 50);
+    bool restored = toy.propagator.setSteppingParameters(saved);
+
+    double maxLooseDiff = 0;
+    unsigned int nLooseMismatch = 0;
+    for (unsigned int i = 0; i < single.size(); i++) {
+      if (looseResults[i].isValid() != single[i].isValid()) {
+	nLooseMismatch++;
+	continue;
+      }
+      if (looseResults[i].isValid())
+	maxLooseDiff = std::max(maxLooseDiff,
+				double((looseResults[i].globalPosition() - 
+					single[i].globalPosition()).mag()));
+    }
+    check(applied && restored && nLooseMismatch == 0 && maxLooseDiff < 0.1,
+	  "loose stepping parameters against the Geant4e ones, cm", maxLooseDiff);
+
+    //Tightening below the current minimum epsilon needs the minimum first
+    Geant4ePropagator::SteppingParameters tight;
+    tight.minimumEpsilonStep = 1e-7;
+    tight.maximumEpsilonStep = 1e-6;
+    bool tightApplied = toy.propagator.setSteppingParameters(tight);
+    restored = toy.propagator.setSteppingParameters(saved);
+    check(tightApplied && restored, "epsilons tightened below the current minimum",
+	  tightApplied);
+  }
+}
+
+
+int main(int argc, char** argv) {
+  if (argc > 1)
+    nBenchmark = std::max(std::atoi(argv[1]), 1);
+  if (argc > 2)
+    physics = argv[2];
+
+  G4ErrorPropagatorManager::GetErrorPropagatorManager()
+    ->SetUserInitialization(buildToyDetector());
+
+  testTabulatedPhysics();
+  testHelixInTracker();
+  testChargeSymmetry();
+  testThroughTheYoke();
+  testPlaneTarget();
+  testBudget();
+  testBatch();
+  testFastErrorTransport();
+  testTransport();
+  testPropagationTable();
+  testAlignmentDerivatives();
+  testInterleavedBatch();
+  testMixture();
+  testScheduler();
+  testBoundsCheck();
+  testMultiTrackStepper();
+  testCore();
+  testSteppingParameters();
+
+  std::cout << "Benchmark: " << nBenchmark << " muons, 5-100 GeV\n" 
+	    << benchmark.str() << std::flush;
+  std::cout << nFailed << " checks failed" << std::endl;
+  return nFailed;
+}